@@ -1063,13 +1063,183 @@ static inline esp_err_t httpd_resp_sendstr_chunk(httpd_req_t *r, const char *str
     return httpd_resp_send_chunk(r, str, (str == NULL) ? 0 : strlen(str));
 }
 
+/**
+ * @brief   API to send the HTTP response headers of a response with known length
+ *
+ * Use this API with httpd_resp_send_body() to stream a response whose
+ * length is known in advance (eg. a file or a part of it) without the
+ * chunked encoding, so that the client knows the size of the content.
+ * Exactly 'content_len' bytes must then be sent with httpd_resp_send_body().
+ *
+ * The status, content type and any additional headers set with
+ * httpd_resp_set_status(), httpd_resp_set_type() and httpd_resp_set_hdr()
+ * are sent.
+ *
+ * @note
+ *  - This API is supposed to be called only from the context of
+ *    a URI handler where httpd_req_t* request pointer is valid.
+ *  - Once this API is called, all request headers are purged, so
+ *    request headers need be copied into separate buffers if they
+ *    are required later.
+ *
+ * @param[in] r             The request being responded to
+ * @param[in] content_len   Length of the content, negative to omit the Content-Length
+ *                          header (only for responses without content, eg. 304)
+ *
+ * @return
+ *  - ESP_OK : On successfully sending the headers
+ *  - ESP_ERR_INVALID_ARG : Null request pointer
+ *  - ESP_ERR_HTTPD_RESP_HDR    : Essential headers are too large for internal buffer
+ *  - ESP_ERR_HTTPD_RESP_SEND   : Error in raw send
+ *  - ESP_ERR_HTTPD_INVALID_REQ : Invalid request
+ */
+esp_err_t httpd_resp_send_hdrs(httpd_req_t *r, ssize_t content_len);
+
+/**
+ * @brief   API to send a part of the response content after httpd_resp_send_hdrs()
+ *
+ * @param[in] r         The request being responded to
+ * @param[in] buf       Buffer with the content
+ * @param[in] buf_len   Length of the buffer
+ *
+ * @return
+ *  - ESP_OK : On successfully sending the content
+ *  - ESP_ERR_INVALID_ARG : Null arguments
+ *  - ESP_ERR_HTTPD_RESP_SEND   : Error in raw send
+ *  - ESP_ERR_HTTPD_INVALID_REQ : Invalid request
+ */
+esp_err_t httpd_resp_send_body(httpd_req_t *r, const char *buf, size_t buf_len);
+
+/**
+ * @brief   Buffered writer for chunked HTTP responses
+ *
+ * Collects the response data in a caller provided buffer and sends it
+ * as one HTTP chunk when the buffer is full or when the writer is
+ * flushed or finished, instead of sending every small piece of the
+ * response as a separate chunk (and TCP segment).
+ *
+ * The members are managed by the httpd_resp_writer_*() APIs, 'err' may
+ * be checked to stop generating the response after a send error.
+ */
+typedef struct httpd_resp_writer {
+    httpd_req_t *req;   /*!< The request being responded to */
+    char        *buf;   /*!< Chunk buffer, with room for the chunk framing */
+    size_t       size;  /*!< Maximum data length in the buffer */
+    size_t       len;   /*!< Data length in the buffer */
+    esp_err_t    err;   /*!< First error, no data is sent after an error */
+} httpd_resp_writer_t;
+
+/**
+ * @brief   Bytes of the writer buffer used for the chunk framing
+ *
+ * The writer buffer must be larger than this, a buffer of a few KB
+ * is recommended.
+ */
+#define HTTPD_RESP_WRITER_OVERHEAD  17
+
+/**
+ * @brief   Initialize the buffered response writer
+ *
+ * The response headers (status, content type and any additional
+ * headers set with httpd_resp_set_hdr()) are sent with the first chunk,
+ * they must be set before the first flush.
+ *
+ * @note
+ *  - This API is supposed to be called only from the context of
+ *    a URI handler where httpd_req_t* request pointer is valid.
+ *  - The buffer must remain valid until httpd_resp_writer_finish()
+ *    is called, it must not be used for anything else meanwhile.
+ *
+ * @param[out] w        Writer to initialize
+ * @param[in]  r        The request being responded to
+ * @param[in]  buf      Buffer for the response chunks
+ * @param[in]  buf_size Size of the buffer, must be larger than HTTPD_RESP_WRITER_OVERHEAD
+ *
+ * @return
+ *  - ESP_OK : Writer initialized
+ *  - ESP_ERR_INVALID_ARG : Null arguments or buffer too small
+ *  - ESP_ERR_HTTPD_INVALID_REQ : Invalid request pointer
+ */
+esp_err_t httpd_resp_writer_init(httpd_resp_writer_t *w, httpd_req_t *r, char *buf, size_t buf_size);
+
+/**
+ * @brief   Add data to the buffered response
+ *
+ * The buffer is sent as a chunk if the data does not fit into it.
+ * Data larger than the buffer is sent as a separate chunk directly
+ * from the caller's memory.
+ *
+ * @param[in] w         Response writer
+ * @param[in] data      Data to send
+ * @param[in] len       Length of the data, HTTPD_RESP_USE_STRLEN to use strlen()
+ *
+ * @return
+ *  - ESP_OK : Data buffered or sent
+ *  - ESP_ERR_INVALID_ARG : Null arguments
+ *  - ESP_ERR_HTTPD_RESP_HDR    : Essential headers are too large for internal buffer
+ *  - ESP_ERR_HTTPD_RESP_SEND   : Error in raw send (also returned by all following calls)
+ */
+esp_err_t httpd_resp_writer_write(httpd_resp_writer_t *w, const char *data, ssize_t len);
+
+/**
+ * @brief   Add a string to the buffered response
+ *
+ * @param[in] w         Response writer
+ * @param[in] str       String to send
+ *
+ * @return  See httpd_resp_writer_write()
+ */
+static inline esp_err_t httpd_resp_writer_str(httpd_resp_writer_t *w, const char *str) {
+    return httpd_resp_writer_write(w, str, HTTPD_RESP_USE_STRLEN);
+}
+
+/**
+ * @brief   Add formatted text to the buffered response
+ *
+ * The text is formatted directly into the writer buffer. Text longer
+ * than the buffer is formatted into a temporary allocated buffer.
+ *
+ * @param[in] w         Response writer
+ * @param[in] fmt       printf() style format string
+ *
+ * @return
+ *  - ESP_OK : Text buffered or sent
+ *  - ESP_ERR_INVALID_ARG : Null arguments or formatting error
+ *  - ESP_ERR_NO_MEM : Text longer than the buffer and no memory for it
+ *  - Errors returned by httpd_resp_writer_write()
+ */
+esp_err_t httpd_resp_writer_printf(httpd_resp_writer_t *w, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+/**
+ * @brief   Send the buffered data as a chunk
+ *
+ * @param[in] w         Response writer
+ *
+ * @return  See httpd_resp_writer_write()
+ */
+esp_err_t httpd_resp_writer_flush(httpd_resp_writer_t *w);
+
+/**
+ * @brief   Send the buffered data and complete the chunked response
+ *
+ * The last data chunk and the terminating empty chunk are sent together.
+ *
+ * @param[in] w         Response writer
+ *
+ * @return  See httpd_resp_writer_write()
+ */
+esp_err_t httpd_resp_writer_finish(httpd_resp_writer_t *w);
+
 /* Some commonly used status codes */
 #define HTTPD_200      "200 OK"                     /*!< HTTP Response 200 */
 #define HTTPD_204      "204 No Content"             /*!< HTTP Response 204 */
+#define HTTPD_206      "206 Partial Content"        /*!< HTTP Response 206 */
 #define HTTPD_207      "207 Multi-Status"           /*!< HTTP Response 207 */
+#define HTTPD_304      "304 Not Modified"           /*!< HTTP Response 304 */
 #define HTTPD_400      "400 Bad Request"            /*!< HTTP Response 400 */
 #define HTTPD_404      "404 Not Found"              /*!< HTTP Response 404 */
 #define HTTPD_408      "408 Request Timeout"        /*!< HTTP Response 408 */
+#define HTTPD_416      "416 Range Not Satisfiable"  /*!< HTTP Response 416 */
 #define HTTPD_500      "500 Internal Server Error"  /*!< HTTP Response 500 */
 
 /**
@@ -14,6 +14,8 @@
 
 
 #include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
 #include <esp_log.h>
 #include <esp_err.h>
 
@@ -380,6 +382,247 @@ esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, ssize_t buf_len
     return ESP_OK;
 }
 
+esp_err_t httpd_resp_send_hdrs(httpd_req_t *r, ssize_t content_len)
+{
+    if (r == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!httpd_valid_req(r)) {
+        return ESP_ERR_HTTPD_INVALID_REQ;
+    }
+
+    struct httpd_req_aux *ra = r->aux;
+    const char *httpd_hdr_str = "HTTP/1.1 %s\r\nContent-Type: %s\r\n";
+    const char *httpd_len_str = "Content-Length: %d\r\n";
+    const char *colon_separator = ": ";
+    const char *cr_lf_seperator = "\r\n";
+
+    /* Request headers are no longer available */
+    ra->req_hdrs_count = 0;
+
+    /* Size of essential headers is limited by scratch buffer size */
+    int len = snprintf(ra->scratch, sizeof(ra->scratch), httpd_hdr_str,
+                       ra->status, ra->content_type);
+    if ((len >= sizeof(ra->scratch)) || ((content_len >= 0) &&
+        (snprintf(ra->scratch + len, sizeof(ra->scratch) - len, httpd_len_str, content_len) >= (sizeof(ra->scratch) - len)))) {
+        return ESP_ERR_HTTPD_RESP_HDR;
+    }
+
+    /* Sending essential headers */
+    if (httpd_send_all(r, ra->scratch, strlen(ra->scratch)) != ESP_OK) {
+        return ESP_ERR_HTTPD_RESP_SEND;
+    }
+
+    /* Sending additional headers based on set_header */
+    for (unsigned i = 0; i < ra->resp_hdrs_count; i++) {
+        /* Send header field */
+        if (httpd_send_all(r, ra->resp_hdrs[i].field, strlen(ra->resp_hdrs[i].field)) != ESP_OK) {
+            return ESP_ERR_HTTPD_RESP_SEND;
+        }
+        /* Send ': ' */
+        if (httpd_send_all(r, colon_separator, strlen(colon_separator)) != ESP_OK) {
+            return ESP_ERR_HTTPD_RESP_SEND;
+        }
+        /* Send header value */
+        if (httpd_send_all(r, ra->resp_hdrs[i].value, strlen(ra->resp_hdrs[i].value)) != ESP_OK) {
+            return ESP_ERR_HTTPD_RESP_SEND;
+        }
+        /* Send CR + LF */
+        if (httpd_send_all(r, cr_lf_seperator, strlen(cr_lf_seperator)) != ESP_OK) {
+            return ESP_ERR_HTTPD_RESP_SEND;
+        }
+    }
+
+    /* End header section */
+    if (httpd_send_all(r, cr_lf_seperator, strlen(cr_lf_seperator)) != ESP_OK) {
+        return ESP_ERR_HTTPD_RESP_SEND;
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send_body(httpd_req_t *r, const char *buf, size_t buf_len)
+{
+    if ((r == NULL) || ((buf == NULL) && buf_len)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!httpd_valid_req(r)) {
+        return ESP_ERR_HTTPD_INVALID_REQ;
+    }
+
+    if (buf_len && (httpd_send_all(r, buf, buf_len) != ESP_OK)) {
+        return ESP_ERR_HTTPD_RESP_SEND;
+    }
+    return ESP_OK;
+}
+
+/* Writer buffer layout:
+ * | chunk size line | data | CRLF [ "0" CRLF CRLF ] |
+ * The chunk size line is written right before the data, so that
+ * the whole chunk is sent with a single httpd_send_all() */
+#define HTTPD_RESP_WRITER_HDR_LEN   10
+#define HTTPD_RESP_WRITER_LAST      "\r\n0\r\n\r\n"
+
+static esp_err_t httpd_resp_writer_send(httpd_resp_writer_t *w, bool last)
+{
+    struct httpd_req_aux *ra = w->req->aux;
+    char *data = w->buf + HTTPD_RESP_WRITER_HDR_LEN;
+
+    if (w->err != ESP_OK) {
+        return w->err;
+    }
+    if (!httpd_valid_req(w->req)) {
+        w->err = ESP_ERR_HTTPD_INVALID_REQ;
+        return w->err;
+    }
+
+    if (!ra->first_chunk_sent) {
+        /* The first chunk is sent together with the response headers */
+        if (w->len) {
+            w->err = httpd_resp_send_chunk(w->req, data, w->len);
+        }
+        if ((w->err == ESP_OK) && last) {
+            w->err = httpd_resp_send_chunk(w->req, NULL, 0);
+        }
+        w->len = 0;
+        return w->err;
+    }
+
+    char *frame = data;
+    size_t frame_len = 0;
+    if (w->len) {
+        char len_str[HTTPD_RESP_WRITER_HDR_LEN + 1];
+        int hdr_len = snprintf(len_str, sizeof(len_str), "%x\r\n", (unsigned) w->len);
+        frame = data - hdr_len;
+        memcpy(frame, len_str, hdr_len);
+        memcpy(data + w->len, "\r\n", 2);
+        frame_len = hdr_len + w->len + 2;
+    }
+    if (last) {
+        /* Terminating empty chunk */
+        memcpy(data + w->len + 2, HTTPD_RESP_WRITER_LAST + 2, strlen(HTTPD_RESP_WRITER_LAST) - 2);
+        if (w->len == 0) {
+            frame = data + 2;
+        }
+        frame_len += strlen(HTTPD_RESP_WRITER_LAST) - 2;
+    }
+    if (frame_len && (httpd_send_all(w->req, frame, frame_len) != ESP_OK)) {
+        w->err = ESP_ERR_HTTPD_RESP_SEND;
+    }
+    w->len = 0;
+    return w->err;
+}
+
+esp_err_t httpd_resp_writer_init(httpd_resp_writer_t *w, httpd_req_t *r, char *buf, size_t buf_size)
+{
+    if ((w == NULL) || (r == NULL) || (buf == NULL) || (buf_size <= HTTPD_RESP_WRITER_OVERHEAD)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!httpd_valid_req(r)) {
+        return ESP_ERR_HTTPD_INVALID_REQ;
+    }
+
+    w->req  = r;
+    w->buf  = buf;
+    w->size = buf_size - HTTPD_RESP_WRITER_OVERHEAD;
+    w->len  = 0;
+    w->err  = ESP_OK;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_writer_write(httpd_resp_writer_t *w, const char *data, ssize_t len)
+{
+    if ((w == NULL) || (w->req == NULL) || ((data == NULL) && (len != 0))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (len == HTTPD_RESP_USE_STRLEN) {
+        len = strlen(data);
+    }
+    if ((w->err != ESP_OK) || (len == 0)) {
+        return w->err;
+    }
+
+    if ((w->len + (size_t) len) > w->size) {
+        if (httpd_resp_writer_send(w, false) != ESP_OK) {
+            return w->err;
+        }
+        if ((size_t) len > w->size) {
+            /* Too large for the buffer, send as it is */
+            w->err = httpd_resp_send_chunk(w->req, data, len);
+            return w->err;
+        }
+    }
+    memcpy(w->buf + HTTPD_RESP_WRITER_HDR_LEN + w->len, data, len);
+    w->len += len;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_writer_printf(httpd_resp_writer_t *w, const char *fmt, ...)
+{
+    va_list args;
+    int len;
+
+    if ((w == NULL) || (w->req == NULL) || (fmt == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (w->err != ESP_OK) {
+        return w->err;
+    }
+
+    for (int i = 0; i < 2; i++) {
+        /* The space reserved for the chunk trailer holds the terminating null character */
+        size_t room = w->size - w->len;
+        va_start(args, fmt);
+        len = vsnprintf(w->buf + HTTPD_RESP_WRITER_HDR_LEN + w->len, room + 1, fmt, args);
+        va_end(args);
+        if (len < 0) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        if ((size_t) len <= room) {
+            w->len += len;
+            return ESP_OK;
+        }
+        if (w->len == 0) {
+            break;
+        }
+        /* Send the buffered data and try again with the empty buffer */
+        if (httpd_resp_writer_send(w, false) != ESP_OK) {
+            return w->err;
+        }
+    }
+
+    /* Longer than the buffer */
+    char *text = malloc(len + 1);
+    if (text == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    va_start(args, fmt);
+    vsnprintf(text, len + 1, fmt, args);
+    va_end(args);
+    w->err = httpd_resp_send_chunk(w->req, text, len);
+    free(text);
+    return w->err;
+}
+
+esp_err_t httpd_resp_writer_flush(httpd_resp_writer_t *w)
+{
+    if ((w == NULL) || (w->req == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return httpd_resp_writer_send(w, false);
+}
+
+esp_err_t httpd_resp_writer_finish(httpd_resp_writer_t *w)
+{
+    if ((w == NULL) || (w->req == NULL)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return httpd_resp_writer_send(w, true);
+}
+
 esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *usr_msg)
 {
     esp_err_t ret;
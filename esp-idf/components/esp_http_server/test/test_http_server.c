@@ -14,8 +14,10 @@
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <esp_system.h>
 #include <esp_http_server.h>
+#include "lwip/sockets.h"
 
 #include "unity.h"
 #include "test_utils.h"
@@ -251,3 +253,187 @@ TEST_CASE("Max Allowed Sockets Test", "[HTTP SERVER]")
     config.max_open_sockets += 1;
     TEST_ASSERT(httpd_start(&hd, &config) != ESP_OK);
 }
+
+/********************* Response API Tests *******************/
+
+/* Writer buffer with room for 47 bytes of data */
+#define HTTPD_TEST_WRITER_BUF   64
+
+#define HTTPD_TEST_CHUNKED_HDRS "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nTransfer-Encoding: chunked\r\n\r\n"
+
+static char test_data_a[101];
+static char test_data_b[61];
+
+/* Content length is known in advance */
+esp_err_t resp_hdrs_body_handler(httpd_req_t *req)
+{
+    httpd_resp_set_hdr(req, "X-Test", "1");
+    if ((httpd_resp_send_hdrs(req, 10) != ESP_OK) ||
+        (httpd_resp_send_body(req, "01234", 5) != ESP_OK) ||
+        (httpd_resp_send_body(req, NULL, 0) != ESP_OK)) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_body(req, "56789", 5);
+}
+
+/* The first chunk is sent with the headers, the last one with the terminating chunk */
+esp_err_t writer_first_handler(httpd_req_t *req)
+{
+    char buf[HTTPD_TEST_WRITER_BUF];
+    httpd_resp_writer_t w;
+    if ((httpd_resp_writer_init(&w, req, buf, sizeof(buf)) != ESP_OK) ||
+        (httpd_resp_writer_str(&w, "hello") != ESP_OK)) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_writer_finish(&w);
+}
+
+/* Data larger than the buffer is sent as a separate chunk,
+ * data filling the buffer uses all the bytes reserved for the chunk framing */
+esp_err_t writer_large_handler(httpd_req_t *req)
+{
+    char buf[HTTPD_TEST_WRITER_BUF];
+    httpd_resp_writer_t w;
+    if ((httpd_resp_writer_init(&w, req, buf, sizeof(buf)) != ESP_OK) ||
+        (httpd_resp_writer_str(&w, "0123456789") != ESP_OK) ||
+        (httpd_resp_writer_write(&w, test_data_a, 100) != ESP_OK) ||
+        (httpd_resp_writer_str(&w, "end") != ESP_OK) ||
+        (httpd_resp_writer_write(&w, test_data_b, 44) != ESP_OK)) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_writer_finish(&w);
+}
+
+/* Formatted text longer than the remaining space and longer than the buffer */
+esp_err_t writer_printf_handler(httpd_req_t *req)
+{
+    char buf[HTTPD_TEST_WRITER_BUF];
+    httpd_resp_writer_t w;
+    if ((httpd_resp_writer_init(&w, req, buf, sizeof(buf)) != ESP_OK) ||
+        (httpd_resp_writer_printf(&w, "%.40s", test_data_a) != ESP_OK) ||
+        (httpd_resp_writer_printf(&w, "%d-%s", 12345, "qqqqqqqqqq") != ESP_OK) ||
+        (httpd_resp_writer_printf(&w, "%s", test_data_b) != ESP_OK)) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_writer_finish(&w);
+}
+
+/* Finish with the buffer emptied by flush */
+esp_err_t writer_flush_handler(httpd_req_t *req)
+{
+    char buf[HTTPD_TEST_WRITER_BUF];
+    httpd_resp_writer_t w;
+    if ((httpd_resp_writer_init(&w, req, buf, sizeof(buf)) != ESP_OK) ||
+        (httpd_resp_writer_str(&w, "x") != ESP_OK) ||
+        (httpd_resp_writer_flush(&w) != ESP_OK)) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_writer_finish(&w);
+}
+
+/* Finish without any data */
+esp_err_t writer_empty_handler(httpd_req_t *req)
+{
+    char buf[HTTPD_TEST_WRITER_BUF];
+    httpd_resp_writer_t w;
+    if (httpd_resp_writer_init(&w, req, buf, sizeof(buf)) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_writer_finish(&w);
+}
+
+/* Send GET request for 'uri' to the server on 'port' and compare the response with 'expected' */
+void test_resp_request(uint16_t port, const char *uri, const char *expected)
+{
+    struct sockaddr_in addr = {
+        .sin_family      = AF_INET,
+        .sin_port        = htons(port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    struct timeval tv = { .tv_sec = 2 };
+    char req[64];
+    size_t exp_len = strlen(expected);
+    size_t len = 0;
+    int ret;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    TEST_ASSERT(fd >= 0);
+    TEST_ASSERT(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0);
+    TEST_ASSERT(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0);
+    snprintf(req, sizeof(req), "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", uri);
+    TEST_ASSERT(send(fd, req, strlen(req), 0) == strlen(req));
+
+    char *resp = calloc(1, exp_len + 1);
+    TEST_ASSERT(resp != NULL);
+    while (len < exp_len) {
+        ret = recv(fd, resp + len, exp_len - len, 0);
+        if (ret <= 0) {
+            break;
+        }
+        len += ret;
+    }
+    close(fd);
+    TEST_ASSERT_EQUAL_STRING(expected, resp);
+    free(resp);
+}
+
+TEST_CASE("Response API Tests", "[HTTP SERVER]")
+{
+    struct resptest {
+        const char *uri;
+        esp_err_t (*handler)(httpd_req_t *req);
+    };
+
+    struct resptest tests[] = {
+        {"/hdrs_body",     resp_hdrs_body_handler},
+        {"/writer_first",  writer_first_handler},
+        {"/writer_large",  writer_large_handler},
+        {"/writer_printf", writer_printf_handler},
+        {"/writer_flush",  writer_flush_handler},
+        {"/writer_empty",  writer_empty_handler},
+    };
+    const int count = sizeof(tests) / sizeof(tests[0]);
+    char expected[512];
+
+    memset(test_data_a, 'a', sizeof(test_data_a) - 1);
+    memset(test_data_b, 'b', sizeof(test_data_b) - 1);
+
+    test_case_uses_tcpip();
+
+    httpd_handle_t hd = test_httpd_start(0);
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    for (int i = 0; i < count; i++) {
+        httpd_uri_t uri = {
+            .uri      = tests[i].uri,
+            .method   = HTTP_GET,
+            .handler  = tests[i].handler,
+            .user_ctx = NULL,
+        };
+        TEST_ASSERT(httpd_register_uri_handler(hd, &uri) == ESP_OK);
+    }
+
+    test_resp_request(config.server_port, "/hdrs_body",
+                      "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: 10\r\n"
+                      "X-Test: 1\r\n\r\n0123456789");
+
+    test_resp_request(config.server_port, "/writer_first",
+                      HTTPD_TEST_CHUNKED_HDRS "5\r\nhello\r\n0\r\n\r\n");
+
+    snprintf(expected, sizeof(expected),
+             HTTPD_TEST_CHUNKED_HDRS "a\r\n0123456789\r\n64\r\n%s\r\n2f\r\nend%.44s\r\n0\r\n\r\n",
+             test_data_a, test_data_b);
+    test_resp_request(config.server_port, "/writer_large", expected);
+
+    snprintf(expected, sizeof(expected),
+             HTTPD_TEST_CHUNKED_HDRS "28\r\n%.40s\r\n10\r\n12345-qqqqqqqqqq\r\n3c\r\n%s\r\n0\r\n\r\n",
+             test_data_a, test_data_b);
+    test_resp_request(config.server_port, "/writer_printf", expected);
+
+    test_resp_request(config.server_port, "/writer_flush",
+                      HTTPD_TEST_CHUNKED_HDRS "1\r\nx\r\n0\r\n\r\n");
+
+    test_resp_request(config.server_port, "/writer_empty",
+                      HTTPD_TEST_CHUNKED_HDRS "0\r\n\r\n");
+
+    TEST_ASSERT(httpd_stop(hd) == ESP_OK);
+}
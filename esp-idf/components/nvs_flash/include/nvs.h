@@ -195,6 +195,8 @@ esp_err_t nvs_open_from_partition(const char *part_name, const char* name, nvs_o
  *               update will be finished after re-initialization of nvs, provided that
  *               flash operation doesn't fail again.
  *             - ESP_ERR_NVS_VALUE_TOO_LONG if the string value is too long
+ *             - ESP_ERR_NVS_NOT_ENOUGH_SPACE if a transaction is open on the handle
+ *               and the staged values wouldn't fit into one page
  */
 esp_err_t nvs_set_i8  (nvs_handle_t handle, const char* key, int8_t value);
 esp_err_t nvs_set_u8  (nvs_handle_t handle, const char* key, uint8_t value);
@@ -233,6 +235,7 @@ esp_err_t nvs_set_str (nvs_handle_t handle, const char* key, const char* value);
  *               update will be finished after re-initialization of nvs, provided that
  *               flash operation doesn't fail again.
  *             - ESP_ERR_NVS_VALUE_TOO_LONG if the value is too long
+ *             - ESP_ERR_NVS_INVALID_STATE if a transaction is open on the handle
  */
 esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length);
 
@@ -362,6 +365,7 @@ esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, si
  *              - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
  *              - ESP_ERR_NVS_READ_ONLY if handle was opened as read only
  *              - ESP_ERR_NVS_NOT_FOUND if the requested key doesn't exist
+ *              - ESP_ERR_NVS_INVALID_STATE if a transaction is open on the handle
  *              - other error codes from the underlying storage driver
  */
 esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key);
@@ -378,10 +382,47 @@ esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key);
  *              - ESP_OK if erase operation was successful
  *              - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
  *              - ESP_ERR_NVS_READ_ONLY if handle was opened as read only
+ *              - ESP_ERR_NVS_INVALID_STATE if a transaction is open on the handle
  *              - other error codes from the underlying storage driver
  */
 esp_err_t nvs_erase_all(nvs_handle_t handle);
 
+/**
+ * @brief      Start collecting the values set with the handle into a transaction
+ *
+ * Until the transaction is committed with nvs_commit or dropped with nvs_transaction_abort,
+ * values set with nvs_set_* (except nvs_set_blob) are kept in RAM and nvs_get_* return
+ * the values which are stored. On commit, the values are written to one page together:
+ * after a power loss either all or none of them are stored. Values which are already
+ * stored are skipped.
+ *
+ * Blobs can't be set and keys can't be erased while the transaction is open. The staged
+ * values have to fit into one page (126 entries).
+ *
+ * @param[in]  handle  Storage handle obtained with nvs_open.
+ *                     Handles that were opened read only cannot be used.
+ *
+ * @return
+ *             - ESP_OK if the transaction was started
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_READ_ONLY if handle was opened as read only
+ *             - ESP_ERR_NVS_INVALID_STATE if a transaction is already open on the handle
+ *             - ESP_ERR_NO_MEM if memory couldn't be allocated
+ */
+esp_err_t nvs_transaction_begin(nvs_handle_t handle);
+
+/**
+ * @brief      Drop the values staged since nvs_transaction_begin
+ *
+ * @param[in]  handle  Storage handle obtained with nvs_open.
+ *
+ * @return
+ *             - ESP_OK if the transaction was dropped
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_INVALID_STATE if no transaction is open on the handle
+ */
+esp_err_t nvs_transaction_abort(nvs_handle_t handle);
+
 /**
  * @brief      Write any pending changes to non-volatile storage
  *
@@ -389,12 +430,17 @@ esp_err_t nvs_erase_all(nvs_handle_t handle);
  * to non-volatile storage. Individual implementations may write to storage at other times,
  * but this is not guaranteed.
  *
+ * If a transaction is open on the handle, its values are written and the transaction
+ * is closed, also if writing fails.
+ *
  * @param[in]  handle  Storage handle obtained with nvs_open.
  *                     Handles that were opened read only cannot be used.
  *
  * @return
  *             - ESP_OK if the changes have been written successfully
  *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_NOT_ENOUGH_SPACE if there is no free page for the
+ *               values of the transaction
  *             - other error codes from the underlying storage driver
  */
 esp_err_t nvs_commit(nvs_handle_t handle);
@@ -24,6 +24,8 @@
 
 #ifdef ESP_PLATFORM
 #include <esp32/rom/crc.h>
+#include "esp_attr.h"
+#include "esp_system.h"
 
 // Uncomment this line to force output from this module
 // #define LOG_LOCAL_LEVEL ESP_LOG_DEBUG
@@ -59,6 +61,7 @@ public:
     uint8_t mReadOnly;
     uint8_t mNsIndex;
     nvs::Storage* mStoragePtr;
+    nvs::Transaction* mTransaction = nullptr;
 };
 
 #ifdef ESP_PLATFORM
@@ -68,9 +71,81 @@ SemaphoreHandle_t nvs::Lock::mSemaphore = NULL;
 using namespace std;
 using namespace nvs;
 
+/* nvs::Lock only protects the list of handles, their transactions and the mount summary, and is
+ * held briefly. Storages have their own locks. s_nvs_storage_lock is held shared by every call which
+ * uses a storage, and exclusively while a storage is added or removed. */
 static intrusive_list<HandleEntry> s_nvs_handles;
 uint32_t HandleEntry::s_nvs_next_handle;
 static intrusive_list<nvs::Storage> s_nvs_storage_list;
+static nvs::RwLock s_nvs_storage_lock;
+
+/* Keeps the storage list locked during a call, and the storage used by the call */
+class StorageLock
+{
+public:
+    StorageLock() : mListLock(s_nvs_storage_lock) {}
+
+    ~StorageLock()
+    {
+        if (!mStorage) {
+            return;
+        }
+        if (mWrite) {
+            mStorage->getLock().unlock();
+        } else {
+            mStorage->getLock().unlockShared();
+        }
+    }
+
+    void lockShared(nvs::Storage* storage)
+    {
+        mStorage = storage;
+        mStorage->getLock().lockShared();
+    }
+
+    void lock(nvs::Storage* storage)
+    {
+        mStorage = storage;
+        mWrite = true;
+        mStorage->getLock().lock();
+    }
+
+    /* Trades the shared lock of the storage for the exclusive one, other calls may use the storage in between */
+    void relock()
+    {
+        mStorage->getLock().unlockShared();
+        mWrite = true;
+        mStorage->getLock().lock();
+    }
+
+protected:
+    nvs::ReadLock mListLock;
+    nvs::Storage* mStorage = nullptr;
+    bool mWrite = false;
+};
+
+#if defined(ESP_PLATFORM) && defined(CONFIG_NVS_FAST_MOUNT)
+static RTC_NOINIT_ATTR uint32_t s_mount_summary_data[CONFIG_NVS_FAST_MOUNT_SUMMARY_SIZE / sizeof(uint32_t)];
+static nvs::MountSummary s_mount_summary(s_mount_summary_data, sizeof(s_mount_summary_data));
+static bool s_mount_summary_checked = false;
+
+static nvs::MountSummary* get_mount_summary()
+{
+    if (!s_mount_summary_checked) {
+        // RTC memory is only kept across deep sleep, after any other reset the flash may have been rewritten
+        if (esp_reset_reason() != ESP_RST_DEEPSLEEP) {
+            s_mount_summary.clear();
+        }
+        s_mount_summary_checked = true;
+    }
+    return &s_mount_summary;
+}
+#else
+static nvs::MountSummary* get_mount_summary()
+{
+    return nullptr;
+}
+#endif
 
 static nvs::Storage* lookup_storage_from_name(const char *name)
 {
@@ -86,7 +161,7 @@ static nvs::Storage* lookup_storage_from_name(const char *name)
 
 extern "C" void nvs_dump(const char *partName)
 {
-    Lock lock;
+    StorageLock lock;
     nvs::Storage* pStorage;
 
     pStorage = lookup_storage_from_name(partName);
@@ -94,14 +169,22 @@ extern "C" void nvs_dump(const char *partName)
         return;
     }
 
+    lock.lockShared(pStorage);
     pStorage->debugDump();
     return;
 }
 
-extern "C" esp_err_t nvs_flash_init_custom(const char *partName, uint32_t baseSector, uint32_t sectorCount)
+/* Several tasks may initialize NVS at once, the storage list lock is created under the handle list lock */
+static esp_err_t nvs_storage_lock_init()
 {
-    ESP_LOGD(TAG, "nvs_flash_init_custom partition=%s start=%d count=%d", partName, baseSector, sectorCount);
+    Lock::init();
+    Lock lock;
+    return s_nvs_storage_lock.init();
+}
 
+/* Adds the storage of the partition or mounts it again, the storage list must be locked for writing */
+static esp_err_t nvs_storage_init(const char *partName, uint32_t baseSector, uint32_t sectorCount)
+{
     nvs::Storage* new_storage = NULL;
     nvs::Storage* storage = lookup_storage_from_name(partName);
     if (storage == NULL) {
@@ -109,10 +192,23 @@ extern "C" esp_err_t nvs_flash_init_custom(const char *partName, uint32_t baseSe
 
         if (!new_storage) return ESP_ERR_NO_MEM;
 
+        if (new_storage->getLock().init() != ESP_OK) {
+            delete new_storage;
+            return ESP_ERR_NO_MEM;
+        }
+
         storage = new_storage;
     }
 
-    esp_err_t err = storage->init(baseSector, sectorCount);
+    nvs::MountSummary* summary = get_mount_summary();
+#ifdef CONFIG_NVS_ENCRYPTION
+    // keep the namespace names of encrypted partitions out of RTC memory
+    if (EncrMgr::isEncrActive() && EncrMgr::getInstance()->findXtsCtxtFromAddr(baseSector * SPI_FLASH_SEC_SIZE)) {
+        summary = nullptr;
+    }
+#endif
+
+    esp_err_t err = storage->init(baseSector, sectorCount, summary);
     if (new_storage != NULL) {
         if (err == ESP_OK) {
             s_nvs_storage_list.push_back(new_storage);
@@ -123,11 +219,20 @@ extern "C" esp_err_t nvs_flash_init_custom(const char *partName, uint32_t baseSe
     return err;
 }
 
-#ifdef CONFIG_NVS_ENCRYPTION
-extern "C" esp_err_t nvs_flash_secure_init_custom(const char *partName, uint32_t baseSector, uint32_t sectorCount, nvs_sec_cfg_t* cfg)
+extern "C" esp_err_t nvs_flash_init_custom(const char *partName, uint32_t baseSector, uint32_t sectorCount)
 {
-    ESP_LOGD(TAG, "nvs_flash_secure_init_custom partition=%s start=%d count=%d", partName, baseSector, sectorCount);
+    ESP_LOGD(TAG, "nvs_flash_init_custom partition=%s start=%d count=%d", partName, baseSector, sectorCount);
 
+    if (nvs_storage_lock_init() != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    WriteLock lock(s_nvs_storage_lock);
+    return nvs_storage_init(partName, baseSector, sectorCount);
+}
+
+#ifdef CONFIG_NVS_ENCRYPTION
+static esp_err_t nvs_storage_secure_init(const char *partName, uint32_t baseSector, uint32_t sectorCount, nvs_sec_cfg_t* cfg)
+{
     if(cfg) {
         auto encrMgr = EncrMgr::getInstance();
 
@@ -139,7 +244,18 @@ extern "C" esp_err_t nvs_flash_secure_init_custom(const char *partName, uint32_t
         }
     }
 
-    return nvs_flash_init_custom(partName, baseSector, sectorCount);
+    return nvs_storage_init(partName, baseSector, sectorCount);
+}
+
+extern "C" esp_err_t nvs_flash_secure_init_custom(const char *partName, uint32_t baseSector, uint32_t sectorCount, nvs_sec_cfg_t* cfg)
+{
+    ESP_LOGD(TAG, "nvs_flash_secure_init_custom partition=%s start=%d count=%d", partName, baseSector, sectorCount);
+
+    if (nvs_storage_lock_init() != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    WriteLock lock(s_nvs_storage_lock);
+    return nvs_storage_secure_init(partName, baseSector, sectorCount, cfg);
 }
 #endif
 
@@ -147,8 +263,10 @@ extern "C" esp_err_t nvs_flash_secure_init_custom(const char *partName, uint32_t
 #ifdef ESP_PLATFORM
 extern "C" esp_err_t nvs_flash_init_partition(const char *part_name)
 {
-    Lock::init();
-    Lock lock;
+    if (nvs_storage_lock_init() != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    WriteLock lock(s_nvs_storage_lock);
     nvs::Storage* mStorage;
 
     mStorage = lookup_storage_from_name(part_name);
@@ -162,7 +280,7 @@ extern "C" esp_err_t nvs_flash_init_partition(const char *part_name)
         return ESP_ERR_NOT_FOUND;
     }
 
-    return nvs_flash_init_custom(part_name, partition->address / SPI_FLASH_SEC_SIZE,
+    return nvs_storage_init(part_name, partition->address / SPI_FLASH_SEC_SIZE,
             partition->size / SPI_FLASH_SEC_SIZE);
 }
 
@@ -174,8 +292,10 @@ extern "C" esp_err_t nvs_flash_init(void)
 #ifdef CONFIG_NVS_ENCRYPTION
 extern "C" esp_err_t nvs_flash_secure_init_partition(const char *part_name, nvs_sec_cfg_t* cfg)
 {
-    Lock::init();
-    Lock lock;
+    if (nvs_storage_lock_init() != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    WriteLock lock(s_nvs_storage_lock);
     nvs::Storage* mStorage;
 
     mStorage = lookup_storage_from_name(part_name);
@@ -189,7 +309,7 @@ extern "C" esp_err_t nvs_flash_secure_init_partition(const char *part_name, nvs_
         return ESP_ERR_NOT_FOUND;
     }
 
-    return nvs_flash_secure_init_custom(part_name, partition->address / SPI_FLASH_SEC_SIZE,
+    return nvs_storage_secure_init(part_name, partition->address / SPI_FLASH_SEC_SIZE,
             partition->size / SPI_FLASH_SEC_SIZE, cfg);
 }
 
@@ -207,6 +327,18 @@ extern "C" esp_err_t nvs_flash_erase_partition(const char *part_name)
         return ESP_ERR_NOT_FOUND;
     }
 
+    // no call may use the storage of the partition while it is erased
+    if (nvs_storage_lock_init() != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+    WriteLock storageLock(s_nvs_storage_lock);
+    {
+        Lock lock;
+        nvs::MountSummary* summary = get_mount_summary();
+        if (summary) {
+            summary->remove(partition->address / SPI_FLASH_SEC_SIZE);
+        }
+    }
     return esp_partition_erase_range(partition, 0, partition->size);
 }
 
@@ -219,7 +351,7 @@ extern "C" esp_err_t nvs_flash_erase()
 extern "C" esp_err_t nvs_flash_deinit_partition(const char* partition_name)
 {
     Lock::init();
-    Lock lock;
+    WriteLock storageLock(s_nvs_storage_lock);
 
     nvs::Storage* storage = lookup_storage_from_name(partition_name);
     if (!storage) {
@@ -234,20 +366,25 @@ extern "C" esp_err_t nvs_flash_deinit_partition(const char* partition_name)
 #endif
 
     /* Clean up handles related to the storage being deinitialized */
-    auto it = s_nvs_handles.begin();
-    auto next = it;
-    while(it != s_nvs_handles.end()) {
-        next++;
-        if (it->mStoragePtr == storage) {
-            ESP_LOGD(TAG, "Deleting handle %d (ns=%d) related to partition \"%s\" (missing call to nvs_close?)",
-                     it->mHandle, it->mNsIndex, partition_name);
-            s_nvs_handles.erase(it);
-            delete static_cast<HandleEntry*>(it);
+    {
+        Lock lock;
+        auto it = s_nvs_handles.begin();
+        auto next = it;
+        while(it != s_nvs_handles.end()) {
+            next++;
+            if (it->mStoragePtr == storage) {
+                ESP_LOGD(TAG, "Deleting handle %d (ns=%d) related to partition \"%s\" (missing call to nvs_close?)",
+                         it->mHandle, it->mNsIndex, partition_name);
+                s_nvs_handles.erase(it);
+                delete it->mTransaction;
+                delete static_cast<HandleEntry*>(it);
+            }
+            it = next;
         }
-        it = next;
     }
 
-    /* Finally delete the storage itself */
+    /* Keep the summary for the next mount, then delete the storage itself */
+    storage->saveSummary();
     s_nvs_storage_list.erase(storage);
     delete storage;
 
@@ -259,21 +396,45 @@ extern "C" esp_err_t nvs_flash_deinit(void)
     return nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME);
 }
 
-static esp_err_t nvs_find_ns_handle(nvs_handle_t handle, HandleEntry& entry)
+static HandleEntry* nvs_find_handle_entry(nvs_handle_t handle)
 {
     auto it = find_if(begin(s_nvs_handles), end(s_nvs_handles), [=](HandleEntry& e) -> bool {
         return e.mHandle == handle;
     });
     if (it == end(s_nvs_handles)) {
+        return nullptr;
+    }
+    return it;
+}
+
+static esp_err_t nvs_find_ns_handle(nvs_handle_t handle, HandleEntry& entry)
+{
+    Lock lock;
+    HandleEntry* found = nvs_find_handle_entry(handle);
+    if (!found) {
         return ESP_ERR_NVS_INVALID_HANDLE;
     }
-    entry = *it;
+    entry = *found;
     return ESP_OK;
 }
 
-extern "C" esp_err_t nvs_open_from_partition(const char *part_name, const char* name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+/* The transaction of a handle is only used with the handle list locked, as it may be committed from another task */
+static esp_err_t nvs_stage_value(nvs_handle_t handle, nvs::ItemType datatype, const char* key, const void* data, size_t dataSize)
 {
     Lock lock;
+    HandleEntry* entry = nvs_find_handle_entry(handle);
+    if (!entry) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (!entry->mTransaction) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    return entry->mTransaction->add(datatype, key, data, dataSize);
+}
+
+extern "C" esp_err_t nvs_open_from_partition(const char *part_name, const char* name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    StorageLock storageLock;
     ESP_LOGD(TAG, "%s %s %d", __func__, name, open_mode);
     uint8_t nsIndex;
     nvs::Storage* sHandle;
@@ -283,7 +444,13 @@ extern "C" esp_err_t nvs_open_from_partition(const char *part_name, const char*
         return ESP_ERR_NVS_PART_NOT_FOUND;
     }
 
-    esp_err_t err = sHandle->createOrOpenNamespace(name, open_mode == NVS_READWRITE, nsIndex);
+    // the storage is only locked for writing when the namespace has to be created
+    storageLock.lockShared(sHandle);
+    esp_err_t err = sHandle->createOrOpenNamespace(name, false, nsIndex);
+    if (err == ESP_ERR_NVS_NOT_FOUND && open_mode == NVS_READWRITE) {
+        storageLock.relock();
+        err = sHandle->createOrOpenNamespace(name, true, nsIndex);
+    }
     if (err != ESP_OK) {
         return err;
     }
@@ -292,6 +459,7 @@ extern "C" esp_err_t nvs_open_from_partition(const char *part_name, const char*
 
     if (!handle_entry) return ESP_ERR_NO_MEM;
 
+    Lock lock;
     s_nvs_handles.push_back(handle_entry);
 
     *out_handle = handle_entry->mHandle;
@@ -312,19 +480,18 @@ extern "C" void nvs_close(nvs_handle_t handle)
 {
     Lock lock;
     ESP_LOGD(TAG, "%s %d", __func__, handle);
-    auto it = find_if(begin(s_nvs_handles), end(s_nvs_handles), [=](HandleEntry& e) -> bool {
-        return e.mHandle == handle;
-    });
-    if (it == end(s_nvs_handles)) {
+    HandleEntry* entry = nvs_find_handle_entry(handle);
+    if (!entry) {
         return;
     }
-    s_nvs_handles.erase(it);
-    delete static_cast<HandleEntry*>(it);
+    s_nvs_handles.erase(entry);
+    delete entry->mTransaction;
+    delete entry;
 }
 
 extern "C" esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key)
 {
-    Lock lock;
+    StorageLock lock;
     ESP_LOGD(TAG, "%s %s\r\n", __func__, key);
     HandleEntry entry;
     auto err = nvs_find_ns_handle(handle, entry);
@@ -334,12 +501,16 @@ extern "C" esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key)
     if (entry.mReadOnly) {
         return ESP_ERR_NVS_READ_ONLY;
     }
+    if (entry.mTransaction) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    lock.lock(entry.mStoragePtr);
     return entry.mStoragePtr->eraseItem(entry.mNsIndex, key);
 }
 
 extern "C" esp_err_t nvs_erase_all(nvs_handle_t handle)
 {
-    Lock lock;
+    StorageLock lock;
     ESP_LOGD(TAG, "%s\r\n", __func__);
     HandleEntry entry;
     auto err = nvs_find_ns_handle(handle, entry);
@@ -349,13 +520,17 @@ extern "C" esp_err_t nvs_erase_all(nvs_handle_t handle)
     if (entry.mReadOnly) {
         return ESP_ERR_NVS_READ_ONLY;
     }
+    if (entry.mTransaction) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    lock.lock(entry.mStoragePtr);
     return entry.mStoragePtr->eraseNamespace(entry.mNsIndex);
 }
 
 template<typename T>
 static esp_err_t nvs_set(nvs_handle_t handle, const char* key, T value)
 {
-    Lock lock;
+    StorageLock lock;
     ESP_LOGD(TAG, "%s %s %d %d", __func__, key, sizeof(T), (uint32_t) value);
     HandleEntry entry;
     auto err = nvs_find_ns_handle(handle, entry);
@@ -365,6 +540,10 @@ static esp_err_t nvs_set(nvs_handle_t handle, const char* key, T value)
     if (entry.mReadOnly) {
         return ESP_ERR_NVS_READ_ONLY;
     }
+    if (entry.mTransaction) {
+        return nvs_stage_value(handle, itemTypeOf(value), key, &value, sizeof(value));
+    }
+    lock.lock(entry.mStoragePtr);
     return entry.mStoragePtr->writeItem(entry.mNsIndex, key, value);
 }
 
@@ -408,17 +587,71 @@ extern "C" esp_err_t nvs_set_u64 (nvs_handle_t handle, const char* key, uint64_t
     return nvs_set(handle, key, value);
 }
 
-extern "C" esp_err_t nvs_commit(nvs_handle_t handle)
+extern "C" esp_err_t nvs_transaction_begin(nvs_handle_t handle)
 {
     Lock lock;
-    // no-op for now, to be used when intermediate cache is added
+    ESP_LOGD(TAG, "%s %d", __func__, handle);
+    HandleEntry* entry = nvs_find_handle_entry(handle);
+    if (!entry) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (entry->mReadOnly) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if (entry->mTransaction) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    entry->mTransaction = new (std::nothrow) nvs::Transaction;
+    if (!entry->mTransaction) {
+        return ESP_ERR_NO_MEM;
+    }
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_transaction_abort(nvs_handle_t handle)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %d", __func__, handle);
+    HandleEntry* entry = nvs_find_handle_entry(handle);
+    if (!entry) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (!entry->mTransaction) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    delete entry->mTransaction;
+    entry->mTransaction = nullptr;
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    StorageLock storageLock;
     HandleEntry entry;
-    return nvs_find_ns_handle(handle, entry);
+    std::unique_ptr<nvs::Transaction> transaction;
+    {
+        Lock lock;
+        HandleEntry* found = nvs_find_handle_entry(handle);
+        if (!found) {
+            return ESP_ERR_NVS_INVALID_HANDLE;
+        }
+        entry = *found;
+        transaction.reset(found->mTransaction);
+        found->mTransaction = nullptr;
+    }
+    storageLock.lock(entry.mStoragePtr);
+    esp_err_t err = ESP_OK;
+    if (transaction) {
+        // the staged items are written together, other items were written when they were set
+        err = entry.mStoragePtr->writeItems(entry.mNsIndex, *transaction);
+    }
+    entry.mStoragePtr->saveSummary();
+    return err;
 }
 
 extern "C" esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value)
 {
-    Lock lock;
+    StorageLock lock;
     ESP_LOGD(TAG, "%s %s %s", __func__, key, value);
     HandleEntry entry;
     auto err = nvs_find_ns_handle(handle, entry);
@@ -428,12 +661,16 @@ extern "C" esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const cha
     if (entry.mReadOnly) {
         return ESP_ERR_NVS_READ_ONLY;
     }
+    if (entry.mTransaction) {
+        return nvs_stage_value(handle, nvs::ItemType::SZ, key, value, strlen(value) + 1);
+    }
+    lock.lock(entry.mStoragePtr);
     return entry.mStoragePtr->writeItem(entry.mNsIndex, nvs::ItemType::SZ, key, value, strlen(value) + 1);
 }
 
 extern "C" esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length)
 {
-    Lock lock;
+    StorageLock lock;
     ESP_LOGD(TAG, "%s %s %d", __func__, key, length);
     HandleEntry entry;
     auto err = nvs_find_ns_handle(handle, entry);
@@ -443,6 +680,10 @@ extern "C" esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const vo
     if (entry.mReadOnly) {
         return ESP_ERR_NVS_READ_ONLY;
     }
+    if (entry.mTransaction) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    lock.lock(entry.mStoragePtr);
     return entry.mStoragePtr->writeItem(entry.mNsIndex, nvs::ItemType::BLOB, key, value, length);
 }
 
@@ -450,13 +691,14 @@ extern "C" esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const vo
 template<typename T>
 static esp_err_t nvs_get(nvs_handle_t handle, const char* key, T* out_value)
 {
-    Lock lock;
+    StorageLock lock;
     ESP_LOGD(TAG, "%s %s %d", __func__, key, sizeof(T));
     HandleEntry entry;
     auto err = nvs_find_ns_handle(handle, entry);
     if (err != ESP_OK) {
         return err;
     }
+    lock.lockShared(entry.mStoragePtr);
     return entry.mStoragePtr->readItem(entry.mNsIndex, key, *out_value);
 }
 
@@ -502,13 +744,14 @@ extern "C" esp_err_t nvs_get_u64 (nvs_handle_t handle, const char* key, uint64_t
 
 static esp_err_t nvs_get_str_or_blob(nvs_handle_t handle, nvs::ItemType type, const char* key, void* out_value, size_t* length)
 {
-    Lock lock;
+    StorageLock lock;
     ESP_LOGD(TAG, "%s %s", __func__, key);
     HandleEntry entry;
     auto err = nvs_find_ns_handle(handle, entry);
     if (err != ESP_OK) {
         return err;
     }
+    lock.lockShared(entry.mStoragePtr);
 
     size_t dataSize;
     err = entry.mStoragePtr->getItemDataSize(entry.mNsIndex, type, key, dataSize);
@@ -527,7 +770,13 @@ static esp_err_t nvs_get_str_or_blob(nvs_handle_t handle, nvs::ItemType type, co
     }
 
     *length = dataSize;
-    return entry.mStoragePtr->readItem(entry.mNsIndex, type, key, out_value, dataSize);
+    err = entry.mStoragePtr->readItem(entry.mNsIndex, type, key, out_value, dataSize);
+    if (err == ESP_ERR_NVS_NOT_FOUND && type == nvs::ItemType::BLOB) {
+        // the blob index was found but a chunk is missing, the blob is erased by a writer
+        lock.relock();
+        entry.mStoragePtr->eraseIncompleteMultiPageBlob(entry.mNsIndex, key);
+    }
+    return err;
 }
 
 extern "C" esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length)
@@ -542,7 +791,7 @@ extern "C" esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* ou
 
 extern "C" esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats)
 {
-    Lock lock;
+    StorageLock lock;
     nvs::Storage* pStorage;
 
     if (nvs_stats == NULL) {
@@ -558,6 +807,7 @@ extern "C" esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
 
+    lock.lockShared(pStorage);
     if(!pStorage->isValid()){
         return ESP_ERR_NVS_INVALID_STATE;
     }
@@ -567,7 +817,7 @@ extern "C" esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats
 
 extern "C" esp_err_t nvs_get_used_entry_count(nvs_handle_t handle, size_t* used_entries)
 {
-    Lock lock;
+    StorageLock lock;
     if(used_entries == NULL){
         return ESP_ERR_INVALID_ARG;
     }
@@ -580,6 +830,7 @@ extern "C" esp_err_t nvs_get_used_entry_count(nvs_handle_t handle, size_t* used_
     }
 
     size_t used_entry_count;
+    lock.lockShared(entry.mStoragePtr);
     err = entry.mStoragePtr->calcEntriesInNamespace(entry.mNsIndex, used_entry_count);
     if(err == ESP_OK){
         *used_entries = used_entry_count;
@@ -721,13 +972,14 @@ static nvs_iterator_t create_iterator(nvs::Storage *storage, nvs_type_t type)
 
 extern "C" nvs_iterator_t nvs_entry_find(const char *part_name, const char *namespace_name, nvs_type_t type)
 {
-    Lock lock;
+    StorageLock lock;
     nvs::Storage *pStorage;
 
     pStorage = lookup_storage_from_name(part_name);
     if (pStorage == NULL) {
         return NULL;
     }
+    lock.lockShared(pStorage);
 
     nvs_iterator_t it = create_iterator(pStorage, type);
     if (it == NULL) {
@@ -745,8 +997,9 @@ extern "C" nvs_iterator_t nvs_entry_find(const char *part_name, const char *name
 
 extern "C" nvs_iterator_t nvs_entry_next(nvs_iterator_t it)
 {
-    Lock lock;
+    StorageLock lock;
     assert(it);
+    lock.lockShared(it->storage);
 
     bool entryFound = it->storage->nextEntry(it);
     if (!entryFound) {
@@ -23,101 +23,154 @@ HashList::HashList()
 
 void HashList::clear()
 {
-    for (auto it = mBlockList.begin(); it != mBlockList.end();) {
-        auto tmp = it;
-        ++it;
-        mBlockList.erase(tmp);
-        delete static_cast<HashListBlock*>(tmp);
-    }
+    delete[] mNodes;
+    mNodes = nullptr;
+    mCapacity = 0;
+    mCount = 0;
 }
 
 HashList::~HashList()
 {
-    clear();
+    delete[] mNodes;
 }
 
-HashList::HashListBlock::HashListBlock()
+esp_err_t HashList::insert(const Item& item, size_t index)
 {
-    static_assert(sizeof(HashListBlock) == HashListBlock::BYTE_SIZE,
-                  "cache block size calculation incorrect");
+    return insertHash(item.calculateCrc32WithoutValue() & 0xffffff, index);
 }
 
-esp_err_t HashList::insert(const Item& item, size_t index)
+size_t HashList::capacityFor(size_t count)
 {
-    const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
-    // add entry to the end of last block if possible
-    if (mBlockList.size()) {
-        auto& block = mBlockList.back();
-        if (block.mCount < HashListBlock::ENTRY_COUNT) {
-            block.mNodes[block.mCount++] = HashListNode(hash_24, index);
-            return ESP_OK;
-        }
+    size_t items = MIN_ITEMS;
+    while (items < count && items < MAX_ITEMS) {
+        items *= 2;
     }
-    // if the above failed, create a new block and add entry to it
-    HashListBlock* newBlock = new (std::nothrow) HashListBlock;
+    return items * 3 / 2;
+}
 
-    if (!newBlock) return ESP_ERR_NO_MEM;
+esp_err_t HashList::reserve(size_t count)
+{
+    const size_t capacity = capacityFor(count);
+    if (capacity <= mCapacity) {
+        return ESP_OK;
+    }
+    HashListNode* nodes = new (std::nothrow) HashListNode[capacity];
+    if (!nodes) {
+        return ESP_ERR_NO_MEM;
+    }
+    HashListNode* oldNodes = mNodes;
+    const size_t oldCapacity = mCapacity;
+    mNodes = nodes;
+    mCapacity = capacity;
+    for (size_t i = 0; i < oldCapacity; ++i) {
+        if (oldNodes[i].mIndex != 0xff) {
+            insertNode(oldNodes[i]);
+        }
+    }
+    delete[] oldNodes;
+    return ESP_OK;
+}
 
-    mBlockList.push_back(newBlock);
-    newBlock->mNodes[0] = HashListNode(hash_24, index);
-    newBlock->mCount++;
+void HashList::insertNode(const HashListNode& node)
+{
+    size_t slot = node.mHash % mCapacity;
+    while (mNodes[slot].mIndex != 0xff) {
+        slot = nextSlot(slot);
+    }
+    mNodes[slot] = node;
+}
 
+esp_err_t HashList::insertHash(uint32_t hash_24, size_t index)
+{
+    if (mCount >= MAX_ITEMS) {
+        return ESP_ERR_NO_MEM;
+    }
+    auto err = reserve(mCount + 1);
+    if (err != ESP_OK) {
+        return err;
+    }
+    insertNode(HashListNode(hash_24, index));
+    ++mCount;
     return ESP_OK;
 }
 
 void HashList::erase(size_t index, bool itemShouldExist)
 {
-    for (auto it = mBlockList.begin(); it != mBlockList.end();) {
-        bool haveEntries = false;
-        bool foundIndex = false;
-        for (size_t i = 0; i < it->mCount; ++i) {
-            if (it->mNodes[i].mIndex == index) {
-                it->mNodes[i].mIndex = 0xff;
-                foundIndex = true;
-                /* found the item and removed it */
-            }
-            if (it->mNodes[i].mIndex != 0xff) {
-                haveEntries = true;
-            }
-            if (haveEntries && foundIndex) {
-                /* item was found, and HashListBlock still has some items */
-                return;
-            }
+    // the hash of the erased item may not be known (CRC error), so the whole table is searched
+    size_t slot = SIZE_MAX;
+    for (size_t i = 0; i < mCapacity; ++i) {
+        if (mNodes[i].mIndex == index) {
+            slot = i;
+            break;
         }
-        /* no items left in HashListBlock, can remove */
-        if (!haveEntries) {
-            auto tmp = it;
-            ++it;
-            mBlockList.erase(tmp);
-            delete static_cast<HashListBlock*>(tmp);
-        } else {
-            ++it;
+    }
+    if (slot == SIZE_MAX) {
+        if (itemShouldExist) {
+            assert(false && "item should have been present in cache");
         }
-        if (foundIndex) {
-            /* item was found and empty HashListBlock was removed */
-            return;
+        return;
+    }
+
+    // move back the following nodes of the probe sequence which can fill the freed slot
+    size_t next = slot;
+    while (true) {
+        next = nextSlot(next);
+        if (mNodes[next].mIndex == 0xff) {
+            break;
         }
+        size_t home = mNodes[next].mHash % mCapacity;
+        bool inRange = (slot <= next) ? (slot < home && home <= next) : (slot < home || home <= next);
+        if (inRange) {
+            continue;
+        }
+        mNodes[slot] = mNodes[next];
+        slot = next;
     }
-    if (itemShouldExist) {
-        assert(false && "item should have been present in cache");
+    mNodes[slot] = HashListNode();
+    if (--mCount == 0) {
+        clear();
     }
 }
 
 size_t HashList::find(size_t start, const Item& item)
 {
+    if (!mNodes) {
+        return SIZE_MAX;
+    }
     const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
-    for (auto it = mBlockList.begin(); it != mBlockList.end(); ++it) {
-        for (size_t index = 0; index < it->mCount; ++index) {
-            HashListNode& e = it->mNodes[index];
-            if (e.mIndex >= start &&
-                    e.mHash == hash_24 &&
-                    e.mIndex != 0xff) {
-                return e.mIndex;
-            }
+    // several items can have the same hash, return the first one
+    size_t result = SIZE_MAX;
+    for (size_t slot = hash_24 % mCapacity; mNodes[slot].mIndex != 0xff; slot = nextSlot(slot)) {
+        const HashListNode& e = mNodes[slot];
+        if (e.mHash == hash_24 && e.mIndex >= start && e.mIndex < result) {
+            result = e.mIndex;
         }
     }
-    return SIZE_MAX;
+    return result;
 }
 
+uint32_t* HashList::save(uint32_t* dst) const
+{
+    for (size_t i = 0; i < mCapacity; ++i) {
+        if (mNodes[i].mIndex != 0xff) {
+            *dst++ = (mNodes[i].mHash << 8) | mNodes[i].mIndex;
+        }
+    }
+    return dst;
+}
+
+bool HashList::restore(const uint32_t* src, size_t count)
+{
+    if (count > MAX_ITEMS || reserve(count) != ESP_OK) {
+        return false;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        size_t index = src[i] & 0xff;
+        if (index >= MAX_ITEMS || insertHash(src[i] >> 8, index) != ESP_OK) {
+            return false;
+        }
+    }
+    return true;
+}
 
 } // namespace nvs
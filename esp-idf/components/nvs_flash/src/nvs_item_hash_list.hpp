@@ -17,11 +17,18 @@
 
 #include "nvs.h"
 #include "nvs_types.hpp"
-#include "intrusive_list.h"
 
 namespace nvs
 {
 
+/**
+ * Hashes of the items on one page, used to find an item without reading the entries.
+ *
+ * The hashes are kept in an open-addressed table with linear probing, which is at most 2/3 full.
+ * The table is sized for 16, 32, 64 or 128 items (96 to 768 bytes): when a page is loaded it is
+ * allocated once for the used entries of the page, afterwards it is grown as items are written.
+ * It is freed when the last item is erased or the page is cleared.
+ */
 class HashList
 {
 public:
@@ -29,10 +36,26 @@ public:
     ~HashList();
 
     esp_err_t insert(const Item& item, size_t index);
+    esp_err_t reserve(size_t count);
     void erase(const size_t index, bool itemShouldExist=true);
     size_t find(size_t start, const Item& item);
     void clear();
 
+    size_t getCount() const
+    {
+        return mCount;
+    }
+
+    /* Store the nodes as (hash << 8 | index) words, returns the end of the stored data */
+    uint32_t* save(uint32_t* dst) const;
+
+    /* Insert nodes stored by save(), returns false if they don't fit or memory runs out */
+    bool restore(const uint32_t* src, size_t count);
+
+    // max number of items, enough for all entries of a page
+    static const size_t MAX_ITEMS = 128;
+    static const size_t MIN_ITEMS = 16;
+
 private:
     HashList(const HashList& other);
     const HashList& operator= (const HashList& rhs);
@@ -50,22 +73,24 @@ protected:
         {
         }
 
-        uint32_t mIndex : 8;
+        uint32_t mIndex : 8;    // 0xff for an empty slot
         uint32_t mHash  : 24;
     };
 
-    struct HashListBlock : public intrusive_list_node<HashList::HashListBlock> {
-        HashListBlock();
+    static size_t capacityFor(size_t count);
 
-        static const size_t BYTE_SIZE = 128;
-        static const size_t ENTRY_COUNT = (BYTE_SIZE - sizeof(intrusive_list_node<HashListBlock>) - sizeof(size_t)) / 4;
+    esp_err_t insertHash(uint32_t hash_24, size_t index);
 
-        size_t mCount = 0;
-        HashListNode mNodes[ENTRY_COUNT];
-    };
+    void insertNode(const HashListNode& node);
+
+    size_t nextSlot(size_t slot) const
+    {
+        return (slot + 1 == mCapacity) ? 0 : slot + 1;
+    }
 
-    typedef intrusive_list<HashListBlock> TBlockList;
-    TBlockList mBlockList;
+    HashListNode* mNodes = nullptr;
+    size_t mCapacity = 0;
+    size_t mCount = 0;
 }; // class HashList
 
 } // namespace nvs
@@ -0,0 +1,243 @@
+// Copyright 2015-2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nvs_item_index.hpp"
+#include "nvs_page.hpp"
+
+namespace nvs
+{
+
+ItemIndex::~ItemIndex()
+{
+    clear();
+}
+
+uint32_t ItemIndex::hash(uint8_t nsIndex, const char* key)
+{
+    // chunk index is left out, so that a blob index and all its chunks have the same hash
+    return Item(nsIndex, ItemType::ANY, 0, key).calculateCrc32WithoutValue();
+}
+
+void ItemIndex::clear()
+{
+    delete[] mRecords;
+    mRecords = nullptr;
+    mCapacity = 0;
+    mSize = 0;
+    mEnabled = true;
+}
+
+void ItemIndex::disable()
+{
+    clear();
+    mEnabled = false;
+}
+
+size_t ItemIndex::findSlot(uint32_t hash, const Page* page) const
+{
+    if (mCapacity == 0) {
+        return SIZE_MAX;
+    }
+    const size_t mask = mCapacity - 1;
+    for (size_t i = hash & mask; mRecords[i].mCount != 0; i = (i + 1) & mask) {
+        if (mRecords[i].mHash == hash && mRecords[i].mPage == page) {
+            return i;
+        }
+    }
+    return SIZE_MAX;
+}
+
+bool ItemIndex::resize(size_t capacity)
+{
+    Record* records = new (std::nothrow) Record[capacity];
+    if (!records) {
+        return false;
+    }
+
+    const size_t mask = capacity - 1;
+    for (size_t i = 0; i < mCapacity; ++i) {
+        if (mRecords[i].mCount == 0) {
+            continue;
+        }
+        size_t j = mRecords[i].mHash & mask;
+        while (records[j].mCount != 0) {
+            j = (j + 1) & mask;
+        }
+        records[j] = mRecords[i];
+    }
+    delete[] mRecords;
+    mRecords = records;
+    mCapacity = capacity;
+    return true;
+}
+
+bool ItemIndex::grow()
+{
+    return resize((mCapacity == 0) ? MIN_CAPACITY : mCapacity * 2);
+}
+
+bool ItemIndex::reserve(size_t count)
+{
+    if (!mEnabled) {
+        return false;
+    }
+    size_t capacity = MIN_CAPACITY;
+    while (count * 4 > capacity * 3) {
+        capacity *= 2;
+    }
+    if (capacity <= mCapacity) {
+        return true;
+    }
+    return resize(capacity);
+}
+
+void ItemIndex::add(uint32_t hash, Page* page)
+{
+    if (!mEnabled) {
+        return;
+    }
+
+    size_t slot = findSlot(hash, page);
+    if (slot != SIZE_MAX) {
+        if (mRecords[slot].mCount < UINT16_MAX) {
+            ++mRecords[slot].mCount;
+        }
+        return;
+    }
+
+    if ((mSize + 1) * 4 > mCapacity * 3 && !grow()) {
+        disable();
+        return;
+    }
+
+    const size_t mask = mCapacity - 1;
+    slot = hash & mask;
+    while (mRecords[slot].mCount != 0) {
+        slot = (slot + 1) & mask;
+    }
+    mRecords[slot].mHash = hash;
+    mRecords[slot].mCount = 1;
+    mRecords[slot].mPage = page;
+    ++mSize;
+}
+
+void ItemIndex::eraseSlot(size_t slot)
+{
+    // shift back the following records of the probe sequence, so that no tombstones are needed
+    const size_t mask = mCapacity - 1;
+    size_t j = slot;
+    while (true) {
+        j = (j + 1) & mask;
+        if (mRecords[j].mCount == 0) {
+            break;
+        }
+        size_t home = mRecords[j].mHash & mask;
+        bool inRange = (slot <= j) ? (slot < home && home <= j) : (slot < home || home <= j);
+        if (inRange) {
+            continue;
+        }
+        mRecords[slot] = mRecords[j];
+        slot = j;
+    }
+    mRecords[slot].mCount = 0;
+    --mSize;
+}
+
+void ItemIndex::remove(uint32_t hash, const Page* page)
+{
+    size_t slot = findSlot(hash, page);
+    if (slot == SIZE_MAX) {
+        return;
+    }
+    if (--mRecords[slot].mCount == 0) {
+        eraseSlot(slot);
+    }
+}
+
+void ItemIndex::movePage(const Page* from, Page* to)
+{
+    // slots depend only on the hash, so the records can be updated in place
+    for (size_t i = 0; i < mCapacity; ++i) {
+        if (mRecords[i].mCount != 0 && mRecords[i].mPage == from) {
+            assert(findSlot(mRecords[i].mHash, to) == SIZE_MAX);
+            mRecords[i].mPage = to;
+        }
+    }
+}
+
+size_t ItemIndex::find(uint32_t hash, Page** pages, size_t maxCount) const
+{
+    if (!mEnabled) {
+        return SIZE_MAX;
+    }
+    if (mCapacity == 0) {
+        return 0;
+    }
+
+    size_t found = 0;
+    const size_t mask = mCapacity - 1;
+    for (size_t i = hash & mask; mRecords[i].mCount != 0; i = (i + 1) & mask) {
+        if (mRecords[i].mHash == hash) {
+            if (found < maxCount) {
+                pages[found] = mRecords[i].mPage;
+            }
+            ++found;
+        }
+    }
+    return found;
+}
+
+size_t ItemIndex::count(uint32_t hash, const Page* page) const
+{
+    size_t slot = findSlot(hash, page);
+    return (slot == SIZE_MAX) ? 0 : mRecords[slot].mCount;
+}
+
+uint32_t* ItemIndex::save(uint32_t* dst, const Page* pages) const
+{
+    *dst++ = static_cast<uint32_t>(mSize);
+    for (size_t i = 0; i < mCapacity; ++i) {
+        if (mRecords[i].mCount != 0) {
+            *dst++ = mRecords[i].mHash;
+            *dst++ = (static_cast<uint32_t>(mRecords[i].mPage - pages) << 16) | mRecords[i].mCount;
+        }
+    }
+    return dst;
+}
+
+bool ItemIndex::restore(const uint32_t* src, size_t size, Page* pages, size_t pageCount)
+{
+    if (size < 1 || (size - 1) / 2 < src[0]) {
+        return false;
+    }
+    const size_t count = src[0];
+    reserve(mSize + count);
+    for (size_t i = 0; i < count; ++i) {
+        const uint32_t hash = src[1 + i * 2];
+        const size_t page = src[2 + i * 2] >> 16;
+        const uint16_t itemCount = src[2 + i * 2] & 0xffff;
+        if (page >= pageCount || itemCount == 0) {
+            return false;
+        }
+        add(hash, &pages[page]);
+        size_t slot = findSlot(hash, &pages[page]);
+        if (slot == SIZE_MAX) {
+            return false;
+        }
+        mRecords[slot].mCount = itemCount;
+    }
+    return true;
+}
+
+} // namespace nvs
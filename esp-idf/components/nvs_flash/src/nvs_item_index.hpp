@@ -0,0 +1,119 @@
+// Copyright 2015-2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef nvs_item_index_hpp
+#define nvs_item_index_hpp
+
+#include "nvs.h"
+#include "nvs_types.hpp"
+
+namespace nvs
+{
+
+class Page;
+
+/**
+ * Partition-wide index which maps <namespace, key> of the stored items to the pages holding them.
+ *
+ * Each record counts the items with the same <namespace, key> on one page (a blob index and its
+ * data chunks share the key). The index may list pages which no longer hold the key, e.g. when
+ * a page dropped an item with a CRC error, but it never misses a page holding it, so a lookup
+ * only has to search the listed pages.
+ *
+ * Records are kept in an open-addressed table with linear probing. When the index is built at
+ * load, the table is reserved for the used entries of the partition, which bound the number of
+ * records; afterwards it is doubled when it is 3/4 full. If the table can't be grown, the index
+ * is disabled and the lookups have to search all pages until the index is rebuilt.
+ * The entry of the key within the page is found by the page's own hash list.
+ */
+class ItemIndex
+{
+public:
+    ItemIndex() {}
+    ~ItemIndex();
+
+    static uint32_t hash(uint8_t nsIndex, const char* key);
+
+    void add(uint32_t hash, Page* page);
+
+    /* Make room for 'count' records without growing the table, returns false if the memory
+     * is not available (the table is then grown as the records are added) */
+    bool reserve(size_t count);
+
+    void remove(uint32_t hash, const Page* page);
+
+    /* Move the records of page 'from' to page 'to', which must not be indexed yet */
+    void movePage(const Page* from, Page* to);
+
+    /* Returns the number of pages which may hold the key (only the first 'maxCount' are stored
+     * in 'pages') or SIZE_MAX if the index is disabled */
+    size_t find(uint32_t hash, Page** pages, size_t maxCount) const;
+
+    size_t count(uint32_t hash, const Page* page) const;
+
+    void clear();
+
+    void disable();
+
+    size_t getSummarySize() const
+    {
+        return 1 + mSize * 2;
+    }
+
+    /* Store the records with the pages as offsets from 'pages', returns the end of the stored data */
+    uint32_t* save(uint32_t* dst, const Page* pages) const;
+
+    /* Add the records stored by save(), returns false if they are malformed or memory runs out */
+    bool restore(const uint32_t* src, size_t size, Page* pages, size_t pageCount);
+
+    bool isEnabled() const
+    {
+        return mEnabled;
+    }
+
+private:
+    ItemIndex(const ItemIndex& other);
+    const ItemIndex& operator= (const ItemIndex& rhs);
+
+protected:
+    struct Record {
+        Record() : mHash(0), mCount(0), mPage(nullptr)
+        {
+        }
+
+        uint32_t mHash;
+        uint16_t mCount;    // 0 for an empty slot
+        Page* mPage;
+    };
+
+    static const size_t MIN_CAPACITY = 64;
+
+    size_t findSlot(uint32_t hash, const Page* page) const;
+
+    bool resize(size_t capacity);
+
+    bool grow();
+
+    void eraseSlot(size_t slot);
+
+    Record* mRecords = nullptr;
+    size_t mCapacity = 0;
+    size_t mSize = 0;
+    bool mEnabled = true;
+}; // class ItemIndex
+
+} // namespace nvs
+
+
+#endif /* nvs_item_index_hpp */
@@ -0,0 +1,122 @@
+// Copyright 2015-2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nvs_mount_summary.hpp"
+#if defined(ESP_PLATFORM)
+#include <esp32/rom/crc.h>
+#else
+#include "crc.h"
+#endif
+#include <cstring>
+
+namespace nvs
+{
+
+uint32_t MountSummary::calculateCrc32(const uint32_t* data, size_t size)
+{
+    return crc32_le(0xffffffff, reinterpret_cast<const uint8_t*>(data), size * sizeof(uint32_t));
+}
+
+void MountSummary::clear()
+{
+    terminate(0);
+}
+
+bool MountSummary::isRecordAt(size_t offset) const
+{
+    if (offset + RECORD_WORDS > mSize) {
+        return false;
+    }
+    const Record* record = recordAt(offset);
+    return record->mMagic == MAGIC && record->mSize <= mSize - offset - RECORD_WORDS;
+}
+
+size_t MountSummary::findRecord(uint32_t baseSector) const
+{
+    for (size_t offset = 0; isRecordAt(offset); offset += RECORD_WORDS + recordAt(offset)->mSize) {
+        if (recordAt(offset)->mBaseSector == baseSector) {
+            return offset;
+        }
+    }
+    return SIZE_MAX;
+}
+
+size_t MountSummary::end() const
+{
+    size_t offset = 0;
+    while (isRecordAt(offset)) {
+        offset += RECORD_WORDS + recordAt(offset)->mSize;
+    }
+    return offset;
+}
+
+void MountSummary::terminate(size_t offset)
+{
+    if (offset < mSize) {
+        mData[offset] = 0;
+    }
+}
+
+const uint32_t* MountSummary::find(uint32_t baseSector, uint32_t sectorCount, size_t& size) const
+{
+    size_t offset = findRecord(baseSector);
+    if (offset == SIZE_MAX) {
+        return nullptr;
+    }
+    const Record* record = recordAt(offset);
+    const uint32_t* content = mData + offset + RECORD_WORDS;
+    if (record->mSectorCount != sectorCount || record->mCrc32 != calculateCrc32(content, record->mSize)) {
+        return nullptr;
+    }
+    size = record->mSize;
+    return content;
+}
+
+uint32_t* MountSummary::reserve(uint32_t baseSector, uint32_t sectorCount, size_t size)
+{
+    remove(baseSector);
+    size_t offset = end();
+    if (offset + RECORD_WORDS > mSize || size > mSize - offset - RECORD_WORDS) {
+        return nullptr;
+    }
+    // the record is only valid once the magic is written by seal()
+    Record* record = recordAt(offset);
+    record->mMagic = 0;
+    record->mSize = size;
+    record->mBaseSector = baseSector;
+    record->mSectorCount = sectorCount;
+    terminate(offset + RECORD_WORDS + size);
+    return mData + offset + RECORD_WORDS;
+}
+
+void MountSummary::seal(uint32_t* summary)
+{
+    Record* record = reinterpret_cast<Record*>(summary - RECORD_WORDS);
+    record->mCrc32 = calculateCrc32(summary, record->mSize);
+    record->mMagic = MAGIC;
+}
+
+void MountSummary::remove(uint32_t baseSector)
+{
+    size_t offset = findRecord(baseSector);
+    if (offset == SIZE_MAX) {
+        return;
+    }
+    size_t next = offset + RECORD_WORDS + recordAt(offset)->mSize;
+    size_t tail = end() - next;
+    memmove(mData + offset, mData + next, tail * sizeof(uint32_t));
+    terminate(offset + tail);
+}
+
+} // namespace nvs
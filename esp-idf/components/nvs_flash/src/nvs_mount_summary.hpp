@@ -0,0 +1,86 @@
+// Copyright 2015-2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef nvs_mount_summary_hpp
+#define nvs_mount_summary_hpp
+
+#include "nvs.h"
+#include <cstdint>
+#include <cstddef>
+
+namespace nvs
+{
+
+/**
+ * Summaries of the mounted partitions, kept in memory which survives a restart
+ * (RTC memory across deep sleep on the chip).
+ *
+ * Each partition has at most one record, protected by a CRC. The content of a record is
+ * written by the storage; it describes the page headers and entry state tables it was taken
+ * from, so it is only used at mount if the flash still matches it.
+ */
+class MountSummary
+{
+public:
+    MountSummary(uint32_t* data, size_t size) : mData(data), mSize(size / sizeof(uint32_t))
+    {
+    }
+
+    void clear();
+
+    /* Returns the summary of the partition and its size in words, or nullptr if there is none */
+    const uint32_t* find(uint32_t baseSector, uint32_t sectorCount, size_t& size) const;
+
+    /* Replaces the summary of the partition with a new one of 'size' words, which has to be
+     * sealed once written. Returns nullptr if there is no room for it. */
+    uint32_t* reserve(uint32_t baseSector, uint32_t sectorCount, size_t size);
+
+    void seal(uint32_t* summary);
+
+    void remove(uint32_t baseSector);
+
+protected:
+    struct Record {
+        uint32_t mMagic;
+        uint32_t mSize;         // size of the content in words
+        uint32_t mBaseSector;
+        uint32_t mSectorCount;
+        uint32_t mCrc32;        // crc of the content
+    };
+
+    static const uint32_t MAGIC = 0x4d53564e;
+    static const size_t RECORD_WORDS = sizeof(Record) / sizeof(uint32_t);
+
+    Record* recordAt(size_t offset) const
+    {
+        return reinterpret_cast<Record*>(mData + offset);
+    }
+
+    bool isRecordAt(size_t offset) const;
+
+    size_t findRecord(uint32_t baseSector) const;
+
+    size_t end() const;
+
+    void terminate(size_t offset);
+
+    static uint32_t calculateCrc32(const uint32_t* data, size_t size);
+
+    uint32_t* mData;
+    size_t mSize;
+}; // class MountSummary
+
+} // namespace nvs
+
+#endif /* nvs_mount_summary_hpp */
@@ -19,6 +19,7 @@
 #endif
 #include <cstdio>
 #include <cstring>
+#include <memory>
 
 #include "nvs_ops.hpp"
 
@@ -32,11 +33,14 @@ uint32_t Page::Header::calculateCrc32()
                     offsetof(Header, mCrc32) - offsetof(Header, mSeqNumber));
 }
 
-esp_err_t Page::load(uint32_t sectorNumber)
+esp_err_t Page::load(uint32_t sectorNumber, const uint32_t* summary, bool* summaryUsed)
 {
     mBaseAddress = sectorNumber * SEC_SIZE;
     mUsedEntryCount = 0;
     mErasedEntryCount = 0;
+    if (summaryUsed) {
+        *summaryUsed = false;
+    }
 
     Header header;
     auto rc = spi_flash_read(mBaseAddress, &header, sizeof(header));
@@ -44,6 +48,16 @@ esp_err_t Page::load(uint32_t sectorNumber)
         mState = PageState::INVALID;
         return rc;
     }
+    if (summary) {
+        bool matches;
+        rc = loadSummary(header, summary, matches);
+        if (rc != ESP_OK || matches) {
+            if (summaryUsed) {
+                *summaryUsed = matches;
+            }
+            return rc;
+        }
+    }
     if (header.mState == PageState::UNINITIALIZED) {
         mState = header.mState;
         // check if the whole page is really empty
@@ -97,6 +111,63 @@ esp_err_t Page::load(uint32_t sectorNumber)
     return ESP_OK;
 }
 
+esp_err_t Page::loadSummary(Header& header, const uint32_t* summary, bool& matches)
+{
+    matches = false;
+    auto state = static_cast<PageState>(summary[SUMMARY_STATE]);
+    if (header.mState != state || header.mSeqNumber != summary[SUMMARY_SEQ]) {
+        return ESP_OK;
+    }
+    if (state == PageState::UNINITIALIZED) {
+        if (summary[SUMMARY_ITEM_COUNT] != 0) {
+            return ESP_OK;
+        }
+    } else if ((state != PageState::ACTIVE && state != PageState::FULL) ||
+            header.mCrc32 != header.calculateCrc32() || header.mVersion < NVS_VERSION) {
+        return ESP_OK;
+    }
+
+    auto rc = spi_flash_read(mBaseAddress + ENTRY_TABLE_OFFSET, mEntryTable.data(), mEntryTable.byteSize());
+    if (rc != ESP_OK) {
+        mState = PageState::INVALID;
+        return rc;
+    }
+    if (crc32_le(0xffffffff, reinterpret_cast<uint8_t*>(mEntryTable.data()), mEntryTable.byteSize()) != summary[SUMMARY_TABLE_CRC]) {
+        return ESP_OK;
+    }
+    if (!mHashList.restore(summary + SUMMARY_HEADER_SIZE, summary[SUMMARY_ITEM_COUNT])) {
+        mHashList.clear();
+        return ESP_OK;
+    }
+
+    // an uninitialized page was checked to be empty before the summary was saved
+    matches = true;
+    mState = state;
+    if (state == PageState::UNINITIALIZED) {
+        return ESP_OK;
+    }
+    mSeqNumber = header.mSeqNumber;
+    mVersion = header.mVersion;
+    return mLoadEntryTable(true);
+}
+
+uint32_t* Page::saveSummary(uint32_t* dst) const
+{
+    dst[SUMMARY_STATE] = static_cast<uint32_t>(mState);
+    dst[SUMMARY_ITEM_COUNT] = static_cast<uint32_t>(mHashList.getCount());
+    if (mState == PageState::UNINITIALIZED) {
+        // the entry state table of an erased page isn't kept in memory
+        TEntryTable erasedTable;
+        std::fill_n(erasedTable.data(), erasedTable.byteSize() / sizeof(uint32_t), 0xffffffff);
+        dst[SUMMARY_SEQ] = UINT32_MAX;
+        dst[SUMMARY_TABLE_CRC] = crc32_le(0xffffffff, reinterpret_cast<uint8_t*>(erasedTable.data()), erasedTable.byteSize());
+    } else {
+        dst[SUMMARY_SEQ] = mSeqNumber;
+        dst[SUMMARY_TABLE_CRC] = crc32_le(0xffffffff, reinterpret_cast<const uint8_t*>(mEntryTable.data()), mEntryTable.byteSize());
+    }
+    return mHashList.save(dst + SUMMARY_HEADER_SIZE);
+}
+
 esp_err_t Page::writeEntry(const Item& item)
 {
     esp_err_t err;
@@ -264,6 +335,127 @@ esp_err_t Page::writeItem(uint8_t nsIndex, ItemType datatype, const char* key, c
     return ESP_OK;
 }
 
+esp_err_t Page::writeItems(uint8_t nsIndex, Transaction& transaction)
+{
+    esp_err_t err;
+
+    if (mState == PageState::INVALID) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    if (mState == PageState::UNINITIALIZED) {
+        err = initialize();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    if (mState == PageState::FULL) {
+        return ESP_ERR_NVS_PAGE_FULL;
+    }
+
+    if (transaction.getItemCount() == 0) {
+        return ESP_OK;
+    }
+    const size_t entriesCount = transaction.getEntryCount();
+    if (mNextFreeEntry == INVALID_ENTRY || mNextFreeEntry + entriesCount > ENTRY_COUNT) {
+        return ESP_ERR_NVS_PAGE_FULL;
+    }
+
+    std::unique_ptr<Item[]> items(new (std::nothrow) Item[entriesCount]);
+    if (!items) {
+        return ESP_ERR_NO_MEM;
+    }
+    // the items are hashed once they are committed, which can't fail then
+    err = mHashList.reserve(mHashList.getCount() + transaction.getItemCount());
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    items[0] = Item(NS_INDEX, ItemType::U32, 1, "");
+    const uint32_t itemEntries = entriesCount - 1;
+    memcpy(items[0].data, &itemEntries, sizeof(itemEntries));
+    items[0].crc32 = items[0].calculateCrc32();
+
+    size_t index = 1;
+    for (auto it = transaction.begin(); it != transaction.end(); ++it) {
+        Item& item = items[index];
+        item = Item(nsIndex, it->mDatatype, it->mSpan, it->mKey);
+        if (!isVariableLengthType(it->mDatatype)) {
+            memcpy(item.data, it->mData, it->mDataSize);
+        } else {
+            item.varLength.dataCrc32 = Item::calculateCrc32(it->mData, it->mDataSize);
+            item.varLength.dataSize = it->mDataSize;
+            item.varLength.reserved = 0xffff;
+            uint8_t* dataEntries = items[index + 1].rawData;
+            std::fill_n(dataEntries, (it->mSpan - 1) * ENTRY_SIZE, 0xff);
+            memcpy(dataEntries, it->mData, it->mDataSize);
+        }
+        item.crc32 = item.calculateCrc32();
+        index += it->mSpan;
+    }
+    assert(index == entriesCount);
+
+    auto rc = nvs_flash_write(getEntryAddress(mNextFreeEntry), items.get(), entriesCount * ENTRY_SIZE);
+    if (rc != ESP_OK) {
+        mState = PageState::INVALID;
+        return rc;
+    }
+
+    // Until the marker is written, the load of the page finds it half-written and erases it together
+    // with the entries of the items, whatever state they are in.
+    err = alterEntryRangeState(mNextFreeEntry + 1, mNextFreeEntry + entriesCount, EntryState::WRITTEN);
+    if (err == ESP_OK) {
+        err = alterEntryState(mNextFreeEntry, EntryState::WRITTEN);
+    }
+    if (err != ESP_OK) {
+        mState = PageState::INVALID;
+        return err;
+    }
+
+    for (index = 1; index < entriesCount; index += items[index].span) {
+        err = mHashList.insert(items[index], mNextFreeEntry + index);
+        assert(err == ESP_OK);
+    }
+
+    if (mFirstUsedEntry == INVALID_ENTRY) {
+        mFirstUsedEntry = mNextFreeEntry;
+    }
+    mTransactionIndex = mNextFreeEntry;
+    mTransactionEnd = mNextFreeEntry + entriesCount;
+    mUsedEntryCount += entriesCount;
+    mNextFreeEntry += entriesCount;
+    return ESP_OK;
+}
+
+esp_err_t Page::finishTransaction()
+{
+    if (mTransactionIndex == INVALID_ENTRY) {
+        return ESP_OK;
+    }
+    const size_t index = mTransactionIndex;
+    auto err = alterEntryState(index, EntryState::ERASED);
+    if (err != ESP_OK) {
+        mState = PageState::INVALID;
+        return err;
+    }
+    mTransactionIndex = INVALID_ENTRY;
+    mTransactionEnd = INVALID_ENTRY;
+    --mUsedEntryCount;
+    ++mErasedEntryCount;
+    if (index == mFirstUsedEntry) {
+        updateFirstUsedEntry(index, 1);
+    }
+    return ESP_OK;
+}
+
+size_t Page::transactionEnd(size_t index, Item& marker)
+{
+    uint32_t itemEntries;
+    marker.getValue(itemEntries);
+    return std::min(index + 1 + static_cast<size_t>(itemEntries), static_cast<size_t>(ENTRY_COUNT));
+}
+
 esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize, uint8_t chunkIdx, VerOffset chunkStart)
 {
     size_t index = 0;
@@ -305,11 +497,8 @@ esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, vo
         left -= willCopy;
         dst += willCopy;
     }
+    // the broken item is left for the next write of the key to replace
     if (Item::calculateCrc32(reinterpret_cast<uint8_t*>(data), item.varLength.dataSize) != item.varLength.dataCrc32) {
-        rc = eraseEntryAndSpan(index);
-        if (rc != ESP_OK) {
-            return rc;
-        }
         return ESP_ERR_NVS_NOT_FOUND;
     }
     return ESP_OK;
@@ -378,6 +567,65 @@ esp_err_t Page::eraseItem(uint8_t nsIndex, ItemType datatype, const char* key, u
     return eraseEntryAndSpan(index);
 }
 
+esp_err_t Page::eraseItems(const size_t* indices, size_t count)
+{
+    static_assert(TEntryTable::byteSize() / 4 <= 32, "modified words should fit into a mask");
+    uint32_t modifiedWords = 0;
+
+    for (size_t i = 0; i < count; ++i) {
+        const size_t index = indices[i];
+        assert(mEntryTable.get(index) == EntryState::WRITTEN);
+
+        Item item;
+        auto rc = readEntry(index, item);
+        if (rc != ESP_OK) {
+            mState = PageState::INVALID;
+            return rc;
+        }
+
+        size_t span = 1;
+        if (item.calculateCrc32() != item.crc32) {
+            mHashList.erase(index, false);
+            --mUsedEntryCount;
+            ++mErasedEntryCount;
+        } else {
+            mHashList.erase(index);
+            span = item.span;
+            for (size_t j = index; j < index + span; ++j) {
+                if (mEntryTable.get(j) == EntryState::WRITTEN) {
+                    --mUsedEntryCount;
+                }
+                ++mErasedEntryCount;
+            }
+        }
+        for (size_t j = index; j < index + span; ++j) {
+            mEntryTable.set(j, EntryState::ERASED);
+            modifiedWords |= 1 << mEntryTable.getWordIndex(j);
+        }
+
+        if (index == mFirstUsedEntry) {
+            updateFirstUsedEntry(index, span);
+        }
+        if (index + span > mNextFreeEntry) {
+            mNextFreeEntry = index + span;
+        }
+    }
+
+    for (size_t wordIndex = 0; modifiedWords != 0; ++wordIndex, modifiedWords >>= 1) {
+        if ((modifiedWords & 1) == 0) {
+            continue;
+        }
+        uint32_t word = mEntryTable.data()[wordIndex];
+        auto rc = spi_flash_write(mBaseAddress + ENTRY_TABLE_OFFSET + static_cast<uint32_t>(wordIndex) * 4,
+                &word, sizeof(word));
+        if (rc != ESP_OK) {
+            mState = PageState::INVALID;
+            return rc;
+        }
+    }
+    return ESP_OK;
+}
+
 esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx, VerOffset chunkStart)
 {
     size_t index = 0;
@@ -470,6 +718,11 @@ esp_err_t Page::copyItems(Page& other)
         }
     }
 
+    auto err = other.mHashList.reserve(other.mHashList.getCount() + mUsedEntryCount);
+    if (err != ESP_OK) {
+        return err;
+    }
+
     Item entry;
     size_t readEntryIndex = mFirstUsedEntry;
 
@@ -485,6 +738,12 @@ esp_err_t Page::copyItems(Page& other)
             return err;
         }
 
+        // the items of a transaction are copied as single items, and broken entries are dropped
+        if (isTransactionMarker(entry) || entry.crc32 != entry.calculateCrc32()) {
+            readEntryIndex++;
+            continue;
+        }
+
         err = other.mHashList.insert(entry, other.mNextFreeEntry);
         if (err != ESP_OK) {
             return err;
@@ -512,12 +771,12 @@ esp_err_t Page::copyItems(Page& other)
     return ESP_OK;
 }
 
-esp_err_t Page::mLoadEntryTable()
+esp_err_t Page::mLoadEntryTable(bool fromSummary)
 {
     // for states where we actually care about data in the page, read entry state table
-    if (mState == PageState::ACTIVE ||
+    if (!fromSummary && (mState == PageState::ACTIVE ||
             mState == PageState::FULL ||
-            mState == PageState::FREEING) {
+            mState == PageState::FREEING)) {
         auto rc = spi_flash_read(mBaseAddress + ENTRY_TABLE_OFFSET, mEntryTable.data(),
                                  mEntryTable.byteSize());
         if (rc != ESP_OK) {
@@ -540,6 +799,15 @@ esp_err_t Page::mLoadEntryTable()
         }
     }
 
+    // allocate the hash table once for the items of the page, instead of growing it
+    if (!fromSummary && mUsedEntryCount > 0) {
+        auto err = mHashList.reserve(mUsedEntryCount);
+        if (err != ESP_OK) {
+            mState = PageState::INVALID;
+            return err;
+        }
+    }
+
     // for PageState::ACTIVE, we may have more data written to this page
     // as such, we need to figure out where the first unused entry is
     if (mState == PageState::ACTIVE) {
@@ -563,6 +831,31 @@ esp_err_t Page::mLoadEntryTable()
                 return rc;
             }
             if (header != 0xffffffff) {
+                // a transaction which wasn't committed is erased as a whole, as the first words
+                // of its entries may be left erased
+                Item marker;
+                rc = readEntry(mNextFreeEntry, marker);
+                if (rc != ESP_OK) {
+                    mState = PageState::INVALID;
+                    return rc;
+                }
+                if (marker.crc32 == marker.calculateCrc32() && isTransactionMarker(marker)) {
+                    size_t end = transactionEnd(mNextFreeEntry, marker);
+                    for (size_t i = mNextFreeEntry; i < end; ++i) {
+                        if (mEntryTable.get(i) == EntryState::WRITTEN) {
+                            --mUsedEntryCount;
+                        }
+                        ++mErasedEntryCount;
+                    }
+                    auto err = alterEntryRangeState(mNextFreeEntry, end, EntryState::ERASED);
+                    if (err != ESP_OK) {
+                        mState = PageState::INVALID;
+                        return err;
+                    }
+                    mNextFreeEntry = end;
+                    continue;
+                }
+
                 auto oldState = mEntryTable.get(mNextFreeEntry);
                 auto err = alterEntryState(mNextFreeEntry, EntryState::ERASED);
                 if (err != ESP_OK) {
@@ -580,6 +873,11 @@ esp_err_t Page::mLoadEntryTable()
             }
         }
 
+        // the items were checked and hashed before the summary was saved
+        if (fromSummary) {
+            return ESP_OK;
+        }
+
         // check that all variable-length items are written or erased fully
         Item item;
         size_t lastItemIndex = INVALID_ENTRY;
@@ -612,6 +910,14 @@ esp_err_t Page::mLoadEntryTable()
                 continue;
             }
 
+            // the page manager erases the values replaced by a transaction which wasn't finished
+            if (isTransactionMarker(item)) {
+                mTransactionIndex = i;
+                mTransactionEnd = transactionEnd(i, item);
+                lastItemIndex = INVALID_ENTRY;
+                continue;
+            }
+
             err = mHashList.insert(item, i);
             if (err != ESP_OK) {
                 mState = PageState::INVALID;
@@ -660,7 +966,7 @@ esp_err_t Page::mLoadEntryTable()
                 }
             }
         }
-    } else if (mState == PageState::FULL || mState == PageState::FREEING) {
+    } else if (!fromSummary && (mState == PageState::FULL || mState == PageState::FREEING)) {
         // We have already filled mHashList for page in active state.
         // Do the same for the case when page is in full or freeing state.
         Item item;
@@ -686,6 +992,12 @@ esp_err_t Page::mLoadEntryTable()
 
             assert(item.span > 0);
 
+            if (isTransactionMarker(item)) {
+                mTransactionIndex = i;
+                mTransactionEnd = transactionEnd(i, item);
+                continue;
+            }
+
             err = mHashList.insert(item, i);
             if (err != ESP_OK) {
                 mState = PageState::INVALID;
@@ -834,17 +1146,16 @@ esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, si
 
         auto rc = readEntry(i, item);
         if (rc != ESP_OK) {
-            mState = PageState::INVALID;
             return rc;
         }
 
+        // readers may search the page together, a broken entry is erased by the next load or page copy
         auto crc32 = item.calculateCrc32();
         if (item.crc32 != crc32) {
-            rc = eraseEntryAndSpan(i);
-            if (rc != ESP_OK) {
-                mState = PageState::INVALID;
-                return rc;
-            }
+            continue;
+        }
+
+        if (isTransactionMarker(item)) {
             continue;
         }
 
@@ -935,6 +1246,8 @@ esp_err_t Page::erase()
     mErasedEntryCount = 0;
     mFirstUsedEntry = INVALID_ENTRY;
     mNextFreeEntry = INVALID_ENTRY;
+    mTransactionIndex = INVALID_ENTRY;
+    mTransactionEnd = INVALID_ENTRY;
     mState = PageState::UNINITIALIZED;
     mHashList.clear();
     return ESP_OK;
@@ -956,6 +1269,16 @@ esp_err_t Page::markFull()
     return alterPageState(PageState::FULL);
 }
 
+size_t Page::getFreeEntryCount() const
+{
+    if (mState == PageState::UNINITIALIZED) {
+        return ENTRY_COUNT;
+    } else if (mState != PageState::ACTIVE || mNextFreeEntry > ENTRY_COUNT) {
+        return 0;
+    }
+    return ENTRY_COUNT - mNextFreeEntry;
+}
+
 size_t Page::getVarDataTailroom() const
 {
     if (mState == PageState::UNINITIALIZED) {
@@ -24,6 +24,7 @@
 #include "compressed_enum_table.hpp"
 #include "intrusive_list.h"
 #include "nvs_item_hash_list.hpp"
+#include "nvs_transaction.hpp"
 
 namespace nvs
 {
@@ -82,7 +83,9 @@ public:
         return mState;
     }
 
-    esp_err_t load(uint32_t sectorNumber);
+    /* If a summary saved by saveSummary() is given and the page on flash still matches it,
+     * the entries are not read and 'summaryUsed' is set */
+    esp_err_t load(uint32_t sectorNumber, const uint32_t* summary = nullptr, bool* summaryUsed = nullptr);
 
     esp_err_t getSeqNumber(uint32_t& seqNumber) const;
 
@@ -92,12 +95,41 @@ public:
 
     esp_err_t writeItem(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY);
 
+    /* Write all items of the transaction to consecutive entries after a marker entry, which holds their
+     * number. The items are marked as written first, the marker last, which commits them. */
+    esp_err_t writeItems(uint8_t nsIndex, Transaction& transaction);
+
+    /* Erase the marker of the last transaction once the values it replaced are erased */
+    esp_err_t finishTransaction();
+
+    /* Entry of the marker of a committed transaction which was not finished, or INVALID_ENTRY.
+     * Its items take the entries up to getTransactionEnd(). */
+    size_t getTransactionIndex() const
+    {
+        return mTransactionIndex;
+    }
+
+    size_t getTransactionEnd() const
+    {
+        return mTransactionEnd;
+    }
+
+    static bool isTransactionMarker(const Item& item)
+    {
+        // the namespace index only holds U8 items
+        return item.nsIndex == NS_INDEX && item.datatype == ItemType::U32;
+    }
+
+    /* readItem and findItem don't modify the page, so several readers may use it at once */
     esp_err_t readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
     esp_err_t cmpItem(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
     esp_err_t eraseItem(uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
+    /* Erase the items starting at the given entries, each modified word of the entry state table is written once */
+    esp_err_t eraseItems(const size_t* indices, size_t count);
+
     esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
     esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, size_t &itemIndex, Item& item, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
@@ -137,6 +169,8 @@ public:
     }
     size_t getVarDataTailroom() const ;
 
+    size_t getFreeEntryCount() const;
+
     esp_err_t markFull();
 
     esp_err_t markFreeing();
@@ -145,6 +179,19 @@ public:
 
     esp_err_t erase();
 
+    size_t getSummarySize() const
+    {
+        return SUMMARY_HEADER_SIZE + mHashList.getCount();
+    }
+
+    /* Returns the end of the stored summary */
+    uint32_t* saveSummary(uint32_t* dst) const;
+
+    static size_t getSummarySize(const uint32_t* summary)
+    {
+        return SUMMARY_HEADER_SIZE + summary[SUMMARY_ITEM_COUNT];
+    }
+
     void debugDump() const;
 
     esp_err_t calcEntries(nvs_stats_t &nvsStats);
@@ -175,7 +222,9 @@ protected:
         INVALID = 0x4 // entry is in inconsistent state (write started but ESB_WRITTEN has not been set yet)
     };
 
-    esp_err_t mLoadEntryTable();
+    esp_err_t mLoadEntryTable(bool fromSummary = false);
+
+    esp_err_t loadSummary(Header& header, const uint32_t* summary, bool& matches);
 
     esp_err_t initialize();
 
@@ -193,6 +242,9 @@ protected:
 
     esp_err_t eraseEntryAndSpan(size_t index);
 
+    /* Returns the end of the entries of the transaction which starts with the given marker */
+    static size_t transactionEnd(size_t index, Item& marker);
+
     void updateFirstUsedEntry(size_t index, size_t span);
 
     static constexpr size_t getAlignmentForType(ItemType type)
@@ -220,9 +272,18 @@ protected:
     size_t mFirstUsedEntry = INVALID_ENTRY;
     uint16_t mUsedEntryCount = 0;
     uint16_t mErasedEntryCount = 0;
+    size_t mTransactionIndex = INVALID_ENTRY;
+    size_t mTransactionEnd = INVALID_ENTRY;
 
     HashList mHashList;
 
+    // summary of a page: state, sequence number, crc of the entry state table, count of hash list nodes, nodes
+    static const size_t SUMMARY_STATE = 0;
+    static const size_t SUMMARY_SEQ = 1;
+    static const size_t SUMMARY_TABLE_CRC = 2;
+    static const size_t SUMMARY_ITEM_COUNT = 3;
+    static const size_t SUMMARY_HEADER_SIZE = 4;
+
     static const uint32_t HEADER_OFFSET = 0;
     static const uint32_t ENTRY_TABLE_OFFSET = HEADER_OFFSET + 32;
     static const uint32_t ENTRY_DATA_OFFSET = ENTRY_TABLE_OFFSET + 32;
@@ -230,6 +291,7 @@ protected:
     static_assert(sizeof(Header) == 32, "header size must be 32 bytes");
     static_assert(ENTRY_TABLE_OFFSET % 32 == 0, "entry table offset should be aligned");
     static_assert(ENTRY_DATA_OFFSET % 32 == 0, "entry data offset should be aligned");
+    static_assert(ENTRY_COUNT <= HashList::MAX_ITEMS, "hash list should have room for all entries");
 
 }; // class Page
 
@@ -15,21 +15,41 @@
 
 namespace nvs
 {
-esp_err_t PageManager::load(uint32_t baseSector, uint32_t sectorCount)
+esp_err_t PageManager::load(uint32_t baseSector, uint32_t sectorCount, const uint32_t* summary, size_t summarySize)
 {
     mBaseSector = baseSector;
     mPageCount = sectorCount;
     mPageList.clear();
     mFreePageList.clear();
+    // built by the storage once the pages are loaded
+    mItemIndex.clear();
     mPages.reset(new (std::nothrow) Page[sectorCount]);
 
     if (!mPages) return ESP_ERR_NO_MEM;
 
+    // the summary holds the page count followed by the summaries of all pages and the item index
+    const uint32_t* summaryEnd = summary + summarySize;
+    if (summary && (summarySize == 0 || summary[0] != sectorCount)) {
+        summary = nullptr;
+    }
+    const uint32_t* pageSummary = summary ? summary + 1 : nullptr;
+    mLoadedFromSummary = (summary != nullptr);
+
     for (uint32_t i = 0; i < sectorCount; ++i) {
-        auto err = mPages[i].load(baseSector + i);
+        const uint32_t* current = pageSummary;
+        if (pageSummary) {
+            if (summaryEnd - pageSummary < static_cast<ptrdiff_t>(Page::getSummarySize(pageSummary))) {
+                current = pageSummary = nullptr;
+            } else {
+                pageSummary += Page::getSummarySize(pageSummary);
+            }
+        }
+        bool summaryUsed = false;
+        auto err = mPages[i].load(baseSector + i, current, &summaryUsed);
         if (err != ESP_OK) {
             return err;
         }
+        mLoadedFromSummary = mLoadedFromSummary && summaryUsed;
         uint32_t seqNumber;
         if (mPages[i].getSeqNumber(seqNumber) != ESP_OK) {
             mFreePageList.push_back(&mPages[i]);
@@ -55,6 +75,15 @@ esp_err_t PageManager::load(uint32_t baseSector, uint32_t sectorCount)
         mSeqNumber = lastSeqNo + 1;
     }
 
+    if (mLoadedFromSummary) {
+        // the summary was saved while no write was in progress, so there is nothing to recover
+        if (mItemIndex.restore(pageSummary, summaryEnd - pageSummary, mPages.get(), sectorCount)) {
+            return (mFreePageList.size() == 0) ? ESP_ERR_NVS_NO_FREE_PAGES : ESP_OK;
+        }
+        mItemIndex.clear();
+        mLoadedFromSummary = false;
+    }
+
     // if power went out after a new item for the given key was written,
     // but before the old one was erased, we end up with a duplicate item
     Page& lastPage = back();
@@ -90,6 +119,13 @@ esp_err_t PageManager::load(uint32_t baseSector, uint32_t sectorCount)
         }
     }
 
+    // the same applies to the items of a transaction, the marker of the last one is only erased
+    // after the values it replaced
+    auto err = finishTransactions();
+    if (err != ESP_OK) {
+        return err;
+    }
+
     // check if power went out while page was being freed
     for (auto it = begin(); it!= end(); ++it) {
         if (it->state() == Page::PageState::FREEING) {
@@ -133,12 +169,108 @@ esp_err_t PageManager::load(uint32_t baseSector, uint32_t sectorCount)
     return ESP_OK;
 }
 
+bool PageManager::canSaveSummary() const
+{
+    for (uint32_t i = 0; i < mPageCount; ++i) {
+        auto state = mPages[i].state();
+        if (state != Page::PageState::UNINITIALIZED && state != Page::PageState::ACTIVE &&
+                state != Page::PageState::FULL) {
+            return false;
+        }
+        // the replaced values of an unfinished transaction are only erased by a full scan
+        if (mPages[i].getTransactionIndex() != Page::INVALID_ENTRY) {
+            return false;
+        }
+    }
+    return mItemIndex.isEnabled();
+}
+
+size_t PageManager::getSummarySize() const
+{
+    size_t size = 1;
+    for (uint32_t i = 0; i < mPageCount; ++i) {
+        size += mPages[i].getSummarySize();
+    }
+    return size + mItemIndex.getSummarySize();
+}
+
+uint32_t* PageManager::saveSummary(uint32_t* dst) const
+{
+    *dst++ = mPageCount;
+    for (uint32_t i = 0; i < mPageCount; ++i) {
+        dst = mPages[i].saveSummary(dst);
+    }
+    return mItemIndex.save(dst, mPages.get());
+}
+
+esp_err_t PageManager::finishTransaction(TPageListIterator page)
+{
+    // a page which failed to write may still hold a replaced value on flash, the marker is kept
+    // and the next load finishes the transaction
+    for (auto it = begin(); ; ++it) {
+        if (it->state() == Page::PageState::INVALID) {
+            return ESP_ERR_NVS_INVALID_STATE;
+        }
+        if (it == page) {
+            break;
+        }
+    }
+
+    Item item;
+    size_t itemIndex = page->getTransactionIndex() + 1;
+    while (page->findItem(Page::NS_ANY, ItemType::ANY, nullptr, itemIndex, item) == ESP_OK &&
+            itemIndex < page->getTransactionEnd()) {
+        // an older value is either on the same page, before the transaction, or on an older page
+        size_t oldIndex = 0;
+        Item oldItem;
+        if (page->findItem(item.nsIndex, item.datatype, item.key, oldIndex, oldItem) == ESP_OK &&
+                oldIndex < page->getTransactionIndex()) {
+            auto err = page->eraseItems(&oldIndex, 1);
+            if (err != ESP_OK) {
+                return err;
+            }
+        } else {
+            for (auto it = begin(); it != page; ++it) {
+                if (it->state() == Page::PageState::FREEING) {
+                    continue;
+                }
+                auto err = it->eraseItem(item.nsIndex, item.datatype, item.key);
+                if (err == ESP_OK) {
+                    break;
+                }
+                if (err != ESP_ERR_NVS_NOT_FOUND) {
+                    return err;
+                }
+            }
+        }
+        itemIndex += item.span;
+    }
+    return page->finishTransaction();
+}
+
+esp_err_t PageManager::finishTransactions()
+{
+    for (auto it = begin(); it != end(); ++it) {
+        if (it->getTransactionIndex() != Page::INVALID_ENTRY) {
+            auto err = finishTransaction(it);
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+    }
+    return ESP_OK;
+}
+
 esp_err_t PageManager::requestNewPage()
 {
     if (mFreePageList.empty()) {
         return ESP_ERR_NVS_INVALID_STATE;
     }
 
+    // the marker of a transaction which was not finished is not copied with the items of its page,
+    // so the page is not freed until the transaction is finished, at the latest by the next load
+    finishTransactions();
+
     // do we have at least two free pages? in that case no erasing is required
     if (mFreePageList.size() >= 2) {
         return activatePage();
@@ -148,6 +280,9 @@ esp_err_t PageManager::requestNewPage()
     TPageListIterator maxUnusedItemsPageIt;
     size_t maxUnusedItems = 0;
     for (auto it = begin(); it != end(); ++it) {
+        if (it->getTransactionIndex() != Page::INVALID_ENTRY) {
+            continue;
+        }
 
         auto unused =  Page::ENTRY_COUNT - it->getUsedEntryCount();
         if (unused > maxUnusedItems) {
@@ -180,6 +315,7 @@ esp_err_t PageManager::requestNewPage()
     if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
         return err;
     }
+    mItemIndex.movePage(erasedPage, newPage);
 
     err = erasedPage->erase();
     if (err != ESP_OK) {
@@ -19,6 +19,7 @@
 #include "nvs_types.hpp"
 #include "nvs_page.hpp"
 #include "nvs_pagemanager.hpp"
+#include "nvs_item_index.hpp"
 #include "intrusive_list.h"
 
 namespace nvs
@@ -31,7 +32,22 @@ public:
 
     PageManager() {}
 
-    esp_err_t load(uint32_t baseSector, uint32_t sectorCount);
+    /* The pages and the item index are taken from the summary saved by saveSummary() if
+     * the partition still matches it, see isLoadedFromSummary() */
+    esp_err_t load(uint32_t baseSector, uint32_t sectorCount, const uint32_t* summary = nullptr, size_t summarySize = 0);
+
+    bool isLoadedFromSummary() const
+    {
+        return mLoadedFromSummary;
+    }
+
+    /* A summary can be saved when no page is being freed or was found to be corrupt */
+    bool canSaveSummary() const;
+
+    size_t getSummarySize() const;
+
+    /* Returns the end of the stored summary */
+    uint32_t* saveSummary(uint32_t* dst) const;
 
     TPageListIterator begin()
     {
@@ -54,6 +70,10 @@ public:
 
     esp_err_t requestNewPage();
 
+    /* Finish the committed transactions whose replaced values could not be erased yet, which
+     * keeps their markers until then */
+    esp_err_t finishTransactions();
+
     esp_err_t fillStats(nvs_stats_t& nvsStats);
 
     uint32_t getBaseSector()
@@ -61,17 +81,27 @@ public:
         return mBaseSector;
     }
 
+    ItemIndex& getItemIndex()
+    {
+        return mItemIndex;
+    }
+
 protected:
     friend class Iterator;
 
     esp_err_t activatePage();
 
+    /* Erase the values replaced by the committed transaction of the page, then its marker */
+    esp_err_t finishTransaction(TPageListIterator page);
+
     TPageList mPageList;
     TPageList mFreePageList;
     std::unique_ptr<Page[]> mPages;
     uint32_t mBaseSector;
     uint32_t mPageCount;
     uint32_t mSeqNumber;
+    bool mLoadedFromSummary = false;
+    ItemIndex mItemIndex;
 }; // class PageManager
 
 
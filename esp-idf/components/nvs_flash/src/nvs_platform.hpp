@@ -14,6 +14,7 @@
 #ifndef nvs_platform_h
 #define nvs_platform_h
 
+#include "esp_err.h"
 
 #ifdef ESP_PLATFORM
 #include "freertos/FreeRTOS.h"
@@ -61,9 +62,115 @@ public:
 
     static SemaphoreHandle_t mSemaphore;
 };
+
+/**
+ * Lock which is either held by any number of readers or by one writer.
+ *
+ * A waiting writer keeps new readers out, so a stream of reads can't starve it.
+ * Until init() is called, the lock does nothing.
+ */
+class RwLock
+{
+public:
+    RwLock() {}
+
+    ~RwLock()
+    {
+        uninit();
+    }
+
+    esp_err_t init()
+    {
+        if (mRoomEmpty) {
+            return ESP_OK;
+        }
+        mTurnstile = xSemaphoreCreateMutex();
+        mReadersMutex = xSemaphoreCreateMutex();
+        // taken by the first reader and given by the last one, which may be another task
+        mRoomEmpty = xSemaphoreCreateBinary();
+        if (!mTurnstile || !mReadersMutex || !mRoomEmpty) {
+            uninit();
+            return ESP_ERR_NO_MEM;
+        }
+        xSemaphoreGive(mRoomEmpty);
+        return ESP_OK;
+    }
+
+    void uninit()
+    {
+        if (mTurnstile) {
+            vSemaphoreDelete(mTurnstile);
+        }
+        if (mReadersMutex) {
+            vSemaphoreDelete(mReadersMutex);
+        }
+        if (mRoomEmpty) {
+            vSemaphoreDelete(mRoomEmpty);
+        }
+        mTurnstile = nullptr;
+        mReadersMutex = nullptr;
+        mRoomEmpty = nullptr;
+    }
+
+    void lockShared()
+    {
+        if (!mRoomEmpty) {
+            return;
+        }
+        xSemaphoreTake(mTurnstile, portMAX_DELAY);
+        xSemaphoreGive(mTurnstile);
+        xSemaphoreTake(mReadersMutex, portMAX_DELAY);
+        if (mReaders++ == 0) {
+            xSemaphoreTake(mRoomEmpty, portMAX_DELAY);
+        }
+        xSemaphoreGive(mReadersMutex);
+    }
+
+    void unlockShared()
+    {
+        if (!mRoomEmpty) {
+            return;
+        }
+        xSemaphoreTake(mReadersMutex, portMAX_DELAY);
+        if (--mReaders == 0) {
+            xSemaphoreGive(mRoomEmpty);
+        }
+        xSemaphoreGive(mReadersMutex);
+    }
+
+    void lock()
+    {
+        if (!mRoomEmpty) {
+            return;
+        }
+        xSemaphoreTake(mTurnstile, portMAX_DELAY);
+        xSemaphoreTake(mRoomEmpty, portMAX_DELAY);
+    }
+
+    void unlock()
+    {
+        if (!mRoomEmpty) {
+            return;
+        }
+        xSemaphoreGive(mRoomEmpty);
+        xSemaphoreGive(mTurnstile);
+    }
+
+protected:
+    RwLock(const RwLock&);
+    const RwLock& operator= (const RwLock&);
+
+    SemaphoreHandle_t mTurnstile = nullptr;
+    SemaphoreHandle_t mReadersMutex = nullptr;
+    SemaphoreHandle_t mRoomEmpty = nullptr;
+    size_t mReaders = 0;
+};
 } // namespace nvs
 
 #else // ESP_PLATFORM
+#include <mutex>
+#include <condition_variable>
+
 namespace nvs
 {
 class Lock
@@ -74,8 +181,105 @@ public:
     static void init() {}
     static void uninit() {}
 };
+
+/**
+ * Host version of the lock, so tests can use it from several threads.
+ *
+ * A waiting writer keeps new readers out, as on the target.
+ */
+class RwLock
+{
+public:
+    RwLock() {}
+
+    esp_err_t init()
+    {
+        return ESP_OK;
+    }
+
+    void uninit() {}
+
+    void lockShared()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCondition.wait(lock, [this] { return !mWriting && mWritersWaiting == 0; });
+        ++mReaders;
+    }
+
+    void unlockShared()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (--mReaders == 0) {
+            mCondition.notify_all();
+        }
+    }
+
+    void lock()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        ++mWritersWaiting;
+        mCondition.wait(lock, [this] { return !mWriting && mReaders == 0; });
+        --mWritersWaiting;
+        mWriting = true;
+    }
+
+    void unlock()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mWriting = false;
+        mCondition.notify_all();
+    }
+
+protected:
+    RwLock(const RwLock&);
+    const RwLock& operator= (const RwLock&);
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    size_t mReaders = 0;
+    size_t mWritersWaiting = 0;
+    bool mWriting = false;
+};
 } // namespace nvs
 #endif // ESP_PLATFORM
 
+namespace nvs
+{
+
+class ReadLock
+{
+public:
+    ReadLock(RwLock& lock) : mLock(lock)
+    {
+        mLock.lockShared();
+    }
+
+    ~ReadLock()
+    {
+        mLock.unlockShared();
+    }
+
+protected:
+    RwLock& mLock;
+};
+
+class WriteLock
+{
+public:
+    WriteLock(RwLock& lock) : mLock(lock)
+    {
+        mLock.lock();
+    }
+
+    ~WriteLock()
+    {
+        mLock.unlock();
+    }
+
+protected:
+    RwLock& mLock;
+};
+} // namespace nvs
+
 
 #endif /* nvs_platform_h */
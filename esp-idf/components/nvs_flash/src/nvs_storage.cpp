@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include "nvs_storage.hpp"
+#include <algorithm>
 
 #ifndef ESP_PLATFORM
 #include <map>
@@ -81,29 +82,65 @@ void Storage::eraseOrphanDataBlobs(TBlobIndexList& blobIdxList)
                             && (item.chunkIndex >=  static_cast<uint8_t> (e.chunkStart))
                             && (item.chunkIndex < static_cast<uint8_t> (e.chunkStart) + e.chunkCount);});
             if (iter == std::end(blobIdxList)) {
-                p.eraseItem(item.nsIndex, item.datatype, item.key, item.chunkIndex);
+                if (p.eraseItem(item.nsIndex, item.datatype, item.key, item.chunkIndex) == ESP_OK) {
+                    removeFromIndex(item.nsIndex, item.key, p);
+                }
             }
             itemIndex += item.span;
         }
     }
 }
 
-esp_err_t Storage::init(uint32_t baseSector, uint32_t sectorCount)
+esp_err_t Storage::init(uint32_t baseSector, uint32_t sectorCount, MountSummary* summary)
 {
-    auto err = mPageManager.load(baseSector, sectorCount);
+    const uint32_t* summaryData = nullptr;
+    size_t summarySize = 0;
+    mSummary = summary;
+    mPendingChanges = 0;
+    // partitions are initialized while no other partition is used, so the summary isn't locked here
+    if (mSummary) {
+        summaryData = mSummary->find(baseSector, sectorCount, summarySize);
+    }
+
+    auto err = mPageManager.load(baseSector, sectorCount, summaryData, summarySize);
     if (err != ESP_OK) {
         mState = StorageState::INVALID;
         return err;
     }
 
-    // load namespaces list
     clearNamespaces();
     std::fill_n(mNamespaceUsage.data(), mNamespaceUsage.byteSize() / 4, 0);
+    if (mPageManager.isLoadedFromSummary()) {
+        // the namespaces follow the summary of the page manager
+        size_t pagesSize = mPageManager.getSummarySize();
+        if (loadNamespaces(summaryData + pagesSize, summarySize - pagesSize)) {
+            mNamespaceUsage.set(0, true);
+            mNamespaceUsage.set(255, true);
+            mState = StorageState::ACTIVE;
+            mSummaryDirty = false;
+#ifndef ESP_PLATFORM
+            debugCheck();
+#endif
+            return ESP_OK;
+        }
+        clearNamespaces();
+        std::fill_n(mNamespaceUsage.data(), mNamespaceUsage.byteSize() / 4, 0);
+        mPageManager.getItemIndex().clear();
+    }
+
+    // load namespaces list and index all items
+    reserveItemIndex();
     for (auto it = mPageManager.begin(); it != mPageManager.end(); ++it) {
         Page& p = *it;
         size_t itemIndex = 0;
         Item item;
-        while (p.findItem(Page::NS_INDEX, ItemType::U8, nullptr, itemIndex, item) == ESP_OK) {
+        while (p.findItem(Page::NS_ANY, ItemType::ANY, nullptr, itemIndex, item) == ESP_OK) {
+            addToIndex(item.nsIndex, item.key, p);
+            if (item.nsIndex != Page::NS_INDEX || item.datatype != ItemType::U8) {
+                itemIndex += item.span;
+                continue;
+            }
+
             NamespaceEntry* entry = new (std::nothrow) NamespaceEntry;
 
             if (!entry) {
@@ -136,6 +173,12 @@ esp_err_t Storage::init(uint32_t baseSector, uint32_t sectorCount)
     // Purge the blob index list
     blobIdxList.clearAndFreeNodes();
 
+    if (mSummary) {
+        mSummary->remove(baseSector);
+        mSummaryDirty = true;
+        saveSummary();
+    }
+
 #ifndef ESP_PLATFORM
     debugCheck();
 #endif
@@ -147,13 +190,113 @@ bool Storage::isValid() const
     return mState == StorageState::ACTIVE;
 }
 
-esp_err_t Storage::findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx, VerOffset chunkStart)
+bool Storage::loadNamespaces(const uint32_t* summary, size_t size)
 {
-    for (auto it = std::begin(mPageManager); it != std::end(mPageManager); ++it) {
+    if (size < 1 || (size - 1) / NAMESPACE_SUMMARY_SIZE < summary[0]) {
+        return false;
+    }
+    const uint32_t* ns = summary + 1;
+    for (size_t i = 0; i < summary[0]; ++i, ns += NAMESPACE_SUMMARY_SIZE) {
+        NamespaceEntry* entry = new (std::nothrow) NamespaceEntry;
+        if (!entry) {
+            return false;
+        }
+        memcpy(entry->mName, ns, sizeof(entry->mName));
+        entry->mName[sizeof(entry->mName) - 1] = 0;
+        entry->mIndex = static_cast<uint8_t>(ns[NAMESPACE_SUMMARY_SIZE - 1]);
+        mNamespaces.push_back(entry);
+        mNamespaceUsage.set(entry->mIndex, true);
+    }
+    return true;
+}
+
+void Storage::saveSummary()
+{
+    if (!mSummary || !mSummaryDirty || mPendingChanges != 0 || mState != StorageState::ACTIVE ||
+            !mPageManager.canSaveSummary()) {
+        return;
+    }
+    size_t size = mPageManager.getSummarySize() + 1 + mNamespaces.size() * NAMESPACE_SUMMARY_SIZE;
+    Lock lock;
+    uint32_t* summary = mSummary->reserve(getBaseSector(), mPageManager.getPageCount(), size);
+    if (!summary) {
+        // no room left, the partition will be scanned at the next mount
+        return;
+    }
+    uint32_t* dst = mPageManager.saveSummary(summary);
+    *dst++ = static_cast<uint32_t>(mNamespaces.size());
+    for (auto it = mNamespaces.begin(); it != mNamespaces.end(); ++it) {
+        std::fill_n(dst, NAMESPACE_SUMMARY_SIZE, 0);
+        memcpy(dst, it->mName, sizeof(it->mName));
+        dst[NAMESPACE_SUMMARY_SIZE - 1] = it->mIndex;
+        dst += NAMESPACE_SUMMARY_SIZE;
+    }
+    mSummary->seal(summary);
+    mSummaryDirty = false;
+}
+
+void Storage::reserveItemIndex()
+{
+    // every item takes at least one entry, so the used entries bound the number of records
+    size_t usedEntries = 0;
+    for (auto it = mPageManager.begin(); it != mPageManager.end(); ++it) {
+        usedEntries += it->getUsedEntryCount();
+    }
+    mPageManager.getItemIndex().reserve(usedEntries);
+}
+
+void Storage::rebuildItemIndex()
+{
+    ItemIndex& index = mPageManager.getItemIndex();
+    index.clear();
+    reserveItemIndex();
+    for (auto it = mPageManager.begin(); it != mPageManager.end(); ++it) {
+        Page& p = *it;
         size_t itemIndex = 0;
-        auto err = it->findItem(nsIndex, datatype, key, itemIndex, item, chunkIdx, chunkStart);
+        Item item;
+        while (p.findItem(Page::NS_ANY, ItemType::ANY, nullptr, itemIndex, item) == ESP_OK) {
+            addToIndex(item.nsIndex, item.key, p);
+            itemIndex += item.span;
+        }
+    }
+}
+
+esp_err_t Storage::findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx, VerOffset chunkStart, size_t* itemIndex)
+{
+    if (key != nullptr && nsIndex != Page::NS_ANY) {
+        Page* pages[INDEXED_PAGES_MAX];
+        size_t count = mPageManager.getItemIndex().find(ItemIndex::hash(nsIndex, key), pages, INDEXED_PAGES_MAX);
+        if (count <= INDEXED_PAGES_MAX) {
+            // only the listed pages can hold the key, search them in the page list order
+            std::sort(pages, pages + count, [](const Page* a, const Page* b) -> bool {
+                uint32_t seqA = UINT32_MAX, seqB = UINT32_MAX;
+                a->getSeqNumber(seqA);
+                b->getSeqNumber(seqB);
+                return seqA < seqB;
+            });
+            for (size_t i = 0; i < count; ++i) {
+                size_t index = 0;
+                auto err = pages[i]->findItem(nsIndex, datatype, key, index, item, chunkIdx, chunkStart);
+                if (err == ESP_OK) {
+                    page = pages[i];
+                    if (itemIndex) {
+                        *itemIndex = index;
+                    }
+                    return ESP_OK;
+                }
+            }
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+    }
+
+    for (auto it = std::begin(mPageManager); it != std::end(mPageManager); ++it) {
+        size_t index = 0;
+        auto err = it->findItem(nsIndex, datatype, key, index, item, chunkIdx, chunkStart);
         if (err == ESP_OK) {
             page = it;
+            if (itemIndex) {
+                *itemIndex = index;
+            }
             return ESP_OK;
         }
     }
@@ -217,6 +360,7 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
         if (err != ESP_OK) {
             break;
         } else {
+            addToIndex(nsIndex, key, page);
             UsedPageNode* node = new (std::nothrow) UsedPageNode();
             if (!node) {
                 err = ESP_ERR_NO_MEM;
@@ -248,6 +392,9 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
 
             err = getCurrentPage().writeItem(nsIndex, ItemType::BLOB_IDX, key, item.data, sizeof(item.data));
             assert(err != ESP_ERR_NVS_PAGE_FULL);
+            if (err == ESP_OK) {
+                addToIndex(nsIndex, key, getCurrentPage());
+            }
             break;
         }
     } while (1);
@@ -256,7 +403,9 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
         /* Anything failed, then we should erase all the written chunks*/
         int ii=0;
         for (auto it = std::begin(usedPages); it != std::end(usedPages); it++) {
-            it->mPage->eraseItem(nsIndex, ItemType::BLOB_DATA, key, ii++);
+            if (it->mPage->eraseItem(nsIndex, ItemType::BLOB_DATA, key, ii++) == ESP_OK) {
+                removeFromIndex(nsIndex, key, *it->mPage);
+            }
         }
     }
     usedPages.clearAndFreeNodes();
@@ -306,6 +455,7 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
             nextStart
                 = (prevStart == VerOffset::VER_1_OFFSET) ? VerOffset::VER_0_OFFSET : VerOffset::VER_1_OFFSET;
         }
+        beginChange();
         /* Write the blob with new version*/
         err = writeMultiPageBlob(nsIndex, key, data, dataSize, nextStart);
 
@@ -344,6 +494,7 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
             return ESP_OK;
         }
 
+        beginChange();
         Page& page = getCurrentPage();
         err = page.writeItem(nsIndex, datatype, key, data, dataSize);
         if (err == ESP_ERR_NVS_PAGE_FULL) {
@@ -368,6 +519,7 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
         } else if (err != ESP_OK) {
             return err;
         }
+        addToIndex(nsIndex, key, getCurrentPage());
     }
 
     if (findPage) {
@@ -382,7 +534,125 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
         if (err != ESP_OK) {
             return err;
         }
+        removeFromIndex(nsIndex, key, *findPage);
     }
+    endChange();
+#ifndef ESP_PLATFORM
+    debugCheck();
+#endif
+    return ESP_OK;
+}
+
+esp_err_t Storage::writeItems(uint8_t nsIndex, Transaction& transaction)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    // values which are already stored are not written again
+    for (auto it = transaction.begin(); it != transaction.end(); ) {
+        auto next = it;
+        ++next;
+        Page* findPage = nullptr;
+        Item item;
+        if (findItem(nsIndex, it->mDatatype, it->mKey, findPage, item) == ESP_OK &&
+                findPage->cmpItem(nsIndex, it->mDatatype, it->mKey, it->mData, it->mDataSize) == ESP_OK) {
+            transaction.remove(it);
+        }
+        it = next;
+    }
+    const size_t itemCount = transaction.getItemCount();
+    if (itemCount == 0) {
+        return ESP_OK;
+    }
+
+    esp_err_t err;
+    beginChange();
+    // a page tracks one transaction, the previous one is finished if its replaced values couldn't be erased
+    err = mPageManager.finishTransactions();
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (getCurrentPage().getFreeEntryCount() < transaction.getEntryCount()) {
+        Page& page = getCurrentPage();
+        if (page.state() != Page::PageState::FULL) {
+            err = page.markFull();
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        err = mPageManager.requestNewPage();
+        if (err != ESP_OK) {
+            return err;
+        }
+        if (getCurrentPage().getFreeEntryCount() < transaction.getEntryCount()) {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+    }
+
+    // the replaced values are looked up once the page is known, as requesting a page moves items
+    struct ReplacedItem {
+        Page* page;
+        size_t index;
+        const char* key;
+    };
+    std::unique_ptr<ReplacedItem[]> replaced(new (std::nothrow) ReplacedItem[itemCount]);
+    std::unique_ptr<size_t[]> indices(new (std::nothrow) size_t[itemCount]);
+    if (!replaced || !indices) {
+        return ESP_ERR_NO_MEM;
+    }
+    size_t replacedCount = 0;
+    for (auto it = transaction.begin(); it != transaction.end(); ++it) {
+        ReplacedItem& r = replaced[replacedCount];
+        Item item;
+        err = findItem(nsIndex, it->mDatatype, it->mKey, r.page, item, Page::CHUNK_ANY, VerOffset::VER_ANY, &r.index);
+        if (err == ESP_OK) {
+            r.key = it->mKey;
+            ++replacedCount;
+        } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+            return err;
+        }
+    }
+
+    Page& page = getCurrentPage();
+    err = page.writeItems(nsIndex, transaction);
+    if (err == ESP_ERR_NVS_PAGE_FULL) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+    for (auto it = transaction.begin(); it != transaction.end(); ++it) {
+        addToIndex(nsIndex, it->mKey, page);
+    }
+
+    // erase the replaced values of each page together
+    std::sort(replaced.get(), replaced.get() + replacedCount, [](const ReplacedItem& a, const ReplacedItem& b) -> bool {
+        return a.page < b.page;
+    });
+    for (size_t i = 0; i < replacedCount; ++i) {
+        indices[i] = replaced[i].index;
+    }
+    for (size_t begin = 0, end; begin < replacedCount; begin = end) {
+        Page* replacedPage = replaced[begin].page;
+        for (end = begin + 1; end < replacedCount && replaced[end].page == replacedPage; ++end) {
+        }
+        err = replacedPage->eraseItems(&indices[begin], end - begin);
+        if (err == ESP_ERR_FLASH_OP_FAIL) {
+            return ESP_ERR_NVS_REMOVE_FAILED;
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+        for (size_t i = begin; i < end; ++i) {
+            removeFromIndex(nsIndex, replaced[i].key, *replacedPage);
+        }
+    }
+    err = page.finishTransaction();
+    if (err != ESP_OK) {
+        return err;
+    }
+    endChange();
 #ifndef ESP_PLATFORM
     debugCheck();
 #endif
@@ -473,12 +743,39 @@ esp_err_t Storage::readMultiPageBlob(uint8_t nsIndex, const char* key, void* dat
     if (err == ESP_OK) {
         assert(offset == dataSize);
     }
-    if (err == ESP_ERR_NVS_NOT_FOUND) {
-        eraseMultiPageBlob(nsIndex, key); // cleanup if a chunk is not found
-    }
+    // readers don't modify the storage, a blob with a missing chunk is erased by eraseIncompleteMultiPageBlob
     return err;
 }
 
+esp_err_t Storage::eraseIncompleteMultiPageBlob(uint8_t nsIndex, const char* key)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    Item item;
+    Page* findPage = nullptr;
+
+    auto err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    uint8_t chunkCount = item.blobIndex.chunkCount;
+    VerOffset chunkStart = item.blobIndex.chunkStart;
+
+    /* The blob could have been written again since it was read, check all chunks */
+    for (uint8_t chunkNum = 0; chunkNum < chunkCount; chunkNum++) {
+        err = findItem(nsIndex, ItemType::BLOB_DATA, key, findPage, item, static_cast<uint8_t> (chunkStart) + chunkNum);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            return eraseMultiPageBlob(nsIndex, key, chunkStart);
+        }
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
 esp_err_t Storage::cmpMultiPageBlob(uint8_t nsIndex, const char* key, const void* data, size_t dataSize)
 {
     Item item;
@@ -556,11 +853,13 @@ esp_err_t Storage::eraseMultiPageBlob(uint8_t nsIndex, const char* key, VerOffse
     if (err != ESP_OK) {
         return err;
     }
+    beginChange();
     /* Erase the index first and make children blobs orphan*/
     err = findPage->eraseItem(nsIndex, ItemType::BLOB_IDX, key, Page::CHUNK_ANY, chunkStart);
     if (err != ESP_OK) {
         return err;
     }
+    removeFromIndex(nsIndex, key, *findPage);
 
     uint8_t chunkCount = item.blobIndex.chunkCount;
 
@@ -583,9 +882,11 @@ esp_err_t Storage::eraseMultiPageBlob(uint8_t nsIndex, const char* key, VerOffse
         if (err != ESP_OK) {
             return err;
         }
+        removeFromIndex(nsIndex, key, *findPage);
 
     }
 
+    endChange();
     return ESP_OK;
 }
 
@@ -610,7 +911,14 @@ esp_err_t Storage::eraseItem(uint8_t nsIndex, ItemType datatype, const char* key
         return eraseMultiPageBlob(nsIndex, key);
     }
 
-    return findPage->eraseItem(nsIndex, datatype, key);
+    beginChange();
+    err = findPage->eraseItem(nsIndex, datatype, key);
+    if (err != ESP_OK) {
+        return err;
+    }
+    removeFromIndex(nsIndex, key, *findPage);
+    endChange();
+    return ESP_OK;
 }
 
 esp_err_t Storage::eraseNamespace(uint8_t nsIndex)
@@ -619,6 +927,7 @@ esp_err_t Storage::eraseNamespace(uint8_t nsIndex)
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
 
+    beginChange();
     for (auto it = std::begin(mPageManager); it != std::end(mPageManager); ++it) {
         while (true) {
             auto err = it->eraseItem(nsIndex, ItemType::ANY, nullptr);
@@ -630,6 +939,9 @@ esp_err_t Storage::eraseNamespace(uint8_t nsIndex)
             }
         }
     }
+    // the erased keys are not known, the stale records would only slow down the lookups
+    rebuildItemIndex();
+    endChange();
     return ESP_OK;
 
 }
@@ -670,11 +982,13 @@ void Storage::debugDump()
 void Storage::debugCheck()
 {
     std::map<std::string, Page*> keys;
+    ItemIndex& index = mPageManager.getItemIndex();
 
     for (auto p = mPageManager.begin(); p != mPageManager.end(); ++p) {
         size_t itemIndex = 0;
         size_t usedCount = 0;
         Item item;
+        std::map<uint32_t, size_t> pageKeys;
         while (p->findItem(Page::NS_ANY, ItemType::ANY, nullptr, itemIndex, item) == ESP_OK) {
             std::stringstream keyrepr;
             keyrepr << static_cast<unsigned>(item.nsIndex) << "_" << static_cast<unsigned>(item.datatype) << "_" << item.key <<"_"<<static_cast<unsigned>(item.chunkIndex);
@@ -687,8 +1001,19 @@ void Storage::debugCheck()
             keys.insert(std::make_pair(keystr, static_cast<Page*>(p)));
             itemIndex += item.span;
             usedCount += item.span;
+            ++pageKeys[ItemIndex::hash(item.nsIndex, item.key)];
         }
         assert(usedCount == p->getUsedEntryCount());
+        // the index may count more items than the page has, but never less
+        if (index.isEnabled()) {
+            for (auto& k : pageKeys) {
+                if (index.count(k.first, p) < k.second) {
+                    printf("Item index is missing a key on page\n");
+                    debugDump();
+                    assert(0);
+                }
+            }
+        }
     }
 }
 #endif //ESP_PLATFORM
@@ -782,7 +1107,7 @@ bool Storage::nextEntry(nvs_opaque_iterator_t* it)
                 it->page = page;
                 return true;
             }
-        } while (err != ESP_ERR_NVS_NOT_FOUND);
+        } while (err == ESP_OK || err == ESP_ERR_NVS_TYPE_MISMATCH);
 
         it->entryIndex = 0;
     }
@@ -21,6 +21,8 @@
 #include "nvs_types.hpp"
 #include "nvs_page.hpp"
 #include "nvs_pagemanager.hpp"
+#include "nvs_mount_summary.hpp"
+#include "nvs_platform.hpp"
 
 //extern void dumpBytes(const uint8_t* data, size_t count);
 
@@ -58,12 +60,23 @@ class Storage : public intrusive_list_node<Storage>
 
     typedef intrusive_list<BlobIndexNode> TBlobIndexList;
 
+    // max pages holding one key which are searched using the item index
+    static const size_t INDEXED_PAGES_MAX = 8;
+
+    // namespace name and index in the mount summary
+    static const size_t NAMESPACE_SUMMARY_SIZE = (sizeof(NamespaceEntry::mName) + 3) / 4 + 1;
+
 public:
     ~Storage();
 
     Storage(const char *pName = NVS_DEFAULT_PART_NAME) : mPartitionName(pName) { };
 
-    esp_err_t init(uint32_t baseSector, uint32_t sectorCount);
+    /* If a mount summary is given, the partition is mounted from it when the flash still
+     * matches it, and a new one is saved when the partition had to be scanned */
+    esp_err_t init(uint32_t baseSector, uint32_t sectorCount, MountSummary* summary = nullptr);
+
+    /* Save the mount summary if the partition was changed since it was saved */
+    void saveSummary();
 
     bool isValid() const;
 
@@ -77,6 +90,9 @@ public:
 
     esp_err_t eraseItem(uint8_t nsIndex, ItemType datatype, const char* key);
 
+    /* Write the staged items together and erase the values they replace */
+    esp_err_t writeItems(uint8_t nsIndex, Transaction& transaction);
+
     template<typename T>
     esp_err_t writeItem(uint8_t nsIndex, const char* key, const T& value)
     {
@@ -105,6 +121,12 @@ public:
         return mPageManager.getBaseSector();
     }
 
+    /* Held shared by the callers which only read, and exclusively by the ones which write */
+    RwLock& getLock()
+    {
+        return mLock;
+    }
+
     esp_err_t writeMultiPageBlob(uint8_t nsIndex, const char* key, const void* data, size_t dataSize, VerOffset chunkStart);
 
     esp_err_t readMultiPageBlob(uint8_t nsIndex, const char* key, void* data, size_t dataSize);
@@ -113,6 +135,8 @@ public:
 
     esp_err_t eraseMultiPageBlob(uint8_t nsIndex, const char* key, VerOffset chunkStart = VerOffset::VER_ANY);
 
+    esp_err_t eraseIncompleteMultiPageBlob(uint8_t nsIndex, const char* key);
+
     void debugDump();
     
     void debugCheck();
@@ -140,7 +164,42 @@ protected:
 
     void fillEntryInfo(Item &item, nvs_entry_info_t &info);
 
-    esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx = Page::CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
+    void addToIndex(uint8_t nsIndex, const char* key, Page& page)
+    {
+        mPageManager.getItemIndex().add(ItemIndex::hash(nsIndex, key), &page);
+    }
+
+    void removeFromIndex(uint8_t nsIndex, const char* key, const Page& page)
+    {
+        mPageManager.getItemIndex().remove(ItemIndex::hash(nsIndex, key), &page);
+    }
+
+    void reserveItemIndex();
+
+    void rebuildItemIndex();
+
+    bool loadNamespaces(const uint32_t* summary, size_t size);
+
+    /* The mount summary is removed before the partition is written. It is not saved again while a
+     * change is pending: a change which failed part way may leave duplicate items behind, which only
+     * the full scan at mount cleans up. */
+    void beginChange()
+    {
+        if (mSummary && !mSummaryDirty) {
+            // the summaries of all partitions share one buffer
+            Lock lock;
+            mSummary->remove(getBaseSector());
+            mSummaryDirty = true;
+        }
+        ++mPendingChanges;
+    }
+
+    void endChange()
+    {
+        --mPendingChanges;
+    }
+
+    esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx = Page::CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY, size_t* itemIndex = nullptr);
 
 protected:
     const char *mPartitionName;
@@ -149,6 +208,10 @@ protected:
     TNamespaces mNamespaces;
     CompressedEnumTable<bool, 1, 256> mNamespaceUsage;
     StorageState mState = StorageState::INVALID;
+    MountSummary* mSummary = nullptr;
+    bool mSummaryDirty = false;
+    size_t mPendingChanges = 0;
+    RwLock mLock;
 };
 
 } // namespace nvs
@@ -0,0 +1,91 @@
+// Copyright 2015-2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nvs_transaction.hpp"
+#include "nvs_page.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace nvs
+{
+
+Transaction::~Transaction()
+{
+    clear();
+}
+
+void Transaction::clear()
+{
+    mItems.clearAndFreeNodes();
+    mEntryCount = 0;
+}
+
+void Transaction::remove(StagedItem* item)
+{
+    mEntryCount -= item->mSpan;
+    mItems.erase(item);
+    delete item;
+}
+
+esp_err_t Transaction::add(ItemType datatype, const char* key, const void* data, size_t dataSize)
+{
+    if (datatype != ItemType::SZ && isVariableLengthType(datatype)) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    if (strlen(key) > Item::MAX_KEY_LENGTH) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+    if (dataSize > Page::CHUNK_MAX_SIZE) {
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+
+    size_t span = 1;
+    if (isVariableLengthType(datatype)) {
+        span += (dataSize + Page::ENTRY_SIZE - 1) / Page::ENTRY_SIZE;
+    }
+
+    auto it = std::find_if(mItems.begin(), mItems.end(), [=](const StagedItem& e) -> bool {
+        return e.mDatatype == datatype && strncmp(key, e.mKey, sizeof(e.mKey) - 1) == 0;
+    });
+    size_t replacedSpan = (it != mItems.end()) ? it->mSpan : 0;
+    if (mEntryCount - replacedSpan + span + 1 > Page::ENTRY_COUNT) {
+        // the items are written to one page
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    StagedItem* item = new (std::nothrow) StagedItem;
+    if (!item) {
+        return ESP_ERR_NO_MEM;
+    }
+    item->mData = new (std::nothrow) uint8_t[dataSize];
+    if (!item->mData) {
+        delete item;
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(item->mData, data, dataSize);
+    item->mDataSize = dataSize;
+    item->mDatatype = datatype;
+    strncpy(item->mKey, key, sizeof(item->mKey) - 1);
+    item->mKey[sizeof(item->mKey) - 1] = 0;
+    item->mSpan = span;
+
+    if (it != mItems.end()) {
+        remove(it);
+    }
+    mItems.push_back(item);
+    mEntryCount += span;
+    return ESP_OK;
+}
+
+} // namespace nvs
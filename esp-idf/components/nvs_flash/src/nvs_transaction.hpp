@@ -0,0 +1,92 @@
+// Copyright 2015-2019 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef nvs_transaction_hpp
+#define nvs_transaction_hpp
+
+#include "nvs.h"
+#include "nvs_types.hpp"
+#include "intrusive_list.h"
+
+namespace nvs
+{
+
+/**
+ * Items of one namespace which are kept in RAM until they are written to flash together.
+ *
+ * Only fixed size items and strings can be staged; all of them have to fit into one page.
+ * Setting a key again replaces the staged value.
+ */
+class Transaction
+{
+public:
+    struct StagedItem : public intrusive_list_node<StagedItem> {
+    public:
+        ~StagedItem()
+        {
+            delete[] mData;
+        }
+
+        ItemType mDatatype;
+        char mKey[Item::MAX_KEY_LENGTH + 1];
+        uint8_t* mData = nullptr;
+        size_t mDataSize;
+        size_t mSpan;   // number of entries the item takes on a page
+    };
+
+    typedef intrusive_list<StagedItem> TItemList;
+
+    Transaction() {}
+    ~Transaction();
+
+    esp_err_t add(ItemType datatype, const char* key, const void* data, size_t dataSize);
+
+    /* Drop a staged item, e.g. when its value is already stored */
+    void remove(StagedItem* item);
+
+    void clear();
+
+    TItemList::iterator begin()
+    {
+        return mItems.begin();
+    }
+
+    TItemList::iterator end()
+    {
+        return mItems.end();
+    }
+
+    size_t getItemCount() const
+    {
+        return mItems.size();
+    }
+
+    /* Number of entries the transaction takes on a page, with the marker which precedes the items */
+    size_t getEntryCount() const
+    {
+        return mEntryCount + 1;
+    }
+
+private:
+    Transaction(const Transaction& other);
+    const Transaction& operator= (const Transaction& rhs);
+
+protected:
+    TItemList mItems;
+    size_t mEntryCount = 0;     // entries of the staged items
+}; // class Transaction
+
+} // namespace nvs
+
+#endif /* nvs_transaction_hpp */
@@ -27,6 +27,10 @@
 #include <sys/wait.h>
 #include <string.h>
 #include <string>
+#include <chrono>
+#include <vector>
+#include <thread>
+#include <atomic>
 
 #define TEST_ESP_ERR(rc, res) CHECK((rc) == (res))
 #define TEST_ESP_OK(rc) CHECK((rc) == ESP_OK)
@@ -291,13 +295,23 @@ TEST_CASE("Page handles invalid CRC of variable length items", "[nvs][cur]")
 class HashListTestHelper : public HashList
 {
     public:
-        size_t getBlockCount()
+        size_t getItemCount()
         {
-            return mBlockList.size();
+            return mCount;
+        }
+
+        size_t getCapacity()
+        {
+            return mCapacity;
+        }
+
+        const void* getTable()
+        {
+            return mNodes;
         }
 };
 
-TEST_CASE("HashList is cleaned up as soon as items are erased", "[nvs]")
+TEST_CASE("HashList table is freed as soon as the last item is erased", "[nvs]")
 {
     HashListTestHelper hashlist;
     // Add items
@@ -306,27 +320,127 @@ TEST_CASE("HashList is cleaned up as soon as items are erased", "[nvs]")
         char key[16];
         snprintf(key, sizeof(key), "i%ld", (long int)i);
         Item item(1, ItemType::U32, 1, key);
-        hashlist.insert(item, i);
+        TEST_ESP_OK(hashlist.insert(item, i));
     }
-    INFO("Added " << count << " items, " << hashlist.getBlockCount() << " blocks");
+    INFO("Added " << count << " items, " << hashlist.getCapacity() << " slots");
     // Remove them in reverse order
     for (size_t i = count; i > 0; --i) {
+        CHECK(hashlist.getTable() != nullptr);
         hashlist.erase(i - 1, true);
     }
-    CHECK(hashlist.getBlockCount() == 0);
+    CHECK(hashlist.getItemCount() == 0);
+    CHECK(hashlist.getTable() == nullptr);
     // Add again
     for (size_t i = 0; i < count; ++i) {
         char key[16];
         snprintf(key, sizeof(key), "i%ld", (long int)i);
         Item item(1, ItemType::U32, 1, key);
-        hashlist.insert(item, i);
+        TEST_ESP_OK(hashlist.insert(item, i));
     }
-    INFO("Added " << count << " items, " << hashlist.getBlockCount() << " blocks");
+    INFO("Added " << count << " items, " << hashlist.getCapacity() << " slots");
     // Remove them in the same order
     for (size_t i = 0; i < count; ++i) {
         hashlist.erase(i, true);
     }
-    CHECK(hashlist.getBlockCount() == 0);
+    CHECK(hashlist.getItemCount() == 0);
+    CHECK(hashlist.getTable() == nullptr);
+}
+
+TEST_CASE("HashList table is sized for the items of the page", "[nvs]")
+{
+    HashListTestHelper hashlist;
+    char key[16];
+    // a page with a few items takes the smallest table
+    for (size_t i = 0; i < 4; ++i) {
+        snprintf(key, sizeof(key), "i%ld", (long int)i);
+        TEST_ESP_OK(hashlist.insert(Item(1, ItemType::U32, 1, key), i));
+    }
+    CHECK(hashlist.getCapacity() == HashList::MIN_ITEMS * 3 / 2);
+    // the table grows while the items are added, all of them are still found
+    for (size_t i = 4; i < 40; ++i) {
+        snprintf(key, sizeof(key), "i%ld", (long int)i);
+        TEST_ESP_OK(hashlist.insert(Item(1, ItemType::U32, 1, key), i));
+    }
+    CHECK(hashlist.getCapacity() == 64 * 3 / 2);
+    for (size_t i = 0; i < 40; ++i) {
+        snprintf(key, sizeof(key), "i%ld", (long int)i);
+        CHECK(hashlist.find(0, Item(1, ItemType::U32, 1, key)) == i);
+    }
+    // a loaded page reserves the table for its used entries at once
+    HashListTestHelper loaded;
+    TEST_ESP_OK(loaded.reserve(Page::ENTRY_COUNT));
+    const void* table = loaded.getTable();
+    for (size_t i = 0; i < Page::ENTRY_COUNT; ++i) {
+        snprintf(key, sizeof(key), "i%ld", (long int)i);
+        TEST_ESP_OK(loaded.insert(Item(1, ItemType::U32, 1, key), i));
+    }
+    CHECK(loaded.getTable() == table);
+    CHECK(loaded.getCapacity() == HashList::MAX_ITEMS * 3 / 2);
+}
+
+TEST_CASE("HashList finds remaining items after erasing some of them", "[nvs]")
+{
+    HashListTestHelper hashlist;
+    std::mt19937 gen(1);
+    const size_t count = Page::ENTRY_COUNT;
+    char key[16];
+    for (size_t i = 0; i < count; ++i) {
+        snprintf(key, sizeof(key), "k%ld", (long int)i);
+        TEST_ESP_OK(hashlist.insert(Item(1, ItemType::U32, 1, key), i));
+    }
+    // items with the same hash are found in index order
+    TEST_ESP_OK(hashlist.insert(Item(1, ItemType::U32, 1, "k3"), 127));
+    CHECK(hashlist.find(0, Item(1, ItemType::U32, 1, "k3")) == 3);
+    CHECK(hashlist.find(4, Item(1, ItemType::U32, 1, "k3")) == 127);
+    hashlist.erase(127, true);
+
+    bool erased[count] = {false};
+    for (size_t n = 0; n < count / 2; ++n) {
+        size_t i = gen() % count;
+        if (!erased[i]) {
+            hashlist.erase(i, true);
+            erased[i] = true;
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        snprintf(key, sizeof(key), "k%ld", (long int)i);
+        size_t found = hashlist.find(0, Item(1, ItemType::U32, 1, key));
+        if (erased[i]) {
+            CHECK(found == SIZE_MAX);
+        } else {
+            CHECK(found == i);
+        }
+    }
+}
+
+class ItemIndexTestHelper : public ItemIndex
+{
+    public:
+        size_t getCapacity()
+        {
+            return mCapacity;
+        }
+};
+
+TEST_CASE("item index reserved at load is not grown while the items are added", "[nvs]")
+{
+    ItemIndexTestHelper index;
+    Page pages[4];
+    const size_t count = 1000;
+    char key[16];
+    CHECK(index.reserve(count));
+    const size_t capacity = index.getCapacity();
+    CHECK(capacity * 3 >= count * 4);
+    for (size_t i = 0; i < count; ++i) {
+        snprintf(key, sizeof(key), "k%ld", (long int)i);
+        index.add(ItemIndex::hash(1, key), &pages[i % 4]);
+    }
+    CHECK(index.isEnabled());
+    CHECK(index.getCapacity() == capacity);
+    for (size_t i = 0; i < count; ++i) {
+        snprintf(key, sizeof(key), "k%ld", (long int)i);
+        CHECK(index.count(ItemIndex::hash(1, key), &pages[i % 4]) == 1);
+    }
 }
 
 TEST_CASE("can init PageManager in empty flash", "[nvs]")
@@ -3286,6 +3400,845 @@ TEST_CASE("check and read data from partition generated via manufacturing utilit
 }
 #endif
 
+/* Storage whose lookups can be switched to the full page scan used before the item index */
+class FullScanStorage : public Storage
+{
+public:
+    void disableItemIndex()
+    {
+        mPageManager.getItemIndex().disable();
+    }
+};
+
+TEST_CASE("measure get/set latency for different partition sizes", "[nvs][perf][long]")
+{
+    const size_t sectorCounts[] = {4, 16, 64};
+    const int opCount = 200;
+
+    for (auto sectorCount : sectorCounts) {
+        SpiFlashEmulator emu(sectorCount);
+        FullScanStorage storage;
+        TEST_ESP_OK(storage.init(0, sectorCount));
+        uint8_t nsIndex;
+        TEST_ESP_OK(storage.createOrOpenNamespace("perf", true, nsIndex));
+
+        // fill about half of the partition with integer keys
+        const int keyCount = (sectorCount - 1) * Page::ENTRY_COUNT / 2;
+        char key[16];
+        for (int i = 0; i < keyCount; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            TEST_ESP_OK(storage.writeItem(nsIndex, key, static_cast<uint32_t>(i)));
+        }
+
+        // the same lookups with the item index and with the full scan
+        int64_t getTime[2], missTime[2], setTime[2];
+        for (int fullScan = 0; fullScan < 2; ++fullScan) {
+            if (fullScan) {
+                storage.disableItemIndex();
+            }
+            std::mt19937 gen(1);
+            uint32_t value;
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < opCount; ++i) {
+                int k = gen() % keyCount;
+                snprintf(key, sizeof(key), "key%d", k);
+                TEST_ESP_OK(storage.readItem(nsIndex, key, value));
+                CHECK(value == static_cast<uint32_t>(k));
+            }
+            getTime[fullScan] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / opCount;
+
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < opCount; ++i) {
+                snprintf(key, sizeof(key), "miss%d", i);
+                TEST_ESP_ERR(storage.readItem(nsIndex, key, value), ESP_ERR_NVS_NOT_FOUND);
+            }
+            missTime[fullScan] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / opCount;
+
+            // the value is not changed, so that only the lookup is measured and not the flash writes
+            start = std::chrono::steady_clock::now();
+            for (int i = 0; i < opCount; ++i) {
+                int k = gen() % keyCount;
+                snprintf(key, sizeof(key), "key%d", k);
+                TEST_ESP_OK(storage.writeItem(nsIndex, key, static_cast<uint32_t>(k)));
+            }
+            setTime[fullScan] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count() / opCount;
+        }
+
+        s_perf << "Get/set latency, " << sectorCount << " sectors, " << keyCount << " keys (full scan -> item index): get "
+               << getTime[1] << " -> " << getTime[0] << " ns, get (missing key) " << missTime[1] << " -> " << missTime[0]
+               << " ns, set (same value) " << setTime[1] << " -> " << setTime[0] << " ns" << std::endl;
+    }
+}
+
+TEST_CASE("mount summary keeps records of several partitions", "[nvs]")
+{
+    uint32_t data[32];
+    MountSummary summary(data, sizeof(data));
+    summary.clear();
+    size_t size;
+    CHECK(summary.find(0, 3, size) == nullptr);
+
+    uint32_t* first = summary.reserve(0, 3, 4);
+    REQUIRE(first != nullptr);
+    std::fill_n(first, 4, 1);
+    summary.seal(first);
+    uint32_t* second = summary.reserve(3, 2, 8);
+    REQUIRE(second != nullptr);
+    std::fill_n(second, 8, 2);
+    summary.seal(second);
+
+    CHECK(summary.find(0, 3, size) != nullptr);
+    CHECK(size == 4);
+    CHECK(summary.find(0, 4, size) == nullptr);
+
+    // the remaining records are moved to the start when one is removed
+    summary.remove(0);
+    CHECK(summary.find(0, 3, size) == nullptr);
+    const uint32_t* found = summary.find(3, 2, size);
+    REQUIRE(found != nullptr);
+    CHECK(size == 8);
+    CHECK(found[7] == 2);
+
+    // a record which doesn't fit is not stored
+    CHECK(summary.reserve(0, 3, 16) == nullptr);
+    CHECK(summary.find(3, 2, size) != nullptr);
+
+    // corrupted records are not used
+    data[6] ^= 1;
+    CHECK(summary.find(3, 2, size) == nullptr);
+}
+
+TEST_CASE("storage is mounted from the summary if the partition is unchanged", "[nvs]")
+{
+    const uint32_t sectorCount = 8;
+    SpiFlashEmulator emu(sectorCount);
+    uint32_t summaryData[1024];
+    MountSummary summary(summaryData, sizeof(summaryData));
+    summary.clear();
+
+    const int keyCount = 300;
+    uint8_t blob[Page::CHUNK_MAX_SIZE + 100];
+    std::fill_n(blob, sizeof(blob), 0xa5);
+    char key[16];
+    uint8_t ns1, ns2;
+    {
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, sectorCount, &summary));
+        TEST_ESP_OK(storage.createOrOpenNamespace("ns1", true, ns1));
+        TEST_ESP_OK(storage.createOrOpenNamespace("ns2", true, ns2));
+        for (int i = 0; i < keyCount; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            TEST_ESP_OK(storage.writeItem(ns1, key, i));
+        }
+        TEST_ESP_OK(storage.writeItem(ns2, ItemType::BLOB, "blob", blob, sizeof(blob)));
+        TEST_ESP_OK(storage.writeItem(ns2, ItemType::SZ, "str", "value", 6));
+        storage.saveSummary();
+    }
+    size_t size;
+    CHECK(summary.find(0, sectorCount, size) != nullptr);
+
+    emu.clearStats();
+    Storage fullStorage;
+    TEST_ESP_OK(fullStorage.init(0, sectorCount));
+    size_t fullReads = emu.getReadOps();
+
+    emu.clearStats();
+    Storage storage;
+    TEST_ESP_OK(storage.init(0, sectorCount, &summary));
+    CHECK(emu.getReadOps() < fullReads);
+
+    uint8_t nsIndex;
+    TEST_ESP_OK(storage.createOrOpenNamespace("ns1", false, nsIndex));
+    CHECK(nsIndex == ns1);
+    TEST_ESP_OK(storage.createOrOpenNamespace("ns2", false, nsIndex));
+    CHECK(nsIndex == ns2);
+    for (int i = 0; i < keyCount; ++i) {
+        snprintf(key, sizeof(key), "key%d", i);
+        int value;
+        TEST_ESP_OK(storage.readItem(ns1, key, value));
+        CHECK(value == i);
+    }
+    uint8_t blobRead[sizeof(blob)];
+    TEST_ESP_OK(storage.readItem(ns2, ItemType::BLOB, "blob", blobRead, sizeof(blobRead)));
+    CHECK(memcmp(blob, blobRead, sizeof(blob)) == 0);
+    char str[6];
+    TEST_ESP_OK(storage.readItem(ns2, ItemType::SZ, "str", str, sizeof(str)));
+    CHECK(strcmp(str, "value") == 0);
+
+    // changes drop the summary until it is saved again
+    TEST_ESP_OK(storage.writeItem(ns1, "key0", 1000));
+    TEST_ESP_OK(storage.eraseItem(ns1, "key1"));
+    CHECK(summary.find(0, sectorCount, size) == nullptr);
+    storage.saveSummary();
+    CHECK(summary.find(0, sectorCount, size) != nullptr);
+
+    Storage storage2;
+    TEST_ESP_OK(storage2.init(0, sectorCount, &summary));
+    int value;
+    TEST_ESP_OK(storage2.readItem(ns1, "key0", value));
+    CHECK(value == 1000);
+    TEST_ESP_ERR(storage2.readItem(ns1, "key1", value), ESP_ERR_NVS_NOT_FOUND);
+}
+
+TEST_CASE("storage is scanned if the partition doesn't match the summary", "[nvs]")
+{
+    const uint32_t sectorCount = 4;
+    SpiFlashEmulator emu(sectorCount);
+    uint32_t summaryData[512];
+    MountSummary summary(summaryData, sizeof(summaryData));
+    summary.clear();
+
+    uint8_t ns1;
+    {
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, sectorCount, &summary));
+        TEST_ESP_OK(storage.createOrOpenNamespace("ns1", true, ns1));
+        TEST_ESP_OK(storage.writeItem(ns1, "key", 1));
+        storage.saveSummary();
+    }
+
+    // the partition is changed without updating the summary
+    uint8_t ns2;
+    {
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, sectorCount));
+        TEST_ESP_OK(storage.writeItem(ns1, "key", 2));
+        TEST_ESP_OK(storage.createOrOpenNamespace("ns2", true, ns2));
+        TEST_ESP_OK(storage.writeItem(ns2, "key", 3));
+    }
+
+    Storage storage;
+    TEST_ESP_OK(storage.init(0, sectorCount, &summary));
+    int value;
+    TEST_ESP_OK(storage.readItem(ns1, "key", value));
+    CHECK(value == 2);
+    uint8_t nsIndex;
+    TEST_ESP_OK(storage.createOrOpenNamespace("ns2", false, nsIndex));
+    CHECK(nsIndex == ns2);
+    TEST_ESP_OK(storage.readItem(ns2, "key", value));
+    CHECK(value == 3);
+
+    // the summary was saved again after the scan
+    size_t size;
+    CHECK(summary.find(0, sectorCount, size) != nullptr);
+
+    // a summary of another partition layout is not used
+    Storage storage2;
+    TEST_ESP_OK(storage2.init(0, sectorCount - 1, &summary));
+    TEST_ESP_OK(storage2.readItem(ns2, "key", value));
+    CHECK(value == 3);
+}
+
+TEST_CASE("mount summary isn't saved after a change failed part way", "[nvs]")
+{
+    const uint32_t sectorCount = 4;
+    uint32_t summaryData[512];
+    MountSummary summary(summaryData, sizeof(summaryData));
+    uint8_t oldBlob[Page::CHUNK_MAX_SIZE + 100];
+    uint8_t newBlob[sizeof(oldBlob)];
+    std::fill_n(oldBlob, sizeof(oldBlob), 0x11);
+    std::fill_n(newBlob, sizeof(newBlob), 0x22);
+
+    for (uint32_t errDelay = 0; ; ++errDelay) {
+        INFO(errDelay);
+        SpiFlashEmulator emu(sectorCount);
+        summary.clear();
+        size_t size;
+        uint8_t ns;
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, sectorCount, &summary));
+        TEST_ESP_OK(storage.createOrOpenNamespace("ns", true, ns));
+        TEST_ESP_OK(storage.writeItem(ns, "key", 1));
+        TEST_ESP_OK(storage.writeItem(ns, ItemType::BLOB, "blob", oldBlob, sizeof(oldBlob)));
+        storage.saveSummary();
+        REQUIRE(summary.find(0, sectorCount, size) != nullptr);
+
+        // the summary is removed before the flash is written
+        emu.failAfter(errDelay);
+        esp_err_t err = storage.writeItem(ns, "key", 2);
+        if (err == ESP_OK) {
+            err = storage.writeItem(ns, ItemType::BLOB, "blob", newBlob, sizeof(newBlob));
+        }
+        emu.failAfter(UINT32_MAX);
+        CHECK(summary.find(0, sectorCount, size) == nullptr);
+        if (err == ESP_OK) {
+            break;
+        }
+
+        // the partition may hold both values now, only the full scan cleans it up
+        storage.saveSummary();
+        CHECK(summary.find(0, sectorCount, size) == nullptr);
+
+        Storage scanned;
+        TEST_ESP_OK(scanned.init(0, sectorCount, &summary));
+        int value;
+        TEST_ESP_OK(scanned.readItem(ns, "key", value));
+        CHECK((value == 1 || value == 2));
+        uint8_t blob[sizeof(oldBlob)];
+        TEST_ESP_OK(scanned.readItem(ns, ItemType::BLOB, "blob", blob, sizeof(blob)));
+        CHECK((memcmp(blob, oldBlob, sizeof(blob)) == 0 || memcmp(blob, newBlob, sizeof(blob)) == 0));
+
+        // the summary saved after the scan gives the same values, unless a page was left corrupted
+        if (summary.find(0, sectorCount, size) == nullptr) {
+            continue;
+        }
+        Storage mounted;
+        TEST_ESP_OK(mounted.init(0, sectorCount, &summary));
+        int mountedValue;
+        TEST_ESP_OK(mounted.readItem(ns, "key", mountedValue));
+        CHECK(mountedValue == value);
+        uint8_t mountedBlob[sizeof(oldBlob)];
+        TEST_ESP_OK(mounted.readItem(ns, ItemType::BLOB, "blob", mountedBlob, sizeof(mountedBlob)));
+        CHECK(memcmp(blob, mountedBlob, sizeof(blob)) == 0);
+    }
+}
+
+TEST_CASE("measure wake-to-ready time with and without mount summary", "[nvs][perf][long]")
+{
+    const size_t sectorCounts[] = {4, 16, 64};
+    // the default and the largest CONFIG_NVS_FAST_MOUNT_SUMMARY_SIZE
+    const size_t summarySizes[] = {2048, 4096};
+
+    for (auto summaryBytes : summarySizes) for (auto sectorCount : sectorCounts) {
+        SpiFlashEmulator emu(sectorCount);
+        std::vector<uint32_t> summaryData(summaryBytes / sizeof(uint32_t));
+        MountSummary summary(summaryData.data(), summaryBytes);
+        summary.clear();
+
+        // as many integer keys as the summary holds (4 words per page, 3 words per key), but at
+        // most half of the partition
+        const int keyCount = std::min((summaryData.size() - 16 - 4 * sectorCount) / 3,
+                (sectorCount - 1) * Page::ENTRY_COUNT / 2);
+        {
+            Storage storage;
+            TEST_ESP_OK(storage.init(0, sectorCount, &summary));
+            uint8_t nsIndex;
+            TEST_ESP_OK(storage.createOrOpenNamespace("perf", true, nsIndex));
+            char key[16];
+            for (int i = 0; i < keyCount; ++i) {
+                snprintf(key, sizeof(key), "key%d", i);
+                TEST_ESP_OK(storage.writeItem(nsIndex, key, i));
+            }
+            storage.saveSummary();
+        }
+        size_t summarySize;
+        REQUIRE(summary.find(0, sectorCount, summarySize) != nullptr);
+
+        // the host build checks the whole storage after init, its flash reads are not counted
+        emu.clearStats();
+        Storage fullStorage;
+        TEST_ESP_OK(fullStorage.init(0, sectorCount));
+        auto fullTime = emu.getTotalTime();
+        emu.clearStats();
+        fullStorage.debugCheck();
+        fullTime -= emu.getTotalTime();
+
+        emu.clearStats();
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, sectorCount, &summary));
+        auto summaryTime = emu.getTotalTime();
+        emu.clearStats();
+        storage.debugCheck();
+        summaryTime -= emu.getTotalTime();
+        CHECK(summaryTime < fullTime);
+
+        s_perf << "Wake-to-ready time, " << sectorCount << " sectors, " << keyCount << " keys: full scan " << fullTime
+               << " us, mount summary " << summaryTime << " us (summary " << summarySize * sizeof(uint32_t) << " of "
+               << summaryBytes << " bytes)" << std::endl;
+    }
+}
+
+TEST_CASE("transaction writes staged values on commit", "[nvs]")
+{
+    SpiFlashEmulator emu(10);
+    const uint32_t NVS_FLASH_SECTOR = 6;
+    const uint32_t NVS_FLASH_SECTOR_COUNT_MIN = 4;
+    emu.setBounds(NVS_FLASH_SECTOR, NVS_FLASH_SECTOR + NVS_FLASH_SECTOR_COUNT_MIN);
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, NVS_FLASH_SECTOR, NVS_FLASH_SECTOR_COUNT_MIN));
+
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open("ns", NVS_READWRITE, &handle));
+    TEST_ESP_OK(nvs_set_i32(handle, "a", 1));
+    TEST_ESP_ERR(nvs_transaction_abort(handle), ESP_ERR_NVS_INVALID_STATE);
+
+    TEST_ESP_OK(nvs_transaction_begin(handle));
+    TEST_ESP_ERR(nvs_transaction_begin(handle), ESP_ERR_NVS_INVALID_STATE);
+    TEST_ESP_OK(nvs_set_i32(handle, "a", 2));
+    TEST_ESP_OK(nvs_set_i32(handle, "a", 3));
+    TEST_ESP_OK(nvs_set_u8(handle, "b", 4));
+    TEST_ESP_OK(nvs_set_str(handle, "c", "value 0123456789abcdef0123456789abcdef"));
+    TEST_ESP_ERR(nvs_set_blob(handle, "d", "blob", 4), ESP_ERR_NVS_INVALID_STATE);
+    TEST_ESP_ERR(nvs_erase_key(handle, "a"), ESP_ERR_NVS_INVALID_STATE);
+    TEST_ESP_ERR(nvs_erase_all(handle), ESP_ERR_NVS_INVALID_STATE);
+
+    // staged values are not visible until they are committed
+    int32_t a;
+    uint8_t b;
+    TEST_ESP_OK(nvs_get_i32(handle, "a", &a));
+    CHECK(a == 1);
+    TEST_ESP_ERR(nvs_get_u8(handle, "b", &b), ESP_ERR_NVS_NOT_FOUND);
+
+    TEST_ESP_OK(nvs_commit(handle));
+    TEST_ESP_OK(nvs_get_i32(handle, "a", &a));
+    CHECK(a == 3);
+    TEST_ESP_OK(nvs_get_u8(handle, "b", &b));
+    CHECK(b == 4);
+    char str[64];
+    size_t length = sizeof(str);
+    TEST_ESP_OK(nvs_get_str(handle, "c", str, &length));
+    CHECK(strcmp(str, "value 0123456789abcdef0123456789abcdef") == 0);
+
+    // values of an aborted transaction are dropped
+    TEST_ESP_OK(nvs_transaction_begin(handle));
+    TEST_ESP_OK(nvs_set_i32(handle, "a", 5));
+    TEST_ESP_OK(nvs_transaction_abort(handle));
+    TEST_ESP_OK(nvs_commit(handle));
+    TEST_ESP_OK(nvs_get_i32(handle, "a", &a));
+    CHECK(a == 3);
+
+    // values which are already stored are not written again
+    TEST_ESP_OK(nvs_transaction_begin(handle));
+    TEST_ESP_OK(nvs_set_i32(handle, "a", 3));
+    TEST_ESP_OK(nvs_set_u8(handle, "b", 4));
+    emu.clearStats();
+    TEST_ESP_OK(nvs_commit(handle));
+    CHECK(emu.getWriteOps() == 0);
+
+    // staged values have to fit into one page, after the marker of the transaction
+    TEST_ESP_OK(nvs_transaction_begin(handle));
+    char key[16];
+    for (size_t i = 0; i < Page::ENTRY_COUNT - 1; ++i) {
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+        TEST_ESP_OK(nvs_set_u8(handle, key, i));
+    }
+    TEST_ESP_ERR(nvs_set_u8(handle, "one_too_many", 0), ESP_ERR_NVS_NOT_ENOUGH_SPACE);
+    TEST_ESP_OK(nvs_transaction_abort(handle));
+    nvs_close(handle);
+
+    TEST_ESP_OK(nvs_open("ns", NVS_READONLY, &handle));
+    TEST_ESP_ERR(nvs_transaction_begin(handle), ESP_ERR_NVS_READ_ONLY);
+    nvs_close(handle);
+
+    // an open transaction is dropped when the handle is closed
+    TEST_ESP_OK(nvs_open("ns", NVS_READWRITE, &handle));
+    TEST_ESP_OK(nvs_transaction_begin(handle));
+    TEST_ESP_OK(nvs_set_i32(handle, "a", 6));
+    nvs_close(handle);
+    TEST_ESP_OK(nvs_open("ns", NVS_READONLY, &handle));
+    TEST_ESP_OK(nvs_get_i32(handle, "a", &a));
+    CHECK(a == 3);
+    nvs_close(handle);
+
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+TEST_CASE("transaction is stored entirely or not at all after power off", "[nvs]")
+{
+    const int keyCount = 10;
+    const char* oldStr = "old value 0123456789abcdef0123456789";
+    // both data entries of the new string start with an erased word
+    const char* newStr = "\xff\xff\xff\xff" "new value 0123456789abcdef01" "\xff\xff\xff\xff";
+    char key[16];
+
+    for (uint32_t errDelay = 0; ; ++errDelay) {
+        INFO(errDelay);
+        SpiFlashEmulator emu(4);
+        uint8_t nsIndex;
+        {
+            Storage storage;
+            TEST_ESP_OK(storage.init(0, 4));
+            TEST_ESP_OK(storage.createOrOpenNamespace("ns", true, nsIndex));
+            for (int i = 0; i < keyCount; ++i) {
+                snprintf(key, sizeof(key), "key%d", i);
+                TEST_ESP_OK(storage.writeItem(nsIndex, key, static_cast<uint32_t>(i)));
+            }
+            TEST_ESP_OK(storage.writeItem(nsIndex, ItemType::SZ, "str", oldStr, strlen(oldStr) + 1));
+            // leave less room on the page than the transaction needs, so the new values go to the next page
+            for (int i = 0; i < 110; ++i) {
+                snprintf(key, sizeof(key), "filler%d", i);
+                TEST_ESP_OK(storage.writeItem(nsIndex, key, static_cast<uint8_t>(i)));
+            }
+        }
+
+        bool committed;
+        {
+            Storage storage;
+            TEST_ESP_OK(storage.init(0, 4));
+            Transaction transaction;
+            for (int i = 0; i < keyCount; ++i) {
+                snprintf(key, sizeof(key), "key%d", i);
+                uint32_t value = 1000 + i;
+                TEST_ESP_OK(transaction.add(ItemType::U32, key, &value, sizeof(value)));
+            }
+            TEST_ESP_OK(transaction.add(ItemType::SZ, "str", newStr, strlen(newStr) + 1));
+            emu.failAfter(errDelay);
+            committed = (storage.writeItems(nsIndex, transaction) == ESP_OK);
+        }
+        emu.failAfter(UINT32_MAX);
+
+        // the host build checks for duplicate items after init
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, 4));
+        uint32_t value;
+        TEST_ESP_OK(storage.readItem(nsIndex, "key0", value));
+        const bool isNew = (value == 1000);
+        for (int i = 0; i < keyCount; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            TEST_ESP_OK(storage.readItem(nsIndex, key, value));
+            CHECK(value == static_cast<uint32_t>(isNew ? 1000 + i : i));
+        }
+        char str[64];
+        TEST_ESP_OK(storage.readItem(nsIndex, ItemType::SZ, "str", str, strlen(oldStr) + 1));
+        CHECK(strcmp(str, isNew ? newStr : oldStr) == 0);
+        // the entries of a transaction which was rolled back are not written again
+        TEST_ESP_OK(storage.writeItem(nsIndex, "after", static_cast<uint32_t>(1)));
+        if (committed) {
+            CHECK(isNew);
+            break;
+        }
+    }
+}
+
+TEST_CASE("items of a transaction are only hashed once it is committed", "[nvs]")
+{
+    SpiFlashEmulator emu(1);
+    Page page;
+    TEST_ESP_OK(page.load(0));
+    TEST_ESP_OK(page.writeItem(1, "a", static_cast<uint32_t>(1)));
+    const size_t summarySize = page.getSummarySize();
+
+    Transaction transaction;
+    uint32_t value = 2;
+    TEST_ESP_OK(transaction.add(ItemType::U32, "a", &value, sizeof(value)));
+    TEST_ESP_OK(transaction.add(ItemType::U32, "b", &value, sizeof(value)));
+    emu.failAfter(0);
+    TEST_ESP_ERR(page.writeItems(1, transaction), ESP_ERR_FLASH_OP_FAIL);
+    emu.failAfter(UINT32_MAX);
+    CHECK(page.getSummarySize() == summarySize);
+
+    // a committed transaction is finished by erasing its marker
+    Page page2;
+    TEST_ESP_OK(page2.load(0));
+    TEST_ESP_OK(page2.writeItems(1, transaction));
+    CHECK((page2.getTransactionIndex() != Page::INVALID_ENTRY));
+    CHECK(page2.getSummarySize() == summarySize + 2);
+    TEST_ESP_OK(page2.finishTransaction());
+    CHECK((page2.getTransactionIndex() == Page::INVALID_ENTRY));
+    TEST_ESP_OK(page2.readItem(1, "b", value));
+    CHECK(value == 2);
+}
+
+TEST_CASE("load erases the values replaced by a transaction which wasn't finished", "[nvs]")
+{
+    const uint32_t sectorCount = 4;
+    SpiFlashEmulator emu(sectorCount);
+    uint8_t nsIndex;
+    {
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, sectorCount));
+        TEST_ESP_OK(storage.createOrOpenNamespace("ns", true, nsIndex));
+        TEST_ESP_OK(storage.writeItem(nsIndex, "a", static_cast<uint32_t>(1)));
+        TEST_ESP_OK(storage.writeItem(nsIndex, "b", static_cast<uint32_t>(1)));
+    }
+    {
+        // the transaction is committed, but neither the replaced values nor the marker are erased
+        PageManager pageManager;
+        TEST_ESP_OK(pageManager.load(0, sectorCount));
+        Transaction transaction;
+        uint32_t value = 2;
+        TEST_ESP_OK(transaction.add(ItemType::U32, "a", &value, sizeof(value)));
+        TEST_ESP_OK(transaction.add(ItemType::U32, "b", &value, sizeof(value)));
+        TEST_ESP_OK(pageManager.back().writeItems(nsIndex, transaction));
+    }
+
+    // the host build checks for duplicate items after init
+    Storage storage;
+    TEST_ESP_OK(storage.init(0, sectorCount));
+    uint32_t value;
+    TEST_ESP_OK(storage.readItem(nsIndex, "a", value));
+    CHECK(value == 2);
+    TEST_ESP_OK(storage.readItem(nsIndex, "b", value));
+    CHECK(value == 2);
+    nvs_stats_t stats;
+    TEST_ESP_OK(storage.fillStats(stats));
+    CHECK(stats.used_entries == 3);
+}
+
+TEST_CASE("a transaction is finished before the page holding its marker is freed", "[nvs]")
+{
+    const uint32_t sectorCount = 3;
+    SpiFlashEmulator emu(sectorCount);
+    uint8_t nsIndex;
+    {
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, sectorCount));
+        TEST_ESP_OK(storage.createOrOpenNamespace("ns", true, nsIndex));
+        TEST_ESP_OK(storage.writeItem(nsIndex, "a", static_cast<uint32_t>(1)));
+        TEST_ESP_OK(storage.writeItem(nsIndex, "b", static_cast<uint32_t>(1)));
+    }
+    {
+        PageManager pageManager;
+        TEST_ESP_OK(pageManager.load(0, sectorCount));
+        Transaction transaction;
+        uint32_t value = 2;
+        TEST_ESP_OK(transaction.add(ItemType::U32, "a", &value, sizeof(value)));
+        TEST_ESP_OK(transaction.add(ItemType::U32, "b", &value, sizeof(value)));
+        TEST_ESP_OK(pageManager.back().writeItems(nsIndex, transaction));
+
+        // fill the next page, so that the one with the marker has the most erased entries
+        TEST_ESP_OK(pageManager.back().markFull());
+        TEST_ESP_OK(pageManager.requestNewPage());
+        char key[16];
+        for (int i = 0; i < 120; ++i) {
+            snprintf(key, sizeof(key), "f%d", i);
+            TEST_ESP_OK(pageManager.back().writeItem(nsIndex, key, static_cast<uint8_t>(i)));
+        }
+        TEST_ESP_OK(pageManager.back().markFull());
+        TEST_ESP_OK(pageManager.requestNewPage());
+    }
+
+    Storage storage;
+    TEST_ESP_OK(storage.init(0, sectorCount));
+    uint32_t value;
+    TEST_ESP_OK(storage.readItem(nsIndex, "a", value));
+    CHECK(value == 2);
+    TEST_ESP_OK(storage.readItem(nsIndex, "b", value));
+    CHECK(value == 2);
+    nvs_stats_t stats;
+    TEST_ESP_OK(storage.fillStats(stats));
+    CHECK(stats.used_entries == 123);
+}
+
+TEST_CASE("a transaction interrupted by a flash failure is seen whole or not at all after load", "[nvs]")
+{
+    const uint32_t sectorCount = 4;
+    bool committed = false;
+    for (uint32_t failAfter = 0; !committed; ++failAfter) {
+        SpiFlashEmulator emu(sectorCount);
+        uint8_t nsIndex;
+        {
+            Storage storage;
+            TEST_ESP_OK(storage.init(0, sectorCount));
+            TEST_ESP_OK(storage.createOrOpenNamespace("ns", true, nsIndex));
+            TEST_ESP_OK(storage.writeItem(nsIndex, "a", static_cast<uint32_t>(1)));
+            TEST_ESP_OK(storage.writeItem(nsIndex, "b", static_cast<uint32_t>(1)));
+
+            Transaction transaction;
+            uint32_t value = 2;
+            TEST_ESP_OK(transaction.add(ItemType::U32, "a", &value, sizeof(value)));
+            TEST_ESP_OK(transaction.add(ItemType::U32, "b", &value, sizeof(value)));
+            emu.failAfter(failAfter);
+            committed = storage.writeItems(nsIndex, transaction) == ESP_OK;
+        }
+
+        // the host build checks for duplicate items after init
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, sectorCount));
+        uint32_t a, b;
+        TEST_ESP_OK(storage.readItem(nsIndex, "a", a));
+        TEST_ESP_OK(storage.readItem(nsIndex, "b", b));
+        CHECK(a == b);
+        nvs_stats_t stats;
+        TEST_ESP_OK(storage.fillStats(stats));
+        CHECK(stats.used_entries == 3);
+    }
+}
+
+TEST_CASE("measure flash writes of a transaction", "[nvs][perf][long]")
+{
+    const int keyCount = 10;
+    char key[16];
+    size_t writeOps[2];
+    size_t writeTime[2];
+
+    for (int useTransaction = 0; useTransaction < 2; ++useTransaction) {
+        SpiFlashEmulator emu(4);
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, 4));
+        uint8_t nsIndex;
+        TEST_ESP_OK(storage.createOrOpenNamespace("perf", true, nsIndex));
+        for (int i = 0; i < keyCount; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            TEST_ESP_OK(storage.writeItem(nsIndex, key, static_cast<uint32_t>(i)));
+        }
+
+        emu.clearStats();
+        if (useTransaction) {
+            Transaction transaction;
+            for (int i = 0; i < keyCount; ++i) {
+                snprintf(key, sizeof(key), "key%d", i);
+                uint32_t value = 1000 + i;
+                TEST_ESP_OK(transaction.add(ItemType::U32, key, &value, sizeof(value)));
+            }
+            TEST_ESP_OK(storage.writeItems(nsIndex, transaction));
+        } else {
+            for (int i = 0; i < keyCount; ++i) {
+                snprintf(key, sizeof(key), "key%d", i);
+                TEST_ESP_OK(storage.writeItem(nsIndex, key, static_cast<uint32_t>(1000 + i)));
+            }
+        }
+        writeOps[useTransaction] = emu.getWriteOps();
+        writeTime[useTransaction] = emu.getTotalTime();
+    }
+    CHECK(writeOps[1] < writeOps[0]);
+
+    s_perf << "Updating " << keyCount << " keys: separately " << writeOps[0] << " write ops, " << writeTime[0]
+           << " us; in a transaction " << writeOps[1] << " write ops, " << writeTime[1] << " us" << std::endl;
+}
+
+TEST_CASE("reading items with a broken crc doesn't modify the page", "[nvs]")
+{
+    SpiFlashEmulator emu(3);
+    Page p;
+    TEST_ESP_OK(p.load(0));
+    const char* str = "foobar";
+    TEST_ESP_OK(p.writeItem(1, ItemType::SZ, "key", str, strlen(str) + 1));
+    TEST_ESP_OK(p.writeItem<uint32_t>(1, "after", 1));
+
+    // corrupt the data of the string (64 is the offset of the first item in page)
+    uint32_t w;
+    CHECK(emu.read(&w, 64 + 32, sizeof(w)));
+    w &= 0xf000000f;
+    CHECK(emu.write(64 + 32, &w, sizeof(w)));
+    char buf[16];
+    TEST_ESP_ERR(p.readItem(1, ItemType::SZ, "key", buf, sizeof(buf)), ESP_ERR_NVS_NOT_FOUND);
+    CHECK(p.getUsedEntryCount() == 3);
+    CHECK(p.getErasedEntryCount() == 0);
+
+    // corrupt the header of the string
+    w = 0;
+    CHECK(emu.write(64, &w, sizeof(w)));
+    TEST_ESP_ERR(p.findItem(1, ItemType::SZ, "key"), ESP_ERR_NVS_NOT_FOUND);
+    CHECK(p.getUsedEntryCount() == 3);
+    CHECK(p.getErasedEntryCount() == 0);
+    uint32_t value;
+    TEST_ESP_OK(p.readItem<uint32_t>(1, "after", value));
+    CHECK(value == 1);
+
+    // the next load erases the string
+    Page p2;
+    TEST_ESP_OK(p2.load(0));
+    CHECK(p2.getUsedEntryCount() == 1);
+    CHECK(p2.getErasedEntryCount() == 2);
+}
+
+TEST_CASE("reading a blob with a missing chunk erases the blob", "[nvs]")
+{
+    const uint32_t sectors = 8;
+    SpiFlashEmulator emu(sectors);
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, sectors));
+    nvs_handle_t handle;
+    TEST_ESP_OK(nvs_open("test", NVS_READWRITE, &handle));
+    static uint8_t blob[Page::CHUNK_MAX_SIZE * 2];
+    static uint8_t buf[Page::CHUNK_MAX_SIZE * 2];
+    memset(blob, 0x5a, sizeof(blob));
+    TEST_ESP_OK(nvs_set_blob(handle, "broken", blob, sizeof(blob)));
+    TEST_ESP_OK(nvs_set_blob(handle, "other", blob, sizeof(blob)));
+    nvs_close(handle);
+
+    // erase the first chunk of the blob behind the storage, then load it again
+    for (uint32_t i = 0; i < sectors; i++) {
+        Page p;
+        TEST_ESP_OK(p.load(i));
+        p.eraseItem(1, ItemType::BLOB_DATA, "broken", 0);
+    }
+    TEST_ESP_OK(nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, sectors));
+    TEST_ESP_OK(nvs_open("test", NVS_READONLY, &handle));
+
+    size_t len = 0;
+    TEST_ESP_OK(nvs_get_blob(handle, "broken", NULL, &len));
+    CHECK(len == sizeof(blob));
+    TEST_ESP_ERR(nvs_get_blob(handle, "broken", buf, &len), ESP_ERR_NVS_NOT_FOUND);
+
+    // the index and the other chunks are erased, the size isn't reported anymore
+    TEST_ESP_ERR(nvs_get_blob(handle, "broken", NULL, &len), ESP_ERR_NVS_NOT_FOUND);
+    for (uint32_t i = 0; i < sectors; i++) {
+        Page p;
+        TEST_ESP_OK(p.load(i));
+        TEST_ESP_ERR(p.findItem(1, ItemType::BLOB_IDX, "broken"), ESP_ERR_NVS_NOT_FOUND);
+        TEST_ESP_ERR(p.findItem(1, ItemType::BLOB_DATA, "broken"), ESP_ERR_NVS_NOT_FOUND);
+    }
+
+    // a complete blob is not touched
+    len = sizeof(buf);
+    TEST_ESP_OK(nvs_get_blob(handle, "other", buf, &len));
+    CHECK(memcmp(buf, blob, sizeof(blob)) == 0);
+    nvs_close(handle);
+
+    TEST_ESP_OK(nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME));
+}
+
+TEST_CASE("rw lock lets readers in together and a waiting writer first", "[nvs]")
+{
+    RwLock rwLock;
+    TEST_ESP_OK(rwLock.init());
+    std::atomic<int> order(0);
+    std::atomic<int> writerOrder(0);
+    std::atomic<int> readerOrder(0);
+
+    rwLock.lockShared();
+    std::thread otherReader([&] {
+        ReadLock lock(rwLock);
+    });
+    otherReader.join();
+
+    std::thread writer([&] {
+        WriteLock lock(rwLock);
+        writerOrder = ++order;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(writerOrder == 0);
+
+    // the waiting writer keeps this reader out
+    std::thread reader([&] {
+        ReadLock lock(rwLock);
+        readerOrder = ++order;
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(readerOrder == 0);
+
+    rwLock.unlockShared();
+    writer.join();
+    reader.join();
+    CHECK(writerOrder == 1);
+    CHECK(readerOrder == 2);
+}
+
+TEST_CASE("rw lock keeps readers out while a writer changes the data", "[nvs]")
+{
+    const int threadCount = 4;
+    const int iterations = 2000;
+    RwLock rwLock;
+    TEST_ESP_OK(rwLock.init());
+    // the writers keep both values equal, readers check them
+    volatile int first = 0;
+    volatile int second = 0;
+    std::atomic<int> mismatches(0);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threadCount; ++t) {
+        threads.emplace_back([&] {
+            for (int i = 0; i < iterations; ++i) {
+                {
+                    WriteLock lock(rwLock);
+                    first = first + 1;
+                    std::this_thread::yield();
+                    second = second + 1;
+                }
+                ReadLock lock(rwLock);
+                if (first != second) {
+                    ++mismatches;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK(mismatches == 0);
+    CHECK(first == threadCount * iterations);
+}
+
 /* Add new tests above */
 /* This test has to be the final one */
 
@@ -0,0 +1,188 @@
+/*
+ * CRC microbenchmark
+ * Compares byte-at-a-time and slice-by-4 crc functions from 'spi_crc.c'
+ * on 32 KB frames (SPI_BUFFER_SIZE_MAX) and checks all variants against
+ * the bitwise reference implementations (which also checks the constant tables).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "spi_crc.h"
+
+#define FRAME_SIZE      32768
+#define ITERATIONS      500
+
+static uint8_t frame[FRAME_SIZE+8];
+static volatile uint32_t sink;
+
+//--------------------
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e6) + (ts.tv_nsec / 1e3);
+}
+
+// Bitwise reference crc32 (zlib compatible, same as ESP32 ROM 'crc32_le(0, ...)')
+//-----------------------------------------------------------
+static uint32_t ref_crc32(const uint8_t *data, size_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    while (length--) {
+        crc ^= *data++;
+        for (int i=0; i<8; i++) crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+    }
+    return ~crc;
+}
+
+// Bitwise reference crc16 (CCITT, MSB first, initial value 0xFFFF)
+//-----------------------------------------------------------
+static uint16_t ref_crc16(const uint8_t *data, size_t length)
+{
+    uint16_t crc = 0xFFFF;
+    while (length--) {
+        crc ^= *data++ << 8;
+        for (int i=0; i<8; i++) crc = (crc & 0x8000) ? ((crc << 1) ^ 0x1021) : (crc << 1);
+    }
+    return crc;
+}
+
+// Bitwise reference crc8 (Dallas/Maxim, initial value 0)
+//--------------------------------------------------------
+static uint8_t ref_crc8(const uint8_t *data, size_t length)
+{
+    uint8_t crc = 0;
+    while (length--) {
+        crc ^= *data++;
+        for (int i=0; i<8; i++) crc = (crc & 1) ? ((crc >> 1) ^ 0x8C) : (crc >> 1);
+    }
+    return crc;
+}
+
+//-----------------
+static int verify()
+{
+    int err = 0;
+    // check different lengths to cover the tail handling
+    for (size_t len=0; len<1024; len++) {
+        uint16_t c16 = ref_crc16(frame, len);
+        uint8_t c8 = ref_crc8(frame, len);
+        if ((calc_crc16_bytewise(frame, len, 0) != c16) || (calc_crc16_slice4(frame, len, 0) != c16)) {
+            printf("crc16 mismatch, length=%zu\n", len);
+            err++;
+        }
+        if ((calc_crc8_bytewise(frame, len, 0) != c8) || (calc_crc8_slice4(frame, len, 0) != c8)) {
+            printf("crc8 mismatch, length=%zu\n", len);
+            err++;
+        }
+        if (calc_crc32(frame, len, 0) != ref_crc32(frame, len)) {
+            printf("crc32 mismatch, length=%zu\n", len);
+            err++;
+        }
+    }
+    if (calc_crc32("123456789", 9, 0) != 0xCBF43926) {
+        printf("crc32 check value mismatch\n");
+        err++;
+    }
+
+    // fused frame crc must be identical to crc32 followed by crc16
+    uint8_t *copy = malloc(FRAME_SIZE+8);
+    for (size_t len=1; len<=FRAME_SIZE; len = (len * 3) + 1) {
+        memcpy(copy, frame, len);
+        uint32_t c32 = ref_crc32(copy, len);
+        memcpy(copy+len, &c32, 4);
+        uint16_t c16 = calc_crc16_bytewise(copy, len+4, 0);
+        memcpy(copy+len+4, &c16, 2);
+        calc_frame_crc(frame, len);
+        if (memcmp(copy, frame, len+6) != 0) {
+            printf("frame crc mismatch, length=%zu\n", len);
+            err++;
+        }
+        // received frame check, with and without the crc16
+        if ((check_frame_crc(frame, len, true, NULL) != CRC_CHECK_OK) ||
+            (check_frame_crc(frame, len, false, NULL) != CRC_CHECK_OK)) {
+            printf("frame crc check failed, length=%zu\n", len);
+            err++;
+        }
+        frame[len+5] ^= 0x01;
+        if (check_frame_crc(frame, len, true, NULL) != CRC_CHECK_CRC16_ERROR) {
+            printf("frame crc16 error not detected, length=%zu\n", len);
+            err++;
+        }
+        frame[len+5] ^= 0x01;
+        frame[len/2] ^= 0x10;
+        if (check_frame_crc(frame, len, true, NULL) != CRC_CHECK_CRC32_ERROR) {
+            printf("frame crc32 error not detected, length=%zu\n", len);
+            err++;
+        }
+        frame[len/2] ^= 0x10;
+    }
+    free(copy);
+    return err;
+}
+
+//---------------------------------------------------------
+static void report(const char *name, double t, double base)
+{
+    double mbs = ((double)FRAME_SIZE * ITERATIONS) / t;
+    printf("%-22s %9.1f us/frame %8.1f MB/s  x%.2f\n", name, t / ITERATIONS, mbs, base / t);
+}
+
+//=====================
+int main(int argc, char **argv)
+{
+    double t, t16, t8, t32;
+
+    srand(1);
+    for (int i=0; i<FRAME_SIZE; i++) frame[i] = rand();
+
+    if (verify() != 0) {
+        printf("FAILED\n");
+        return 1;
+    }
+
+    printf("Frame size: %d bytes, %d iterations\n\n", FRAME_SIZE, ITERATIONS);
+
+    t = now_us();
+    for (int i=0; i<ITERATIONS; i++) sink += calc_crc16_bytewise(frame, FRAME_SIZE, 0);
+    t16 = now_us() - t;
+    report("crc16 bytewise", t16, t16);
+    t = now_us();
+    for (int i=0; i<ITERATIONS; i++) sink += calc_crc16_slice4(frame, FRAME_SIZE, 0);
+    report("crc16 slice-by-4", now_us() - t, t16);
+
+    t = now_us();
+    for (int i=0; i<ITERATIONS; i++) sink += calc_crc8_bytewise(frame, FRAME_SIZE, 0);
+    t8 = now_us() - t;
+    report("crc8 bytewise", t8, t8);
+    t = now_us();
+    for (int i=0; i<ITERATIONS; i++) sink += calc_crc8_slice4(frame, FRAME_SIZE, 0);
+    report("crc8 slice-by-4", now_us() - t, t8);
+
+    // frame trailer: crc32 pass followed by crc16 pass vs. the fused single pass
+    t = now_us();
+    for (int i=0; i<ITERATIONS; i++) {
+        uint32_t c32 = ref_crc32(frame, FRAME_SIZE-6);
+        memcpy(frame+FRAME_SIZE-6, &c32, 4);
+        sink += calc_crc16_bytewise(frame, FRAME_SIZE-2, 0);
+    }
+    t32 = now_us() - t;
+    report("crc32+crc16 bitwise", t32, t32);
+    t = now_us();
+    for (int i=0; i<ITERATIONS; i++) {
+        uint32_t c32 = calc_crc32(frame, FRAME_SIZE-6, 0);
+        memcpy(frame+FRAME_SIZE-6, &c32, 4);
+        sink += calc_crc16_slice4(frame, FRAME_SIZE-2, 0);
+    }
+    report("crc32+crc16 sliced", now_us() - t, t32);
+    t = now_us();
+    for (int i=0; i<ITERATIONS; i++) calc_frame_crc(frame, FRAME_SIZE-6);
+    report("frame crc fused", now_us() - t, t32);
+    t = now_us();
+    for (int i=0; i<ITERATIONS; i++) sink += check_frame_crc(frame, FRAME_SIZE-6, true, NULL);
+    report("frame check fused", now_us() - t, t32);
+
+    return 0;
+}
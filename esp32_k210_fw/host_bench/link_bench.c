@@ -0,0 +1,934 @@
+/*
+ * ESP32 <-> K210 link benchmark
+ * Runs the ESP32 SPI master firmware ('spi_master.c', 'spi_common.c', 'wifi.c') on host
+ * against the simulated K210 slave ('sim/k210_sim.c') and measures the end-to-end
+ * throughput and latency of the main transfer paths:
+ *   echo   - K210 requests with ECHO command of different sizes
+ *   batch  - K210 BATCH requests with several ECHO sub-commands and one rejected sub-command
+ *   file   - ESP32 file requests, write and read back a file in K210 file system
+ *   fpipe  - ESP32 pipelined file write ('file_pipe.c'), the data is written by the pipe task
+ *   listdir - ESP32 directory list of a directory larger than one SPI frame (paged listing)
+ *   fconc  - ESP32 file requests from several tasks at the same time (file request queue)
+ *   socket - K210 socket requests, send to and receive from a loopback TCP echo server,
+ *            and a receive in a batch whose response only has room for part of the data
+ *   rqget  - K210 requests GET, the response is streamed to K210 in blocks
+ *   shutdown - run last: K210 DEEPSLEEP request with a connected socket, the SPI task exits
+ *            and must terminate the socket tasks before the sockets and the mutex are freed
+ * All transferred data is verified.
+ *
+ * Usage: link_bench [-c clock_hz] [-n iterations] [-e bit_error_rate] [-t tests] [-z] [-o] [-l] [-v level]
+ *   -t: comma separated list of tests to run, default: echo,batch,file,fpipe,listdir,fconc,socket,rqget,shutdown
+ *   -z: the simulated K210 supports compressed frames
+ *   -o: the simulated K210 is older firmware without the optional protocol features
+ *   -l: the test data is log text instead of random bytes
+ *   -v: ESP32 debug log level, messages are printed if > 0
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "global.h"
+#include "lwip/sockets.h"
+#include "k210_sim.h"
+
+#define RESPONSE_TIMEOUT    5000
+#define FILE_SIZE           (256*1024)
+#define FILE_NAME           "/bench/data.bin"
+#define RQGET_SIZE          (128*1024)
+#define LISTDIR_FILES       1000
+#define LISTDIR_PATH        "/bench/log"
+#define CONC_TASKS          4
+#define CONC_FILE_SIZE      (64*1024)
+#define CONC_CHUNK          4096
+#define MAX_SAMPLES         100000
+#define BATCH_COMMANDS      8
+
+extern int sim_log_enabled;
+
+typedef struct {
+    const char *name;
+    int ok;
+    int errors;
+    uint64_t bytes;
+    double time_us;
+    int n_samples;
+    double *samples;
+} bench_result_t;
+
+static int iterations = 200;
+static bool legacy_k210 = false;     // the simulated K210 is older firmware (-o)
+static uint8_t *resp_buf;
+static uint32_t resp_buf_size = 65536;
+static uint8_t *pattern;
+
+// rqget block handler state
+static uint32_t rq_received = 0;
+static uint32_t rq_blocks = 0;
+static uint32_t rq_headers = 0;
+static uint32_t rq_bad = 0;
+
+
+//--------------------
+static double now_us()
+{
+    return sim_time_ns() / 1000.0;
+}
+
+// Fill the buffer with log lines, compresses about as well as the real K210 logs
+//------------------------------------------------
+static void fill_log_text(uint8_t *buf, int size)
+{
+    static const char *tags[] = {"sensor", "wifi", "sdcard", "main", "display"};
+    char line[128];
+    int pos = 0;
+    int n = 0;
+    while (pos < size) {
+        int len = snprintf(line, sizeof(line), "%c (%07u) %s: temp=%d.%d C, hum=%d%%, vbat=%d mV, status 0x%04X\n",
+                ((rand() % 8) == 0) ? 'W' : 'I', n * 250 + (rand() % 50), tags[rand() % 5],
+                20 + (rand() % 10), rand() % 10, 40 + (rand() % 20), 3600 + (rand() % 500), rand() & 0xFFFF);
+        if (len > (size - pos)) len = size - pos;
+        memcpy(buf + pos, line, len);
+        pos += len;
+        n++;
+    }
+}
+
+//-----------------------------------------------------
+static void result_init(bench_result_t *res, const char *name)
+{
+    memset(res, 0, sizeof(bench_result_t));
+    res->name = name;
+    res->samples = malloc(MAX_SAMPLES * sizeof(double));
+}
+
+//------------------------------------------------------
+static void result_add(bench_result_t *res, double t_us)
+{
+    if (res->n_samples < MAX_SAMPLES) res->samples[res->n_samples++] = t_us;
+}
+
+//---------------------------------------------
+static int cmp_double(const void *a, const void *b)
+{
+    double da = *(const double *)a, db = *(const double *)b;
+    return (da > db) - (da < db);
+}
+
+//----------------------------------------------------------
+static double percentile(bench_result_t *res, double p)
+{
+    if (res->n_samples == 0) return 0;
+    int idx = (int)((res->n_samples - 1) * p + 0.5);
+    return res->samples[idx];
+}
+
+//-----------------------------------------------
+static void result_print(bench_result_t *res)
+{
+    qsort(res->samples, res->n_samples, sizeof(double), cmp_double);
+    double secs = res->time_us / 1e6;
+    printf("%-16s %7d %6d %10.1f %10.1f %9.1f %9.1f\n", res->name, res->ok, res->errors,
+            (secs > 0) ? res->ok / secs : 0.0, (secs > 0) ? (res->bytes / 1024.0) / secs : 0.0,
+            percentile(res, 0.5), percentile(res, 0.99));
+    free(res->samples);
+    res->samples = NULL;
+}
+
+// Send K210 request and check the response status
+//------------------------------------------------------------------------------------------
+static int k210_request(uint16_t cmd, const void *data, uint16_t len, k210_sim_frame_t *resp)
+{
+    resp->data = resp_buf;
+    resp->size = resp_buf_size;
+    int res = k210_sim_request(cmd, data, len, resp, RESPONSE_TIMEOUT);
+    if (res != K210_SIM_OK) return res;
+    if ((resp->cmdstat & 0x00FF) != cmd) return -10;
+    if (resp->cmdstat & 0xFF00) return -11;
+    return K210_SIM_OK;
+}
+
+// ==== Tests =================================================================
+
+//----------------------------------------------------
+static void bench_echo(bench_result_t *res, int size)
+{
+    k210_sim_frame_t resp;
+
+    for (int i=0; i<iterations; i++) {
+        double t = now_us();
+        int r = k210_request(ESP_COMMAND_ECHO, pattern + (i & 0xFF), size, &resp);
+        t = now_us() - t;
+        if ((r != K210_SIM_OK) || (resp.len != size) || (memcmp(resp.data, pattern + (i & 0xFF), size) != 0)) {
+            res->errors++;
+            continue;
+        }
+        res->ok++;
+        res->bytes += size * 2;
+        res->time_us += t;
+        result_add(res, t);
+    }
+}
+
+// BATCH_COMMANDS echo sub-commands of 'size' bytes followed by a sub-command not allowed in a batch
+//-----------------------------------------------------
+static void bench_batch(bench_result_t *res, int size)
+{
+    k210_sim_frame_t resp;
+    int req_len = ((4 + size) * BATCH_COMMANDS) + 4;
+    uint8_t *req = malloc(req_len);
+
+    for (int i=0; i<iterations; i++) {
+        uint8_t *p = req;
+        for (int n=0; n<BATCH_COMMANDS; n++) {
+            *((uint16_t *)p) = ESP_COMMAND_ECHO;
+            *((uint16_t *)(p+2)) = size;
+            memcpy(p+4, pattern + ((i+n) & 0xFF), size);
+            p += 4 + size;
+        }
+        *((uint16_t *)p) = ESP_COMMAND_RQGET;
+        *((uint16_t *)(p+2)) = 0;
+
+        double t = now_us();
+        int r = k210_request(ESP_COMMAND_BATCH, req, req_len, &resp);
+        t = now_us() - t;
+        // the echo responses have the same layout as the request, the last sub-command is rejected
+        uint8_t *last = resp.data + (p - req);
+        if ((r != K210_SIM_OK) || (resp.len != req_len) || (memcmp(resp.data, req, p - req) != 0) ||
+            (*((uint16_t *)last) != (ESP_COMMAND_RQGET | ESP_ERROR_COMMAND_UNKNOWN)) || (*((uint16_t *)(last+2)) != 0)) {
+            res->errors++;
+            continue;
+        }
+        res->ok++;
+        res->bytes += req_len * 2;
+        res->time_us += t;
+        result_add(res, t);
+    }
+    free(req);
+}
+
+//-------------------------------------------------------------------------------------
+static void bench_file(bench_result_t *wr_res, bench_result_t *rd_res, int chunk)
+{
+    uint8_t *rdbuf = malloc(chunk);
+    const uint8_t *data;
+    uint32_t size;
+    int loops = (iterations * chunk) / FILE_SIZE;
+    if (loops < 1) loops = 1;
+
+    for (int l=0; l<loops; l++) {
+        // --- write ---
+        int fd = k210_file_open(FILE_NAME, ESP_FILE_MODE_WR);
+        if (fd < 0) {
+            wr_res->errors++;
+            continue;
+        }
+        for (int pos=0; pos<FILE_SIZE; pos+=chunk) {
+            int n = ((FILE_SIZE - pos) < chunk) ? (FILE_SIZE - pos) : chunk;
+            double t = now_us();
+            int w = k210_file_write(fd, pattern + (pos % 251), n);
+            t = now_us() - t;
+            if (w != n) {
+                wr_res->errors++;
+                continue;
+            }
+            wr_res->ok++;
+            wr_res->bytes += n;
+            wr_res->time_us += t;
+            result_add(wr_res, t);
+        }
+        k210_file_close(fd);
+
+        if ((k210_sim_file_get(FILE_NAME, &data, &size) != 0) || (size != FILE_SIZE)) wr_res->errors++;
+        else {
+            for (int pos=0; pos<FILE_SIZE; pos+=chunk) {
+                int n = ((FILE_SIZE - pos) < chunk) ? (FILE_SIZE - pos) : chunk;
+                if (memcmp(data + pos, pattern + (pos % 251), n) != 0) {
+                    wr_res->errors++;
+                    break;
+                }
+            }
+        }
+
+        // --- read back ---
+        fd = k210_file_open(FILE_NAME, ESP_FILE_MODE_RO);
+        if (fd < 0) {
+            rd_res->errors++;
+            continue;
+        }
+        for (int pos=0; pos<FILE_SIZE; pos+=chunk) {
+            int n = ((FILE_SIZE - pos) < chunk) ? (FILE_SIZE - pos) : chunk;
+            double t = now_us();
+            int r = k210_file_read(fd, rdbuf, n);
+            t = now_us() - t;
+            if ((r != n) || (memcmp(rdbuf, pattern + (pos % 251), n) != 0)) {
+                rd_res->errors++;
+                continue;
+            }
+            rd_res->ok++;
+            rd_res->bytes += n;
+            rd_res->time_us += t;
+            result_add(rd_res, t);
+        }
+        k210_file_close(fd);
+    }
+    free(rdbuf);
+}
+
+// Write the file through the file pipe, the time of each buffer hand-off is measured
+//----------------------------------------------------
+static void bench_fpipe(bench_result_t *res)
+{
+    const uint8_t *data;
+    uint32_t size;
+    int loops = (iterations * 16384) / FILE_SIZE;
+    if (loops < 1) loops = 1;
+
+    for (int l=0; l<loops; l++) {
+        int fd = k210_file_open(FILE_NAME, ESP_FILE_MODE_WR);
+        if (fd < 0) {
+            res->errors++;
+            continue;
+        }
+        file_pipe_t *pipe = file_pipe_open(fd);
+        if (pipe == NULL) {
+            k210_file_close(fd);
+            res->errors++;
+            continue;
+        }
+        double tstart = now_us();
+        int pos = 0;
+        while (pos < FILE_SIZE) {
+            size_t bufsize;
+            double t = now_us();
+            uint8_t *buf = file_pipe_get(pipe, &bufsize);
+            if (buf == NULL) break;
+            int n = ((FILE_SIZE - pos) < (int)bufsize) ? (FILE_SIZE - pos) : (int)bufsize;
+            for (int i=0; i<n; i++) buf[i] = pattern[(pos + i) % 65536];
+            file_pipe_put(pipe, n);
+            result_add(res, now_us() - t);
+            res->ok++;
+            pos += n;
+        }
+        int written = file_pipe_close(pipe);
+        res->time_us += now_us() - tstart;
+        k210_file_close(fd);
+        if (written != FILE_SIZE) {
+            res->errors++;
+            continue;
+        }
+        res->bytes += written;
+
+        if ((k210_sim_file_get(FILE_NAME, &data, &size) != 0) || (size != FILE_SIZE)) res->errors++;
+        else {
+            for (int i=0; i<FILE_SIZE; i++) {
+                if (data[i] != pattern[i % 65536]) {
+                    res->errors++;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+// List a directory with LISTDIR_FILES files, the list is much larger than the SPI buffer
+//-------------------------------------------------
+static void bench_listdir(bench_result_t *res)
+{
+    char path[64];
+    uint32_t stamp = 0x12345678;
+    int loops = iterations / 10;
+    if (loops < 1) loops = 1;
+
+    for (int i=0; i<LISTDIR_FILES; i++) {
+        sprintf(path, LISTDIR_PATH "/rec_%05d.log", i);
+        if (k210_sim_file_put(path, &stamp, 4) != 0) {
+            res->errors++;
+            return;
+        }
+    }
+    for (int l=0; l<loops; l++) {
+        void *list = NULL;
+        double t = now_us();
+        int n = k210_file_listdir(LISTDIR_PATH "/", &list);
+        t = now_us() - t;
+        if (n != LISTDIR_FILES) {
+            res->errors++;
+            if (list) free(list);
+            continue;
+        }
+        // check the entries
+        size_t ptr = 0;
+        bool ok = true;
+        for (int i=0; (i<n) && (ok); i++) {
+            sprintf(path, "rec_%05d.log", i);
+            uint32_t size;
+            memcpy(&size, (uint8_t *)list + ptr + 1, 4);
+            if ((size != 4) || (strcmp((char *)list + ptr + 9, path) != 0)) ok = false;
+            ptr += strlen(path) + 10;
+        }
+        free(list);
+        if (!ok) {
+            res->errors++;
+            continue;
+        }
+        res->ok++;
+        res->bytes += ptr;
+        res->time_us += t;
+        result_add(res, t);
+    }
+    void *list = NULL;
+    if (k210_file_listdir("/no/such/dir/", &list) != -1) res->errors++;
+    k210_sim_file_remove_all();
+}
+
+typedef struct {
+    int id;
+    int loops;
+    int ok;
+    int errors;
+    double time_us;
+    SemaphoreHandle_t done;
+} conc_task_t;
+
+// Write and read back the task's own file, the requests of all tasks are queued at the same time
+//-----------------------------------
+static void conc_file_task(void *arg)
+{
+    conc_task_t *ct = (conc_task_t *)arg;
+    uint8_t rdbuf[CONC_CHUNK];
+    char path[32];
+    sprintf(path, "/bench/conc_%d.bin", ct->id);
+
+    for (int l=0; l<ct->loops; l++) {
+        double t = now_us();
+        int fd = k210_file_open(path, ESP_FILE_MODE_WR);
+        if (fd < 0) {
+            ct->errors++;
+            continue;
+        }
+        for (int pos=0; pos<CONC_FILE_SIZE; pos+=CONC_CHUNK) {
+            if (k210_file_write(fd, pattern + ((pos + ct->id) % 251), CONC_CHUNK) == CONC_CHUNK) ct->ok++;
+            else ct->errors++;
+        }
+        k210_file_close(fd);
+
+        fd = k210_file_open(path, ESP_FILE_MODE_RO);
+        if (fd < 0) {
+            ct->errors++;
+            continue;
+        }
+        for (int pos=0; pos<CONC_FILE_SIZE; pos+=CONC_CHUNK) {
+            int r = k210_file_read(fd, rdbuf, CONC_CHUNK);
+            if ((r == CONC_CHUNK) && (memcmp(rdbuf, pattern + ((pos + ct->id) % 251), CONC_CHUNK) == 0)) ct->ok++;
+            else ct->errors++;
+        }
+        k210_file_close(fd);
+        ct->time_us += now_us() - t;
+    }
+    xSemaphoreGive(ct->done);
+    vTaskDelete(NULL);
+}
+
+// CONC_TASKS tasks writing and reading their files at the same time
+//------------------------------------------
+static void bench_fconc(bench_result_t *res)
+{
+    conc_task_t ct[CONC_TASKS];
+    int loops = (iterations * CONC_CHUNK) / (CONC_FILE_SIZE * CONC_TASKS);
+    if (loops < 1) loops = 1;
+
+    double tstart = now_us();
+    for (int i=0; i<CONC_TASKS; i++) {
+        memset(&ct[i], 0, sizeof(conc_task_t));
+        ct[i].id = i;
+        ct[i].loops = loops;
+        ct[i].done = xSemaphoreCreateBinary();
+        if (xTaskCreatePinnedToCore(conc_file_task, "conc", 4096, &ct[i], 5, NULL, 0) != pdPASS) {
+            res->errors++;
+            xSemaphoreGive(ct[i].done);
+        }
+    }
+    for (int i=0; i<CONC_TASKS; i++) {
+        xSemaphoreTake(ct[i].done, portMAX_DELAY);
+        vSemaphoreDelete(ct[i].done);
+        res->ok += ct[i].ok;
+        res->errors += ct[i].errors;
+        result_add(res, ct[i].time_us / loops);
+    }
+    res->time_us = now_us() - tstart;
+    res->bytes = (uint64_t)res->ok * CONC_CHUNK;
+    k210_sim_file_remove_all();
+}
+
+// Loopback TCP echo server
+//--------------------------------------
+static void *echo_server_thread(void *arg)
+{
+    int lfd = *(int *)arg;
+    uint8_t buf[4096];
+
+    while (1) {
+        int cfd = accept(lfd, NULL, NULL);
+        if (cfd < 0) break;
+        int n;
+        while ((n = recv(cfd, buf, sizeof(buf), 0)) > 0) {
+            int sent = 0;
+            while (sent < n) {
+                int s = send(cfd, buf + sent, n - sent, 0);
+                if (s <= 0) break;
+                sent += s;
+            }
+        }
+        close(cfd);
+    }
+    return NULL;
+}
+
+//-------------------------------
+static int start_echo_server()
+{
+    static int lfd;
+    static int port = 0;
+    pthread_t thread;
+
+    if (port) return port;
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    lfd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if ((bind(lfd, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(lfd, 4) < 0) ||
+        (getsockname(lfd, (struct sockaddr *)&addr, &addr_len) < 0)) {
+        close(lfd);
+        return -1;
+    }
+    pthread_create(&thread, NULL, echo_server_thread, &lfd);
+    pthread_detach(thread);
+    port = ntohs(addr.sin_port);
+    return port;
+}
+
+// A receive in a batch whose response would not fit gets only the data that fits,
+// the rest stays in the socket for the next receive
+//----------------------------------------
+static bool batch_recv(int fd, int size)
+{
+    k210_sim_frame_t resp;
+    const int fit = 100;
+    // the echo response leaves room for 'fit' bytes of received data in the batch response
+    int echo_len = (spi_master_buffer_size - 64) - 4 - (4 + 9) - fit;
+    int req_len = (4 + echo_len) + (4 + 13);
+    uint8_t *req = malloc(req_len);
+    int32_t *p = (int32_t *)req;
+    bool ok = false;
+
+    p[0] = fd;
+    p[1] = 1000;
+    p[2] = size;
+    p[3] = 0;
+    memcpy(req + 16, pattern, size);
+    if ((k210_request(ESP_COMMAND_SCK_SEND, req, 16 + size, &resp) != K210_SIM_OK) || (*(int32_t *)resp.data != size)) goto exit;
+
+    *((uint16_t *)req) = ESP_COMMAND_ECHO;
+    *((uint16_t *)(req+2)) = echo_len;
+    memcpy(req + 4, pattern, echo_len);
+    uint8_t *rq = req + 4 + echo_len;
+    *((uint16_t *)rq) = ESP_COMMAND_SCK_RECV;
+    *((uint16_t *)(rq+2)) = 13;
+    p = (int32_t *)(rq + 4);
+    p[0] = fd;
+    p[1] = size;
+    p[2] = 1000;
+    rq[4+12] = 0;
+    if (k210_request(ESP_COMMAND_BATCH, req, req_len, &resp) != K210_SIM_OK) goto exit;
+    uint8_t *last = resp.data + 4 + echo_len;
+    int received = *(int32_t *)(last + 4);
+    if ((*((uint16_t *)last) != ESP_COMMAND_SCK_RECV) || (received <= 0) || (received > fit) ||
+        (memcmp(last + 4 + 9, pattern, received) != 0)) goto exit;
+
+    // the rest of the data is received alone
+    p = (int32_t *)req;
+    while (received < size) {
+        p[0] = fd;
+        p[1] = size - received;
+        p[2] = 1000;
+        req[12] = 0;
+        if ((k210_request(ESP_COMMAND_SCK_RECV, req, 13, &resp) != K210_SIM_OK) || (*(int32_t *)resp.data <= 0)) goto exit;
+        int n = *(int32_t *)resp.data;
+        if ((received + n > size) || (memcmp(resp.data + 9, pattern + received, n) != 0)) goto exit;
+        received += n;
+    }
+    ok = true;
+
+exit:
+    free(req);
+    return ok;
+}
+
+//-----------------------------------------------------
+static void bench_socket(bench_result_t *res, int size)
+{
+    k210_sim_frame_t resp;
+    uint8_t req[64 + 16384];
+    uint32_t seq = 0;
+    int32_t value;
+
+    int port = start_echo_server();
+    if (port < 0) {
+        res->errors++;
+        return;
+    }
+
+    // open and connect
+    int32_t *p = (int32_t *)req;
+    p[0] = AF_INET;
+    p[1] = SOCK_STREAM;
+    p[2] = 0;
+    req[12] = 0;
+    if (k210_request(ESP_COMMAND_SCK_OPEN, req, 13, &resp) != K210_SIM_OK) {
+        res->errors++;
+        return;
+    }
+    int fd = *(int32_t *)resp.data;
+    p[0] = fd;
+    p[1] = port;
+    strcpy((char *)(req + 8), "127.0.0.1");
+    if ((k210_request(ESP_COMMAND_SCK_CONNECT, req, 8 + 10, &resp) != K210_SIM_OK) || (*(int32_t *)resp.data < 0)) {
+        res->errors++;
+        goto exit;
+    }
+    k210_sim_wait_status(ESP32_STATUS_CODE_SOCKETRD, &seq, NULL, 0);
+
+    for (int i=0; i<iterations; i++) {
+        const uint8_t *data = pattern + (i & 0xFF);
+        double t = now_us();
+        // send
+        p[0] = fd;
+        p[1] = 1000;
+        p[2] = size;
+        p[3] = 0;
+        memcpy(req + 16, data, size);
+        if ((k210_request(ESP_COMMAND_SCK_SEND, req, 16 + size, &resp) != K210_SIM_OK) || (*(int32_t *)resp.data != size)) {
+            res->errors++;
+            continue;
+        }
+        // receive the echoed data, wait for the data available status before each receive
+        int received = 0;
+        bool ok = true;
+        while (received < size) {
+            if (!k210_sim_wait_status(ESP32_STATUS_CODE_SOCKETRD, &seq, &value, 1000)) {
+                ok = false;
+                break;
+            }
+            // older K210 firmware gets the socket fd instead of the bitmap of ready sockets
+            if ((legacy_k210) ? (value != fd) : ((value & (1u << (fd - LWIP_SOCKET_OFFSET))) == 0)) continue;
+            p[0] = fd;
+            p[1] = size - received;
+            p[2] = 1000;
+            req[12] = 0;
+            if ((k210_request(ESP_COMMAND_SCK_RECV, req, 13, &resp) != K210_SIM_OK) || (*(int32_t *)resp.data <= 0)) {
+                ok = false;
+                break;
+            }
+            int n = *(int32_t *)resp.data;
+            if ((received + n > size) || (memcmp(resp.data + 9, data + received, n) != 0)) {
+                ok = false;
+                break;
+            }
+            received += n;
+        }
+        t = now_us() - t;
+        if (!ok) {
+            res->errors++;
+            continue;
+        }
+        res->ok++;
+        res->bytes += size * 2;
+        res->time_us += t;
+        result_add(res, t);
+    }
+    if (!batch_recv(fd, size)) res->errors++;
+
+exit:
+    p[0] = fd;
+    k210_request(ESP_COMMAND_SCK_CLOSE, req, 4, &resp);
+}
+
+//-----------------------------------------------------------------------------------
+static void rqget_block(uint16_t status, const uint8_t *data, uint16_t len, void *arg)
+{
+    rq_blocks++;
+    if (status == ESP_STATUS_RQHEADER) rq_headers++;
+    if (status != ESP_STATUS_MULTIBLOCK) return;
+    for (int i=0; i<len; i++) {
+        if (data[i] != (uint8_t)((rq_received + i) * 7 + 3)) {
+            rq_bad++;
+            break;
+        }
+    }
+    rq_received += len;
+}
+
+//-----------------------------------------------------
+static void bench_rqget(bench_result_t *res, int size)
+{
+    k210_sim_frame_t resp;
+    char url[64];
+    int loops = iterations / 20;
+    if (loops < 1) loops = 1;
+
+    sprintf(url, "http://sim/bytes/%d", size);
+    k210_sim_set_block_handler(rqget_block, NULL);
+    for (int i=0; i<loops; i++) {
+        rq_received = 0;
+        rq_blocks = 0;
+        rq_headers = 0;
+        rq_bad = 0;
+        double t = now_us();
+        resp.data = resp_buf;
+        resp.size = resp_buf_size;
+        int r = k210_sim_request(ESP_COMMAND_RQGET, url, strlen(url), &resp, RESPONSE_TIMEOUT);
+        t = now_us() - t;
+        if ((r != K210_SIM_OK) || (resp.cmdstat != (ESP_STATUS_RQFINISH | ESP_COMMAND_RQGET)) ||
+            (*(int32_t *)resp.data != size) || (rq_received != size) || (rq_bad) ||
+            // the headers block is only sent to the K210 firmware which accepts it
+            (rq_headers != ((legacy_k210) ? 0 : 1))) {
+            res->errors++;
+            continue;
+        }
+        res->ok++;
+        res->bytes += size;
+        res->time_us += t;
+        result_add(res, t);
+    }
+    k210_sim_set_block_handler(NULL, NULL);
+}
+
+// The SPI task exits on DEEPSLEEP request, SOCKET_task is monitoring a connected socket
+//-----------------------------
+static bool bench_shutdown()
+{
+    k210_sim_frame_t resp;
+    uint8_t req[64];
+    uint32_t seq = 0;
+    int32_t *p = (int32_t *)req;
+
+    int port = start_echo_server();
+    if (port < 0) return false;
+    p[0] = AF_INET;
+    p[1] = SOCK_STREAM;
+    p[2] = 0;
+    req[12] = 0;
+    if (k210_request(ESP_COMMAND_SCK_OPEN, req, 13, &resp) != K210_SIM_OK) return false;
+    int fd = *(int32_t *)resp.data;
+    p[0] = fd;
+    p[1] = port;
+    strcpy((char *)(req + 8), "127.0.0.1");
+    if ((k210_request(ESP_COMMAND_SCK_CONNECT, req, 8 + 10, &resp) != K210_SIM_OK) || (*(int32_t *)resp.data < 0)) return false;
+    k210_sim_wait_status(ESP32_STATUS_CODE_SOCKETRD, &seq, NULL, 0);
+
+    // DEEPSLEEP has no response, the SPI task exits after it
+    uint32_t sleep_time = (uint32_t)time(NULL) + 3600;
+    resp.data = resp_buf;
+    resp.size = resp_buf_size;
+    k210_sim_request(ESP_COMMAND_DEEPSLEEP, &sleep_time, 4, &resp, RESPONSE_TIMEOUT);
+    for (int i=0; (i < 500) && ((spi_task_handle) || (socket_task_handle) || (ssl_task_handle)); i++) usleep(10000);
+    if ((spi_task_handle) || (socket_task_handle) || (ssl_task_handle) || (sock_mutex)) return false;
+    for (int i=0; i<CONFIG_LWIP_MAX_SOCKETS; i++) {
+        if (opened_sockets[i].fd >= 0) return false;
+    }
+    int32_t exit_val;
+    return ((xQueueReceive(main_evt_queue, &exit_val, 0) == pdTRUE) && (exit_val == (int32_t)sleep_time));
+}
+
+// ==== Main ==================================================================
+
+//------------------------------------------------
+static bool test_enabled(const char *tests, const char *name)
+{
+    if (tests == NULL) return true;
+    const char *p = strstr(tests, name);
+    if (p == NULL) return false;
+    if ((p != tests) && (p[-1] != ',')) return false;
+    return ((p[strlen(name)] == '\0') || (p[strlen(name)] == ','));
+}
+
+//============================
+int main(int argc, char **argv)
+{
+    k210_sim_config_t config;
+    k210_sim_stats_t stats;
+    const char *tests = NULL;
+    char name[32];
+    int opt;
+
+    k210_sim_default_config(&config);
+    bool log_text = false;
+    while ((opt = getopt(argc, argv, "c:n:e:t:zolv:")) != -1) {
+        switch (opt) {
+            case 'c': config.clock_hz = atoi(optarg); break;
+            case 'n': iterations = atoi(optarg); break;
+            case 'e': config.bit_error_rate = atof(optarg); break;
+            case 't': tests = optarg; break;
+            case 'z': config.lz = true; break;
+            case 'o': config.legacy = legacy_k210 = true; break;
+            case 'l': log_text = true; break;
+            case 'v': debug_log = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-c clock_hz] [-n iterations] [-e bit_error_rate] [-t echo,batch,file,fpipe,listdir,fconc,socket,rqget] [-z] [-o] [-l] [-v level]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (iterations < 1) iterations = 1;
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    sim_log_enabled = (debug_log > 0);
+
+    resp_buf = malloc(resp_buf_size);
+    pattern = malloc(65536 + 512);
+    if (log_text) fill_log_text(pattern, 65536 + 512);
+    else for (int i=0; i<(65536 + 512); i++) pattern[i] = (uint8_t)(rand() & 0xFF);
+
+    k210_sim_init(&config);
+    // the SPI task reports the deep sleep request to the main task
+    main_evt_queue = xQueueCreate(1, sizeof(int32_t));
+    // WiFi is not simulated, the socket and request tests use the host network
+    wifi_is_connected = true;
+    xTaskCreatePinnedToCore(SPI_task, "SPI task", 4096, NULL, 7, &spi_task_handle, 1);
+
+    for (int i=0; (i < 500) && (!k210_slave_connected); i++) usleep(10000);
+    if (!k210_slave_connected) {
+        printf("K210 not detected\n");
+        return 1;
+    }
+    // let the startup requests complete
+    usleep(100000);
+    k210_sim_reset_stats();
+
+    printf("SPI clock %u Hz, buffer %u bytes, bit error rate %g, %d iterations, compression %s, %s data\n\n",
+            k210_sim_get_clock(), spi_master_buffer_size, config.bit_error_rate, iterations,
+            (config.lz) ? "on" : "off", (log_text) ? "log text" : "random");
+    printf("%-16s %7s %6s %10s %10s %9s %9s\n", "test", "ok", "errors", "frames/s", "KB/s", "p50 us", "p99 us");
+
+    bench_result_t res, res2;
+    int total_errors = 0;
+    if (test_enabled(tests, "echo")) {
+        int sizes[] = {16, 256, 4096, 16384};
+        for (int i=0; i<4; i++) {
+            sprintf(name, "echo %d", sizes[i]);
+            result_init(&res, name);
+            bench_echo(&res, sizes[i]);
+            total_errors += res.errors;
+            result_print(&res);
+        }
+    }
+    if (test_enabled(tests, "batch")) {
+        int sizes[] = {16, 1024};
+        for (int i=0; i<2; i++) {
+            sprintf(name, "batch %dx%d", BATCH_COMMANDS, sizes[i]);
+            result_init(&res, name);
+            bench_batch(&res, sizes[i]);
+            total_errors += res.errors;
+            result_print(&res);
+        }
+    }
+    if (test_enabled(tests, "file")) {
+        int sizes[] = {1024, 16384};
+        for (int i=0; i<2; i++) {
+            char name2[32];
+            sprintf(name, "fwrite %d", sizes[i]);
+            sprintf(name2, "fread %d", sizes[i]);
+            result_init(&res, name);
+            result_init(&res2, name2);
+            bench_file(&res, &res2, sizes[i]);
+            total_errors += res.errors + res2.errors;
+            result_print(&res);
+            result_print(&res2);
+        }
+    }
+    if (test_enabled(tests, "fpipe")) {
+        result_init(&res, "fpipe");
+        bench_fpipe(&res);
+        total_errors += res.errors;
+        result_print(&res);
+    }
+    if (test_enabled(tests, "listdir")) {
+        sprintf(name, "listdir %d", LISTDIR_FILES);
+        result_init(&res, name);
+        bench_listdir(&res);
+        total_errors += res.errors;
+        result_print(&res);
+    }
+    if (test_enabled(tests, "fconc")) {
+        sprintf(name, "fconc %d", CONC_TASKS);
+        result_init(&res, name);
+        bench_fconc(&res);
+        total_errors += res.errors;
+        result_print(&res);
+    }
+    if (test_enabled(tests, "socket")) {
+        int sizes[] = {64, 4096};
+        for (int i=0; i<2; i++) {
+            sprintf(name, "socket %d", sizes[i]);
+            result_init(&res, name);
+            bench_socket(&res, sizes[i]);
+            total_errors += res.errors;
+            result_print(&res);
+        }
+    }
+    if (test_enabled(tests, "rqget")) {
+        sprintf(name, "rqget %d", RQGET_SIZE);
+        result_init(&res, name);
+        bench_rqget(&res, RQGET_SIZE);
+        total_errors += res.errors;
+        result_print(&res);
+    }
+
+    k210_sim_get_stats(&stats);
+    printf("\nLink: %u commands (%u crc errors, %u busy), %u data crc errors, %u frame errors, %u protocol errors, %u bit errors\n",
+            stats.commands, stats.cmd_crc_errors, stats.cmd_busy, stats.data_crc_errors, stats.frame_errors,
+            stats.protocol_errors, stats.bit_errors);
+    printf("      %llu bytes sent, %llu bytes received, %.1f ms on the wire\n",
+            (unsigned long long)stats.bytes_tx, (unsigned long long)stats.bytes_rx, stats.wire_ns / 1e6);
+    printf("      %u requests (%u pulses), %u file requests, %u blocks, %u status messages\n",
+            stats.requests, stats.request_pulses, stats.file_requests, stats.blocks, stats.status_msgs);
+    if (config.lz) printf("      %u compressed frames sent, %u received\n", stats.lz_frames_tx, stats.lz_frames_rx);
+
+    // ESP32 side statistics, read with the statistics command as K210 would do it
+    k210_sim_frame_t resp;
+    uint8_t reset = 0;
+    if ((k210_request(ESP_COMMAND_GETSTATS, &reset, 1, &resp) == K210_SIM_OK) && (resp.len >= sizeof(link_stats_header_t))) {
+        link_stats_header_t hdr;
+        memcpy(&hdr, resp.data, sizeof(hdr));
+        const uint32_t *counters = (const uint32_t *)(resp.data + sizeof(hdr));
+        const link_stats_hist_t *phases = (const link_stats_hist_t *)(counters + hdr.n_counters);
+        printf("ESP32: %u transfers, %u retries, %u crc16 errors, %u frame errors, %u handshake timeouts, %u long waits\n",
+                counters[LINK_STAT_TRANSFERS], counters[LINK_STAT_RETRIES], counters[LINK_STAT_CRC16_ERRORS],
+                counters[LINK_STAT_FRAME_ERRORS], counters[LINK_STAT_HANDSHAKE_TIMEOUTS], counters[LINK_STAT_LONG_WAITS]);
+        printf("       phase avg (us): command %.1f, ready %.1f, data %.1f, process %.1f; %u commands\n",
+                (phases[LINK_PHASE_COMMAND].count) ? (double)phases[LINK_PHASE_COMMAND].sum_us / phases[LINK_PHASE_COMMAND].count : 0.0,
+                (phases[LINK_PHASE_READY].count) ? (double)phases[LINK_PHASE_READY].sum_us / phases[LINK_PHASE_READY].count : 0.0,
+                (phases[LINK_PHASE_DATA].count) ? (double)phases[LINK_PHASE_DATA].sum_us / phases[LINK_PHASE_DATA].count : 0.0,
+                (phases[LINK_PHASE_PROCESS].count) ? (double)phases[LINK_PHASE_PROCESS].sum_us / phases[LINK_PHASE_PROCESS].count : 0.0,
+                hdr.n_commands);
+        if (debug_log > 0) {
+            char *text = malloc(8192);
+            link_stats_text(text, 8192);
+            printf("\n%s", text);
+            free(text);
+        }
+    }
+    else printf("ESP32: statistics not received\n");
+
+    if (test_enabled(tests, "shutdown")) {
+        bool ok = bench_shutdown();
+        printf("\nShutdown: %s\n", (ok) ? "socket tasks terminated, sockets closed" : "FAILED");
+        if (!ok) total_errors++;
+    }
+
+    // with bit errors some of the requests are expected to fail
+    return ((total_errors) && (config.bit_error_rate == 0.0)) ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * Frame compression microbenchmark
+ * Measures the speed and the ratio of the 'spi_lz.c' compressor and decompressor
+ * on 32 KB frames (SPI_BUFFER_SIZE_MAX) of log text and of random data,
+ * checks that every frame decompresses to the original data, also in place.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "spi_lz.h"
+
+#define FRAME_SIZE      32704   // largest frame payload
+#define ITERATIONS      500
+
+static uint8_t frame[FRAME_SIZE];
+static uint8_t packed[FRAME_SIZE];
+static uint8_t *inplace;
+static uint16_t table[LZ_TABLE_SIZE];
+
+//--------------------
+static double now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e6) + (ts.tv_nsec / 1e3);
+}
+
+//------------------------------
+static void fill_log_text(int n)
+{
+    static const char *tags[] = {"sensor", "wifi", "sdcard", "main", "display"};
+    char line[128];
+    int pos = 0;
+    while (pos < FRAME_SIZE) {
+        int len = snprintf(line, sizeof(line), "%c (%07u) %s: temp=%d.%d C, hum=%d%%, vbat=%d mV, status 0x%04X\n",
+                ((rand() % 8) == 0) ? 'W' : 'I', n * 250 + (rand() % 50), tags[rand() % 5],
+                20 + (rand() % 10), rand() % 10, 40 + (rand() % 20), 3600 + (rand() % 500), rand() & 0xFFFF);
+        if (len > (FRAME_SIZE - pos)) len = FRAME_SIZE - pos;
+        memcpy(frame + pos, line, len);
+        pos += len;
+        n++;
+    }
+}
+
+// Round trip of all lengths up to 'max_len', normal and in place decompression
+//-------------------------------
+static int verify(size_t max_len)
+{
+    int err = 0;
+    uint8_t *out = malloc(FRAME_SIZE);
+    for (size_t len=0; len<=max_len; len = (len < 64) ? len+1 : (len * 3) + 1) {
+        size_t clen = lz_compress(frame, len, packed, FRAME_SIZE, table);
+        if ((clen == 0) || (lz_decompress(packed, clen, out, len) != (int)len) || (memcmp(out, frame, len) != 0)) {
+            printf("round trip error, length=%zu\n", len);
+            err++;
+            continue;
+        }
+        // the compressed data at the end of the buffer with the in place margin
+        uint8_t *in = inplace + len + LZ_INPLACE_MARGIN(len) - clen;
+        memcpy(in, packed, clen);
+        if ((lz_decompress(in, clen, inplace, len) != (int)len) || (memcmp(inplace, frame, len) != 0)) {
+            printf("in place error, length=%zu\n", len);
+            err++;
+        }
+        // truncated data must be rejected
+        if ((clen > 1) && (lz_decompress(packed, clen-1, out, len) == (int)len)) {
+            printf("truncated data accepted, length=%zu\n", len);
+            err++;
+        }
+    }
+    free(out);
+    return err;
+}
+
+//---------------------------------------
+static int bench(const char *name)
+{
+    uint8_t *out = malloc(FRAME_SIZE);
+    size_t clen = 0;
+    double t = now_us();
+    for (int i=0; i<ITERATIONS; i++) clen = lz_compress(frame, FRAME_SIZE, packed, FRAME_SIZE - (FRAME_SIZE / 16), table);
+    double tc = now_us() - t;
+    printf("%-8s compress %9.1f us/frame %8.1f MB/s", name, tc / ITERATIONS, ((double)FRAME_SIZE * ITERATIONS) / tc);
+    if (clen == 0) {
+        // rejected, sent uncompressed
+        printf("  not compressed\n");
+        free(out);
+        return 0;
+    }
+    int err = 0;
+    t = now_us();
+    for (int i=0; i<ITERATIONS; i++) {
+        if (lz_decompress(packed, clen, out, FRAME_SIZE) != FRAME_SIZE) err++;
+    }
+    double td = now_us() - t;
+    printf("  decompress %8.1f MB/s  ratio %.2f\n", ((double)FRAME_SIZE * ITERATIONS) / td, (double)FRAME_SIZE / clen);
+    if ((err) || (memcmp(out, frame, FRAME_SIZE) != 0)) {
+        printf("decompression error\n");
+        err++;
+    }
+    free(out);
+    return err;
+}
+
+//=====================
+int main(int argc, char **argv)
+{
+    int err = 0;
+    inplace = malloc(FRAME_SIZE + LZ_INPLACE_MARGIN(FRAME_SIZE));
+
+    srand(1);
+    printf("Frame size: %d bytes, %d iterations\n\n", FRAME_SIZE, ITERATIONS);
+
+    fill_log_text(0);
+    err += verify(FRAME_SIZE);
+    err += bench("log");
+
+    for (int i=0; i<FRAME_SIZE; i++) frame[i] = rand();
+    err += bench("random");
+
+    // compressible start followed by random data, the worst case for in place decompression
+    fill_log_text(100);
+    for (int i=FRAME_SIZE/2; i<FRAME_SIZE; i++) frame[i] = rand();
+    err += verify(FRAME_SIZE);
+    err += bench("mixed");
+
+    free(inplace);
+    if (err) {
+        printf("FAILED\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <time.h>
+#include <sys/time.h>
+
+#define SNTP_OPMODE_POLL        0
+
+typedef enum {
+    SNTP_SYNC_MODE_IMMED,
+    SNTP_SYNC_MODE_SMOOTH,
+} sntp_sync_mode_t;
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval *tv);
+
+void sntp_setoperatingmode(int operating_mode);
+void sntp_setservername(int idx, const char *server);
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback);
+void sntp_set_sync_mode(sntp_sync_mode_t sync_mode);
+void sntp_init(void);
+void sntp_stop(void);
+bool sntp_enabled(void);
@@ -0,0 +1,5 @@
+#pragma once
+
+typedef signed char err_t;
+
+#define ERR_OK      0
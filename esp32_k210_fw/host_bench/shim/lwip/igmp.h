@@ -0,0 +1,5 @@
+#pragma once
+
+#include "lwip/ip4.h"
+
+err_t igmp_joingroup(const ip4_addr_t *ifaddr, const ip4_addr_t *groupaddr);
@@ -0,0 +1,43 @@
+/*
+ * lwIP socket API mapped to the host BSD sockets
+ */
+#pragma once
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define LWIP_SOCKET_OFFSET      0
+
+#define lwip_socket             socket
+#define lwip_bind               bind
+#define lwip_listen             listen
+#define lwip_accept             accept
+#define lwip_connect            connect
+#define lwip_close              close
+#define lwip_read               read
+#define lwip_write              write
+#define lwip_recv               recv
+#define lwip_recvfrom           recvfrom
+#define lwip_send               send
+#define lwip_sendto             sendto
+#define lwip_select             select
+#define lwip_fcntl              fcntl
+#define lwip_setsockopt         setsockopt
+#define lwip_getsockopt         getsockopt
+#define lwip_getsockname        getsockname
+#define lwip_getaddrinfo        sim_getaddrinfo
+#define lwip_freeaddrinfo       freeaddrinfo
+#define lwip_ntohs              ntohs
+#define lwip_htons              htons
+
+// host getaddrinfo, the simulated HTTP server host 'sim' resolves to 127.0.0.1 (see 'sim/net_host.c')
+int sim_getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res);
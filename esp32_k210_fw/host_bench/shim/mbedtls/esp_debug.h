@@ -0,0 +1,5 @@
+#pragma once
+
+#include "mbedtls/ssl.h"
+
+void mbedtls_esp_enable_debug_log(mbedtls_ssl_config *conf, int threshold);
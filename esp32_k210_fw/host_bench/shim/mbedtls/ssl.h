@@ -0,0 +1,97 @@
+/*
+ * mbedTLS API subset used by the firmware SSL sockets
+ * TLS is not simulated, the functions fail (see 'sim/net_host.c')
+ */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MBEDTLS_ERR_NET_CONN_RESET          -0x0050
+#define MBEDTLS_ERR_NET_UNKNOWN_HOST        -0x0052
+#define MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY   -0x7880
+#define MBEDTLS_ERR_SSL_WANT_READ           -0x6900
+#define MBEDTLS_ERR_SSL_WANT_WRITE          -0x6880
+#define MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE -0x7080
+#define MBEDTLS_ERR_SSL_TIMEOUT             -0x6800
+
+#define MBEDTLS_NET_PROTO_TCP               0
+#define MBEDTLS_NET_POLL_READ               1
+#define MBEDTLS_NET_POLL_WRITE              2
+#define MBEDTLS_SSL_IS_CLIENT               0
+#define MBEDTLS_SSL_IS_SERVER               1
+#define MBEDTLS_SSL_TRANSPORT_STREAM        0
+#define MBEDTLS_SSL_PRESET_DEFAULT          0
+#define MBEDTLS_SSL_VERIFY_NONE             0
+#define MBEDTLS_SSL_VERIFY_OPTIONAL         1
+#define MBEDTLS_SSL_VERIFY_REQUIRED         2
+#define MBEDTLS_SSL_SESSION_TICKETS_DISABLED 0
+#define MBEDTLS_SSL_SESSION_TICKETS_ENABLED 1
+#define MBEDTLS_SSL_SESSION_TICKETS
+
+typedef struct { int fd; } mbedtls_net_context;
+typedef struct { int dummy; } mbedtls_entropy_context;
+typedef struct { int dummy; } mbedtls_ctr_drbg_context;
+typedef struct { int dummy; } mbedtls_ssl_config;
+typedef struct { int dummy; } mbedtls_ssl_context;
+typedef struct { int dummy; } mbedtls_ssl_session;
+typedef struct { int dummy; } mbedtls_x509_crt;
+typedef struct { int dummy; } mbedtls_pk_context;
+
+typedef int (*mbedtls_ssl_send_t)(void *ctx, const unsigned char *buf, size_t len);
+typedef int (*mbedtls_ssl_recv_t)(void *ctx, unsigned char *buf, size_t len);
+typedef int (*mbedtls_ssl_recv_timeout_t)(void *ctx, unsigned char *buf, size_t len, uint32_t timeout);
+
+void mbedtls_net_init(mbedtls_net_context *ctx);
+void mbedtls_net_free(mbedtls_net_context *ctx);
+int mbedtls_net_connect(mbedtls_net_context *ctx, const char *host, const char *port, int proto);
+int mbedtls_net_bind(mbedtls_net_context *ctx, const char *bind_ip, const char *port, int proto);
+int mbedtls_net_accept(mbedtls_net_context *bind_ctx, mbedtls_net_context *client_ctx, void *client_ip, size_t buf_size, size_t *ip_len);
+int mbedtls_net_set_nonblock(mbedtls_net_context *ctx);
+int mbedtls_net_poll(mbedtls_net_context *ctx, uint32_t rw, uint32_t timeout);
+int mbedtls_net_send(void *ctx, const unsigned char *buf, size_t len);
+int mbedtls_net_recv(void *ctx, unsigned char *buf, size_t len);
+
+void mbedtls_entropy_init(mbedtls_entropy_context *ctx);
+void mbedtls_entropy_free(mbedtls_entropy_context *ctx);
+int mbedtls_entropy_func(void *data, unsigned char *output, size_t len);
+void mbedtls_ctr_drbg_init(mbedtls_ctr_drbg_context *ctx);
+void mbedtls_ctr_drbg_free(mbedtls_ctr_drbg_context *ctx);
+int mbedtls_ctr_drbg_seed(mbedtls_ctr_drbg_context *ctx, int (*f_entropy)(void *, unsigned char *, size_t),
+        void *p_entropy, const unsigned char *custom, size_t len);
+int mbedtls_ctr_drbg_random(void *p_rng, unsigned char *output, size_t output_len);
+
+void mbedtls_x509_crt_init(mbedtls_x509_crt *crt);
+void mbedtls_x509_crt_free(mbedtls_x509_crt *crt);
+int mbedtls_x509_crt_parse(mbedtls_x509_crt *chain, const unsigned char *buf, size_t buflen);
+int mbedtls_x509_crt_verify_info(char *buf, size_t size, const char *prefix, uint32_t flags);
+void mbedtls_pk_init(mbedtls_pk_context *ctx);
+void mbedtls_pk_free(mbedtls_pk_context *ctx);
+int mbedtls_pk_parse_key(mbedtls_pk_context *ctx, const unsigned char *key, size_t keylen, const unsigned char *pwd, size_t pwdlen);
+
+void mbedtls_ssl_init(mbedtls_ssl_context *ssl);
+void mbedtls_ssl_free(mbedtls_ssl_context *ssl);
+void mbedtls_ssl_config_init(mbedtls_ssl_config *conf);
+void mbedtls_ssl_config_free(mbedtls_ssl_config *conf);
+int mbedtls_ssl_config_defaults(mbedtls_ssl_config *conf, int endpoint, int transport, int preset);
+void mbedtls_ssl_conf_authmode(mbedtls_ssl_config *conf, int authmode);
+void mbedtls_ssl_conf_ca_chain(mbedtls_ssl_config *conf, mbedtls_x509_crt *ca_chain, void *ca_crl);
+int mbedtls_ssl_conf_own_cert(mbedtls_ssl_config *conf, mbedtls_x509_crt *own_cert, mbedtls_pk_context *pk_key);
+void mbedtls_ssl_conf_rng(mbedtls_ssl_config *conf, int (*f_rng)(void *, unsigned char *, size_t), void *p_rng);
+int mbedtls_ssl_setup(mbedtls_ssl_context *ssl, const mbedtls_ssl_config *conf);
+int mbedtls_ssl_set_hostname(mbedtls_ssl_context *ssl, const char *hostname);
+void mbedtls_ssl_set_bio(mbedtls_ssl_context *ssl, void *p_bio, mbedtls_ssl_send_t f_send,
+        mbedtls_ssl_recv_t f_recv, mbedtls_ssl_recv_timeout_t f_recv_timeout);
+int mbedtls_ssl_handshake(mbedtls_ssl_context *ssl);
+uint32_t mbedtls_ssl_get_verify_result(const mbedtls_ssl_context *ssl);
+const char *mbedtls_ssl_get_ciphersuite(const mbedtls_ssl_context *ssl);
+size_t mbedtls_ssl_get_bytes_avail(const mbedtls_ssl_context *ssl);
+int mbedtls_ssl_read(mbedtls_ssl_context *ssl, unsigned char *buf, size_t len);
+int mbedtls_ssl_write(mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len);
+int mbedtls_ssl_close_notify(mbedtls_ssl_context *ssl);
+int mbedtls_ssl_session_reset(mbedtls_ssl_context *ssl);
+void mbedtls_ssl_conf_session_tickets(mbedtls_ssl_config *conf, int use_tickets);
+void mbedtls_ssl_session_init(mbedtls_ssl_session *session);
+void mbedtls_ssl_session_free(mbedtls_ssl_session *session);
+int mbedtls_ssl_get_session(const mbedtls_ssl_context *ssl, mbedtls_ssl_session *session);
+int mbedtls_ssl_set_session(mbedtls_ssl_context *ssl, const mbedtls_ssl_session *session);
@@ -0,0 +1,9 @@
+/*
+ * Host build configuration, the values used by the simulated firmware modules
+ */
+#pragma once
+
+#define CONFIG_FREERTOS_HZ                  1000
+#define CONFIG_LWIP_MAX_SOCKETS             10
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ   240
+#define CONFIG_MBEDTLS_DEBUG_LEVEL 0
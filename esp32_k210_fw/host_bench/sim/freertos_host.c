@@ -0,0 +1,490 @@
+/*
+ * FreeRTOS API subset on POSIX threads
+ * ---------------------------------------------------------------------------------------
+ * Every task is a thread, the priorities and core affinity are ignored.
+ * Threads not created as tasks (the benchmark main thread) get the task
+ * structure on first use, so they can use the task notifications too.
+ * The task structures are never freed, a notification sent to a deleted task is lost.
+ * Task watchdog subscription is tracked per task, with the same return codes
+ * as ESP-IDF, so that the firmware 'CHECK_ERROR_CODE()' checks are exercised.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_task_wdt.h"
+#include "k210_sim.h"
+
+#define TASK_STACK_SIZE     (256*1024)
+
+struct sim_task {
+    pthread_t       thread;
+    TaskFunction_t  code;
+    void            *param;
+    char            name[16];
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    uint32_t        notify_value;
+    bool            notify_pending;
+    bool            wdt;
+    bool            running;
+};
+
+struct sim_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    uint8_t         *items;
+    UBaseType_t     length;
+    UBaseType_t     item_size;
+    UBaseType_t     head;
+    UBaseType_t     count;
+};
+
+struct sim_event_group {
+    pthread_mutex_t mutex;
+    pthread_cond_t  cond;
+    EventBits_t     bits;
+};
+
+static __thread struct sim_task *current_task = NULL;
+static pthread_mutex_t tasks_mutex = PTHREAD_MUTEX_INITIALIZER;
+static UBaseType_t tasks_running = 0;
+static uint64_t start_time = 0;
+
+
+//----------------------------------------
+static void init_cond(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+//------------------------------------------------------------------
+static bool wait_deadline(TickType_t ticks, struct timespec *ts)
+{
+    // false: wait forever
+    if (ticks == portMAX_DELAY) return false;
+    uint64_t t = sim_time_ns() + ((uint64_t)ticks * portTICK_PERIOD_MS * 1000000ULL);
+    ts->tv_sec = t / 1000000000ULL;
+    ts->tv_nsec = t % 1000000000ULL;
+    return true;
+}
+
+//----------------------------------------------------
+static struct sim_task *task_alloc(const char *name)
+{
+    struct sim_task *task = calloc(1, sizeof(struct sim_task));
+    if (task == NULL) return NULL;
+    strncpy(task->name, name, sizeof(task->name)-1);
+    pthread_mutex_init(&task->mutex, NULL);
+    init_cond(&task->cond);
+    return task;
+}
+
+//----------------------------------
+static struct sim_task *task_self()
+{
+    if (current_task == NULL) {
+        current_task = task_alloc("host");
+        if (current_task) current_task->thread = pthread_self();
+    }
+    return current_task;
+}
+
+//----------------------------------
+static void *task_start(void *arg)
+{
+    struct sim_task *task = (struct sim_task *)arg;
+    current_task = task;
+    task->code(task->param);
+    // a FreeRTOS task must not return
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+// ==== Tasks =================================================================
+
+//===============================================================================================
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t code, const char *name, uint32_t stack_depth,
+        void *param, UBaseType_t priority, TaskHandle_t *created_task, BaseType_t core_id)
+{
+    pthread_attr_t attr;
+    struct sim_task *task = task_alloc(name);
+    if (task == NULL) return pdFAIL;
+    task->code = code;
+    task->param = param;
+    task->running = true;
+
+    pthread_mutex_lock(&tasks_mutex);
+    tasks_running++;
+    pthread_mutex_unlock(&tasks_mutex);
+    // the handle must be valid before the task runs
+    if (created_task) *created_task = task;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, TASK_STACK_SIZE);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int res = pthread_create(&task->thread, &attr, task_start, task);
+    pthread_attr_destroy(&attr);
+    if (res != 0) {
+        pthread_mutex_lock(&tasks_mutex);
+        tasks_running--;
+        pthread_mutex_unlock(&tasks_mutex);
+        if (created_task) *created_task = NULL;
+        return pdFAIL;
+    }
+    return pdPASS;
+}
+
+//==================================
+void vTaskDelete(TaskHandle_t task)
+{
+    if ((task != NULL) && (task != current_task)) {
+        fprintf(stderr, "vTaskDelete: deleting other tasks is not supported\n");
+        abort();
+    }
+    task = current_task;
+    if ((task) && (task->running)) {
+        task->running = false;
+        pthread_mutex_lock(&tasks_mutex);
+        tasks_running--;
+        pthread_mutex_unlock(&tasks_mutex);
+    }
+    pthread_exit(NULL);
+}
+
+//=============================
+void vTaskDelay(TickType_t ticks)
+{
+    if (ticks == 0) {
+        sched_yield();
+        return;
+    }
+    struct timespec ts;
+    uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000ULL;
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    while ((nanosleep(&ts, &ts) != 0) && (errno == EINTR));
+}
+
+//========================================
+TaskHandle_t xTaskGetCurrentTaskHandle()
+{
+    return task_self();
+}
+
+//==================================
+UBaseType_t uxTaskGetNumberOfTasks()
+{
+    pthread_mutex_lock(&tasks_mutex);
+    UBaseType_t n = tasks_running;
+    pthread_mutex_unlock(&tasks_mutex);
+    return n;
+}
+
+//==============================
+TickType_t xTaskGetTickCount()
+{
+    if (start_time == 0) start_time = sim_time_ns();
+    return (TickType_t)((sim_time_ns() - start_time) / (portTICK_PERIOD_MS * 1000000ULL));
+}
+
+// ==== Task notifications ====================================================
+
+//===============================================================================
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    BaseType_t res = pdPASS;
+    if (task == NULL) return pdFAIL;
+
+    pthread_mutex_lock(&task->mutex);
+    switch (action) {
+        case eSetBits:
+            task->notify_value |= value;
+            break;
+        case eIncrement:
+            task->notify_value++;
+            break;
+        case eSetValueWithOverwrite:
+            task->notify_value = value;
+            break;
+        case eSetValueWithoutOverwrite:
+            if (task->notify_pending) res = pdFAIL;
+            else task->notify_value = value;
+            break;
+        default:
+            break;
+    }
+    task->notify_pending = true;
+    pthread_cond_signal(&task->cond);
+    pthread_mutex_unlock(&task->mutex);
+    return res;
+}
+
+//=======================================================================================================================
+BaseType_t xTaskNotifyFromISR(TaskHandle_t task, uint32_t value, eNotifyAction action, BaseType_t *higher_prio_woken)
+{
+    if (higher_prio_woken) *higher_prio_woken = pdFALSE;
+    return xTaskNotify(task, value, action);
+}
+
+//===========================================================================================================
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks)
+{
+    struct sim_task *task = task_self();
+    struct timespec ts;
+    bool timed = wait_deadline(ticks, &ts);
+    BaseType_t res = pdFAIL;
+
+    pthread_mutex_lock(&task->mutex);
+    if (!task->notify_pending) {
+        task->notify_value &= ~clear_on_entry;
+        while ((!task->notify_pending) && (ticks > 0)) {
+            if (timed) {
+                if (pthread_cond_timedwait(&task->cond, &task->mutex, &ts) == ETIMEDOUT) break;
+            }
+            else pthread_cond_wait(&task->cond, &task->mutex);
+        }
+    }
+    if (value) *value = task->notify_value;
+    if (task->notify_pending) {
+        task->notify_value &= ~clear_on_exit;
+        task->notify_pending = false;
+        res = pdPASS;
+    }
+    pthread_mutex_unlock(&task->mutex);
+    return res;
+}
+
+// ==== Queues and semaphores =================================================
+
+//=========================================================================
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct sim_queue *queue = calloc(1, sizeof(struct sim_queue));
+    if (queue == NULL) return NULL;
+    if (item_size > 0) {
+        queue->items = malloc(length * item_size);
+        if (queue->items == NULL) {
+            free(queue);
+            return NULL;
+        }
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    pthread_mutex_init(&queue->mutex, NULL);
+    init_cond(&queue->cond);
+    return queue;
+}
+
+//======================================
+void vQueueDelete(QueueHandle_t queue)
+{
+    if (queue == NULL) return;
+    pthread_mutex_destroy(&queue->mutex);
+    pthread_cond_destroy(&queue->cond);
+    free(queue->items);
+    free(queue);
+}
+
+//======================================================================================
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    struct timespec ts;
+    bool timed = wait_deadline(ticks, &ts);
+    BaseType_t res = pdFAIL;
+
+    pthread_mutex_lock(&queue->mutex);
+    while ((queue->count >= queue->length) && (ticks > 0)) {
+        if (timed) {
+            if (pthread_cond_timedwait(&queue->cond, &queue->mutex, &ts) == ETIMEDOUT) break;
+        }
+        else pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+    if (queue->count < queue->length) {
+        // Semaphores are zero-sized queues given with a NULL item
+        if ((queue->item_size > 0) && (item != NULL)) {
+            UBaseType_t idx = (queue->head + queue->count) % queue->length;
+            memcpy(queue->items + (idx * queue->item_size), item, queue->item_size);
+        }
+        queue->count++;
+        pthread_cond_broadcast(&queue->cond);
+        res = pdPASS;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return res;
+}
+
+//================================================================================
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    struct timespec ts;
+    bool timed = wait_deadline(ticks, &ts);
+    BaseType_t res = pdFAIL;
+
+    pthread_mutex_lock(&queue->mutex);
+    while ((queue->count == 0) && (ticks > 0)) {
+        if (timed) {
+            if (pthread_cond_timedwait(&queue->cond, &queue->mutex, &ts) == ETIMEDOUT) break;
+        }
+        else pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+    if (queue->count > 0) {
+        if (queue->item_size > 0) {
+            memcpy(item, queue->items + (queue->head * queue->item_size), queue->item_size);
+        }
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->cond);
+        res = pdPASS;
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return res;
+}
+
+//=========================================
+BaseType_t xQueueReset(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->head = 0;
+    queue->count = 0;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+    return pdPASS;
+}
+
+//=====================================================
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    UBaseType_t n = queue->count;
+    pthread_mutex_unlock(&queue->mutex);
+    return n;
+}
+
+//=====================================
+SemaphoreHandle_t xSemaphoreCreateBinary()
+{
+    return xQueueCreate(1, 0);
+}
+
+//====================================
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+    SemaphoreHandle_t sem = xQueueCreate(1, 0);
+    if (sem) xSemaphoreGive(sem);
+    return sem;
+}
+
+// ==== Event groups ==========================================================
+
+//=====================================
+EventGroupHandle_t xEventGroupCreate()
+{
+    struct sim_event_group *group = calloc(1, sizeof(struct sim_event_group));
+    if (group == NULL) return NULL;
+    pthread_mutex_init(&group->mutex, NULL);
+    init_cond(&group->cond);
+    return group;
+}
+
+//================================================
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+    if (group == NULL) return;
+    pthread_mutex_destroy(&group->mutex);
+    pthread_cond_destroy(&group->cond);
+    free(group);
+}
+
+//=============================================================================
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->mutex);
+    group->bits |= bits;
+    EventBits_t res = group->bits;
+    pthread_cond_broadcast(&group->cond);
+    pthread_mutex_unlock(&group->mutex);
+    return res;
+}
+
+//===============================================================================
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->mutex);
+    EventBits_t res = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->mutex);
+    return res;
+}
+
+//==================================================================================
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits,
+        BaseType_t clear_on_exit, BaseType_t wait_for_all, TickType_t ticks)
+{
+    struct timespec ts;
+    bool timed = wait_deadline(ticks, &ts);
+
+    pthread_mutex_lock(&group->mutex);
+    while (1) {
+        EventBits_t set = group->bits & bits;
+        if ((wait_for_all) ? (set == bits) : (set != 0)) break;
+        if (ticks == 0) break;
+        if (timed) {
+            if (pthread_cond_timedwait(&group->cond, &group->mutex, &ts) == ETIMEDOUT) break;
+        }
+        else pthread_cond_wait(&group->cond, &group->mutex);
+    }
+    EventBits_t res = group->bits;
+    EventBits_t set = res & bits;
+    if ((clear_on_exit) && ((wait_for_all) ? (set == bits) : (set != 0))) group->bits &= ~bits;
+    pthread_mutex_unlock(&group->mutex);
+    return res;
+}
+
+// ==== Task watchdog =========================================================
+
+//============================================
+esp_err_t esp_task_wdt_add(TaskHandle_t task)
+{
+    if (task == NULL) task = task_self();
+    if (task->wdt) return ESP_ERR_INVALID_ARG;
+    task->wdt = true;
+    return ESP_OK;
+}
+
+//===============================================
+esp_err_t esp_task_wdt_delete(TaskHandle_t task)
+{
+    if (task == NULL) task = task_self();
+    if (!task->wdt) return ESP_ERR_INVALID_ARG;
+    task->wdt = false;
+    return ESP_OK;
+}
+
+//===============================================
+esp_err_t esp_task_wdt_status(TaskHandle_t task)
+{
+    if (task == NULL) task = task_self();
+    return (task->wdt) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+//============================
+esp_err_t esp_task_wdt_reset()
+{
+    return (task_self()->wdt) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
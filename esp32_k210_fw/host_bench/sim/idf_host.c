@@ -0,0 +1,311 @@
+/*
+ * ESP-IDF system and driver functions used by the firmware modules, host implementation
+ * The SPI transactions and the handshake line are passed to the simulated K210 slave
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "global.h"
+#include "esp_system.h"
+#include "driver/gpio.h"
+#include "driver/spi_master.h"
+#include "k210_sim.h"
+
+struct spi_device_t {
+    int clock_speed_hz;
+    spi_transaction_t *queued;
+};
+
+static struct spi_device_t spi_device;
+static uint64_t timer_start = 0;
+
+int sim_log_enabled = 0;
+
+
+// ==== System ================================================================
+
+//=============================
+int64_t esp_timer_get_time()
+{
+    if (timer_start == 0) timer_start = sim_time_ns();
+    return (int64_t)((sim_time_ns() - timer_start) / 1000);
+}
+
+//===============================
+void ets_delay_us(uint32_t us)
+{
+    sim_spin_until_ns(sim_time_ns() + (us * 1000ULL));
+}
+
+//=================
+void esp_restart()
+{
+    fprintf(stderr, "esp_restart() called\n");
+    exit(1);
+}
+
+//==============================================
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+        case ESP_OK:                return "ESP_OK";
+        case ESP_FAIL:              return "ESP_FAIL";
+        case ESP_ERR_NO_MEM:        return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG:   return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE:  return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND:     return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT:       return "ESP_ERR_TIMEOUT";
+        default:                    return "UNKNOWN ERROR";
+    }
+}
+
+//==============================================================================
+void sim_log_write(char level, const char *tag, const char *fmt, ...)
+{
+    va_list args;
+    if (!sim_log_enabled) return;
+    printf("%c (%lld) %s: ", level, (long long)(esp_timer_get_time() / 1000), tag);
+    va_start(args, fmt);
+    vprintf(fmt, args);
+    va_end(args);
+    printf("\n");
+}
+
+// ==== Heap ==================================================================
+
+//==================================================
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return malloc(size);
+}
+
+//===================================================================
+void heap_caps_get_info(multi_heap_info_t *info, uint32_t caps)
+{
+    memset(info, 0, sizeof(multi_heap_info_t));
+    info->total_free_bytes = 200000;
+    info->minimum_free_bytes = 200000;
+    info->largest_free_block = 100000;
+}
+
+//============================================
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return 200000;
+}
+
+// ==== GPIO ==================================================================
+
+//=============================================
+esp_err_t gpio_config(const gpio_config_t *conf)
+{
+    if (conf->pin_bit_mask & (1ULL << K210_SIM_HANDSHAKE_GPIO)) k210_sim_handshake_intr_type(conf->intr_type);
+    return ESP_OK;
+}
+
+//=============================================================
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    return ESP_OK;
+}
+
+//=====================================
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    if (gpio_num == K210_SIM_HANDSHAKE_GPIO) return k210_sim_handshake_level();
+    return 0;
+}
+
+//====================================================================
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode)
+{
+    return ESP_OK;
+}
+
+//=========================================================================
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio_num, gpio_pull_mode_t pull)
+{
+    return ESP_OK;
+}
+
+//==============================================================================
+esp_err_t gpio_set_intr_type(gpio_num_t gpio_num, gpio_int_type_t intr_type)
+{
+    if (gpio_num == K210_SIM_HANDSHAKE_GPIO) k210_sim_handshake_intr_type(intr_type);
+    return ESP_OK;
+}
+
+//============================================
+esp_err_t gpio_intr_enable(gpio_num_t gpio_num)
+{
+    if (gpio_num == K210_SIM_HANDSHAKE_GPIO) k210_sim_handshake_intr_enable(true);
+    return ESP_OK;
+}
+
+//=============================================
+esp_err_t gpio_intr_disable(gpio_num_t gpio_num)
+{
+    if (gpio_num == K210_SIM_HANDSHAKE_GPIO) k210_sim_handshake_intr_enable(false);
+    return ESP_OK;
+}
+
+//==========================================================================================
+esp_err_t gpio_isr_handler_add(gpio_num_t gpio_num, gpio_isr_t isr_handler, void *args)
+{
+    if (gpio_num != K210_SIM_HANDSHAKE_GPIO) return ESP_ERR_NOT_SUPPORTED;
+    k210_sim_handshake_isr(isr_handler, args);
+    return ESP_OK;
+}
+
+//=============================================================================================
+esp_err_t gpio_isr_register(void (*fn)(void *), void *arg, int intr_alloc_flags, void *handle)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+//=========================================
+void gpio_pad_select_gpio(uint8_t gpio_num)
+{
+}
+
+// ==== SPI master ============================================================
+
+//===========================================================================================================
+esp_err_t spi_bus_initialize(spi_host_device_t host, const spi_bus_config_t *bus_config, int dma_chan)
+{
+    return ESP_OK;
+}
+
+//============================================
+esp_err_t spi_bus_free(spi_host_device_t host)
+{
+    return ESP_OK;
+}
+
+//========================================================================================================================
+esp_err_t spi_bus_add_device(spi_host_device_t host, const spi_device_interface_config_t *dev_config, spi_device_handle_t *handle)
+{
+    memset(&spi_device, 0, sizeof(spi_device));
+    spi_device.clock_speed_hz = dev_config->clock_speed_hz;
+    k210_sim_set_device_clock(dev_config->clock_speed_hz);
+    *handle = &spi_device;
+    return ESP_OK;
+}
+
+//==========================================================
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle)
+{
+    return ESP_OK;
+}
+
+//--------------------------------------------------------
+static esp_err_t spi_transmit(spi_transaction_t *trans)
+{
+    // Half duplex, the transaction either sends or receives
+    if ((trans->tx_buffer) && (trans->length)) {
+        return k210_sim_transmit(trans->tx_buffer, NULL, trans->length / 8) ? ESP_FAIL : ESP_OK;
+    }
+    if (trans->rx_buffer) {
+        size_t bits = (trans->rxlength) ? trans->rxlength : trans->length;
+        return k210_sim_transmit(NULL, trans->rx_buffer, bits / 8) ? ESP_FAIL : ESP_OK;
+    }
+    return ESP_ERR_INVALID_ARG;
+}
+
+//===================================================================================================================
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle, spi_transaction_t *trans_desc, TickType_t ticks_to_wait)
+{
+    if (handle->queued) return ESP_ERR_TIMEOUT;
+    esp_err_t ret = spi_transmit(trans_desc);
+    if (ret == ESP_OK) handle->queued = trans_desc;
+    return ret;
+}
+
+//==========================================================================================================================
+esp_err_t spi_device_get_trans_result(spi_device_handle_t handle, spi_transaction_t **trans_desc, TickType_t ticks_to_wait)
+{
+    if (handle->queued == NULL) return ESP_ERR_TIMEOUT;
+    *trans_desc = handle->queued;
+    handle->queued = NULL;
+    return ESP_OK;
+}
+
+//=====================================================================================
+esp_err_t spi_device_polling_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc)
+{
+    return spi_transmit(trans_desc);
+}
+
+//=========================================================================================================
+esp_err_t spi_device_nodma_transmit(spi_device_handle_t handle, spi_transaction_t *trans_desc, int16_t delay)
+{
+    return spi_transmit(trans_desc);
+}
+
+//=======================================================
+bool spi_device_uses_native_pins(spi_device_handle_t handle)
+{
+    return false;
+}
+
+//==================================================
+int spi_device_get_speed(spi_device_handle_t handle)
+{
+    return k210_sim_get_clock();
+}
+
+// ==== Application globals (defined in 'app_main.c' on ESP32) ================
+
+uint8_t debug_log = 0;
+bool vdd_enabled = true;
+xQueueHandle main_evt_queue = NULL;
+xQueueHandle ota_evt_queue = NULL;
+char ota_fname[65] = {0};
+char ota_fmd5[33] = {0};
+uint8_t kpad_state = 0;
+uint32_t adc_voltage1 = 0;
+uint32_t adc_voltage2 = 0;
+QueueHandle_t adc_mutex = NULL;
+const uint32_t wakeup_intervals[6] = {300, 600, 900, 1200, 1800, 3600};
+uint32_t wakeup_interval = 1800;
+uint8_t rtc_ram[RTCRAM_BUFF_SIZE];
+static uint32_t esp32_status = ESP32_STATUS_KPAD_MASK;
+
+//==========================================
+void setStatus(uint32_t status, uint8_t op)
+{
+    if (op == SET_STATUS_OP_SET) esp32_status = status;
+    else if (op == SET_STATUS_OP_AND) esp32_status &= status;
+    else if (op == SET_STATUS_OP_OR) esp32_status |= status;
+}
+
+//==================
+uint32_t getStatus()
+{
+    return esp32_status;
+}
+
+// K210 VFS and the file server are not part of the host build
+
+//===================================
+esp_err_t esp_vfs_k210ffs_register()
+{
+    return ESP_OK;
+}
+
+//=====================================
+esp_err_t esp_vfs_k210ffs_unregister()
+{
+    return ESP_OK;
+}
+
+//====================================================
+esp_err_t start_file_server(const char *base_path)
+{
+    return ESP_FAIL;
+}
@@ -0,0 +1,1157 @@
+/*
+ * Simulated K210 SPI slave, see 'k210_sim.h'
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "global.h"
+#include "driver/gpio.h"
+#include "k210_sim.h"
+
+#define LINE_SCHED_MAX          16
+#define WIRE_BUFFER_SIZE        (65536+64)
+#define OUT_BUFFER_SIZE         64
+#define STATUS_TYPES            16
+#define SIM_FILES_MAX           2048
+#define SIM_FDS_MAX             8
+#define SIM_PATH_MAX            128
+#define SIM_FD_CLOSEALL         99
+#define SIM_INFO_STR            "K210SIM1.00"
+#define SIM_DATA_TIMEOUT_NS     (10*1000000ULL)
+
+typedef enum {
+    PHASE_CMD,          // waiting for the command block
+    PHASE_READ,         // data block prepared, waiting for the read transaction
+    PHASE_WRITE,        // waiting for the write transaction
+    PHASE_TRANS,        // 'readTrans()' status block prepared
+} slave_phase_t;
+
+typedef enum {
+    REQ_NONE,
+    REQ_WAIT,           // request prepared, waiting for the slave to become idle
+    REQ_PULSED,         // request signaled to ESP32
+    REQ_READ,           // request status read by ESP32
+    REQ_DONE,           // response received
+} request_state_t;
+
+typedef struct {
+    char     path[SIM_PATH_MAX];
+    uint8_t  *data;
+    uint32_t size;
+    uint32_t cap;
+    uint32_t time;
+    bool     used;
+} sim_file_t;
+
+typedef struct {
+    int      file;
+    uint32_t pos;
+    int      mode;
+    bool     used;
+} sim_fd_t;
+
+static k210_sim_config_t cfg;
+static k210_sim_stats_t stats;
+static uint32_t device_clock = SPI_MASTER_FREQ_16M;
+
+// ---- Handshake line ----
+static pthread_mutex_t line_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t line_cond;
+static int line_level = 1;
+static int line_n = 0;
+static uint64_t line_time[LINE_SCHED_MAX];
+static int line_sched_level[LINE_SCHED_MAX];
+static bool intr_enabled = false;
+static int intr_type = GPIO_INTR_NEGEDGE;
+static void (*line_isr)(void *) = NULL;
+static void *line_isr_arg = NULL;
+static uint64_t line_resp_time = 0;
+
+// ---- Slave ----
+static pthread_mutex_t slave_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t *sbuf = NULL;
+static uint32_t sbuf_size = 0;
+static uint8_t *wire_buf = NULL;
+static uint8_t out_buf[OUT_BUFFER_SIZE];
+static slave_phase_t phase = PHASE_CMD;
+static uint64_t phase_timeout = 0;
+static const uint8_t *rd_src = NULL;
+static uint32_t rd_len = 0;
+static bool rd_crc = false;
+static uint32_t wr_addr = 0;
+static uint32_t wr_size = 0;
+static bool wr_crc = false;
+static uint64_t err_skip = 0;
+
+// ---- K210 requests ----
+static pthread_cond_t req_cond;
+static request_state_t req_state = REQ_NONE;
+static uint8_t *req_frame = NULL;
+static uint32_t req_frame_len = 0;
+static k210_sim_frame_t *req_resp = NULL;
+static k210_sim_block_cb_t block_cb = NULL;
+static void *block_cb_arg = NULL;
+
+// ---- Status messages ----
+static pthread_cond_t status_cond;
+static uint32_t status_seq[STATUS_TYPES];
+static int32_t status_val[STATUS_TYPES];
+
+// ---- File system ----
+static sim_file_t sim_files[SIM_FILES_MAX];
+static sim_fd_t sim_fds[SIM_FDS_MAX];
+static uint8_t *resp_ptr = NULL;
+static uint32_t resp_len = 0;
+
+// ---- Compressed frames ----
+static bool esp_lz = false;         // ESP32 accepts compressed frames
+static uint8_t *lz_buf = NULL;
+static uint16_t lz_table[LZ_TABLE_SIZE];
+
+
+// ==== Time ==================================================================
+
+//-------------------
+uint64_t sim_time_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+//----------------------------------
+void sim_spin_until_ns(uint64_t t)
+{
+    while (sim_time_ns() < t);
+}
+
+//-----------------------------------------------
+static void abs_timespec(uint64_t t, struct timespec *ts)
+{
+    ts->tv_sec = t / 1000000000ULL;
+    ts->tv_nsec = t % 1000000000ULL;
+}
+
+//----------------------------------------
+static void init_cond(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// ==== Handshake line ========================================================
+// line_mutex must be held by the caller
+
+static void line_schedule(uint64_t t, int level);
+
+//-----------------------------------
+static void line_apply(uint64_t now)
+{
+    // the response pulse is held until ESP32 waits for it, see 'line_response_pulse()'
+    if ((line_resp_time) && (line_resp_time <= now) && (intr_enabled) && (intr_type != GPIO_INTR_POSEDGE)) {
+        line_resp_time = 0;
+        line_schedule(now, 0);
+        line_schedule(now + (cfg.pulse_us * 1000ULL), 1);
+    }
+    // apply all transitions due, the interrupt handler is called on the enabled edges
+    while ((line_n > 0) && (line_time[0] <= now)) {
+        int level = line_sched_level[0];
+        line_n--;
+        memmove(line_time, line_time+1, line_n * sizeof(uint64_t));
+        memmove(line_sched_level, line_sched_level+1, line_n * sizeof(int));
+        if (level == line_level) continue;
+        line_level = level;
+        if ((intr_enabled) && (line_isr)) {
+            if ( ((level == 0) && ((intr_type == GPIO_INTR_NEGEDGE) || (intr_type == GPIO_INTR_ANYEDGE))) ||
+                 ((level == 1) && ((intr_type == GPIO_INTR_POSEDGE) || (intr_type == GPIO_INTR_ANYEDGE))) ) {
+                line_isr(line_isr_arg);
+            }
+        }
+    }
+}
+
+//-----------------------------------------------
+static void line_schedule(uint64_t t, int level)
+{
+    if (line_n >= LINE_SCHED_MAX) {
+        stats.protocol_errors++;
+        return;
+    }
+    int i = line_n;
+    while ((i > 0) && (line_time[i-1] > t)) {
+        line_time[i] = line_time[i-1];
+        line_sched_level[i] = line_sched_level[i-1];
+        i--;
+    }
+    line_time[i] = t;
+    line_sched_level[i] = level;
+    line_n++;
+    pthread_cond_signal(&line_cond);
+}
+
+//------------------------------------
+static void line_pulse(uint64_t t)
+{
+    line_schedule(t, 0);
+    line_schedule(t + (cfg.pulse_us * 1000ULL), 1);
+}
+
+// The file request result and the block confirmation are signaled with a pulse ESP32
+// waits for on the interrupt. Host threads are not real time, ESP32 may enable the interrupt
+// later than it would on the device, so the pulse is issued at 't' or, if ESP32 is not
+// waiting yet, as soon as it enables the interrupt.
+//-------------------------------------------
+static void line_response_pulse(uint64_t t)
+{
+    line_resp_time = t;
+    pthread_cond_signal(&line_cond);
+}
+
+//----------------------------------
+static bool line_busy(uint64_t now)
+{
+    line_apply(now);
+    return ((line_n > 0) || (line_level == 0) || (line_resp_time));
+}
+
+//----------------------------------
+static void *line_thread(void *arg)
+{
+    // Apply the transitions when nobody polls the line (ESP32 waits on the interrupt)
+    pthread_mutex_lock(&line_mutex);
+    while (1) {
+        uint64_t now = sim_time_ns();
+        line_apply(now);
+        uint64_t tnext = (line_n > 0) ? line_time[0] : 0;
+        if ((line_resp_time) && (intr_enabled)) {
+            uint64_t t = (line_resp_time > now) ? line_resp_time : now;
+            if ((tnext == 0) || (t < tnext)) tnext = t;
+        }
+        if (tnext == 0) pthread_cond_wait(&line_cond, &line_mutex);
+        else {
+            struct timespec ts;
+            abs_timespec(tnext, &ts);
+            pthread_cond_timedwait(&line_cond, &line_mutex, &ts);
+        }
+    }
+    return NULL;
+}
+
+//===========================
+int k210_sim_handshake_level()
+{
+    // The data transaction was not started in time, return to IDLE
+    // (ESP32 gave up the transfer, K210 slave does the same)
+    pthread_mutex_lock(&slave_mutex);
+    if ((phase != PHASE_CMD) && (sim_time_ns() > phase_timeout)) {
+        phase = PHASE_CMD;
+        stats.protocol_errors++;
+        pthread_mutex_lock(&line_mutex);
+        line_schedule(sim_time_ns(), 1);
+        pthread_mutex_unlock(&line_mutex);
+    }
+    pthread_mutex_unlock(&slave_mutex);
+
+    pthread_mutex_lock(&line_mutex);
+    line_apply(sim_time_ns());
+    int level = line_level;
+    pthread_mutex_unlock(&line_mutex);
+    return level;
+}
+
+//==============================================
+void k210_sim_handshake_intr_enable(bool enable)
+{
+    pthread_mutex_lock(&line_mutex);
+    line_apply(sim_time_ns());
+    intr_enabled = enable;
+    if ((enable) && (line_resp_time)) pthread_cond_signal(&line_cond);
+    pthread_mutex_unlock(&line_mutex);
+}
+
+//========================================
+void k210_sim_handshake_intr_type(int type)
+{
+    pthread_mutex_lock(&line_mutex);
+    line_apply(sim_time_ns());
+    intr_type = type;
+    pthread_mutex_unlock(&line_mutex);
+}
+
+//===========================================================
+void k210_sim_handshake_isr(void (*isr)(void *), void *arg)
+{
+    pthread_mutex_lock(&line_mutex);
+    line_isr = isr;
+    line_isr_arg = arg;
+    pthread_mutex_unlock(&line_mutex);
+}
+
+// ==== Wire ==================================================================
+
+//----------------------------
+static uint64_t err_next_skip()
+{
+    // number of good bits before the next bit error (geometric distribution)
+    double u = ((double)rand_r(&cfg.seed) + 1.0) / ((double)RAND_MAX + 2.0);
+    return (uint64_t)(-log(u) / cfg.bit_error_rate);
+}
+
+//--------------------------------------------------
+static void inject_errors(uint8_t *buf, size_t len)
+{
+    if (cfg.bit_error_rate <= 0.0) return;
+    uint64_t bits = (uint64_t)len * 8;
+    uint64_t pos = 0;
+    while (err_skip < (bits - pos)) {
+        pos += err_skip;
+        buf[pos / 8] ^= 1 << (pos % 8);
+        stats.bit_errors++;
+        pos++;
+        err_skip = err_next_skip();
+    }
+    err_skip -= bits - pos;
+}
+
+//=================================================
+void k210_sim_set_device_clock(uint32_t clock_hz)
+{
+    device_clock = clock_hz;
+}
+
+//=========================
+uint32_t k210_sim_get_clock()
+{
+    return (cfg.clock_hz) ? cfg.clock_hz : device_clock;
+}
+
+// ==== Status messages =======================================================
+
+//-----------------------------------------------------
+static void record_status(int type, int32_t value)
+{
+    stats.status_msgs++;
+    if ((type < 0) || (type >= STATUS_TYPES)) return;
+    if (type == ESP32_STATUS_CODE_LZ) esp_lz = (cfg.lz) && (value == 1);
+    status_val[type] = value;
+    status_seq[type]++;
+    pthread_cond_broadcast(&status_cond);
+}
+
+//===========================================================================================
+bool k210_sim_wait_status(int type, uint32_t *seq, int32_t *value, uint32_t timeout_ms)
+{
+    if ((type < 0) || (type >= STATUS_TYPES)) return false;
+    struct timespec ts;
+    abs_timespec(sim_time_ns() + (timeout_ms * 1000000ULL), &ts);
+
+    pthread_mutex_lock(&slave_mutex);
+    while (status_seq[type] == *seq) {
+        if (pthread_cond_timedwait(&status_cond, &slave_mutex, &ts) == ETIMEDOUT) break;
+    }
+    bool res = (status_seq[type] != *seq);
+    *seq = status_seq[type];
+    if (value) *value = status_val[type];
+    pthread_mutex_unlock(&slave_mutex);
+    return res;
+}
+
+// ==== File system ===========================================================
+
+//-----------------------------------------
+static int file_find(const char *path)
+{
+    for (int i=0; i<SIM_FILES_MAX; i++) {
+        if ((sim_files[i].used) && (strcmp(sim_files[i].path, path) == 0)) return i;
+    }
+    return -1;
+}
+
+//------------------------------------
+static bool file_isdir(const char *path)
+{
+    // directories are not stored, a path is a directory if some file is in it
+    size_t plen = strlen(path);
+    if ((plen == 0) || (strcmp(path, "/") == 0)) return true;
+    for (int i=0; i<SIM_FILES_MAX; i++) {
+        if ((sim_files[i].used) && (strncmp(sim_files[i].path, path, plen) == 0) && (sim_files[i].path[plen] == '/')) return true;
+    }
+    return false;
+}
+
+//-----------------------------------------
+static int file_create(const char *path)
+{
+    if (strlen(path) >= SIM_PATH_MAX) return -1;
+    for (int i=0; i<SIM_FILES_MAX; i++) {
+        if (!sim_files[i].used) {
+            memset(&sim_files[i], 0, sizeof(sim_file_t));
+            strcpy(sim_files[i].path, path);
+            sim_files[i].time = (uint32_t)time(NULL);
+            sim_files[i].used = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+//------------------------------------------------------------
+static bool file_reserve(sim_file_t *f, uint32_t size)
+{
+    if (size <= f->cap) return true;
+    uint32_t cap = (f->cap) ? f->cap : 4096;
+    while (cap < size) cap *= 2;
+    uint8_t *data = realloc(f->data, cap);
+    if (data == NULL) return false;
+    f->data = data;
+    f->cap = cap;
+    return true;
+}
+
+//--------------------------------------
+static void file_delete(int idx)
+{
+    free(sim_files[idx].data);
+    memset(&sim_files[idx], 0, sizeof(sim_file_t));
+    for (int i=0; i<SIM_FDS_MAX; i++) {
+        if ((sim_fds[i].used) && (sim_fds[i].file == idx)) sim_fds[i].used = false;
+    }
+}
+
+//=========================================================================
+int k210_sim_file_put(const char *path, const void *data, uint32_t size)
+{
+    pthread_mutex_lock(&slave_mutex);
+    int idx = file_find(path);
+    if (idx < 0) idx = file_create(path);
+    if ((idx >= 0) && (file_reserve(&sim_files[idx], size))) {
+        memcpy(sim_files[idx].data, data, size);
+        sim_files[idx].size = size;
+    }
+    else idx = -1;
+    pthread_mutex_unlock(&slave_mutex);
+    return (idx >= 0) ? 0 : -1;
+}
+
+//===============================================================================
+int k210_sim_file_get(const char *path, const uint8_t **data, uint32_t *size)
+{
+    // the returned data is valid until the file is changed by ESP32
+    pthread_mutex_lock(&slave_mutex);
+    int idx = file_find(path);
+    if (idx >= 0) {
+        *data = sim_files[idx].data;
+        *size = sim_files[idx].size;
+    }
+    pthread_mutex_unlock(&slave_mutex);
+    return (idx >= 0) ? 0 : -1;
+}
+
+//=============================
+void k210_sim_file_remove_all()
+{
+    pthread_mutex_lock(&slave_mutex);
+    for (int i=0; i<SIM_FILES_MAX; i++) {
+        if (sim_files[i].used) file_delete(i);
+    }
+    pthread_mutex_unlock(&slave_mutex);
+}
+
+// ---- Compressed frames ----
+
+// Compress the frame payload (at 'frame'+4) in place if ESP32 accepts compressed frames
+// Returns the frame length field (with ESP_FRAME_LZ flag if compressed)
+//------------------------------------------------------------
+static uint16_t frame_compress(uint8_t *frame, uint16_t len)
+{
+    if ((!esp_lz) || (len < SPI_LZ_MIN_LENGTH)) return len;
+    size_t clen = lz_compress(frame+4, len, lz_buf, len - (len / 16) - 2, lz_table);
+    if (clen == 0) return len;
+    frame[4] = len & 0xFF;
+    frame[5] = len >> 8;
+    memcpy(frame+6, lz_buf, clen);
+    stats.lz_frames_tx++;
+    return (clen + 2) | ESP_FRAME_LZ;
+}
+
+// Decompress the payload of the frame received from ESP32
+// Returns the payload length or -1 on error
+//---------------------------------------------------------
+static int frame_decompress(uint8_t *frame, uint16_t len)
+{
+    if ((!cfg.lz) || (len < 2)) return -1;
+    uint16_t size = frame[4] | (frame[5] << 8);
+    if ((uint32_t)(size + 8) > sbuf_size) return -1;
+    if (lz_decompress(frame+6, len-2, lz_buf, size) != size) return -1;
+    memcpy(frame+4, lz_buf, size);
+    stats.lz_frames_rx++;
+    return size;
+}
+
+// ---- Response frame (ESP_COMMAND_FRESPONSE) in the slave buffer ----
+
+//-------------------------
+static void resp_begin()
+{
+    resp_ptr = sbuf + 4;
+    resp_len = 0;
+}
+
+//----------------------------------------------------
+static void resp_put(const void *data, uint32_t len)
+{
+    if ((resp_len + len + 8) > sbuf_size) return;
+    memcpy(resp_ptr + resp_len, data, len);
+    resp_len += len;
+}
+
+//----------------------------------
+static void resp_put_i32(int32_t val)
+{
+    resp_put(&val, 4);
+}
+
+//----------------------
+static void resp_end()
+{
+    uint16_t flen = frame_compress(sbuf, resp_len);
+    uint16_t len = flen & ~ESP_FRAME_LZ;
+    sbuf[0] = ESP_COMMAND_FRESPONSE;
+    sbuf[1] = 0;
+    sbuf[2] = flen & 0xFF;
+    sbuf[3] = flen >> 8;
+    uint32_t crc32 = calc_crc32(sbuf, len + 4, 0);
+    memcpy(sbuf + len + 4, &crc32, 4);
+}
+
+//-------------------------------------------------------------------
+static void resp_put_stat(uint32_t mode, int32_t size, uint32_t time)
+{
+    resp_put(&mode, 4);
+    resp_put_i32(size);
+    resp_put(&time, 4);
+}
+
+//-------------------------------------------
+static sim_fd_t *get_fd(const uint8_t *data)
+{
+    int32_t fd;
+    memcpy(&fd, data, 4);
+    if ((fd < 0) || (fd >= SIM_FDS_MAX) || (!sim_fds[fd].used)) return NULL;
+    return &sim_fds[fd];
+}
+
+//---------------------------------------------------------------------------------
+static uint32_t file_request(uint8_t cmd, const uint8_t *data, uint16_t len)
+{
+    // Execute the file request, the response frame is placed into the slave buffer
+    // Returns the number of file data bytes transferred (used for the timing)
+    char path[SIM_PATH_MAX];
+    uint32_t nbytes = 0;
+    int32_t res = -1;
+
+    memset(path, 0, sizeof(path));
+    if ((cmd == ESP_COMMAND_FFSTAT) || (cmd == ESP_COMMAND_FLISTDIR) || (cmd == ESP_COMMAND_FREMOVE) || (cmd == ESP_COMMAND_FRMDIR)) {
+        memcpy(path, data, (len < SIM_PATH_MAX) ? len : SIM_PATH_MAX-1);
+    }
+    else if ((cmd == ESP_COMMAND_FLISTDIRP) && (len > 8)) {
+        memcpy(path, data+8, ((len-8) < SIM_PATH_MAX) ? len-8 : SIM_PATH_MAX-1);
+    }
+    resp_begin();
+
+    switch (cmd) {
+        case ESP_COMMAND_FOPEN: {
+            int32_t mode;
+            memcpy(&mode, data, 4);
+            memcpy(path, data+4, ((len-4) < SIM_PATH_MAX) ? len-4 : SIM_PATH_MAX-1);
+            int idx = file_find(path);
+            if ((idx < 0) && (mode != ESP_FILE_MODE_RO)) idx = file_create(path);
+            if (idx >= 0) {
+                for (int i=0; i<SIM_FDS_MAX; i++) {
+                    if (!sim_fds[i].used) {
+                        sim_fds[i].used = true;
+                        sim_fds[i].file = idx;
+                        sim_fds[i].mode = mode;
+                        sim_fds[i].pos = 0;
+                        if (mode == ESP_FILE_MODE_WR) sim_files[idx].size = 0;
+                        else if (mode == ESP_FILE_MODE_APPEND) sim_fds[i].pos = sim_files[idx].size;
+                        res = i;
+                        break;
+                    }
+                }
+            }
+            resp_put_i32(res);
+            break;
+        }
+        case ESP_COMMAND_FREAD: {
+            sim_fd_t *fd = get_fd(data);
+            uint32_t size;
+            memcpy(&size, data+4, 4);
+            if ((fd) && (fd->mode != ESP_FILE_MODE_WR) && (fd->mode != ESP_FILE_MODE_APPEND)) {
+                sim_file_t *f = &sim_files[fd->file];
+                uint32_t n = (fd->pos < f->size) ? f->size - fd->pos : 0;
+                if (n > size) n = size;
+                if (n > (sbuf_size - 64)) n = sbuf_size - 64;
+                resp_put(f->data + fd->pos, n);
+                fd->pos += n;
+                nbytes = n;
+            }
+            break;
+        }
+        case ESP_COMMAND_FWRITE: {
+            sim_fd_t *fd = get_fd(data);
+            uint32_t n = len - 4;
+            if ((fd) && (fd->mode != ESP_FILE_MODE_RO)) {
+                sim_file_t *f = &sim_files[fd->file];
+                if (file_reserve(f, fd->pos + n)) {
+                    if (fd->pos > f->size) memset(f->data + f->size, 0, fd->pos - f->size);
+                    memcpy(f->data + fd->pos, data+4, n);
+                    fd->pos += n;
+                    if (fd->pos > f->size) f->size = fd->pos;
+                    f->time = (uint32_t)time(NULL);
+                    res = n;
+                    nbytes = n;
+                }
+            }
+            resp_put_i32(res);
+            break;
+        }
+        case ESP_COMMAND_FCLOSE: {
+            int32_t fdn;
+            memcpy(&fdn, data, 4);
+            if (fdn == SIM_FD_CLOSEALL) {
+                for (int i=0; i<SIM_FDS_MAX; i++) sim_fds[i].used = false;
+                res = 0;
+            }
+            else {
+                sim_fd_t *fd = get_fd(data);
+                if (fd) {
+                    fd->used = false;
+                    res = 0;
+                }
+            }
+            resp_put_i32(res);
+            break;
+        }
+        case ESP_COMMAND_FSEEK: {
+            sim_fd_t *fd = get_fd(data);
+            int32_t offset, whence;
+            memcpy(&offset, data+4, 4);
+            memcpy(&whence, data+8, 4);
+            if (fd) {
+                int64_t pos = offset;
+                if (whence == SEEK_CUR) pos += fd->pos;
+                else if (whence == SEEK_END) pos += sim_files[fd->file].size;
+                if (pos >= 0) {
+                    fd->pos = (uint32_t)pos;
+                    res = fd->pos;
+                }
+            }
+            resp_put_i32(res);
+            break;
+        }
+        case ESP_COMMAND_FSTAT: {
+            sim_fd_t *fd = get_fd(data);
+            if (fd) resp_put_stat(0x8000, sim_files[fd->file].size, sim_files[fd->file].time);
+            else resp_put_stat(0, -1, 0);
+            break;
+        }
+        case ESP_COMMAND_FFSTAT: {
+            int idx = file_find(path);
+            if (idx >= 0) resp_put_stat(0x8000, sim_files[idx].size, sim_files[idx].time);
+            else if (file_isdir(path)) resp_put_stat(0x4000, 0, 0);
+            else resp_put_stat(0, -1, 0);
+            break;
+        }
+        case ESP_COMMAND_FLISTDIR: {
+            // | int16_t n | (uint8_t mode, uint32_t size, uint32_t time, name\0) ... |
+            int16_t n = 0;
+            size_t plen = strlen(path);
+            if ((plen > 0) && (path[plen-1] == '/')) plen--;
+            resp_put(&n, 2);
+            for (int i=0; i<SIM_FILES_MAX; i++) {
+                sim_file_t *f = &sim_files[i];
+                if ((!f->used) || (strncmp(f->path, path, plen) != 0) || (f->path[plen] != '/')) continue;
+                const char *name = f->path + plen + 1;
+                if (strchr(name, '/')) continue;
+                uint8_t mode = 0;
+                resp_put(&mode, 1);
+                resp_put(&f->size, 4);
+                resp_put(&f->time, 4);
+                resp_put(name, strlen(name)+1);
+                n++;
+            }
+            memcpy(sbuf+4, &n, 2);
+            break;
+        }
+        case ESP_COMMAND_FLISTDIRP: {
+            // | int16_t n | uint32_t next_cursor | entries ... |, the cursor is the next file slot
+            uint32_t cursor, max_len, used = 0;
+            int16_t n = 0;
+            memcpy(&cursor, data, 4);
+            memcpy(&max_len, data+4, 4);
+            size_t plen = strlen(path);
+            if ((plen > 0) && (path[plen-1] == '/')) plen--;
+            path[plen] = '\0';
+            if (!file_isdir(path)) {
+                n = -1;
+                cursor = 0;
+                resp_put(&n, 2);
+                resp_put(&cursor, 4);
+                break;
+            }
+            resp_put(&n, 2);
+            resp_put(&cursor, 4);
+            for (; cursor<SIM_FILES_MAX; cursor++) {
+                sim_file_t *f = &sim_files[cursor];
+                if ((!f->used) || (strncmp(f->path, path, plen) != 0) || (f->path[plen] != '/')) continue;
+                const char *name = f->path + plen + 1;
+                if (strchr(name, '/')) continue;
+                if ((used + strlen(name) + 10) > max_len) break;
+                uint8_t mode = 0;
+                resp_put(&mode, 1);
+                resp_put(&f->size, 4);
+                resp_put(&f->time, 4);
+                resp_put(name, strlen(name)+1);
+                used += strlen(name) + 10;
+                n++;
+            }
+            if (cursor >= SIM_FILES_MAX) cursor = 0;
+            memcpy(sbuf+4, &n, 2);
+            memcpy(sbuf+6, &cursor, 4);
+            nbytes = used;
+            break;
+        }
+        case ESP_COMMAND_FREMOVE: {
+            int idx = file_find(path);
+            if (idx >= 0) {
+                file_delete(idx);
+                res = 0;
+            }
+            resp_put_i32(res);
+            break;
+        }
+        case ESP_COMMAND_FRMDIR: {
+            resp_put_i32((file_isdir(path)) ? -1 : 0);
+            break;
+        }
+    }
+    resp_end();
+    stats.file_requests++;
+    return nbytes;
+}
+
+// ==== Slave protocol ========================================================
+
+//----------------------------------------------
+static void put_crc16(uint8_t *buf, size_t len)
+{
+    uint16_t crc16 = calc_crc16_bytewise(buf, len, 0);
+    memcpy(buf + len, &crc16, 2);
+}
+
+//--------------------------------------------------------------
+static uint64_t file_time_ns(uint32_t nbytes)
+{
+    uint64_t t = cfg.file_us * 1000ULL;
+    if (cfg.file_kbps) t += ((uint64_t)nbytes * 1000000000ULL) / ((uint64_t)cfg.file_kbps * 1024);
+    return t;
+}
+
+//----------------------------------------
+static void slave_frame(uint64_t t_idle)
+{
+    // ESP32 has written a frame to the command address
+    uint16_t cmdstat = sbuf[0] | (sbuf[1] << 8);
+    uint16_t flen = sbuf[2] | (sbuf[3] << 8);
+    uint16_t len = flen & ~ESP_FRAME_LZ;
+    uint32_t crc32;
+
+    if ((uint32_t)(len + 8) > sbuf_size) {
+        stats.frame_errors++;
+        return;
+    }
+    memcpy(&crc32, sbuf + len + 4, 4);
+    if (crc32 != calc_crc32(sbuf, len + 4, 0)) {
+        stats.frame_errors++;
+        return;
+    }
+    if (flen & ESP_FRAME_LZ) {
+        int size = frame_decompress(sbuf, len);
+        if (size < 0) {
+            stats.frame_errors++;
+            return;
+        }
+        len = size;
+    }
+
+    uint8_t cmd = cmdstat & 0xFF;
+    uint16_t status = cmdstat & 0xFF00;
+    if ((status == 0) && (cmd > ESP_COMMAND_FILE_FUNCSTART) && (cmd < ESP_COMMAND_FILE_FUNCMAX) && (cmd != ESP_COMMAND_FRESPONSE)) {
+        // ---- file request, the result is signaled with the handshake pulse ----
+        uint32_t nbytes = file_request(cmd, sbuf+4, len);
+        pthread_mutex_lock(&line_mutex);
+        line_response_pulse(t_idle + file_time_ns(nbytes));
+        pthread_mutex_unlock(&line_mutex);
+        return;
+    }
+    if ((status == ESP_STATUS_MULTIBLOCK) || (status == ESP_STATUS_RQHEADER)) {
+        // ---- streamed block, confirmed with the handshake pulse ----
+        stats.blocks++;
+        if (block_cb) block_cb(status, sbuf+4, len, block_cb_arg);
+        pthread_mutex_lock(&line_mutex);
+        line_response_pulse(t_idle + (cfg.confirm_us * 1000ULL));
+        pthread_mutex_unlock(&line_mutex);
+        return;
+    }
+    // ---- response to the K210 request ----
+    if (((req_state == REQ_PULSED) || (req_state == REQ_READ)) && (req_resp)) {
+        req_resp->cmdstat = cmdstat;
+        req_resp->len = len;
+        if (req_resp->data) memcpy(req_resp->data, sbuf+4, (len < req_resp->size) ? len : req_resp->size);
+        req_state = REQ_DONE;
+        pthread_cond_broadcast(&req_cond);
+    }
+    else stats.protocol_errors++;
+}
+
+//-----------------------------------------------------------
+static void slave_command(const uint8_t *cmd_buf, uint64_t tdone)
+{
+    stats.commands++;
+    if (calc_crc16_bytewise(cmd_buf, 14, 0) != (cmd_buf[14] | (cmd_buf[15] << 8))) {
+        stats.cmd_crc_errors++;
+        return;
+    }
+
+    uint8_t cmd = cmd_buf[0] & 0x0F;
+    bool opt_crc = (cmd_buf[0] & SLAVE_CMD_OPT_CRC);
+    int32_t value;
+    memcpy(&value, cmd_buf+2, 4);
+    if (cmd == SLAVE_CMD_WRSTAT) {
+        record_status(cmd_buf[1] & 0x0F, value);
+        return;
+    }
+
+    pthread_mutex_lock(&line_mutex);
+    if (line_busy(sim_time_ns())) {
+        // signaling a request or a result, the command is ignored
+        pthread_mutex_unlock(&line_mutex);
+        stats.cmd_busy++;
+        return;
+    }
+
+    uint32_t addr = cmd_buf[1] | (cmd_buf[2] << 8) | ((cmd_buf[3] & 0x0F) << 16);
+    uint32_t size = (cmd_buf[4] | (cmd_buf[5] << 8)) + 1;
+    bool ok = true;
+    switch (cmd) {
+        case SLAVE_CMD_WRSTAT_CONFIRM:
+            // | cmd | type | value (4) | status | crc16 |
+            record_status(cmd_buf[1] & 0x0F, value);
+            memset(out_buf, 0, 9);
+            memcpy(out_buf, cmd_buf, 6);
+            out_buf[6] = ESP_ERROR_OK;
+            put_crc16(out_buf, 7);
+            rd_src = out_buf;
+            rd_len = 9;
+            rd_crc = false;
+            phase = PHASE_READ;
+            break;
+        case SLAVE_CMD_INFO: {
+            uint32_t info[4] = {cfg.buffer_size, cfg.buffer_ro_size, cfg.crc_speed, cfg.crc32_speed};
+            memset(out_buf, 0, OUT_BUFFER_SIZE);
+            memcpy(out_buf, SIM_INFO_STR, 11);
+            esp_lz = false;
+            for (int i=0; i<4; i++) {
+                out_buf[12+(i*3)] = info[i] & 0xFF;
+                out_buf[13+(i*3)] = (info[i] >> 8) & 0xFF;
+                out_buf[14+(i*3)] = (info[i] >> 16) & 0xFF;
+            }
+            out_buf[24] = K210_INFO_HANDSHAKE | ((cfg.lz) ? K210_INFO_LZ : 0) | ((cfg.legacy) ? 0 : (K210_INFO_SOCKRDMAP | K210_INFO_RQHEADER | K210_INFO_OTASTATS | K210_INFO_ASYNCSSL));
+            rd_src = out_buf;
+            rd_len = SLAVE_INFO_LENGTH;
+            rd_crc = opt_crc;
+            phase = PHASE_READ;
+            break;
+        }
+        case SLAVE_CMD_READ:
+        case SLAVE_CMD_RDSTAT:
+            if ((addr + size) > sbuf_size) {
+                ok = false;
+                break;
+            }
+            if ((cmd == SLAVE_CMD_RDSTAT) && (addr == 0) && (req_state == REQ_PULSED)) req_state = REQ_READ;
+            rd_src = sbuf + addr;
+            rd_len = size;
+            rd_crc = opt_crc;
+            phase = PHASE_READ;
+            break;
+        case SLAVE_CMD_WRITE:
+            if ((addr + size) > (sbuf_size - cfg.buffer_ro_size)) {
+                ok = false;
+                break;
+            }
+            wr_addr = addr;
+            wr_size = size;
+            wr_crc = opt_crc;
+            phase = PHASE_WRITE;
+            break;
+        default:
+            ok = false;
+    }
+    if (ok) {
+        line_schedule(tdone + (cfg.ready_us * 1000ULL), 0);
+        phase_timeout = tdone + SIM_DATA_TIMEOUT_NS;
+    }
+    else stats.protocol_errors++;
+    pthread_mutex_unlock(&line_mutex);
+}
+
+//------------------------------------------------------------------------
+static void slave_receive(const uint8_t *data, size_t len, uint64_t tdone)
+{
+    // Data sent by ESP32
+    switch (phase) {
+        case PHASE_CMD:
+            if (len == 16) slave_command(data, tdone);
+            else if ((len == 1) && ((data[0] == SLAVE_CMD_READ_TRANS) || (data[0] == SLAVE_CMD_STATUS_TRANS))) {
+                // transaction status, nothing to report
+                int n = (data[0] == SLAVE_CMD_READ_TRANS) ? 32 : 12;
+                memset(out_buf, 0, n);
+                put_crc16(out_buf, n-2);
+                rd_src = out_buf;
+                rd_len = n;
+                rd_crc = false;
+                phase = PHASE_TRANS;
+                phase_timeout = tdone + SIM_DATA_TIMEOUT_NS;
+            }
+            else stats.protocol_errors++;
+            break;
+        case PHASE_WRITE: {
+            uint32_t total = wr_size + ((wr_crc) ? 2 : 0);
+            uint32_t n = (len < total) ? len : total;
+            phase = PHASE_CMD;
+            if (len != total) stats.protocol_errors++;
+            memcpy(sbuf + wr_addr, data, n);
+            bool ok = (n == total);
+            uint64_t crc_ns = 0;
+            if ((ok) && (wr_crc)) {
+                crc_ns = ((uint64_t)wr_size * cfg.crc_speed) / 1000;
+                uint16_t crc16;
+                memcpy(&crc16, data + wr_size, 2);
+                if (crc16 != calc_crc16_bytewise(data, wr_size, 0)) {
+                    stats.data_crc_errors++;
+                    ok = false;
+                }
+            }
+            uint64_t t_idle = tdone + (cfg.idle_us * 1000ULL) + crc_ns;
+            pthread_mutex_lock(&line_mutex);
+            line_schedule(t_idle, 1);
+            pthread_mutex_unlock(&line_mutex);
+            if ((ok) && (wr_addr == 0)) slave_frame(t_idle);
+            break;
+        }
+        default:
+            // read expected
+            stats.protocol_errors++;
+            phase = PHASE_CMD;
+            pthread_mutex_lock(&line_mutex);
+            line_schedule(tdone + (cfg.idle_us * 1000ULL), 1);
+            pthread_mutex_unlock(&line_mutex);
+    }
+}
+
+//---------------------------------------------------------------
+static void slave_send(uint8_t *data, size_t len, uint64_t tdone)
+{
+    // Data read by ESP32
+    memset(data, 0xFF, len);
+    if ((phase != PHASE_READ) && (phase != PHASE_TRANS)) {
+        stats.protocol_errors++;
+        return;
+    }
+    uint32_t n = (len < rd_len) ? len : rd_len;
+    memcpy(data, rd_src, n);
+    if ((rd_crc) && (len >= (rd_len + 2))) {
+        uint16_t crc16 = calc_crc16_bytewise(rd_src, rd_len, 0);
+        memcpy(data + rd_len, &crc16, 2);
+    }
+    if (phase == PHASE_READ) {
+        pthread_mutex_lock(&line_mutex);
+        line_schedule(tdone + (cfg.idle_us * 1000ULL), 1);
+        pthread_mutex_unlock(&line_mutex);
+    }
+    phase = PHASE_CMD;
+}
+
+//=================================================================
+int k210_sim_transmit(const uint8_t *tx, uint8_t *rx, size_t len)
+{
+    uint64_t tstart = sim_time_ns();
+    uint64_t wire_ns = ((uint64_t)len * 8 * 1000000000ULL) / k210_sim_get_clock();
+    uint64_t tdone = tstart + (cfg.trans_us * 1000ULL) + wire_ns;
+
+    if (len > WIRE_BUFFER_SIZE) return -1;
+    pthread_mutex_lock(&slave_mutex);
+    stats.wire_ns += wire_ns;
+    if (tx) {
+        memcpy(wire_buf, tx, len);
+        inject_errors(wire_buf, len);
+        stats.bytes_tx += len;
+        slave_receive(wire_buf, len, tdone);
+    }
+    else if (rx) {
+        slave_send(rx, len, tdone);
+        inject_errors(rx, len);
+        stats.bytes_rx += len;
+    }
+    pthread_mutex_unlock(&slave_mutex);
+
+    // the transaction is executed by the CPU (no DMA), ESP32 is busy until it is finished
+    sim_spin_until_ns(tdone);
+    return 0;
+}
+
+// ==== K210 requests =========================================================
+
+//=====================================================================
+void k210_sim_set_block_handler(k210_sim_block_cb_t cb, void *arg)
+{
+    pthread_mutex_lock(&slave_mutex);
+    block_cb = cb;
+    block_cb_arg = arg;
+    pthread_mutex_unlock(&slave_mutex);
+}
+
+//==================================================================================================================
+int k210_sim_request(uint16_t cmd, const void *data, uint16_t len, k210_sim_frame_t *resp, uint32_t timeout_ms)
+{
+    if ((uint32_t)(len + 8) > (sbuf_size - cfg.buffer_ro_size)) return K210_SIM_ERR_SIZE;
+
+    pthread_mutex_lock(&slave_mutex);
+    if (req_state != REQ_NONE) {
+        pthread_mutex_unlock(&slave_mutex);
+        return K210_SIM_ERR_BUSY;
+    }
+    // | cmd | ESP_STATUS_MREQUEST | len | data | crc32 |
+    if (len) memcpy(req_frame+4, data, len);
+    uint16_t flen = frame_compress(req_frame, len);
+    len = flen & ~ESP_FRAME_LZ;
+    req_frame[0] = cmd & 0xFF;
+    req_frame[1] = ESP_STATUS_MREQUEST >> 8;
+    req_frame[2] = flen & 0xFF;
+    req_frame[3] = flen >> 8;
+    uint32_t crc32 = calc_crc32(req_frame, len+4, 0);
+    memcpy(req_frame+len+4, &crc32, 4);
+    req_frame_len = len + 8;
+    req_resp = resp;
+    req_state = REQ_WAIT;
+    stats.requests++;
+
+    uint64_t tend = sim_time_ns() + (timeout_ms * 1000000ULL);
+    uint64_t tnext = 0;
+    while (req_state != REQ_DONE) {
+        uint64_t now = sim_time_ns();
+        if (now >= tend) break;
+        if ((req_state != REQ_READ) && (now >= tnext)) {
+            // (re)signal the request when the slave is idle
+            pthread_mutex_lock(&line_mutex);
+            if ((phase == PHASE_CMD) && (!line_busy(now))) {
+                memcpy(sbuf, req_frame, req_frame_len);
+                line_pulse(now);
+                req_state = REQ_PULSED;
+                stats.request_pulses++;
+                tnext = now + (cfg.request_retry_ms * 1000000ULL);
+            }
+            else tnext = now + 100000;
+            pthread_mutex_unlock(&line_mutex);
+        }
+        struct timespec ts;
+        abs_timespec(((req_state != REQ_READ) && (tnext < tend)) ? tnext : tend, &ts);
+        pthread_cond_timedwait(&req_cond, &slave_mutex, &ts);
+    }
+    int res = (req_state == REQ_DONE) ? K210_SIM_OK : K210_SIM_ERR_TIMEOUT;
+    req_state = REQ_NONE;
+    req_resp = NULL;
+    pthread_mutex_unlock(&slave_mutex);
+    return res;
+}
+
+// ==== Setup =================================================================
+
+//=======================================================
+void k210_sim_default_config(k210_sim_config_t *config)
+{
+    memset(config, 0, sizeof(k210_sim_config_t));
+    config->clock_hz = 0;
+    config->trans_us = 5;
+    config->ready_us = 20;
+    config->idle_us = 30;
+    config->pulse_us = 50;
+    config->file_us = 200;
+    config->file_kbps = 0;
+    config->confirm_us = 100;
+    config->request_retry_ms = 50;
+    config->bit_error_rate = 0.0;
+    config->buffer_size = 32768 + 4096;
+    config->buffer_ro_size = 4096;
+    config->crc_speed = 15000;
+    config->crc32_speed = 25000;
+    config->seed = 1;
+    config->lz = false;
+    config->legacy = false;
+}
+
+//==================================================
+void k210_sim_init(const k210_sim_config_t *config)
+{
+    pthread_t thread;
+
+    cfg = *config;
+    memset(&stats, 0, sizeof(stats));
+
+    sbuf_size = cfg.buffer_size;
+    sbuf = calloc(1, sbuf_size + 64);
+    req_frame = calloc(1, sbuf_size + 64);
+    wire_buf = malloc(WIRE_BUFFER_SIZE);
+    lz_buf = malloc(sbuf_size + 64);
+    if ((sbuf == NULL) || (req_frame == NULL) || (wire_buf == NULL) || (lz_buf == NULL)) {
+        fprintf(stderr, "K210 simulator: buffer allocation failed\n");
+        exit(1);
+    }
+    if (cfg.bit_error_rate > 0.0) err_skip = err_next_skip();
+
+    init_cond(&line_cond);
+    init_cond(&req_cond);
+    init_cond(&status_cond);
+    if (pthread_create(&thread, NULL, line_thread, NULL) != 0) {
+        fprintf(stderr, "K210 simulator: cannot create the handshake thread\n");
+        exit(1);
+    }
+    pthread_detach(thread);
+}
+
+//=================================================
+void k210_sim_get_stats(k210_sim_stats_t *result)
+{
+    pthread_mutex_lock(&slave_mutex);
+    *result = stats;
+    pthread_mutex_unlock(&slave_mutex);
+}
+
+//=========================
+void k210_sim_reset_stats()
+{
+    pthread_mutex_lock(&slave_mutex);
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_unlock(&slave_mutex);
+}
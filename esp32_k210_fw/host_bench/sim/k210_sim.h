@@ -0,0 +1,134 @@
+/*
+ * Simulated K210 SPI slave
+ * ---------------------------------------------------------------------------------------
+ * The model runs on the host and replaces the SPI bus, the handshake line and the K210
+ * slave firmware for the ESP32 modules built on host ('spi_master.c', 'spi_common.c', ...).
+ *
+ * - every SPI transaction issued by the ESP32 driver shim is passed to 'k210_sim_transmit()',
+ *   which takes the time the transfer would take on the wire (clock, per transaction overhead)
+ *   and optionally flips bits with the configured bit error rate
+ * - the slave parses and checks (crc16) the 16-byte command blocks, serves the INFO, READ,
+ *   RDSTAT, WRITE, WRSTAT and WRSTAT_CONFIRM commands and drives the handshake line
+ *   (READY low after the command block, IDLE high after the data block) with the
+ *   configured latencies
+ * - K210 initiated requests ('k210_sim_request()') are placed into the slave buffer and
+ *   signaled with a handshake pulse, the response frame written by ESP32 is returned
+ * - file requests from ESP32 are served from an in-memory file system and confirmed with a
+ *   handshake pulse, the same is done for the streamed request blocks (MULTIBLOCK, RQHEADER)
+ * - status messages sent by ESP32 are recorded and can be waited for
+ * - if enabled, the slave advertises compressed frames support (K210_INFO_LZ), decompresses
+ *   the compressed frames from ESP32 and, after ESP32 has reported that it accepts them
+ *   (ESP32_STATUS_CODE_LZ), sends its request and response frames compressed
+ * - unless configured as older firmware ('legacy'), the slave advertises the optional protocol
+ *   features (K210_INFO_SOCKRDMAP, K210_INFO_RQHEADER, K210_INFO_OTASTATS, K210_INFO_ASYNCSSL)
+ * - if ESP32 does not start the data transaction within 10 ms after the command block,
+ *   the slave returns to IDLE (as after a transfer abandoned by ESP32)
+ *
+ * The handshake level is computed from the scheduled transitions when it is read, so that
+ * the spin waits see the exact latencies, a helper thread applies the transitions (and calls
+ * the handshake interrupt handler) when ESP32 waits blocked on the interrupt.
+ * ---------------------------------------------------------------------------------------
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t clock_hz;          // SPI clock, 0: use the clock configured by ESP32
+    uint32_t trans_us;          // SPI driver overhead per transaction
+    uint32_t ready_us;          // command block -> READY (handshake low)
+    uint32_t idle_us;           // data block -> IDLE (handshake high), crc check time is added
+    uint32_t pulse_us;          // handshake pulse width
+    uint32_t file_us;           // file request processing time
+    uint32_t file_kbps;         // file data rate (KB/s), 0: not limited
+    uint32_t confirm_us;        // streamed block processing time before the confirmation pulse
+    uint32_t request_retry_ms;  // repeat the request pulse if ESP32 does not read the request
+    double   bit_error_rate;    // probability of a bit error on the wire
+    uint32_t buffer_size;       // reported slave buffer size
+    uint32_t buffer_ro_size;    // reported read only part of the buffer
+    uint32_t crc_speed;         // reported crc16 speed (ns per 1000 bytes), also used for the crc check time
+    uint32_t crc32_speed;       // reported crc32 speed (ns per 1000 bytes)
+    unsigned seed;              // bit error generator seed
+    bool     lz;                // compressed frames supported
+    bool     legacy;            // older K210 firmware, optional protocol features not advertised
+} k210_sim_config_t;
+
+typedef struct {
+    uint32_t commands;          // command blocks received
+    uint32_t cmd_crc_errors;    // command blocks with bad crc (ignored)
+    uint32_t cmd_busy;          // command blocks received while busy (ignored)
+    uint32_t data_crc_errors;   // written data blocks with bad crc16
+    uint32_t frame_errors;      // written frames with bad length or crc32
+    uint32_t protocol_errors;   // unexpected transactions
+    uint32_t bit_errors;        // injected bit errors
+    uint64_t bytes_tx;          // bytes sent by ESP32
+    uint64_t bytes_rx;          // bytes received by ESP32
+    uint64_t wire_ns;           // time spent on the wire
+    uint32_t requests;          // K210 requests sent
+    uint32_t request_pulses;    // request pulses (including repeated)
+    uint32_t file_requests;     // file requests served
+    uint32_t blocks;            // streamed blocks received
+    uint32_t status_msgs;       // status messages received
+    uint32_t lz_frames_tx;      // compressed frames sent to ESP32
+    uint32_t lz_frames_rx;      // compressed frames received from ESP32
+} k210_sim_stats_t;
+
+typedef struct {
+    uint16_t cmdstat;
+    uint16_t len;
+    uint8_t  *data;             // response data, owned by the caller
+    uint32_t size;              // size of 'data' buffer
+} k210_sim_frame_t;
+
+// called (from the SPI task) for every streamed block (ESP_STATUS_MULTIBLOCK, ESP_STATUS_RQHEADER)
+typedef void (*k210_sim_block_cb_t)(uint16_t status, const uint8_t *data, uint16_t len, void *arg);
+
+#define K210_SIM_HANDSHAKE_GPIO     2
+
+#define K210_SIM_OK                 0
+#define K210_SIM_ERR_BUSY           -1
+#define K210_SIM_ERR_TIMEOUT        -2
+#define K210_SIM_ERR_SIZE           -3
+
+void k210_sim_default_config(k210_sim_config_t *cfg);
+void k210_sim_init(const k210_sim_config_t *cfg);
+void k210_sim_get_stats(k210_sim_stats_t *stats);
+void k210_sim_reset_stats();
+
+// --- ESP32 side (SPI and GPIO driver shims) ---
+void k210_sim_set_device_clock(uint32_t clock_hz);
+uint32_t k210_sim_get_clock();
+int k210_sim_transmit(const uint8_t *tx, uint8_t *rx, size_t len);
+int k210_sim_handshake_level();
+void k210_sim_handshake_intr_enable(bool enable);
+void k210_sim_handshake_intr_type(int intr_type);
+void k210_sim_handshake_isr(void (*isr)(void *), void *arg);
+
+// --- K210 side ---
+// ESP32 and K210 share the slave buffer, K210 requests must not be sent
+// while ESP32 file requests are executed
+int k210_sim_request(uint16_t cmd, const void *data, uint16_t len, k210_sim_frame_t *resp, uint32_t timeout_ms);
+void k210_sim_set_block_handler(k210_sim_block_cb_t cb, void *arg);
+bool k210_sim_wait_status(int type, uint32_t *seq, int32_t *value, uint32_t timeout_ms);
+
+// In-memory file system served to ESP32 file requests
+int k210_sim_file_put(const char *path, const void *data, uint32_t size);
+int k210_sim_file_get(const char *path, const uint8_t **data, uint32_t *size);
+void k210_sim_file_remove_all();
+
+// Simulated HTTP client data rate (KB/s), 0: not limited (see 'net_host.c')
+void sim_http_set_rate(uint32_t kbps);
+
+// --- Time ---
+uint64_t sim_time_ns();
+void sim_spin_until_ns(uint64_t t);
+
+#ifdef __cplusplus
+}
+#endif
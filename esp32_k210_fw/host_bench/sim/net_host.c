@@ -0,0 +1,301 @@
+/*
+ * WiFi, SNTP, TLS and HTTP client functions used by 'wifi.c', host implementation
+ * ---------------------------------------------------------------------------------------
+ * - WiFi and SNTP are not simulated, the benchmark sets 'wifi_is_connected' itself
+ * - TLS is not available, all mbedTLS functions fail
+ * - the HTTP client serves generated responses:
+ *     http://sim/bytes/<n>     200, <n> bytes of data, byte i = (uint8_t)(i*7+3)
+ *     any other url            404, no data
+ *   the host 'sim' resolves to 127.0.0.1, the url is matched by its path only
+ *   the data is delivered in 'buffer_size' chunks at the rate set by 'sim_http_set_rate()'
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_event.h"
+#include "esp_wifi.h"
+#include "esp_sntp.h"
+#include "esp_tls.h"
+#include "esp_http_client.h"
+#include "tcpip_adapter.h"
+#include "lwip/igmp.h"
+#include "lwip/sockets.h"
+#include "mbedtls/ssl.h"
+#include "k210_sim.h"
+
+#define SIM_HTTP_PATH_BYTES     "/bytes/"
+
+struct esp_http_client {
+    esp_http_client_config_t config;
+    char *url;
+    int status_code;
+    int content_length;
+};
+
+esp_event_base_t WIFI_EVENT = "WIFI_EVENT";
+esp_event_base_t IP_EVENT = "IP_EVENT";
+
+static uint32_t http_kbps = 0;
+
+
+// ==== WiFi, events, SNTP ====================================================
+
+esp_err_t esp_event_loop_create_default(void) { return ESP_OK; }
+esp_err_t esp_event_handler_register(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler, void *event_handler_arg) { return ESP_OK; }
+esp_err_t esp_event_handler_unregister(esp_event_base_t event_base, int32_t event_id, esp_event_handler_t event_handler) { return ESP_OK; }
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config) { return ESP_FAIL; }
+esp_err_t esp_wifi_deinit(void) { return ESP_OK; }
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode) { return ESP_FAIL; }
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t *conf) { return ESP_FAIL; }
+esp_err_t esp_wifi_start(void) { return ESP_FAIL; }
+esp_err_t esp_wifi_stop(void) { return ESP_OK; }
+esp_err_t esp_wifi_connect(void) { return ESP_FAIL; }
+esp_err_t esp_wifi_get_max_tx_power(int8_t *power) { *power = 0; return ESP_OK; }
+
+void sntp_setoperatingmode(int operating_mode) { }
+void sntp_setservername(int idx, const char *server) { }
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback) { }
+void sntp_set_sync_mode(sntp_sync_mode_t sync_mode) { }
+void sntp_init(void) { }
+void sntp_stop(void) { }
+bool sntp_enabled(void) { return false; }
+
+void tcpip_adapter_init(void) { }
+
+//=================================================================================================
+esp_err_t tcpip_adapter_get_ip_info(tcpip_adapter_if_t tcpip_if, tcpip_adapter_ip_info_t *ip_info)
+{
+    memset(ip_info, 0, sizeof(tcpip_adapter_ip_info_t));
+    ip_info->ip.addr = htonl(INADDR_LOOPBACK);
+    ip_info->netmask.addr = htonl(0xFF000000);
+    return ESP_OK;
+}
+
+//=====================================================================================================================================
+esp_err_t tcpip_adapter_get_dns_info(tcpip_adapter_if_t tcpip_if, tcpip_adapter_dns_type_t type, tcpip_adapter_dns_info_t *dns)
+{
+    memset(dns, 0, sizeof(tcpip_adapter_dns_info_t));
+    return ESP_OK;
+}
+
+//===================================================================
+char *ip4addr_ntoa_r(const ip4_addr_t *addr, char *buf, int buflen)
+{
+    struct in_addr in = { .s_addr = addr->addr };
+    return (char *)inet_ntop(AF_INET, &in, buf, buflen);
+}
+
+//=================================================
+int ip4addr_aton(const char *cp, ip4_addr_t *addr)
+{
+    struct in_addr in;
+    if (inet_pton(AF_INET, cp, &in) != 1) return 0;
+    addr->addr = in.s_addr;
+    return 1;
+}
+
+//==============================================================================================================
+int sim_getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res)
+{
+    if ((node) && (strcmp(node, "sim") == 0)) node = "127.0.0.1";
+    return getaddrinfo(node, service, hints, res);
+}
+
+//=======================================
+char *ip4addr_ntoa(const ip4_addr_t *addr)
+{
+    static char buf[16];
+    return ip4addr_ntoa_r(addr, buf, sizeof(buf));
+}
+
+//=============================================================================
+err_t igmp_joingroup(const ip4_addr_t *ifaddr, const ip4_addr_t *groupaddr)
+{
+    return ERR_OK;
+}
+
+// ==== TLS ===================================================================
+
+//=============================================================================================================
+esp_err_t esp_tls_get_and_clear_last_error(esp_tls_error_handle_t h, int *esp_tls_code, int *esp_tls_flags)
+{
+    if (esp_tls_code) *esp_tls_code = 0;
+    if (esp_tls_flags) *esp_tls_flags = 0;
+    return ESP_OK;
+}
+
+void mbedtls_net_init(mbedtls_net_context *ctx) { ctx->fd = -1; }
+void mbedtls_net_free(mbedtls_net_context *ctx) { if (ctx->fd >= 0) close(ctx->fd); ctx->fd = -1; }
+int mbedtls_net_connect(mbedtls_net_context *ctx, const char *host, const char *port, int proto) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+int mbedtls_net_bind(mbedtls_net_context *ctx, const char *bind_ip, const char *port, int proto) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+int mbedtls_net_accept(mbedtls_net_context *bind_ctx, mbedtls_net_context *client_ctx, void *client_ip, size_t buf_size, size_t *ip_len) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+int mbedtls_net_set_nonblock(mbedtls_net_context *ctx) { return 0; }
+int mbedtls_net_poll(mbedtls_net_context *ctx, uint32_t rw, uint32_t timeout) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+int mbedtls_net_send(void *ctx, const unsigned char *buf, size_t len) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+int mbedtls_net_recv(void *ctx, unsigned char *buf, size_t len) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+
+void mbedtls_entropy_init(mbedtls_entropy_context *ctx) { }
+void mbedtls_entropy_free(mbedtls_entropy_context *ctx) { }
+int mbedtls_entropy_func(void *data, unsigned char *output, size_t len) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+void mbedtls_ctr_drbg_init(mbedtls_ctr_drbg_context *ctx) { }
+void mbedtls_ctr_drbg_free(mbedtls_ctr_drbg_context *ctx) { }
+int mbedtls_ctr_drbg_seed(mbedtls_ctr_drbg_context *ctx, int (*f_entropy)(void *, unsigned char *, size_t),
+        void *p_entropy, const unsigned char *custom, size_t len) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+int mbedtls_ctr_drbg_random(void *p_rng, unsigned char *output, size_t output_len) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+
+void mbedtls_x509_crt_init(mbedtls_x509_crt *crt) { }
+void mbedtls_x509_crt_free(mbedtls_x509_crt *crt) { }
+int mbedtls_x509_crt_parse(mbedtls_x509_crt *chain, const unsigned char *buf, size_t buflen) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+int mbedtls_x509_crt_verify_info(char *buf, size_t size, const char *prefix, uint32_t flags) { if (size) buf[0] = '\0'; return 0; }
+void mbedtls_pk_init(mbedtls_pk_context *ctx) { }
+void mbedtls_pk_free(mbedtls_pk_context *ctx) { }
+int mbedtls_pk_parse_key(mbedtls_pk_context *ctx, const unsigned char *key, size_t keylen, const unsigned char *pwd, size_t pwdlen) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+
+void mbedtls_ssl_init(mbedtls_ssl_context *ssl) { }
+void mbedtls_ssl_free(mbedtls_ssl_context *ssl) { }
+void mbedtls_ssl_config_init(mbedtls_ssl_config *conf) { }
+void mbedtls_ssl_config_free(mbedtls_ssl_config *conf) { }
+int mbedtls_ssl_config_defaults(mbedtls_ssl_config *conf, int endpoint, int transport, int preset) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+void mbedtls_ssl_conf_authmode(mbedtls_ssl_config *conf, int authmode) { }
+void mbedtls_ssl_conf_ca_chain(mbedtls_ssl_config *conf, mbedtls_x509_crt *ca_chain, void *ca_crl) { }
+int mbedtls_ssl_conf_own_cert(mbedtls_ssl_config *conf, mbedtls_x509_crt *own_cert, mbedtls_pk_context *pk_key) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+void mbedtls_ssl_conf_rng(mbedtls_ssl_config *conf, int (*f_rng)(void *, unsigned char *, size_t), void *p_rng) { }
+int mbedtls_ssl_setup(mbedtls_ssl_context *ssl, const mbedtls_ssl_config *conf) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+int mbedtls_ssl_set_hostname(mbedtls_ssl_context *ssl, const char *hostname) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+void mbedtls_ssl_set_bio(mbedtls_ssl_context *ssl, void *p_bio, mbedtls_ssl_send_t f_send,
+        mbedtls_ssl_recv_t f_recv, mbedtls_ssl_recv_timeout_t f_recv_timeout) { }
+int mbedtls_ssl_handshake(mbedtls_ssl_context *ssl) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+uint32_t mbedtls_ssl_get_verify_result(const mbedtls_ssl_context *ssl) { return 0xFFFFFFFF; }
+const char *mbedtls_ssl_get_ciphersuite(const mbedtls_ssl_context *ssl) { return "none"; }
+size_t mbedtls_ssl_get_bytes_avail(const mbedtls_ssl_context *ssl) { return 0; }
+int mbedtls_ssl_read(mbedtls_ssl_context *ssl, unsigned char *buf, size_t len) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+int mbedtls_ssl_write(mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+int mbedtls_ssl_close_notify(mbedtls_ssl_context *ssl) { return 0; }
+int mbedtls_ssl_session_reset(mbedtls_ssl_context *ssl) { return 0; }
+void mbedtls_ssl_conf_session_tickets(mbedtls_ssl_config *conf, int use_tickets) { }
+void mbedtls_ssl_session_init(mbedtls_ssl_session *session) { }
+void mbedtls_ssl_session_free(mbedtls_ssl_session *session) { }
+int mbedtls_ssl_get_session(const mbedtls_ssl_context *ssl, mbedtls_ssl_session *session) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+int mbedtls_ssl_set_session(mbedtls_ssl_context *ssl, const mbedtls_ssl_session *session) { return MBEDTLS_ERR_SSL_FEATURE_UNAVAILABLE; }
+void mbedtls_esp_enable_debug_log(mbedtls_ssl_config *conf, int threshold) { }
+
+// ==== HTTP client ===========================================================
+
+//====================================
+void sim_http_set_rate(uint32_t kbps)
+{
+    http_kbps = kbps;
+}
+
+//-------------------------------------------------------------------------------------------------------------------
+static void http_event(esp_http_client_handle_t client, esp_http_client_event_id_t id, void *data, int len, char *key, char *value)
+{
+    if (client->config.event_handler == NULL) return;
+    esp_http_client_event_t evt = {
+        .event_id = id,
+        .client = client,
+        .data = data,
+        .data_len = len,
+        .user_data = client->config.user_data,
+        .header_key = key,
+        .header_value = value,
+    };
+    client->config.event_handler(&evt);
+}
+
+//==========================================================================================
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    if ((config->url == NULL) || (strncmp(config->url, "http://", 7) != 0)) return NULL;
+    esp_http_client_handle_t client = calloc(1, sizeof(struct esp_http_client));
+    if (client == NULL) return NULL;
+    client->config = *config;
+    if (client->config.buffer_size <= 0) client->config.buffer_size = 512;
+    client->url = strdup(config->url);
+    client->content_length = -1;
+    return client;
+}
+
+//===================================================================
+esp_err_t esp_http_client_perform(esp_http_client_handle_t client)
+{
+    int length = 0;
+    char value[16];
+
+    const char *path = strchr(client->url + 7, '/');
+    if ((path) && (strncmp(path, SIM_HTTP_PATH_BYTES, strlen(SIM_HTTP_PATH_BYTES)) == 0)) {
+        client->status_code = 200;
+        length = atoi(path + strlen(SIM_HTTP_PATH_BYTES));
+    }
+    else client->status_code = 404;
+    client->content_length = length;
+
+    http_event(client, HTTP_EVENT_ON_CONNECTED, NULL, 0, NULL, NULL);
+    http_event(client, HTTP_EVENT_HEADERS_SENT, NULL, 0, NULL, NULL);
+    http_event(client, HTTP_EVENT_ON_HEADER, NULL, 0, "Content-Type", "application/octet-stream");
+    sprintf(value, "%d", length);
+    http_event(client, HTTP_EVENT_ON_HEADER, NULL, 0, "Content-Length", value);
+
+    uint8_t *buf = malloc(client->config.buffer_size);
+    if (buf == NULL) return ESP_ERR_NO_MEM;
+    uint64_t t = sim_time_ns();
+    int pos = 0;
+    while (pos < length) {
+        int n = length - pos;
+        if (n > client->config.buffer_size) n = client->config.buffer_size;
+        for (int i = 0; i < n; i++) buf[i] = (uint8_t)((pos + i) * 7 + 3);
+        if (http_kbps) {
+            // bytes / (KB/s) -> ns
+            t += ((uint64_t)n * 1000000ULL) / http_kbps;
+            uint64_t now = sim_time_ns();
+            if (t > now) {
+                struct timespec ts = { .tv_sec = (t - now) / 1000000000ULL, .tv_nsec = (t - now) % 1000000000ULL };
+                nanosleep(&ts, NULL);
+            }
+        }
+        http_event(client, HTTP_EVENT_ON_DATA, buf, n, NULL, NULL);
+        pos += n;
+    }
+    free(buf);
+
+    http_event(client, HTTP_EVENT_ON_FINISH, NULL, 0, NULL, NULL);
+    http_event(client, HTTP_EVENT_DISCONNECTED, NULL, 0, NULL, NULL);
+    return ESP_OK;
+}
+
+//=========================================================================================================
+esp_err_t esp_http_client_set_header(esp_http_client_handle_t client, const char *key, const char *value)
+{
+    return (client) ? ESP_OK : ESP_FAIL;
+}
+
+//===================================================================
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    if (client == NULL) return ESP_FAIL;
+    free(client->url);
+    free(client);
+    return ESP_OK;
+}
+
+//=============================================================
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->status_code;
+}
+
+//================================================================
+int esp_http_client_get_content_length(esp_http_client_handle_t client)
+{
+    return client->content_length;
+}
+
+//=================================================================
+bool esp_http_client_is_chunked_response(esp_http_client_handle_t client)
+{
+    return false;
+}
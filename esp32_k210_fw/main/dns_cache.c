@@ -0,0 +1,245 @@
+/*
+ * Host name resolver cache
+ * ---------------------------------------------------------------------------------------
+ * Small fixed size cache of the resolved IPv4 addresses, keyed by the host name.
+ * Used by the K210 socket commands ('get_ipaddr()'), the SSL connect and 'requests_GET()',
+ * so that reconnecting to the same host does not wait for a DNS round trip each time.
+ * - lwIP does not return the record TTL, the successful lookups are kept for DNS_CACHE_TTL
+ *   seconds (lwIP's own resolver table still honours the record TTL for the lookups we make)
+ * - failed lookups are cached for DNS_CACHE_NEG_TTL seconds (negative caching), the same
+ *   error is returned without a new query
+ * - an entry used within DNS_CACHE_PREFETCH seconds of its expiry is refreshed in the
+ *   background by a short lived task, so frequently used hosts never wait for the resolver
+ * - when the cache is full, the least recently used entry is replaced
+ * Numeric addresses are converted directly and not cached.
+ * The resolver is never called with the cache mutex taken.
+ * The cache is flushed when WiFi is deinitialized.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "lwip/ip4.h"
+
+#include "global.h"
+
+#define DNS_CACHE_SIZE          8
+#define DNS_CACHE_HOST_MAX      64
+#define DNS_CACHE_TTL           300     // seconds
+#define DNS_CACHE_NEG_TTL       10      // seconds
+#define DNS_CACHE_PREFETCH      30      // seconds before expiry, 0: no prefetch
+#define DNS_PREFETCH_STACK      3072
+#define DNS_PREFETCH_PRIORITY   3
+
+typedef struct _dns_cache_entry_t
+{
+    char     host[DNS_CACHE_HOST_MAX];
+    uint32_t addr;          // IPv4 address, network byte order
+    int      errcode;       // 0: resolved, else negative entry (errno of the failed lookup)
+    uint32_t expires;       // seconds since boot
+    uint32_t last_used;
+    bool     valid;
+    bool     prefetch;      // refresh requested
+} dns_cache_entry_t;
+
+static dns_cache_entry_t dns_cache[DNS_CACHE_SIZE] = {0};
+static dns_cache_stats_t dns_stats = {0};
+static uint32_t dns_cache_seq = 0;
+static SemaphoreHandle_t dns_mutex = NULL;
+static bool dns_prefetch_running = false;
+
+static const char *DNS_TAG = "[DNS_CACHE]";
+
+//--------------------------
+static uint32_t dns_time_s()
+{
+    return (uint32_t)(esp_timer_get_time() / 1000000);
+}
+
+//--------------------------------------------------------
+static dns_cache_entry_t *dns_cache_find(const char *host)
+{
+    for (int i=0; i<DNS_CACHE_SIZE; i++) {
+        if ((dns_cache[i].valid) && (strcmp(dns_cache[i].host, host) == 0)) return &dns_cache[i];
+    }
+    return NULL;
+}
+
+// Resolve the host name, returns the errno of the failed lookup or 0
+//------------------------------------------------------
+static int dns_resolve(const char *host, uint32_t *addr)
+{
+    const struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *resp = NULL;
+    struct addrinfo *resi;
+    int errcode;
+
+    int ret = lwip_getaddrinfo(host, NULL, &hints, &resp);
+    errcode = errno;
+    if ((ret == 0) && (resp)) {
+        for (resi = resp; resi; resi = resi->ai_next) {
+            if (resi->ai_family == AF_INET) break;
+        }
+        if (resi) {
+            *addr = ((struct sockaddr_in *)resi->ai_addr)->sin_addr.s_addr;
+            errcode = 0;
+        }
+        else errcode = ENETRESET;
+    }
+    else if (errcode == 0) errcode = EHOSTUNREACH;
+    if (resp) lwip_freeaddrinfo(resp);
+    return errcode;
+}
+
+// Save the lookup result, replaces the least recently used entry
+//-----------------------------------------------------------------------
+static void dns_cache_store(const char *host, uint32_t addr, int errcode)
+{
+    dns_cache_entry_t *entry = dns_cache_find(host);
+    if (entry == NULL) {
+        entry = &dns_cache[0];
+        for (int i=0; i<DNS_CACHE_SIZE; i++) {
+            if (!dns_cache[i].valid) {
+                entry = &dns_cache[i];
+                break;
+            }
+            if (dns_cache[i].last_used < entry->last_used) entry = &dns_cache[i];
+        }
+        strcpy(entry->host, host);
+        entry->last_used = ++dns_cache_seq;
+    }
+    entry->addr = addr;
+    entry->errcode = errcode;
+    entry->expires = dns_time_s() + ((errcode) ? DNS_CACHE_NEG_TTL : DNS_CACHE_TTL);
+    entry->prefetch = false;
+    entry->valid = true;
+}
+
+//--------------------------------------
+static void dns_prefetch_task(void *arg)
+{
+    char host[DNS_CACHE_HOST_MAX];
+    uint32_t addr = 0;
+
+    while (1) {
+        // get the next entry to refresh
+        host[0] = '\0';
+        xSemaphoreTake(dns_mutex, portMAX_DELAY);
+        for (int i=0; i<DNS_CACHE_SIZE; i++) {
+            if ((dns_cache[i].valid) && (dns_cache[i].prefetch)) {
+                dns_cache[i].prefetch = false;
+                strcpy(host, dns_cache[i].host);
+                break;
+            }
+        }
+        if (host[0] == '\0') dns_prefetch_running = false;
+        xSemaphoreGive(dns_mutex);
+        if (host[0] == '\0') break;
+
+        int errcode = dns_resolve(host, &addr);
+        xSemaphoreTake(dns_mutex, portMAX_DELAY);
+        dns_stats.prefetches++;
+        // a failed refresh does not replace the valid address, it expires normally
+        if ((errcode == 0) && (dns_cache_find(host))) dns_cache_store(host, addr, 0);
+        xSemaphoreGive(dns_mutex);
+        if (debug_log >= 2) ESP_LOGI(DNS_TAG, "Prefetch '%s': %d", host, errcode);
+    }
+    vTaskDelete(NULL);
+}
+
+//===================
+void dns_cache_init()
+{
+    if (dns_mutex == NULL) dns_mutex = xSemaphoreCreateMutex();
+}
+
+// Get the IPv4 address (network byte order) of the host
+// Returns 0 on success or the errno of the (cached) failed lookup
+//====================================================
+int dns_cache_lookup(const char *host, uint32_t *addr)
+{
+    ip4_addr_t ip4;
+    if (ip4addr_aton(host, &ip4)) {
+        // numeric address
+        *addr = ip4.addr;
+        return 0;
+    }
+    if ((dns_mutex == NULL) || (strlen(host) >= DNS_CACHE_HOST_MAX)) return dns_resolve(host, addr);
+
+    int errcode = -1;
+    bool start_prefetch = false;
+    uint32_t now = dns_time_s();
+
+    xSemaphoreTake(dns_mutex, portMAX_DELAY);
+    dns_cache_entry_t *entry = dns_cache_find(host);
+    if ((entry) && ((int32_t)(entry->expires - now) > 0)) {
+        entry->last_used = ++dns_cache_seq;
+        *addr = entry->addr;
+        errcode = entry->errcode;
+        if (errcode == 0) {
+            dns_stats.hits++;
+            if ((DNS_CACHE_PREFETCH > 0) && ((int32_t)(entry->expires - now) <= DNS_CACHE_PREFETCH)) {
+                entry->prefetch = true;
+                if (!dns_prefetch_running) {
+                    dns_prefetch_running = true;
+                    start_prefetch = true;
+                }
+            }
+        }
+        else dns_stats.negative_hits++;
+    }
+    else dns_stats.misses++;
+    xSemaphoreGive(dns_mutex);
+
+    if (start_prefetch) {
+        if (xTaskCreatePinnedToCore(dns_prefetch_task, "DNS prefetch", DNS_PREFETCH_STACK, NULL, DNS_PREFETCH_PRIORITY, NULL, 0) != pdPASS) {
+            xSemaphoreTake(dns_mutex, portMAX_DELAY);
+            dns_prefetch_running = false;
+            xSemaphoreGive(dns_mutex);
+        }
+    }
+    if (errcode >= 0) return errcode;
+
+    // not cached or expired
+    errcode = dns_resolve(host, addr);
+    xSemaphoreTake(dns_mutex, portMAX_DELAY);
+    dns_cache_store(host, *addr, errcode);
+    xSemaphoreGive(dns_mutex);
+    if (debug_log >= 2) ESP_LOGI(DNS_TAG, "Resolved '%s': %d", host, errcode);
+    return errcode;
+}
+
+//====================
+void dns_cache_flush()
+{
+    if (dns_mutex == NULL) return;
+    xSemaphoreTake(dns_mutex, portMAX_DELAY);
+    for (int i=0; i<DNS_CACHE_SIZE; i++) {
+        dns_cache[i].valid = false;
+        dns_cache[i].prefetch = false;
+    }
+    xSemaphoreGive(dns_mutex);
+}
+
+//================================================
+void dns_cache_get_stats(dns_cache_stats_t *stats)
+{
+    if (dns_mutex == NULL) {
+        memset(stats, 0, sizeof(dns_cache_stats_t));
+        return;
+    }
+    xSemaphoreTake(dns_mutex, portMAX_DELAY);
+    memcpy(stats, &dns_stats, sizeof(dns_cache_stats_t));
+    stats->entries = 0;
+    for (int i=0; i<DNS_CACHE_SIZE; i++) {
+        if (dns_cache[i].valid) stats->entries++;
+    }
+    xSemaphoreGive(dns_mutex);
+}
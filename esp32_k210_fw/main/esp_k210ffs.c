@@ -23,103 +23,333 @@
 #include <sys/errno.h>
 #include <sys/fcntl.h>
 #include <sys/lock.h>
+#include <sys/stat.h>
 #include "esp_vfs.h"
 #include "esp_err.h"
 
 
-//----------------------------------------------------------------------------
+/*
+ * Files on K210 are accessed through the SPI link, every K210 file request is a full
+ * request/response round trip, so the number of requests is kept as low as possible:
+ *  - reads are served from the per-file read-ahead cache, which is filled with
+ *    the largest block which fits into one SPI frame ('K210_FILE_READ_MAX')
+ *  - reads larger than the block size are transferred directly into the caller's buffer
+ *  - lseek only sets the file position, K210 file position is synchronized
+ *    on the next K210 read/write request (if needed)
+ * The table mutex is held only while a file slot is looked up, allocated or released,
+ * the file operations take the per-file lock, so the requests for different files
+ * from different tasks are queued to the SPI task at the same time.
+ */
+typedef struct _k210ffs_file_t
+{
+    int      k210_fd;       // K210 file descriptor, -1 if not used
+    off_t    pos;           // current file position
+    off_t    k210_pos;      // file position on K210
+    off_t    eof_pos;       // file end (detected on short read), -1 if unknown
+    uint8_t  *cache;        // read-ahead cache
+    off_t    cache_pos;     // file position of the first cached byte
+    size_t   cache_len;     // number of bytes in cache
+    SemaphoreHandle_t lock;
+} k210ffs_file_t;
+
+#define K210FFS_FD_OPENING  -2  // slot reserved, K210 open request in progress
+
+static k210ffs_file_t k210ffs_files[K210VFS_MAX_FILES];
+static SemaphoreHandle_t k210ffs_mutex = NULL;
+
+//-------------------------------
+static int k210ffs_errno(int res)
+{
+    if (res == ESP_FILEERR_NOTCONNECTED) return ENODEV;
+    if (res == -1) return ENOENT;
+    return EIO;
+}
+
+//---------------------------------------------
+static k210ffs_file_t *k210ffs_get_file(int fd)
+{
+    if ((fd < 0) || (fd >= K210VFS_MAX_FILES) || (k210ffs_files[fd].k210_fd < 0)) return NULL;
+    return &k210ffs_files[fd];
+}
+
+// Get the opened file and take its lock
+//----------------------------------------------
+static k210ffs_file_t *k210ffs_lock_file(int fd)
+{
+    xSemaphoreTake(k210ffs_mutex, portMAX_DELAY);
+    k210ffs_file_t *f = k210ffs_get_file(fd);
+    xSemaphoreGive(k210ffs_mutex);
+    if (f == NULL) return NULL;
+
+    xSemaphoreTake(f->lock, portMAX_DELAY);
+    // the file could be closed while waiting for the lock
+    if (f->k210_fd < 0) {
+        xSemaphoreGive(f->lock);
+        return NULL;
+    }
+    return f;
+}
+
+//--------------------------------------------
+static int k210ffs_sync_pos(k210ffs_file_t *f)
+{
+    // Set K210 file position to the current file position
+    if (f->k210_pos == f->pos) return 0;
+    int res = k210_file_lseek(f->k210_fd, (int)f->pos, SEEK_SET);
+    if (res < 0) return res;
+    f->k210_pos = res;
+    return (res == f->pos) ? 0 : -1;
+}
+
+//-----------------------------------------------------------------
 static int vfs_k210ffs_open(const char * path, int flags, int mode)
 {
     if (path == NULL) return -1;
-    int fd = k210_file_open(path, flags);
-    if (fd < 0) {
-        errno = K210_errno;
-        K210_errno = 0;
+
+    int k210_mode = ESP_FILE_MODE_RO;
+    if ((flags & O_ACCMODE) == O_RDWR) k210_mode = ESP_FILE_MODE_RW;
+    else if ((flags & O_ACCMODE) == O_WRONLY) k210_mode = (flags & O_APPEND) ? ESP_FILE_MODE_APPEND : ESP_FILE_MODE_WR;
+
+    xSemaphoreTake(k210ffs_mutex, portMAX_DELAY);
+    int fd;
+    for (fd=0; fd<K210VFS_MAX_FILES; fd++) {
+        if (k210ffs_files[fd].k210_fd == -1) break;
+    }
+    if (fd >= K210VFS_MAX_FILES) {
+        xSemaphoreGive(k210ffs_mutex);
+        errno = ENFILE;
+        return -1;
+    }
+    k210ffs_file_t *f = &k210ffs_files[fd];
+    f->k210_fd = K210FFS_FD_OPENING;
+    xSemaphoreGive(k210ffs_mutex);
+
+    int res = k210_file_open(path, k210_mode);
+    xSemaphoreTake(k210ffs_mutex, portMAX_DELAY);
+    if (res < 0) {
+        f->k210_fd = -1;
+        xSemaphoreGive(k210ffs_mutex);
+        errno = k210ffs_errno(res);
         return -1;
     }
+    f->pos = 0;
+    f->k210_pos = 0;
+    f->eof_pos = -1;
+    f->cache = NULL;
+    f->cache_pos = 0;
+    f->cache_len = 0;
+    f->k210_fd = res;
+    xSemaphoreGive(k210ffs_mutex);
     return fd;
 }
 
 //----------------------------------------------------------------------
 static ssize_t vfs_k210ffs_write(int fd, const void * data, size_t size)
 {
-    ssize_t res = k210_file_write(fd, (void *)data, size);
-    if (res < 0) {
-        errno = K210_errno;
-        K210_errno = 0;
+    const uint8_t *pdata = (const uint8_t *)data;
+    size_t done = 0;
+    int res = 0;
+
+    k210ffs_file_t *f = k210ffs_lock_file(fd);
+    if (f == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    // cached data is not valid anymore
+    f->cache_len = 0;
+    f->eof_pos = -1;
+
+    res = k210ffs_sync_pos(f);
+    while ((res >= 0) && (done < size)) {
+        size_t n = size - done;
+        if (n > K210_FILE_READ_MAX) n = K210_FILE_READ_MAX;
+        res = k210_file_write(f->k210_fd, pdata+done, n);
+        if (res <= 0) break;
+        done += res;
+        f->pos += res;
+        f->k210_pos += res;
+        if (res < n) break;
+    }
+    xSemaphoreGive(f->lock);
+
+    if ((done == 0) && (res < 0)) {
+        errno = k210ffs_errno(res);
         return -1;
     }
-    return res;
+    return done;
 }
 
 //--------------------------------------------------------------
 static ssize_t vfs_k210ffs_read(int fd, void * dst, size_t size)
 {
-    ESP_LOGI(SPI_TAG, "k210ffs: File read: %d, %d", fd, size);
-    vTaskDelay(50);
-    ssize_t res = k210_file_read(fd, dst, size);
-    if (res < 0) {
-        errno = K210_errno;
-        K210_errno = 0;
+    uint8_t *pdst = (uint8_t *)dst;
+    size_t done = 0;
+    size_t block = K210_FILE_READ_MAX;
+    int res = 0;
+
+    k210ffs_file_t *f = k210ffs_lock_file(fd);
+    if (f == NULL) {
+        errno = EBADF;
         return -1;
     }
-    return res;
+
+    while (done < size) {
+        // Serve from cache if possible
+        if ((f->cache_len > 0) && (f->pos >= f->cache_pos) && (f->pos < (f->cache_pos + f->cache_len))) {
+            size_t n = (f->cache_pos + f->cache_len) - f->pos;
+            if (n > (size - done)) n = size - done;
+            memcpy(pdst+done, f->cache + (f->pos - f->cache_pos), n);
+            done += n;
+            f->pos += n;
+            continue;
+        }
+        if ((f->eof_pos >= 0) && (f->pos >= f->eof_pos)) break;
+
+        res = k210ffs_sync_pos(f);
+        if (res < 0) break;
+
+        if ((f->cache == NULL) && ((size - done) < block)) f->cache = malloc(block);
+        if (((size - done) >= block) || (f->cache == NULL)) {
+            // Large read, transfer directly into the caller's buffer
+            size_t n = ((size - done) > block) ? block : (size - done);
+            res = k210_file_read(f->k210_fd, pdst+done, n);
+            if (res < 0) break;
+            done += res;
+            f->pos += res;
+            f->k210_pos += res;
+            if (res < n) {
+                f->eof_pos = f->pos;
+                break;
+            }
+        }
+        else {
+            // Fill the read-ahead cache
+            res = k210_file_read(f->k210_fd, f->cache, block);
+            if (res < 0) break;
+            f->cache_pos = f->pos;
+            f->cache_len = res;
+            f->k210_pos += res;
+            if (res < block) f->eof_pos = f->pos + res;
+            if (res == 0) break;
+        }
+    }
+    xSemaphoreGive(f->lock);
+
+    if ((done == 0) && (res < 0)) {
+        errno = k210ffs_errno(res);
+        return -1;
+    }
+    return done;
 }
 
-//---------------------------------------------
+//----------------------------------
 static int vfs_k210ffs_close(int fd)
 {
-    int res = k210_file_close(fd);
+    k210ffs_file_t *f = k210ffs_lock_file(fd);
+    if (f == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    int res = k210_file_close(f->k210_fd);
+    if (f->cache) free(f->cache);
+    f->cache = NULL;
+    xSemaphoreTake(k210ffs_mutex, portMAX_DELAY);
+    f->k210_fd = -1;
+    xSemaphoreGive(k210ffs_mutex);
+    xSemaphoreGive(f->lock);
+
     if (res < 0) {
-        errno = K210_errno;
-        K210_errno = 0;
+        errno = k210ffs_errno(res);
         return -1;
     }
-    return res;
+    return 0;
 }
 
-//-----------------------------------------------------------------------
+//------------------------------------------------------------
 static off_t vfs_k210ffs_lseek(int fd, off_t offset, int mode)
 {
-    errno = ENOTSUP;
-    return -1;
-/*
-    off_t res = k210_file_lseek(fd, offset, mode);
-    if (res < 0) {
-        errno = K210_errno;
-        K210_errno = 0;
+    off_t newpos;
+    k210_fstat_t k210_st;
+
+    k210ffs_file_t *f = k210ffs_lock_file(fd);
+    if (f == NULL) {
+        errno = EBADF;
         return -1;
     }
-    return res;
-*/
+    switch (mode) {
+        case SEEK_SET:
+            newpos = offset;
+            break;
+        case SEEK_CUR:
+            newpos = f->pos + offset;
+            break;
+        case SEEK_END: {
+            int res = k210_file_fstat(f->k210_fd, &k210_st);
+            if (res < 0) {
+                xSemaphoreGive(f->lock);
+                errno = k210ffs_errno(res);
+                return -1;
+            }
+            newpos = k210_st.size + offset;
+            break;
+        }
+        default:
+            newpos = -1;
+    }
+    if (newpos < 0) {
+        xSemaphoreGive(f->lock);
+        errno = EINVAL;
+        return -1;
+    }
+    // K210 file position is set on the next request, a seek within the cached window costs nothing
+    f->pos = newpos;
+    xSemaphoreGive(f->lock);
+    return newpos;
 }
 
-//--------------------------------------------------------------
+//-----------------------------------------------------------------
+static void k210ffs_to_stat(k210_fstat_t *k210_st, struct stat *st)
+{
+    memset(st, 0, sizeof(struct stat));
+    st->st_mode = k210_st->mode;
+    st->st_size = k210_st->size;
+    st->st_mtime = k210_st->time;
+}
+
+//---------------------------------------------------
 static int vfs_k210ffs_fstat(int fd, struct stat *st)
 {
+    k210_fstat_t k210_st;
     if (st == NULL) return -1;
-    int res = k210_file_fstat(fd, st);
+
+    k210ffs_file_t *f = k210ffs_lock_file(fd);
+    if (f == NULL) {
+        errno = EBADF;
+        return -1;
+    }
+    int res = k210_file_fstat(f->k210_fd, &k210_st);
+    xSemaphoreGive(f->lock);
     if (res < 0) {
-        errno = K210_errno;
-        K210_errno = 0;
+        errno = k210ffs_errno(res);
         return -1;
     }
-    return res;
+    k210ffs_to_stat(&k210_st, st);
+    return 0;
 }
 
-//-----------------------------------------------------------------------
+//------------------------------------------------------------
 static int vfs_k210ffs_stat(const char *path, struct stat *st)
 {
+    k210_fstat_t k210_st;
     if ((path == NULL) || (st == NULL))  return -1;
 
-    int res = k210_file_stat(path, st);
+    int res = k210_file_stat(path, &k210_st);
     if (res < 0) {
-        errno = K210_errno;
-        K210_errno = 0;
+        errno = k210ffs_errno(res);
         return -1;
     }
-
-    return res;
+    k210ffs_to_stat(&k210_st, st);
+    return 0;
 }
 
 static int vfs_k210ffs_rename(const char *src, const char *dst)
@@ -212,6 +442,19 @@ esp_err_t esp_vfs_k210ffs_register()
         .rmdir = &vfs_k210ffs_rmdir
     };
 
+    if (k210ffs_mutex == NULL) {
+        k210ffs_mutex = xSemaphoreCreateMutex();
+        if (k210ffs_mutex == NULL) return ESP_ERR_NO_MEM;
+    }
+    for (int i=0; i<K210VFS_MAX_FILES; i++) {
+        if (k210ffs_files[i].lock == NULL) {
+            k210ffs_files[i].lock = xSemaphoreCreateMutex();
+            if (k210ffs_files[i].lock == NULL) return ESP_ERR_NO_MEM;
+        }
+        k210ffs_files[i].k210_fd = -1;
+        k210ffs_files[i].cache = NULL;
+    }
+
     esp_err_t err = esp_vfs_register(K210VFS_BASE_PATH, &vfs, NULL);
 
     return err;
@@ -221,6 +464,11 @@ esp_err_t esp_vfs_k210ffs_register()
 esp_err_t esp_vfs_k210ffs_unregister()
 {
     esp_err_t err = esp_vfs_unregister(K210VFS_BASE_PATH);
+    for (int i=0; i<K210VFS_MAX_FILES; i++) {
+        if (k210ffs_files[i].cache) free(k210ffs_files[i].cache);
+        k210ffs_files[i].cache = NULL;
+        k210ffs_files[i].k210_fd = -1;
+    }
     return err;
 }
 
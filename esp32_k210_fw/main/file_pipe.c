@@ -0,0 +1,184 @@
+/*
+ * Pipelined K210 file writer
+ * ---------------------------------------------------------------------------------------
+ * Data produced by one task (e.g. received by the http server) is written to the K210 file
+ * by the pipe task, so that the producer does not wait for the SPI request/response of
+ * each write and the network receive and the SPI transfers run at the same time.
+ * - the data is passed in FILE_PIPE_BUFFERS buffers of up to one SPI frame
+ * - if the SPI frame pool has spare frame buffers, the buffers are SPI frames taken from
+ *   the pool, the producer fills the data directly into the FWRITE request frame and the
+ *   frame is handed over to the SPI task ('k210_file_write_frame()') without copying
+ * - otherwise the buffers are allocated (K210_FILE_READ_MAX, at most FILE_PIPE_BLOCK_MAX bytes)
+ *   and the data is copied into the SPI frame
+ * - the producer only waits when all buffers are queued for writing
+ * - after a write error the queued data is discarded, the error is returned to the producer
+ *   on its next 'file_pipe_get()' / 'file_pipe_put()' and by 'file_pipe_close()'
+ * Usage:
+ *   pipe = file_pipe_open(fd);
+ *   while (...) {
+ *       buf = file_pipe_get(pipe, &size); fill up to 'size' bytes; file_pipe_put(pipe, len);
+ *   }
+ *   res = file_pipe_close(pipe);
+ * The K210 file is not closed by the pipe.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+
+#define FILE_PIPE_BUFFERS       3
+#define FILE_PIPE_BLOCK_MAX     8192
+#define FILE_PIPE_STACK         3072
+#define FILE_PIPE_PRIORITY      5
+
+typedef struct _file_pipe_block_t
+{
+    uint8_t *data;
+    size_t  len;            // 0: end of data
+    uint8_t *frame;         // SPI frame buffer holding the data, NULL if not taken
+} file_pipe_block_t;
+
+struct _file_pipe_t
+{
+    int               fd;
+    size_t            block_size;
+    bool              use_frames;   // the buffers are SPI frames from the frame pool
+    QueueHandle_t     free_queue;
+    QueueHandle_t     write_queue;
+    SemaphoreHandle_t done;
+    file_pipe_block_t *current;     // the block owned by the producer
+    volatile int      error;        // first write error
+    volatile uint32_t written;
+    file_pipe_block_t blocks[FILE_PIPE_BUFFERS];
+};
+
+static const char *PIPE_TAG = "[FILE_PIPE]";
+
+//-----------------------------------
+static void file_pipe_task(void *arg)
+{
+    file_pipe_t *pipe = (file_pipe_t *)arg;
+    file_pipe_block_t *block;
+
+    while (1) {
+        xQueueReceive(pipe->write_queue, &block, portMAX_DELAY);
+        if (block->len == 0) break;
+        if (pipe->error == 0) {
+            int res;
+            if (block->frame) res = k210_file_write_frame(pipe->fd, block->frame, block->len);
+            else res = k210_file_write(pipe->fd, block->data, block->len);
+            if (res == (int)block->len) pipe->written += res;
+            else {
+                pipe->error = (res < 0) ? res : ESP_FILEERR_SIZE;
+                if (debug_log >= 1) ESP_LOGE(PIPE_TAG, "Write error (%d)", res);
+            }
+        }
+        // after a write error the data is discarded
+        else spi_frame_put(block->frame);
+        // the frame buffer is now owned by the SPI task or returned to the pool
+        block->frame = NULL;
+        xQueueSend(pipe->free_queue, &block, portMAX_DELAY);
+    }
+    // the end block can hold an unused frame
+    spi_frame_put(block->frame);
+    block->frame = NULL;
+    xSemaphoreGive(pipe->done);
+    vTaskDelete(NULL);
+}
+
+//-------------------------------------------
+static void file_pipe_free(file_pipe_t *pipe)
+{
+    if (pipe->free_queue) vQueueDelete(pipe->free_queue);
+    if (pipe->write_queue) vQueueDelete(pipe->write_queue);
+    if (pipe->done) vSemaphoreDelete(pipe->done);
+    if ((!pipe->use_frames) && (pipe->blocks[0].data)) free(pipe->blocks[0].data);
+    free(pipe);
+}
+
+// Start the pipe for writing to the opened K210 file
+// Returns NULL if there is not enough memory
+//=================================
+file_pipe_t *file_pipe_open(int fd)
+{
+    file_pipe_t *pipe = calloc(1, sizeof(file_pipe_t));
+    if (pipe == NULL) return NULL;
+
+    pipe->fd = fd;
+    pipe->use_frames = (spi_frame_spare() > 0);
+    if (pipe->use_frames) pipe->block_size = K210_FILE_READ_MAX;
+    else pipe->block_size = (K210_FILE_READ_MAX < FILE_PIPE_BLOCK_MAX) ? K210_FILE_READ_MAX : FILE_PIPE_BLOCK_MAX;
+    pipe->free_queue = xQueueCreate(FILE_PIPE_BUFFERS, sizeof(file_pipe_block_t *));
+    pipe->write_queue = xQueueCreate(FILE_PIPE_BUFFERS, sizeof(file_pipe_block_t *));
+    pipe->done = xSemaphoreCreateBinary();
+    uint8_t *data = NULL;
+    if (!pipe->use_frames) data = malloc(pipe->block_size * FILE_PIPE_BUFFERS);
+    if ((pipe->free_queue == NULL) || (pipe->write_queue == NULL) || (pipe->done == NULL) || ((!pipe->use_frames) && (data == NULL))) {
+        if (data) free(data);
+        file_pipe_free(pipe);
+        return NULL;
+    }
+    for (int i=0; i<FILE_PIPE_BUFFERS; i++) {
+        file_pipe_block_t *block = &pipe->blocks[i];
+        if (data) block->data = data + (i * pipe->block_size);
+        xQueueSend(pipe->free_queue, &block, 0);
+    }
+
+    if (xTaskCreatePinnedToCore(file_pipe_task, "File pipe", FILE_PIPE_STACK, pipe, FILE_PIPE_PRIORITY, NULL, 0) != pdPASS) {
+        file_pipe_free(pipe);
+        return NULL;
+    }
+    return pipe;
+}
+
+// Get the next buffer to fill, '*size' is set to the buffer size
+// Waits until a buffer is free, returns NULL after a write error
+//=======================================================
+uint8_t *file_pipe_get(file_pipe_t *pipe, size_t *size)
+{
+    if (pipe->current == NULL) xQueueReceive(pipe->free_queue, &pipe->current, portMAX_DELAY);
+    *size = pipe->block_size;
+    if (pipe->error != 0) return NULL;
+    if ((pipe->use_frames) && (pipe->current->frame == NULL)) {
+        // waits until the SPI task releases a frame buffer
+        pipe->current->frame = spi_frame_get(portMAX_DELAY);
+        if (pipe->current->frame == NULL) {
+            pipe->error = ESP_FILEERR_NOTCONNECTED;
+            return NULL;
+        }
+        pipe->current->data = pipe->current->frame + K210_FILE_WRITE_OFFSET;
+    }
+    return pipe->current->data;
+}
+
+// Queue 'len' bytes of the buffer returned by 'file_pipe_get()' for writing
+// Returns 0 or the first write error
+//===============================================
+int file_pipe_put(file_pipe_t *pipe, size_t len)
+{
+    if ((pipe->current == NULL) || (len == 0)) return pipe->error;
+    if (len > pipe->block_size) len = pipe->block_size;
+    pipe->current->len = len;
+    xQueueSend(pipe->write_queue, &pipe->current, portMAX_DELAY);
+    pipe->current = NULL;
+    return pipe->error;
+}
+
+// Wait until all queued data is written and stop the pipe
+// Returns the number of bytes written or the first write error
+//==================================
+int file_pipe_close(file_pipe_t *pipe)
+{
+    if (pipe->current == NULL) xQueueReceive(pipe->free_queue, &pipe->current, portMAX_DELAY);
+    // the empty block ends the pipe task
+    pipe->current->len = 0;
+    xQueueSend(pipe->write_queue, &pipe->current, portMAX_DELAY);
+    xSemaphoreTake(pipe->done, portMAX_DELAY);
+
+    int res = (pipe->error) ? pipe->error : (int)pipe->written;
+    file_pipe_free(pipe);
+    return res;
+}
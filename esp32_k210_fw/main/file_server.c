@@ -8,9 +8,12 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <sys/param.h>
 #include <sys/unistd.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <dirent.h>
 #include <sys/errno.h>
@@ -36,12 +39,21 @@
 /* Scratch buffer size */
 #define SCRATCH_BUFSIZE  8192
 
+/* Buffered response size, the chunks are sent in two full TCP segments */
+#define RESP_BUFSIZE     (2*1460)
+
+/* Browser cache time of the files embedded in flash, they only change with the firmware */
+#define EMBEDDED_MAX_AGE "public, max-age=86400"
+
 struct file_server_data {
     /* Base path of file storage */
     char base_path[ESP_VFS_PATH_MAX + 1];
 
     /* Scratch buffer for temporary storage during file transfer */
     char scratch[SCRATCH_BUFSIZE];
+
+    /* Buffer for the run-time generated responses ('httpd_resp_writer_t') */
+    char resp[RESP_BUFSIZE];
 };
 
 static const char *TAG = "[File_server]";
@@ -68,6 +80,7 @@ static esp_err_t favicon_get_handler(httpd_req_t *req)
     extern const unsigned char favicon_ico_end[]   asm("_binary_favicon_ico_end");
     const size_t favicon_ico_size = (favicon_ico_end - favicon_ico_start);
     httpd_resp_set_type(req, "image/x-icon");
+    httpd_resp_set_hdr(req, "Cache-Control", EMBEDDED_MAX_AGE);
     httpd_resp_send(req, (const char *)favicon_ico_start, favicon_ico_size);
     return ESP_OK;
 }
@@ -79,12 +92,134 @@ static esp_err_t logo_get_handler(httpd_req_t *req)
     extern const unsigned char logo_end[]   asm("_binary_logo_png_end");
     const size_t logo_size = (logo_end - logo_start);
     httpd_resp_set_type(req, "image/png");
+    httpd_resp_set_hdr(req, "Cache-Control", EMBEDDED_MAX_AGE);
     httpd_resp_send(req, (const char *)logo_start, logo_size);
     return ESP_OK;
 }
 
+/* Handler to respond with the ESP32 <-> K210 link statistics as plain text */
+//--------------------------------------------------
+static esp_err_t stats_get_handler(httpd_req_t *req)
+{
+    char *buf = ((struct file_server_data *)req->user_ctx)->scratch;
+    int len = link_stats_text(buf, SCRATCH_BUFSIZE);
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_send(req, buf, len);
+    return ESP_OK;
+}
+
+/* Handler to respond with the link statistics and clear them afterwards */
+//---------------------------------------------------
+static esp_err_t stats_post_handler(httpd_req_t *req)
+{
+    char *buf = ((struct file_server_data *)req->user_ctx)->scratch;
+    int len = link_stats_text(buf, SCRATCH_BUFSIZE);
+    link_stats_reset();
+    httpd_resp_set_type(req, "text/plain");
+    httpd_resp_send(req, buf, len);
+    return ESP_OK;
+}
+
+/* Directory list cache
+ * Recently viewed directory lists are kept in 'k210_file_listdir_page()' format, so that
+ * browsing back and forth does not transfer the whole list from K210 again.
+ * The cache is flushed by the upload, new directory and delete handlers; the K210 itself
+ * (data logger) also creates files, so the cached lists expire after DIR_CACHE_TTL seconds.
+ * Only used from the http server task. */
+#define DIR_CACHE_SIZE      2
+#define DIR_CACHE_MAX_LEN   (16*1024)
+#define DIR_CACHE_TTL       10
+
+typedef struct {
+    char     path[FILE_PATH_MAX];
+    uint8_t  *list;
+    size_t   len;
+    int      n_entries;
+    uint32_t time;
+} dir_cache_entry_t;
+
+static dir_cache_entry_t dir_cache[DIR_CACHE_SIZE] = {0};
+
+//------------------------------
+static uint32_t dir_cache_time()
+{
+    return (uint32_t)(esp_timer_get_time() / 1000000);
+}
+
+//--------------------------------------------------------
+static dir_cache_entry_t *dir_cache_find(const char *path)
+{
+    uint32_t now = dir_cache_time();
+    for (int i=0; i<DIR_CACHE_SIZE; i++) {
+        if ((dir_cache[i].list) && (strcmp(dir_cache[i].path, path) == 0)) {
+            if ((now - dir_cache[i].time) < DIR_CACHE_TTL) return &dir_cache[i];
+            free(dir_cache[i].list);
+            dir_cache[i].list = NULL;
+        }
+    }
+    return NULL;
+}
+
+// Save the list, replaces the oldest entry; the list is owned by the cache after the call
+//-------------------------------------------------------------------------------------
+static void dir_cache_store(const char *path, uint8_t *list, size_t len, int n_entries)
+{
+    if (strlen(path) >= FILE_PATH_MAX) {
+        free(list);
+        return;
+    }
+    dir_cache_entry_t *entry = &dir_cache[0];
+    for (int i=0; i<DIR_CACHE_SIZE; i++) {
+        if (dir_cache[i].list == NULL) {
+            entry = &dir_cache[i];
+            break;
+        }
+        if (dir_cache[i].time < entry->time) entry = &dir_cache[i];
+    }
+    if (entry->list) free(entry->list);
+    strcpy(entry->path, path);
+    entry->list = list;
+    entry->len = len;
+    entry->n_entries = n_entries;
+    entry->time = dir_cache_time();
+}
+
+//---------------------------
+static void dir_cache_flush()
+{
+    for (int i=0; i<DIR_CACHE_SIZE; i++) {
+        if (dir_cache[i].list) free(dir_cache[i].list);
+        dir_cache[i].list = NULL;
+    }
+}
+
+/* Get the next entry from the directory list page,
+ * returns false at the end of the page */
+//---------------------------------------------------------------------------------------------------------------------
+static bool dir_list_entry(const uint8_t *list, size_t len, size_t *ptr, struct dirent *entry, struct stat *entry_stat)
+{
+    uint32_t size, time;
+
+    if ((*ptr + 10) > len) return false;
+    const uint8_t *p = list + *ptr;
+    size_t name_len = strnlen((const char *)(p + 9), len - *ptr - 9);
+    if ((*ptr + 9 + name_len) >= len) return false;
+
+    // the entries are not aligned
+    memcpy(&size, p + 1, 4);
+    memcpy(&time, p + 5, 4);
+    entry->d_type = (p[0] == 0) ? DT_REG : DT_DIR;
+    entry_stat->st_size = (entry->d_type == DT_REG) ? size : 0;
+    entry_stat->st_mtime = time;
+    strlcpy(entry->d_name, (const char *)(p + 9), sizeof(entry->d_name));
+    *ptr += name_len + 10;
+    return true;
+}
+
 /* Send HTTP response with a run-time generated html consisting of
  * a list of all files and folders under the requested path.
+ * The list is received from K210 page by page into the scratch buffer
+ * and each page is sent before the next one is requested.
 */
 //------------------------------------------------------------------------
 static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath)
@@ -96,26 +231,39 @@ static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath)
     const char *entrytype;
     char dirpath_loc[strlen(dirpath)+1];
 
-    struct dirent *entry = NULL;
+    struct dirent entry;
     struct stat entry_stat;
 
-    struct dirent k210_entry;
-    void *dirlist = NULL;
+    uint8_t *page = (uint8_t *)((struct file_server_data *)req->user_ctx)->scratch;
+    size_t page_len = SCRATCH_BUFSIZE;
+    uint32_t cursor = 0;
     int n_entries = 0;
-    int curr_entry = 0;
-    int list_ptr = 0;
+    int n_total = 0;
+    size_t list_ptr;
+
+    // the complete list is collected for the cache if it is small enough
+    uint8_t *cache_list = NULL;
+    size_t cache_len = 0;
+    bool cache_ok = true;
 
     strcpy(dirpath_loc, dirpath);
 
     if ((strlen(dirpath_loc) > 1) && (dirpath_loc[strlen(dirpath_loc)] == '/')) {
         dirpath_loc[strlen(dirpath_loc)] = '\0';
     }
-    n_entries = k210_file_listdir(dirpath, &dirlist);
+    dir_cache_entry_t *cached = dir_cache_find(dirpath);
+    if (cached) {
+        page = cached->list;
+        page_len = cached->len;
+        n_entries = cached->n_entries;
+        cache_ok = false;
+    }
+    else n_entries = k210_file_listdir_page(dirpath, &cursor, page, &page_len);
     const size_t dirpath_len = strlen(dirpath);
 
     /* Retrieve the base path of file storage to construct the full path */
     strlcpy(entrypath, dirpath, sizeof(entrypath));
-    if (debug_log >= 1) ESP_LOGI(TAG, "Open directory '%s' -> '%s'; path='%s'", dirpath, dirpath_loc, entrypath);
+    if (debug_log >= 1) ESP_LOGI(TAG, "Open directory '%s' -> '%s'; path='%s'%s", dirpath, dirpath_loc, entrypath, (cached) ? " (cached)" : "");
 
     if (n_entries < 0) {
         if (debug_log >= 1) ESP_LOGE(TAG, "Failed to open K210 directory: %s (%d)", dirpath_loc, n_entries);
@@ -124,12 +272,15 @@ static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath)
         return ESP_FAIL;
     }
 
+    httpd_resp_writer_t wr;
+    httpd_resp_writer_init(&wr, req, ((struct file_server_data *)req->user_ctx)->resp, RESP_BUFSIZE);
+
     /* Send HTML file header */
-    httpd_resp_sendstr_chunk(req, "<!DOCTYPE html><html><head ><meta http-equiv=\"Content-Type\" content= \"text/html; charset=utf-8\">");
-    httpd_resp_sendstr_chunk(req, "<title>ADOS MKM2018</title></head><body background=\"/bg_w2.jpg\")><div>");
-    httpd_resp_sendstr_chunk(req, "<img src=\"/logo.png\" ALIGN=\"left\" HSPACE=\"20\" VSPACE=\"20\" alt=\"Higra d.o.o.\">");
-    httpd_resp_sendstr_chunk(req, "<div><p><font face=\"verdana\" color=\"brown\"><h2>ADOS - Automatski Dojavni Sustav</h2></font></p>");
-    httpd_resp_sendstr_chunk(req, "<h3>Mjerno dojavni uređaj: MKM-2018</h3>(c) Higra d.o.o. 2020</div><BR CLEAR=\"left\"/></div><hr><div style=\"background-image: url('/bg_w1.jpg');\">");
+    httpd_resp_writer_str(&wr, "<!DOCTYPE html><html><head ><meta http-equiv=\"Content-Type\" content= \"text/html; charset=utf-8\">");
+    httpd_resp_writer_str(&wr, "<title>ADOS MKM2018</title></head><body background=\"/bg_w2.jpg\")><div>");
+    httpd_resp_writer_str(&wr, "<img src=\"/logo.png\" ALIGN=\"left\" HSPACE=\"20\" VSPACE=\"20\" alt=\"Higra d.o.o.\">");
+    httpd_resp_writer_str(&wr, "<div><p><font face=\"verdana\" color=\"brown\"><h2>ADOS - Automatski Dojavni Sustav</h2></font></p>");
+    httpd_resp_writer_str(&wr, "<h3>Mjerno dojavni uređaj: MKM-2018</h3>(c) Higra d.o.o. 2020</div><BR CLEAR=\"left\"/></div><hr><div style=\"background-image: url('/bg_w1.jpg');\">");
 
     /* Get handle to embedded file upload script */
     extern const unsigned char upload_script_start[] asm("_binary_upload_script_html_start");
@@ -137,10 +288,10 @@ static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath)
     const size_t upload_script_size = (upload_script_end - upload_script_start);
 
     /* Add file upload form and script which on execution sends a POST request to /upload */
-    httpd_resp_send_chunk(req, (const char *)upload_script_start, upload_script_size);
+    httpd_resp_writer_write(&wr, (const char *)upload_script_start, upload_script_size);
 
     /* Send file-list table definition and column labels */
-    httpd_resp_sendstr_chunk(req,
+    httpd_resp_writer_str(&wr,
         "<br><table class=\"fixed\" style=\"border: 1px solid black; border-collapse: collapse;\">"
         "<col width=\"600px\" /><col width=\"200px\" /><col width=\"300px\" /><col width=\"300px\" /><col width=\"100px\" />"
         "<thead style=\"background-color:rgba(194, 214, 214, 80);\"><tr><th>Ime</th><th>Tip</th><th>Veličina (Bajta)</th><th>Vrijeme</th><th>Obriši</th></tr></thead>"
@@ -148,65 +299,68 @@ static esp_err_t http_resp_dir_html(httpd_req_t *req, const char *dirpath)
 
     /* Iterate over all files / folders and fetch their names and sizes */
     while (1) {
-        if (dirlist == NULL) entry = NULL;
-        else {
-            if (curr_entry >= n_entries) entry = NULL;
-            else {
-                entry = &k210_entry;
-                entry->d_type = (*((uint8_t *)dirlist + list_ptr) == 0) ? DT_REG : DT_DIR;
-                entry_stat.st_size = (entry->d_type == DT_REG) ? *((uint32_t *)(dirlist + list_ptr + 1)) : 0;
-                entry_stat.st_mtime = *((uint32_t *)(dirlist + list_ptr + 5));
-                char *name = (char *)(dirlist + list_ptr + 9);
-                strcpy(entry->d_name, name);
-                list_ptr += strlen(name) + 10;
-                curr_entry++;
+        list_ptr = 0;
+        while (dir_list_entry(page, page_len, &list_ptr, &entry, &entry_stat)) {
+            entrytype = (entry.d_type == DT_DIR ? "mapa" : "datoteka");
+
+            strlcpy(entrypath + dirpath_len, entry.d_name, sizeof(entrypath) - dirpath_len);
+
+            sprintf(entrysize, "%ld", entry_stat.st_size);
+            tm_info = gmtime(&entry_stat.st_mtime);
+            strftime(entrytime, 23, "%d. %m. %Y %H:%M:%S", tm_info);
+            if (debug_log >= 2) ESP_LOGI(TAG, "Found %s : %s (%s bytes, %s)", entrytype, entry.d_name, entrysize, entrytime);
+
+            /* Add table entry with file name and size */
+            httpd_resp_writer_printf(&wr,
+                "<tr style=\"border: 1px solid black;\"><td style=\"padding-left: 10px;\"><a href=\"%s%s%s\">%s</a></td>"
+                "<td align=\"center\">%s</td><td style=\"padding-left: 10px;\">%s</td><td style=\"padding-left: 10px;\">%s</td><td align=\"center\">",
+                req->uri, entry.d_name, (entry.d_type == DT_DIR) ? "/" : "", entry.d_name, entrytype, entrysize, entrytime);
+            if (entry.d_type == DT_REG) {
+                httpd_resp_writer_printf(&wr, "<form method=\"post\" action=\"/delete%s%s\"><button type=\"submit\">Obriši</button></form>",
+                    req->uri, entry.d_name);
             }
+            httpd_resp_writer_str(&wr, "</td></tr>\n");
+        }
+        n_total += n_entries;
+
+        if (cache_ok) {
+            // add the page to the list for the cache
+            uint8_t *new_list = NULL;
+            if ((cache_len + page_len) <= DIR_CACHE_MAX_LEN) new_list = realloc(cache_list, cache_len + page_len + 1);
+            if (new_list) {
+                cache_list = new_list;
+                memcpy(cache_list + cache_len, page, page_len);
+                cache_len += page_len;
+            }
+            else cache_ok = false;
         }
-        if (entry == NULL) break;
-
-        entrytype = (entry->d_type == DT_DIR ? "mapa" : "datoteka");
-
-        strlcpy(entrypath + dirpath_len, entry->d_name, sizeof(entrypath) - dirpath_len);
-
-        sprintf(entrysize, "%ld", entry_stat.st_size);
-        tm_info = gmtime(&entry_stat.st_mtime);
-        strftime(entrytime, 23, "%d. %m. %Y %H:%M:%S", tm_info);
-        if (debug_log >= 2) ESP_LOGI(TAG, "Found %s : %s (%s bytes, %s)", entrytype, entry->d_name, entrysize, entrytime);
 
-        /* Send chunk of HTML file containing table entries with file name and size */
-        httpd_resp_sendstr_chunk(req, "<tr style=\"border: 1px solid black;\"><td style=\"padding-left: 10px;\"><a href=\"");
-        httpd_resp_sendstr_chunk(req, req->uri);
-        httpd_resp_sendstr_chunk(req, entry->d_name);
-        if (entry->d_type == DT_DIR) {
-            httpd_resp_sendstr_chunk(req, "/");
+        if (cursor == 0) break;
+        if (wr.err != ESP_OK) {
+            /* the client is gone, do not read the rest of the list */
+            cache_ok = false;
+            break;
         }
-        httpd_resp_sendstr_chunk(req, "\">");
-        httpd_resp_sendstr_chunk(req, entry->d_name);
-        httpd_resp_sendstr_chunk(req, "</a></td><td align=\"center\">");
-        httpd_resp_sendstr_chunk(req, entrytype);
-        httpd_resp_sendstr_chunk(req, "</td><td style=\"padding-left: 10px;\">");
-        httpd_resp_sendstr_chunk(req, entrysize);
-        httpd_resp_sendstr_chunk(req, "</td><td style=\"padding-left: 10px;\">");
-        httpd_resp_sendstr_chunk(req, entrytime);
-        httpd_resp_sendstr_chunk(req, "</td><td align=\"center\">");
-        if (entry->d_type == DT_REG) {
-            httpd_resp_sendstr_chunk(req, "<form method=\"post\" action=\"/delete");
-            httpd_resp_sendstr_chunk(req, req->uri);
-            httpd_resp_sendstr_chunk(req, entry->d_name);
-            httpd_resp_sendstr_chunk(req, "\"><button type=\"submit\">Obriši</button></form>");
+        /* Get the next page */
+        page_len = SCRATCH_BUFSIZE;
+        n_entries = k210_file_listdir_page(dirpath, &cursor, page, &page_len);
+        if (n_entries < 0) {
+            if (debug_log >= 1) ESP_LOGE(TAG, "Failed to read K210 directory: %s (%d)", dirpath_loc, n_entries);
+            cache_ok = false;
+            break;
         }
-        httpd_resp_sendstr_chunk(req, "</td></tr>\n");
     }
-    if (dirlist) free(dirlist);
-
-    /* Finish the file list table */
-    httpd_resp_sendstr_chunk(req, "</tbody></table>");
+    if (cache_ok) dir_cache_store(dirpath, cache_list, cache_len, n_total);
+    else if (cache_list) free(cache_list);
 
-    /* Send remaining chunk of HTML file to complete it */
-    httpd_resp_sendstr_chunk(req, "<br></div></body></html>");
+    /* Finish the file list table and the HTML file */
+    httpd_resp_writer_str(&wr, "</tbody></table><br></div></body></html>");
 
-    /* Send empty chunk to signal HTTP response completion */
-    httpd_resp_sendstr_chunk(req, NULL);
+    /* Send the remaining data and the empty chunk to signal HTTP response completion */
+    if (httpd_resp_writer_finish(&wr) != ESP_OK) {
+        if (debug_log >= 1) ESP_LOGE(TAG, "Failed to send directory list: %s", dirpath_loc);
+        return ESP_FAIL;
+    }
     return ESP_OK;
 }
 
@@ -267,6 +421,77 @@ static const char* get_path_from_uri(char *dest, const char *base_path, const ch
     return dest + base_pathlen;
 }
 
+/* Format the time as HTTP date, eg. "Sun, 06 Nov 1994 08:49:37 GMT" */
+//-----------------------------------------------------
+static void http_date(time_t t, char *buf, size_t size)
+{
+    struct tm tm_info;
+    gmtime_r(&t, &tm_info);
+    strftime(buf, size, "%a, %d %b %Y %H:%M:%S GMT", &tm_info);
+}
+
+/* Parse the HTTP date, only the preferred format (as sent in 'Last-Modified') is accepted */
+//-----------------------------------------------------
+static bool http_date_parse(const char *str, time_t *t)
+{
+    static const char *months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    char month[4];
+    int day, year, hour, min, sec;
+
+    if (sscanf(str, "%*3s, %d %3s %d %d:%d:%d GMT", &day, month, &year, &hour, &min, &sec) != 6) return false;
+    const char *m = strstr(months, month);
+    if ((m == NULL) || (strlen(month) != 3) || (((m - months) % 3) != 0)) return false;
+    int mon = (m - months) / 3 + 1;
+
+    // days since 1970-01-01 of the civil date (newlib has no 'timegm()')
+    int y = year - (mon <= 2);
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (mon + (mon > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    int32_t days = era * 146097 + doe - 719468;
+
+    *t = (time_t)days * 86400 + hour * 3600 + min * 60 + sec;
+    return true;
+}
+
+/* Parse the 'Range' header, only a single byte range is supported
+ * Returns 1 if the range is valid, 0 if the whole file should be sent
+ * or -1 if the range can not be satisfied */
+//-----------------------------------------------------------------------------------------
+static int http_parse_range(const char *range, int32_t size, int32_t *first, int32_t *last)
+{
+    char *end;
+
+    if (strncmp(range, "bytes=", 6) != 0) return 0;
+    range += 6;
+    if (strchr(range, ',')) return 0;
+    while (*range == ' ') range++;
+
+    if (*range == '-') {
+        // suffix range, the last n bytes
+        long n = strtol(range+1, &end, 10);
+        if ((end == range+1) || (n < 0)) return 0;
+        if ((n == 0) || (size == 0)) return -1;
+        *first = (n < size) ? size - n : 0;
+        *last = size - 1;
+        return 1;
+    }
+    long f = strtol(range, &end, 10);
+    if ((end == range) || (*end != '-') || (f < 0)) return 0;
+    range = end + 1;
+    long l = size - 1;
+    if ((*range != '\0') && (*range != ' ')) {
+        l = strtol(range, &end, 10);
+        if ((end == range) || (l < f)) return 0;
+        if (l >= size) l = size - 1;
+    }
+    if (f >= size) return -1;
+    *first = f;
+    *last = l;
+    return 1;
+}
+
 /* Handler to download a file kept on the server */
 //-----------------------------------------------------
 static esp_err_t download_get_handler(httpd_req_t *req)
@@ -308,47 +533,113 @@ static esp_err_t download_get_handler(httpd_req_t *req)
         return ESP_FAIL;
     }
 
-    fdd = k210_file_open(filepath, ESP_FILE_MODE_RO);
+    /* Validators of the file, the ETag is derived from the file size and time.
+     * K210 can rewrite a file with the same size within the same second,
+     * so it is a weak validator and is not used for 'If-Range' */
+    char etag[28];
+    char lastmod[32];
+    char hdrval[64];
+    char content_range[48];
+    int32_t first = 0;
+    int32_t last = fstat.size - 1;
+    int range = 0;
+    bool not_modified = false;
+
+    snprintf(etag, sizeof(etag), "W/\"%x-%x\"", fstat.size, fstat.time);
+    http_date(fstat.time, lastmod, sizeof(lastmod));
+
+    /* Conditional GET, 'If-None-Match' takes precedence over 'If-Modified-Since',
+     * weak comparison: the 'W/' prefix is ignored */
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", hdrval, sizeof(hdrval)) == ESP_OK) {
+        not_modified = ((strstr(hdrval, etag+2) != NULL) || (strcmp(hdrval, "*") == 0));
+    }
+    else if (httpd_req_get_hdr_value_str(req, "If-Modified-Since", hdrval, sizeof(hdrval)) == ESP_OK) {
+        time_t since;
+        not_modified = ((http_date_parse(hdrval, &since)) && ((time_t)fstat.time <= since));
+    }
+
+    /* Range request, 'If-Range' requires a strong validator, which the file does not have,
+     * the range is ignored and the whole file is sent */
+    if ((!not_modified) && (httpd_req_get_hdr_value_str(req, "Range", hdrval, sizeof(hdrval)) == ESP_OK)) {
+        range = http_parse_range(hdrval, fstat.size, &first, &last);
+        if ((range != 0) && (httpd_req_get_hdr_value_len(req, "If-Range") > 0)) {
+            range = 0;
+            first = 0;
+            last = fstat.size - 1;
+        }
+    }
+
+    set_content_type_from_file(req, filename);
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Last-Modified", lastmod);
+    /* K210 may change the file at any time, the browser must always revalidate */
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+
+    if (not_modified) {
+        if (debug_log >= 1) ESP_LOGI(TAG, "File not modified : %s", filename);
+        httpd_resp_set_status(req, HTTPD_304);
+        httpd_resp_send_hdrs(req, -1);
+        return ESP_OK;
+    }
+    if (range < 0) {
+        if (debug_log >= 1) ESP_LOGW(TAG, "Range not satisfiable : %s (%d bytes)", filename, fstat.size);
+        snprintf(content_range, sizeof(content_range), "bytes */%d", fstat.size);
+        httpd_resp_set_status(req, HTTPD_416);
+        httpd_resp_set_hdr(req, "Content-Range", content_range);
+        httpd_resp_send(req, NULL, 0);
+        return ESP_OK;
+    }
+
+    /* Open the file through K210 VFS, reads are served from its read-ahead cache */
+    char vfspath[FILE_PATH_MAX+8];
+    snprintf(vfspath, sizeof(vfspath), "%s%s", K210VFS_BASE_PATH, filepath);
+    fdd = open(vfspath, O_RDONLY);
+    if ((fdd >= 0) && (first > 0) && (lseek(fdd, first, SEEK_SET) != first)) {
+        close(fdd);
+        fdd = -1;
+    }
     if (fdd < 0) {
-        if (debug_log >= 1) ESP_LOGE(TAG, "Failed to read existing file : %s (%d)", filepath, fdd);
+        if (debug_log >= 1) ESP_LOGE(TAG, "Failed to read existing file : %s (%d)", filepath, errno);
         /* Respond with 500 Internal Server Error */
         httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Greška pri otvaranju datoteke");
         return ESP_FAIL;
     }
 
-    if (debug_log >= 1) ESP_LOGI(TAG, "Sending file : %s (%d bytes)...", filename, fstat.size);
-    set_content_type_from_file(req, filename);
+    int32_t remaining = (fstat.size > 0) ? last - first + 1 : 0;
+    if (range > 0) {
+        snprintf(content_range, sizeof(content_range), "bytes %d-%d/%d", first, last, fstat.size);
+        httpd_resp_set_status(req, HTTPD_206);
+        httpd_resp_set_hdr(req, "Content-Range", content_range);
+        if (debug_log >= 1) ESP_LOGI(TAG, "Sending file : %s (%s)...", filename, content_range);
+    }
+    else if (debug_log >= 1) ESP_LOGI(TAG, "Sending file : %s (%d bytes)...", filename, fstat.size);
+
+    /* The content length is known, the file is sent without chunked encoding */
+    if (httpd_resp_send_hdrs(req, remaining) != ESP_OK) {
+        close(fdd);
+        if (debug_log >= 1) ESP_LOGW(TAG, "File sending failed (headers)!");
+        return ESP_FAIL;
+    }
 
     /* Retrieve the pointer to scratch buffer for temporary storage */
     char *chunk = ((struct file_server_data *)req->user_ctx)->scratch;
-    size_t chunksize;
-    do {
+    while (remaining > 0) {
         /* Read file in chunks into the scratch buffer */
-        int rdlen = k210_file_read(fdd, (void *)chunk, SCRATCH_BUFSIZE);
-        if (rdlen < 0) chunksize = 0;
-        else chunksize = rdlen;
-
-        /* Send the buffer contents as HTTP response chunk */
-        esp_err_t ret = httpd_resp_send_chunk(req, chunk, chunksize);
+        int rdlen = read(fdd, (void *)chunk, MIN(remaining, SCRATCH_BUFSIZE));
+        esp_err_t ret = (rdlen > 0) ? httpd_resp_send_body(req, chunk, rdlen) : ESP_FAIL;
         if (ret != ESP_OK) {
-            k210_file_close(fdd);
-            if (debug_log >= 1) ESP_LOGW(TAG, "File sending failed (size=%d, err=%d)!", chunksize, ret);
-            /* Abort sending file */
-            httpd_resp_sendstr_chunk(req, NULL);
-            /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Greška pri slanju datoteke");
+            /* The headers are already sent, the connection is closed to signal the error */
+            close(fdd);
+            if (debug_log >= 1) ESP_LOGW(TAG, "File sending failed (read=%d, remaining=%d, err=%d)!", rdlen, remaining, ret);
             return ESP_FAIL;
         }
-
-        /* Keep looping till the whole file is sent */
-    } while (chunksize != 0);
+        remaining -= rdlen;
+    }
 
     /* Close file after sending complete */
-    k210_file_close(fdd);
+    close(fdd);
     if (debug_log >= 1) ESP_LOGI(TAG, "File sending complete");
-
-    /* Respond with an empty chunk to signal HTTP response completion */
-    httpd_resp_send_chunk(req, NULL, 0);
     return ESP_OK;
 }
 
@@ -434,53 +725,72 @@ static esp_err_t upload_post_handler(httpd_req_t *req)
 
     if (debug_log >= 1) ESP_LOGI(TAG, "Receiving file : %s...", filename);
 
-    /* Retrieve the pointer to scratch buffer for temporary storage */
-    char *buf = ((struct file_server_data *)req->user_ctx)->scratch;
-    int received, written;
+    /* The received data is written to K210 by the file pipe task,
+     * while the next part of the file is received */
+    file_pipe_t *pipe = file_pipe_open(fdd);
+    if (pipe == NULL) {
+        k210_file_close(fdd);
+        if (debug_log >= 1) ESP_LOGE(TAG, "No memory for file pipe");
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Greška pri stvaranju datoteke");
+        return ESP_FAIL;
+    }
+
+    int received;
+    size_t bufsize, buflen;
+    bool recv_failed = false;
 
     /* Content length of the request gives
      * the size of the file being uploaded */
     int remaining = req->content_len;
 
     while (remaining > 0) {
-        if (debug_log >= 1) ESP_LOGI(TAG, "Remaining size : %d", remaining);
-        /* Receive the file part by part into a buffer */
-        if ((received = httpd_req_recv(req, buf, MIN(remaining, SCRATCH_BUFSIZE))) <= 0) {
-            if (received == HTTPD_SOCK_ERR_TIMEOUT) {
-                /* Retry if timeout occurred */
-                continue;
+        /* Get the next free pipe buffer, waits while all buffers are being written */
+        char *buf = (char *)file_pipe_get(pipe, &bufsize);
+        if (buf == NULL) break;
+
+        /* Receive the file part by part into the buffer until it is full */
+        buflen = 0;
+        while ((remaining > 0) && (buflen < bufsize)) {
+            if (debug_log >= 2) ESP_LOGI(TAG, "Remaining size : %d", remaining);
+            if ((received = httpd_req_recv(req, buf + buflen, MIN(remaining, bufsize - buflen))) <= 0) {
+                if (received == HTTPD_SOCK_ERR_TIMEOUT) {
+                    /* Retry if timeout occurred */
+                    continue;
+                }
+                recv_failed = true;
+                break;
             }
-
-            /* In case of unrecoverable error,
-             * close and delete the unfinished file*/
-            k210_file_close(fdd);
-
-            if (debug_log >= 1) ESP_LOGE(TAG, "File reception failed!");
-            /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Greška u prijemu datoteke");
-            return ESP_FAIL;
+            buflen += received;
+            /* Keep track of remaining size of
+             * the file left to be uploaded */
+            remaining -= received;
         }
+        if (recv_failed) break;
 
-        /* Write buffer content to file on storage */
-        written = k210_file_write(fdd, buf, received);
-        if (received && (received != written)) {
-            /* Couldn't write everything to file!
-             * Storage may be full? */
-            k210_file_close(fdd);
-
-            if (debug_log >= 1) ESP_LOGE(TAG, "File write failed (%d)!", written);
-            /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Greška pri spremanju datotekee");
-            return ESP_FAIL;
-        }
-
-        /* Keep track of remaining size of
-         * the file left to be uploaded */
-        remaining -= received;
+        /* Queue the buffer content to be written to file on storage */
+        if (file_pipe_put(pipe, buflen) != 0) break;
     }
 
-    /* Close file upon upload completion */
+    /* Wait until all data is written, then close the file */
+    int written = file_pipe_close(pipe);
     k210_file_close(fdd);
+    dir_cache_flush();
+
+    if (recv_failed) {
+        /* In case of unrecoverable error the unfinished file is left */
+        if (debug_log >= 1) ESP_LOGE(TAG, "File reception failed!");
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Greška u prijemu datoteke");
+        return ESP_FAIL;
+    }
+    if (written != req->content_len) {
+        /* Couldn't write everything to file!
+         * Storage may be full? */
+        if (debug_log >= 1) ESP_LOGE(TAG, "File write failed (%d)!", written);
+        /* Respond with 500 Internal Server Error */
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Greška pri spremanju datotekee");
+        return ESP_FAIL;
+    }
     if (debug_log >= 1) ESP_LOGI(TAG, "File reception complete");
 
     reloc(req, filepath);
@@ -521,6 +831,7 @@ static esp_err_t newdir_post_handler(httpd_req_t *req)
 
     if (debug_log >= 1) ESP_LOGI(TAG, "Make dir '%s'", filepath);
     int res = mkdir(filepath, 0775);
+    dir_cache_flush();
     if (res < 0) {
         if (debug_log >= 1) ESP_LOGE(TAG, "Failed to create directory: %d", errno);
         /* Respond with 500 Internal Server Error */
@@ -578,6 +889,7 @@ static esp_err_t delete_post_handler(httpd_req_t *req)
         /* Delete file */
         res = k210_file_remove(filepath);
     }
+    dir_cache_flush();
     if (res != 0) {
         if (debug_log >= 1) ESP_LOGE(TAG, "Failed to delete file or directory: %d", errno);
         /* Respond with 500 Internal Server Error */
@@ -627,6 +939,25 @@ esp_err_t start_file_server(const char *base_path)
         return ESP_FAIL;
     }
 
+    /* URI handlers for the link statistics, registered before the
+     * wildcard download handler so that they take precedence */
+    httpd_uri_t stats_get = {
+        .uri       = "/stats",
+        .method    = HTTP_GET,
+        .handler   = stats_get_handler,
+        .user_ctx  = server_data    // Pass server data as context
+    };
+    httpd_register_uri_handler(server, &stats_get);
+
+    /* POST to '/stats' clears the statistics after they are sent */
+    httpd_uri_t stats_reset = {
+        .uri       = "/stats",
+        .method    = HTTP_POST,
+        .handler   = stats_post_handler,
+        .user_ctx  = server_data    // Pass server data as context
+    };
+    httpd_register_uri_handler(server, &stats_reset);
+
     /* URI handler for getting uploaded files */
     httpd_uri_t file_download = {
         .uri       = "/*",  // Match all URIs of type /path/to/file
@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stddef.h>
 #include <string.h>
 
@@ -19,6 +20,8 @@
 #include "esp_task_wdt.h"
 #include "driver/spi_master.h"
 #include "esp_wifi.h"
+#include "spi_crc.h"
+#include "spi_lz.h"
 
 typedef enum {
     SLAVE_CMD_NONE,
@@ -40,6 +43,7 @@ typedef struct _k210_info_t
     uint32_t crc_speed;
     uint32_t crc32_speed;
     char     info[12];
+    uint8_t  features;      // K210_INFO_xxx flags
 } k210_info_t;
 
 typedef struct _k210_fstat_t
@@ -64,8 +68,84 @@ typedef struct _file_params_t
     int          result;
     k210_fstat_t *st;
     void         **listres;
+    uint32_t     cursor;
+    void         *dst;
 } file_params_t;
 
+/*
+ * Link statistics ('link_stats.c')
+ * ---------------------------------------------------------------------------------------
+ * Latency histograms have LINK_STATS_BUCKETS log2 buckets,
+ * bucket 0: 0-1 us, bucket n: 2^n - 2^(n+1)-1 us, the last bucket: >= 2^(LINK_STATS_BUCKETS-1) us
+ *
+ * ESP_COMMAND_GETSTATS response (all values little endian):
+ *   link_stats_header_t
+ *   uint32_t            counters[n_counters]   (link_stat_counter_t order)
+ *   link_stats_hist_t   phases[n_phases]       (link_stat_phase_t order)
+ *   link_stats_cmd_t    commands[n_commands]   (only the commands executed since reset)
+ * If the first request data byte is not 0, the statistics are cleared after they are sent.
+ * ---------------------------------------------------------------------------------------
+ */
+#define LINK_STATS_VERSION          1
+#define LINK_STATS_BUCKETS          16
+#define LINK_STATS_CMD_SLOTS        32
+
+typedef enum {
+    LINK_STAT_TRANSFERS,            // completed transfers
+    LINK_STAT_RETRIES,              // command blocks repeated, K210 not ready
+    LINK_STAT_READY_TIMEOUTS,       // transfers failed, K210 not ready after all retries
+    LINK_STAT_NOT_IDLE,             // transfers not started, K210 not in IDLE state
+    LINK_STAT_LONG_WAITS,           // K210 busy for more than 1 ms after the data block
+    LINK_STAT_BUSY_TIMEOUTS,        // K210 busy for more than K210_BUSY_TIMEOUT
+    LINK_STAT_HANDSHAKE_TIMEOUTS,   // handshake waits timed out
+    LINK_STAT_CRC16_ERRORS,         // status and command blocks received with bad crc16
+    LINK_STAT_FRAME_ERRORS,         // command frames with bad crc32, length or command
+    LINK_STAT_REQUESTS,             // K210 requests executed
+    LINK_STAT_REQUEST_ERRORS,       // K210 requests not read
+    LINK_STAT_FILE_REQUESTS,        // ESP32 file requests
+    LINK_STAT_FILE_ERRORS,          // ESP32 file requests failed
+    LINK_STAT_LZ_SENT,              // frames sent compressed
+    LINK_STAT_LZ_RECEIVED,          // compressed frames received
+    LINK_STAT_MAX,
+} link_stat_counter_t;
+
+typedef enum {
+    LINK_PHASE_COMMAND,             // command block sent
+    LINK_PHASE_READY,               // K210 ready for the data block
+    LINK_PHASE_DATA,                // data block transferred
+    LINK_PHASE_PROCESS,             // K210 returned to IDLE
+    LINK_PHASE_MAX,
+} link_stat_phase_t;
+
+typedef struct _link_stats_hist_t
+{
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t sum_us;
+    uint32_t bucket[LINK_STATS_BUCKETS];
+} link_stats_hist_t;
+
+typedef struct _link_stats_cmd_t
+{
+    uint8_t  cmd;
+    uint8_t  reserved[7];
+    link_stats_hist_t hist;
+} link_stats_cmd_t;
+
+typedef struct _link_stats_header_t
+{
+    uint16_t version;
+    uint8_t  n_counters;
+    uint8_t  n_phases;
+    uint8_t  n_buckets;
+    uint8_t  n_commands;
+    uint16_t reserved;
+    uint32_t time_ms;               // time since the statistics were cleared
+    uint32_t reserved1;
+    uint64_t bytes_tx;              // data bytes sent to K210
+    uint64_t bytes_rx;              // data bytes received from K210
+} link_stats_header_t;
+
 typedef struct _socketcfg_t
 {
     int  fd;
@@ -74,8 +154,22 @@ typedef struct _socketcfg_t
     bool rdset;
     bool listening;
     bool ssl;
+    uint16_t open_seq;  // incremented each time a new socket is placed in the slot
 } socketcfg_t;
 
+// Resolver cache statistics ('dns_cache.c')
+typedef struct _dns_cache_stats_t
+{
+    uint32_t hits;                  // lookups served from the cache
+    uint32_t negative_hits;         // lookups answered with the cached failure
+    uint32_t misses;                // lookups sent to the resolver
+    uint32_t prefetches;            // entries refreshed in background before expiry
+    uint32_t entries;               // valid entries
+} dns_cache_stats_t;
+
+// Pipelined K210 file writer ('file_pipe.c')
+typedef struct _file_pipe_t file_pipe_t;
+
 #define VERSION_STR                 "1.06"
 #define VERSION_NUM                 0x106
 
@@ -106,21 +200,21 @@ typedef struct _socketcfg_t
 #define RTCRAM_BUFF_SIZE            2048+16
 
 // K210 status constants
-#define ESP32_STATUS_K210_DETECTED  0x00000001UL
-#define ESP32_STATUS_TIME_BAD       0x00000002UL
-#define ESP32_STATUS_FS_OK          0x00000004UL
-#define ESP32_STATUS_WIFI_INIT      0x00000008UL
-#define ESP32_STATUS_WIFI_MODEAP    0x00000010UL
-#define ESP32_STATUS_WIFI_CONNECTED 0x00000020UL
-#define ESP32_STATUS_WEBSERVER_OK   0x00000040UL
-#define ESP32_STATUS_OTAUPDATED     0x00000080UL
-#define ESP32_STATUS_OTAFAILED      0x00000100UL
-#define ESP32_STATUS_KPAD_CHANGED   0x00010000UL
-#define ESP32_STATUS_KPAD_MASK      0xF0000000UL
-#define ESP32_STATUS_RST_MASK       0x0FF00000UL
-#define ESP32_STATUS_WAKE_EXT0      0x00000011UL
-#define ESP32_STATUS_WAKE_EXT1      0x00000012UL
-#define ESP32_STATUS_WAKE_TIMR      0x00000013UL
+#define ESP32_STATUS_K210_DETECTED  0x00000001U
+#define ESP32_STATUS_TIME_BAD       0x00000002U
+#define ESP32_STATUS_FS_OK          0x00000004U
+#define ESP32_STATUS_WIFI_INIT      0x00000008U
+#define ESP32_STATUS_WIFI_MODEAP    0x00000010U
+#define ESP32_STATUS_WIFI_CONNECTED 0x00000020U
+#define ESP32_STATUS_WEBSERVER_OK   0x00000040U
+#define ESP32_STATUS_OTAUPDATED     0x00000080U
+#define ESP32_STATUS_OTAFAILED      0x00000100U
+#define ESP32_STATUS_KPAD_CHANGED   0x00010000U
+#define ESP32_STATUS_KPAD_MASK      0xF0000000U
+#define ESP32_STATUS_RST_MASK       0x0FF00000U
+#define ESP32_STATUS_WAKE_EXT0      0x00000011U
+#define ESP32_STATUS_WAKE_EXT1      0x00000012U
+#define ESP32_STATUS_WAKE_TIMR      0x00000013U
 
 // System watchdog timeout in seconds
 #define TWDT_TIMEOUT_S              5
@@ -140,6 +234,12 @@ typedef struct _socketcfg_t
 #define SLAVE_CMD_OPT_CRC           0x10
 #define SLAVE_CMD_OPT_CONFIRM       0x20
 #define SLAVE_INFO_LENGTH           25
+#define K210_INFO_HANDSHAKE         0x01    // slave info byte 24 flags
+#define K210_INFO_LZ                0x02    // K210 accepts compressed frames
+#define K210_INFO_SOCKRDMAP         0x04    // K210 decodes ESP32_STATUS_CODE_SOCKETRD value as a bitmap
+#define K210_INFO_RQHEADER          0x08    // K210 accepts the ESP_STATUS_RQHEADER block in RQGET responses
+#define K210_INFO_OTASTATS          0x10    // K210 accepts ESP32_STATUS_CODE_OTA status messages
+#define K210_INFO_ASYNCSSL          0x20    // K210 accepts EINPROGRESS from SSL SCK_CONNECT/SCK_ACCEPT and the ESP32_STATUS_CODE_SSL result
 #define SLAVE_BUFFER_CMD_ADDRESS    0
 
 #define DMA_CHAN                    1
@@ -158,15 +258,27 @@ typedef struct _socketcfg_t
 #define DUMMY_BYTES                 0
 #define SPI_BUFFER_SIZE_MAX         (32768+32)
 #define SPI_RW_BUFFER               (spi_buffer+DUMMY_BYTES)
+#define K210_FILE_READ_MAX          (spi_master_buffer_size-64)
+#define K210_FILE_WRITE_OFFSET      (DUMMY_BYTES+8)     // data offset in ESP_COMMAND_FWRITE request frame
+#define SPI_FRAME_GUARD             16                  // zeroed bytes after the received frame payload
+#define ESP_FRAME_LZ                0x8000              // frame length flag, the payload is |length (2)|LZ4 block|
+#define SPI_LZ_MIN_LENGTH           256                 // shorter payloads are sent uncompressed, 0: never compress
+#define SPI_FRAME_ALLOC_SIZE        (spi_master_buffer_size+64+LZ_INPLACE_MARGIN(spi_master_buffer_size))
+#define K210VFS_BASE_PATH           "/k210"
+#define K210VFS_MAX_FILES           4
 #define REQUESTS_URL_MAX_SIZE       256
 
 #define ESP32_STATUS_CODE_KPD       1
 #define ESP32_STATUS_CODE_VOLTAGE   2
 #define ESP32_STATUS_CODE_STATUS    3
 #define ESP32_STATUS_CODE_FILE      4
-#define ESP32_STATUS_CODE_SOCKETRD  5
+#define ESP32_STATUS_CODE_SOCKETRD  5   // value: bitmap of sockets with received data (K210_INFO_SOCKRDMAP), else socket fd
+#define SOCKET_RDMAP_SSL_BIT        16  // bit 'n' is lwip socket 'LWIP_SOCKET_OFFSET+n', bit '16+n' is SSL socket 'n'
 #define ESP32_STATUS_CODE_TIME      6
 #define ESP32_STATUS_CODE_SLEEP     7
+#define ESP32_STATUS_CODE_OTA       8   // only sent if K210 reported K210_INFO_OTASTATS; value: throughput in KB/s (bits 16-31), read stage % (bits 8-15), write stage % (bits 0-7)
+#define ESP32_STATUS_CODE_SSL       9   // only sent if K210 reported K210_INFO_ASYNCSSL; value: SSL socket fd (bits 16-31), handshake result (bits 0-15): 0 connected, else negated mbedtls error
+#define ESP32_STATUS_CODE_LZ        10  // value: 1 ESP32 accepts compressed frames
 
 // -------------------------------------
 // ESP32 <-> K210 communication commands
@@ -184,6 +296,8 @@ typedef struct _socketcfg_t
 #define ESP_COMMAND_SETRTCRAM       11
 #define ESP_COMMAND_SETWKUPINTER    12
 #define ESP_COMMAND_GETVER          13
+#define ESP_COMMAND_BATCH           14
+#define ESP_COMMAND_GETSTATS        15
 
 #define ESP_COMMAND_SCK_START       20
 #define ESP_COMMAND_SCK_ADDRINFO    21
@@ -216,7 +330,8 @@ typedef struct _socketcfg_t
 #define ESP_COMMAND_FLISTDIR        109
 #define ESP_COMMAND_FREMOVE         110
 #define ESP_COMMAND_FRMDIR          111
-#define ESP_COMMAND_FILE_FUNCMAX    112
+#define ESP_COMMAND_FLISTDIRP       112     // paged directory list, see 'k210_file_listdir_page()'
+#define ESP_COMMAND_FILE_FUNCMAX    113
 
 #define ESP_COMMAND_STAT_SEND       180
 #define ESP_COMMAND_OTAUPDATE       190
@@ -265,10 +380,12 @@ typedef struct _socketcfg_t
 #define ESP_STATUS_RQFINISH         0x6000
 #define ESP_STATUS_MREQUEST         0x6100
 #define ESP_STATUS_MULTIBLOCK       0x6200
+#define ESP_STATUS_RQHEADER         0x6300  // only sent if K210 reported K210_INFO_RQHEADER
 // ------------------------------------------------
 
 #define SPI_NOTIFY_HANDSHAKE        0x00010000
-#define SPI_NOTIFY_FUNC_MASK        0x000000FF
+#define SPI_NOTIFY_FILE_RQ          0x00020000
+#define SPI_NOTIFY_FRAME            0x00040000
 #define SPI_NOTIFY_EXIT             0x00100000
 
 #define STREAM_POLL_RD              (0x0001)
@@ -294,14 +411,14 @@ typedef struct _socketcfg_t
 
 extern TaskHandle_t spi_task_handle;
 extern TaskHandle_t socket_task_handle;
+extern TaskHandle_t ssl_task_handle;
 extern bool k210_slave_connected;
 extern k210_info_t k210_info;
 extern uint32_t spi_master_buffer_size;
-extern SemaphoreHandle_t func_semaphore;
 extern file_params_t file_func_params;
 extern QueueHandle_t sock_mutex;
 extern socketcfg_t opened_sockets[CONFIG_LWIP_MAX_SOCKETS];
-const uint32_t wakeup_intervals[6];
+extern const uint32_t wakeup_intervals[6];
 extern RTC_NOINIT_ATTR uint32_t wakeup_interval;
 extern RTC_NOINIT_ATTR uint8_t rtc_ram[RTCRAM_BUFF_SIZE];
 
@@ -309,6 +426,14 @@ void setStatus(uint32_t status, uint8_t op);
 uint32_t getStatus();
 
 int transferData(uint8_t cmd, uint32_t addr, uint32_t dsize, uint8_t *data);
+int transferDataAsync(uint8_t cmd, uint32_t addr, uint32_t dsize);
+int transferDataWait();
+int readFrame(uint8_t cmd, uint32_t dsize, bool *frame_ok);
+uint8_t *spi_buffer_swap();
+void spi_buffer_set(uint8_t *frame);
+uint8_t *spi_frame_get(TickType_t wait);
+void spi_frame_put(uint8_t *frame);
+int spi_frame_spare();
 
 #if USE_KEYPAD
 
@@ -339,6 +464,9 @@ int uartWrite(const char* buf, size_t size);
 #endif
 
 void SOCKET_task(void* arg);
+void SSL_task(void* arg);
+void socket_monitor_wakeup();
+bool socket_tasks_stop();
 
 extern uint8_t *spi_buffer;
 extern int16_t esp_cmdstat;
@@ -367,14 +495,33 @@ extern size_t spi_transaction_length;
 // Global functions
 void getStatsInfo(bool stats, bool prn);
 
+// Link statistics
+void link_stats_count(link_stat_counter_t counter);
+void link_stats_transfer(bool write, uint32_t size, const uint32_t *phase_us);
+void link_stats_command(uint8_t cmd, uint32_t time_us);
+void link_stats_reset();
+int link_stats_get(uint8_t *buf, int size);
+int link_stats_text(char *buf, int size);
+
+void dns_cache_init();
+int dns_cache_lookup(const char *host, uint32_t *addr);
+void dns_cache_flush();
+void dns_cache_get_stats(dns_cache_stats_t *stats);
+
+file_pipe_t *file_pipe_open(int fd);
+uint8_t *file_pipe_get(file_pipe_t *pipe, size_t *size);
+int file_pipe_put(file_pipe_t *pipe, size_t len);
+int file_pipe_close(file_pipe_t *pipe);
+
 void SPI_task(void* arg);
 esp_err_t spi_slave_transaction(void);
-bool command_frame_check(void);
+bool command_frame_check(bool with_crc16);
 int32_t processCommand();
 void setCRC(uint8_t *buff, int len);
 bool checkCRC(uint8_t *buff, int len);
 int k210_wait_handshake();
 esp_err_t send_response(uint8_t opt);
+esp_err_t send_response_async(uint8_t opt);
 uint16_t getCommand(uint16_t type);
 
 esp_err_t start_file_server(const char *base_path);
@@ -391,17 +538,25 @@ void requests_GET(char *url);
 
 int k210_file_open(const char *path, int flags);
 int k210_file_write(int fd, const void *data, size_t size);
+int k210_file_write_frame(int fd, uint8_t *frame, size_t size);
 int k210_file_read(int fd, void *dst, size_t size);
 int k210_file_close(int fd);
 int k210_file_closeall();
+int k210_file_lseek(int fd, int offset, int whence);
 int k210_file_fstat(int fd, k210_fstat_t *st);
 int k210_file_stat(const char *path, k210_fstat_t *st);
 int k210_file_listdir(const char *path, void **list);
+int k210_file_listdir_page(const char *path, uint32_t *cursor, void *buf, size_t *size);
 int k210_file_remove(const char *path);
 int k210_file_rmdir(const char *path);
 int k210_status_send(int type, int val);
 
-void process_internal_request(uint8_t command);
+bool file_request_init();
+void process_file_requests();
+void file_request_abort();
+
+esp_err_t esp_vfs_k210ffs_register();
+esp_err_t esp_vfs_k210ffs_unregister();
 
 void OTA_task(void* arg);
 
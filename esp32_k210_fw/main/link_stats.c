@@ -0,0 +1,283 @@
+/*
+ * ESP32 <-> K210 link statistics
+ * ---------------------------------------------------------------------------------------
+ * Counters and log2 latency histograms of the SPI transfer phases and of the executed
+ * commands (K210 requests and ESP32 file requests).
+ * All statistics are updated from the SPI task only, the other tasks read a snapshot.
+ * No locks are used: the writer increments the sequence number before and after each
+ * update, the reader repeats the copy if the sequence number was odd or has changed.
+ * 'link_stats_reset()' can be called from any task, the statistics are cleared by the
+ * writer on its next update.
+ * ---------------------------------------------------------------------------------------
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "global.h"
+
+#define LINK_STATS_READ_RETRIES     16
+
+typedef struct _link_stats_t
+{
+    uint64_t          reset_time;
+    uint64_t          bytes_tx;
+    uint64_t          bytes_rx;
+    uint32_t          counters[LINK_STAT_MAX];
+    link_stats_hist_t phases[LINK_PHASE_MAX];
+    uint8_t           n_cmds;
+    uint8_t           cmd_slot[256];        // command -> slot+1, 0: no slot assigned
+    link_stats_cmd_t  cmds[LINK_STATS_CMD_SLOTS];
+} link_stats_t;
+
+static link_stats_t link_stats = {0};
+static volatile uint32_t link_stats_seq = 0;
+static volatile bool link_stats_reset_pending = true;
+
+static const char *counter_names[LINK_STAT_MAX] = {
+    "Transfers", "Retries", "Ready timeouts", "Not idle", "Long waits", "Busy timeouts",
+    "Handshake timeouts", "CRC16 errors", "Frame errors", "K210 requests", "Request errors",
+    "File requests", "File errors", "LZ frames sent", "LZ frames received",
+};
+
+static const char *phase_names[LINK_PHASE_MAX] = {
+    "command", "ready", "data", "process",
+};
+
+
+// ==== Writer (SPI task) ================================================================
+
+//----------------------------
+static void link_stats_begin()
+{
+    link_stats_seq++;
+    __sync_synchronize();
+    if (link_stats_reset_pending) {
+        link_stats_reset_pending = false;
+        memset(&link_stats, 0, sizeof(link_stats_t));
+        link_stats.reset_time = esp_timer_get_time();
+    }
+}
+
+//--------------------------
+static void link_stats_end()
+{
+    __sync_synchronize();
+    link_stats_seq++;
+}
+
+//-------------------------------------------------------------
+static void hist_add(link_stats_hist_t *hist, uint32_t time_us)
+{
+    int b = (time_us) ? (31 - __builtin_clz(time_us)) : 0;
+    if (b >= LINK_STATS_BUCKETS) b = LINK_STATS_BUCKETS-1;
+    hist->bucket[b]++;
+    hist->count++;
+    hist->sum_us += time_us;
+    if (time_us > hist->max_us) hist->max_us = time_us;
+}
+
+//================================================
+void link_stats_count(link_stat_counter_t counter)
+{
+    if (counter >= LINK_STAT_MAX) return;
+    link_stats_begin();
+    link_stats.counters[counter]++;
+    link_stats_end();
+}
+
+//===========================================================================
+void link_stats_transfer(bool write, uint32_t size, const uint32_t *phase_us)
+{
+    link_stats_begin();
+    link_stats.counters[LINK_STAT_TRANSFERS]++;
+    if (write) link_stats.bytes_tx += size;
+    else link_stats.bytes_rx += size;
+    for (int i=0; i<LINK_PHASE_MAX; i++) {
+        hist_add(&link_stats.phases[i], phase_us[i]);
+    }
+    link_stats_end();
+}
+
+//====================================================
+void link_stats_command(uint8_t cmd, uint32_t time_us)
+{
+    link_stats_begin();
+    uint8_t slot = link_stats.cmd_slot[cmd];
+    if (slot == 0) {
+        if (link_stats.n_cmds < LINK_STATS_CMD_SLOTS) {
+            slot = ++link_stats.n_cmds;
+            link_stats.cmd_slot[cmd] = slot;
+            link_stats.cmds[slot-1].cmd = cmd;
+        }
+    }
+    if (slot) hist_add(&link_stats.cmds[slot-1].hist, time_us);
+    link_stats_end();
+}
+
+//=====================
+void link_stats_reset()
+{
+    link_stats_reset_pending = true;
+}
+
+// ==== Reader ===========================================================================
+
+//-------------------------------------------------
+static bool link_stats_snapshot(link_stats_t *snap)
+{
+    for (int i=0; i<LINK_STATS_READ_RETRIES; i++) {
+        uint32_t seq = link_stats_seq;
+        __sync_synchronize();
+        if (seq & 1) {
+            // update in progress
+            vTaskDelay(1);
+            continue;
+        }
+        memcpy(snap, &link_stats, sizeof(link_stats_t));
+        __sync_synchronize();
+        if (seq == link_stats_seq) return true;
+    }
+    return false;
+}
+
+// Get the statistics in ESP_COMMAND_GETSTATS format (see 'global.h')
+// Returns the length or -1 if the buffer is too small
+//========================================
+int link_stats_get(uint8_t *buf, int size)
+{
+    link_stats_t *snap = malloc(sizeof(link_stats_t));
+    if (snap == NULL) return -1;
+    if (!link_stats_snapshot(snap)) {
+        free(snap);
+        return -1;
+    }
+
+    int len = sizeof(link_stats_header_t) + sizeof(snap->counters) + sizeof(snap->phases) + (snap->n_cmds * sizeof(link_stats_cmd_t));
+    if (len > size) {
+        free(snap);
+        return -1;
+    }
+
+    link_stats_header_t hdr = {0};
+    hdr.version = LINK_STATS_VERSION;
+    hdr.n_counters = LINK_STAT_MAX;
+    hdr.n_phases = LINK_PHASE_MAX;
+    hdr.n_buckets = LINK_STATS_BUCKETS;
+    hdr.n_commands = snap->n_cmds;
+    hdr.time_ms = (uint32_t)((esp_timer_get_time() - snap->reset_time) / 1000);
+    hdr.bytes_tx = snap->bytes_tx;
+    hdr.bytes_rx = snap->bytes_rx;
+
+    uint8_t *p = buf;
+    memcpy(p, &hdr, sizeof(hdr));
+    p += sizeof(hdr);
+    memcpy(p, snap->counters, sizeof(snap->counters));
+    p += sizeof(snap->counters);
+    memcpy(p, snap->phases, sizeof(snap->phases));
+    p += sizeof(snap->phases);
+    memcpy(p, snap->cmds, snap->n_cmds * sizeof(link_stats_cmd_t));
+
+    free(snap);
+    return len;
+}
+
+// Approximate percentile, the upper limit of the bucket
+//-------------------------------------------------------------------
+static uint32_t hist_percentile(const link_stats_hist_t *hist, int p)
+{
+    uint32_t target = ((uint64_t)hist->count * p + 99) / 100;
+    uint32_t n = 0;
+    for (int b=0; b<LINK_STATS_BUCKETS; b++) {
+        n += hist->bucket[b];
+        if ((n >= target) && (n > 0)) {
+            uint32_t limit = (b < (LINK_STATS_BUCKETS-1)) ? ((2UL << b) - 1) : hist->max_us;
+            return (limit < hist->max_us) ? limit : hist->max_us;
+        }
+    }
+    return hist->max_us;
+}
+
+//----------------------------------------------------------------------------------------
+static int hist_text(char *buf, int size, const char *name, const link_stats_hist_t *hist)
+{
+    return snprintf(buf, size, "%-14s%9u%9u%9u%9u%9u\n", name, hist->count,
+            (hist->count) ? (uint32_t)(hist->sum_us / hist->count) : 0,
+            hist_percentile(hist, 50), hist_percentile(hist, 99), hist->max_us);
+}
+
+//------------------------------------------
+static const char *command_name(uint8_t cmd)
+{
+    switch (cmd) {
+        case ESP_COMMAND_ECHO:          return "ECHO";
+        case ESP_COMMAND_INFO:          return "INFO";
+        case ESP_COMMAND_GETSTATUS:     return "GETSTATUS";
+        case ESP_COMMAND_BATCH:         return "BATCH";
+        case ESP_COMMAND_GETSTATS:      return "GETSTATS";
+        case ESP_COMMAND_SCK_OPEN:      return "SCK_OPEN";
+        case ESP_COMMAND_SCK_CLOSE:     return "SCK_CLOSE";
+        case ESP_COMMAND_SCK_RECV:      return "SCK_RECV";
+        case ESP_COMMAND_SCK_SEND:      return "SCK_SEND";
+        case ESP_COMMAND_SCK_POLL:      return "SCK_POLL";
+        case ESP_COMMAND_SCK_CONNECT:   return "SCK_CONNECT";
+        case ESP_COMMAND_RQGET:         return "RQGET";
+        case ESP_COMMAND_FOPEN:         return "FOPEN";
+        case ESP_COMMAND_FREAD:         return "FREAD";
+        case ESP_COMMAND_FWRITE:        return "FWRITE";
+        case ESP_COMMAND_FCLOSE:        return "FCLOSE";
+        case ESP_COMMAND_FSTAT:         return "FSTAT";
+        case ESP_COMMAND_FFSTAT:        return "FFSTAT";
+        case ESP_COMMAND_FSEEK:         return "FSEEK";
+        case ESP_COMMAND_FLISTDIR:      return "FLISTDIR";
+        case ESP_COMMAND_FLISTDIRP:     return "FLISTDIRP";
+        case ESP_COMMAND_FREMOVE:       return "FREMOVE";
+        case ESP_COMMAND_STAT_SEND:     return "STAT_SEND";
+        default:                        return NULL;
+    }
+}
+
+// Format the statistics as text (file server '/stats' page)
+// Returns the length of the text
+//======================================
+int link_stats_text(char *buf, int size)
+{
+    link_stats_t *snap = malloc(sizeof(link_stats_t));
+    if (snap == NULL) return snprintf(buf, size, "Link statistics: no memory\n");
+    if (!link_stats_snapshot(snap)) {
+        free(snap);
+        return snprintf(buf, size, "Link statistics: busy, try again\n");
+    }
+
+    char name[16];
+    int len = 0;
+    len += snprintf(buf+len, size-len, "Link statistics (%.3f s)\n-------------------------\n",
+            (double)(esp_timer_get_time() - snap->reset_time) / 1000000.0);
+    for (int i=0; (i<LINK_STAT_MAX) && (len < size); i++) {
+        len += snprintf(buf+len, size-len, "%18s: %u\n", counter_names[i], snap->counters[i]);
+    }
+    if (len < size) len += snprintf(buf+len, size-len, "%18s: %" PRIu64 "\n%18s: %" PRIu64 "\n",
+            "Bytes sent", snap->bytes_tx, "Bytes received", snap->bytes_rx);
+
+    dns_cache_stats_t dns;
+    dns_cache_get_stats(&dns);
+    if (len < size) len += snprintf(buf+len, size-len, "%18s: %u hits, %u negative hits, %u misses, %u prefetches, %u entries\n\n",
+            "DNS cache", dns.hits, dns.negative_hits, dns.misses, dns.prefetches, dns.entries);
+
+    if (len < size) len += snprintf(buf+len, size-len, "%-14s%9s%9s%9s%9s%9s\n", "Phase (us)", "count", "avg", "p50", "p99", "max");
+    for (int i=0; (i<LINK_PHASE_MAX) && (len < size); i++) {
+        len += hist_text(buf+len, size-len, phase_names[i], &snap->phases[i]);
+    }
+
+    if (len < size) len += snprintf(buf+len, size-len, "\n%-14s%9s%9s%9s%9s%9s\n", "Command (us)", "count", "avg", "p50", "p99", "max");
+    for (int i=0; (i<snap->n_cmds) && (len < size); i++) {
+        const char *cname = command_name(snap->cmds[i].cmd);
+        if (cname) snprintf(name, sizeof(name), "%s", cname);
+        else snprintf(name, sizeof(name), "%u", snap->cmds[i].cmd);
+        len += hist_text(buf+len, size-len, name, &snap->cmds[i].hist);
+    }
+
+    free(snap);
+    return (len < size) ? len : size-1;
+}
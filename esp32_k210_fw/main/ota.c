@@ -1,9 +1,14 @@
 
+#include <fcntl.h>
+#include <unistd.h>
 #include "global.h"
 #include "esp_ota_ops.h"
 #include "mbedtls/md5.h"
 
 #define BUFFSIZE 8192
+#define OTA_RING_BUFFERS        3
+#define OTA_READER_STACK        4096
+#define OTA_READER_PRIORITY     5
 
 char ota_fname[65] = {0};
 char ota_fmd5[33] = {0};
@@ -12,14 +17,107 @@ xQueueHandle ota_evt_queue = NULL;
 
 const char *OTA_TAG = "[OTA_TASK]";
 
+/*
+ * OTA update pipeline
+ *
+ * The reader task reads the update file from K210 into a ring of buffers,
+ * the OTA task hashes and writes the previous chunk to the flash at the same time.
+ * Buffers are passed by index through two queues: free buffers to the reader,
+ * filled chunks to the writer. The reader always finishes with the end chunk
+ * (len=0 on end of file, len<0 on error).
+ */
+typedef struct {
+    int idx;        // ring buffer index
+    int len;        // chunk length
+} ota_chunk_t;
+
+typedef struct {
+    int fd;
+    int size;
+    uint64_t read_time;
+} ota_reader_t;
+
+static char *ota_ring[OTA_RING_BUFFERS] = {NULL};
+static QueueHandle_t ota_free_queue = NULL;
+static QueueHandle_t ota_full_queue = NULL;
+static volatile bool ota_abort = false;
+
+
+//=====================================
+static void OTA_reader_task(void *arg)
+{
+    ota_reader_t *reader = (ota_reader_t *)arg;
+    ota_chunk_t chunk = { .idx = 0, .len = 0 };
+    int remaining = reader->size;
+
+    while ((remaining > 0) && (!ota_abort)) {
+        if (xQueueReceive(ota_free_queue, &chunk.idx, portMAX_DELAY) != pdTRUE) continue;
+        if (ota_abort) break;
+
+        int to_read = (remaining > BUFFSIZE) ? BUFFSIZE : remaining;
+        uint64_t tstart = esp_timer_get_time();
+        chunk.len = read(reader->fd, (void *)ota_ring[chunk.idx], to_read);
+        reader->read_time += (esp_timer_get_time() - tstart);
+        if (chunk.len != to_read) {
+            if (debug_log >= 1)  ESP_LOGW(OTA_TAG, "Error reading file chunk (%d <> %d), rem=%d", chunk.len, to_read, remaining);
+            chunk.len = -1;
+            break;
+        }
+        remaining -= chunk.len;
+        xQueueSend(ota_full_queue, &chunk, portMAX_DELAY);
+    }
+
+    // Signal the end of file to the writer
+    if (chunk.len > 0) chunk.len = 0;
+    if (ota_abort) chunk.len = -1;
+    xQueueSend(ota_full_queue, &chunk, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+//--------------------------------------------------------------
+static int ota_next_chunk(ota_chunk_t *chunk, bool *reader_done)
+{
+    // Wait for the next chunk from the reader task
+    while (xQueueReceive(ota_full_queue, chunk, pdMS_TO_TICKS(1000)) != pdTRUE) {
+        CHECK_ERROR_CODE(esp_task_wdt_reset(), ESP_OK);
+    }
+    CHECK_ERROR_CODE(esp_task_wdt_reset(), ESP_OK);
+    if (chunk->len <= 0) *reader_done = true;
+    return chunk->len;
+}
+
+//---------------------------------------------------------
+static void ota_send_stats(int length, uint64_t total_time,
+                           uint64_t read_time, uint64_t write_time)
+{
+    // Report the throughput and the stages busy time to K210
+    if (total_time == 0) total_time = 1;
+    uint32_t kbps = (uint32_t)(((uint64_t)length * 1000000ULL) / (total_time * 1024ULL));
+    uint32_t rd_pct = (uint32_t)((read_time * 100) / total_time);
+    uint32_t wr_pct = (uint32_t)((write_time * 100) / total_time);
+    if (kbps > 0xFFFF) kbps = 0xFFFF;
+    if (rd_pct > 100) rd_pct = 100;
+    if (wr_pct > 100) wr_pct = 100;
+
+    if (debug_log >= 1)  ESP_LOGI(OTA_TAG, "Throughput: %u KB/s, time=%llu ms (read: %llu ms, %u%%; hash+write: %llu ms, %u%%)",
+            kbps, total_time / 1000, read_time / 1000, rd_pct, write_time / 1000, wr_pct);
+    // older K210 firmware doesn't know this status code
+    if (k210_info.features & K210_INFO_OTASTATS) {
+        k210_status_send(ESP32_STATUS_CODE_OTA, (int)((kbps << 16) | (rd_pct << 8) | wr_pct));
+    }
+}
+
 //------------------------
 esp_err_t ota_fileupdate()
 {
-    char *ota_write_data = NULL; // ota data write buffer
     esp_err_t err = ESP_FAIL, errexit = ESP_FAIL;
     k210_fstat_t fstat;
     int fres = -1;
-    int fdd = -1;
+    ota_reader_t reader = { .fd = -1, .size = 0, .read_time = 0 };
+    ota_chunk_t chunk = { .idx = 0, .len = 0 };
+    bool reader_done = true;
+    uint64_t write_time = 0;
+    uint64_t tstart = 0;
     char local_md5[33] = {0};
 
     // update handle : set by esp_ota_begin(), must be freed via esp_ota_end() !
@@ -38,11 +136,24 @@ esp_err_t ota_fileupdate()
         goto exit;
     }
 
-    ota_write_data = malloc(BUFFSIZE+16);
-    if (ota_write_data == NULL) {
-        if (debug_log >= 1)  ESP_LOGE(OTA_TAG, "Error allocating buffer !");
+    // The queues are kept, the reader task can still be inside 'xQueueSend' when the end chunk is received
+    if (ota_free_queue == NULL) ota_free_queue = xQueueCreate(OTA_RING_BUFFERS, sizeof(int));
+    if (ota_full_queue == NULL) ota_full_queue = xQueueCreate(OTA_RING_BUFFERS+1, sizeof(ota_chunk_t));
+    if ((ota_free_queue == NULL) || (ota_full_queue == NULL)) {
+        if (debug_log >= 1)  ESP_LOGE(OTA_TAG, "Error creating queues !");
         goto exit;
     }
+    xQueueReset(ota_free_queue);
+    xQueueReset(ota_full_queue);
+
+    for (int i=0; i<OTA_RING_BUFFERS; i++) {
+        ota_ring[i] = malloc(BUFFSIZE+16);
+        if (ota_ring[i] == NULL) {
+            if (debug_log >= 1)  ESP_LOGE(OTA_TAG, "Error allocating buffer !");
+            goto exit;
+        }
+        xQueueSend(ota_free_queue, &i, 0);
+    }
 
     if (debug_log >= 1)  ESP_LOGI(OTA_TAG, "Starting OTA update from '%s' to '%s' partition", running_partition->label, update_partition->label);
 
@@ -70,23 +181,39 @@ esp_err_t ota_fileupdate()
         if (debug_log >= 1)  ESP_LOGE(OTA_TAG, "File size too small !");
         goto exit;
     }
+    if (expect_len > update_partition->size) {
+        if (debug_log >= 1)  ESP_LOGE(OTA_TAG, "Update file bigger than the partition size: %u > %u", expect_len, update_partition->size);
+        goto exit;
+    }
 
-    // Open the update file
-    fdd = k210_file_open(ota_fname, ESP_FILE_MODE_RO);
-    if (fdd < 0) {
+    // Open the update file through K210 VFS
+    char vfs_fname[sizeof(ota_fname)+8];
+    snprintf(vfs_fname, sizeof(vfs_fname), "%s%s", K210VFS_BASE_PATH, ota_fname);
+    reader.fd = open(vfs_fname, O_RDONLY);
+    if (reader.fd < 0) {
         if (debug_log >= 1)  ESP_LOGE(OTA_TAG, "Error opening update file !");
         goto exit;
     }
 
-    // Read 1st chunk from update file
-    int rd_len = k210_file_read(fdd, (void *)ota_write_data, BUFFSIZE);
-    if (rd_len != BUFFSIZE) {
+    // Start the reader stage
+    reader.size = expect_len;
+    ota_abort = false;
+    tstart = esp_timer_get_time();
+    if (xTaskCreatePinnedToCore(OTA_reader_task, "OTA reader", OTA_READER_STACK, (void *)&reader, OTA_READER_PRIORITY, NULL, 1) != pdPASS) {
+        if (debug_log >= 1)  ESP_LOGE(OTA_TAG, "Error creating reader task !");
+        goto exit;
+    }
+    reader_done = false;
+
+    // Check the 1st chunk from update file
+    if (ota_next_chunk(&chunk, &reader_done) != BUFFSIZE) {
         if (debug_log >= 1)  ESP_LOGE(OTA_TAG, "Error reading from update file !");
         goto exit;
     }
 
-    if (ota_write_data[0] != 0xE9) {
+    if (ota_ring[chunk.idx][0] != 0xE9) {
         if (debug_log >= 1)  ESP_LOGE(OTA_TAG, "Error: OTA image has invalid magic byte!");
+        xQueueSend(ota_free_queue, &chunk.idx, portMAX_DELAY);
         goto exit;
     }
 
@@ -98,44 +225,40 @@ esp_err_t ota_fileupdate()
     mbedtls_md5_init( &ctx );
     mbedtls_md5_starts( &ctx );
     int binary_file_length = 0; // image total length
-    int remaining = expect_len; // remaining to read
-    int to_read;
-
-    // ==== Read chunks of update file and write to the ota partition ====
-    while (remaining > 0) {
-        vTaskDelay(1);
-        CHECK_ERROR_CODE(esp_task_wdt_reset(), ESP_OK);
 
-        mbedtls_md5_update( &ctx, (const unsigned char *)ota_write_data, rd_len);
+    // ==== Hash and write the chunks to the ota partition while the next ones are read ====
+    while (1) {
+        uint64_t twrite = esp_timer_get_time();
+        mbedtls_md5_update( &ctx, (const unsigned char *)ota_ring[chunk.idx], chunk.len);
 
-        err = esp_ota_write( update_handle, (const void *)ota_write_data, rd_len);
+        err = esp_ota_write( update_handle, (const void *)ota_ring[chunk.idx], chunk.len);
+        write_time += (esp_timer_get_time() - twrite);
+        // Return the buffer to the reader
+        xQueueSend(ota_free_queue, &chunk.idx, portMAX_DELAY);
         if (err != ESP_OK) {
-            //mp_hal_stdout_tx_newline();
             if (debug_log >= 1)  ESP_LOGE(OTA_TAG, "Error: esp_ota_write failed! err=0x%x", err);
+            mbedtls_md5_free( &ctx );
             goto exit;
         }
         // Update sizes
-        binary_file_length += rd_len;
-        remaining -= rd_len;
-        if (remaining <= 0) break;
-
-        // read next chunk of data
-        to_read = (remaining > BUFFSIZE) ? BUFFSIZE : remaining;
-        rd_len = k210_file_read(fdd, (void *)ota_write_data, to_read);
+        binary_file_length += chunk.len;
+        if (binary_file_length >= expect_len) break;
 
-        if (rd_len != to_read) {
-            if (debug_log >= 1)  ESP_LOGW(OTA_TAG, "Error reading file chunk (%d <> %d), rem=%d", rd_len, to_read, remaining);
+        // get next chunk of data
+        if (ota_next_chunk(&chunk, &reader_done) <= 0) {
+            mbedtls_md5_free( &ctx );
             goto exit;
         }
-        if ((binary_file_length + rd_len) > expect_len) {
-            if (debug_log >= 1)  ESP_LOGW(OTA_TAG, "More than expected bytes read %u > %u [%d]", binary_file_length+rd_len, expect_len, rd_len);
-            goto exit;
-        }
-        if ((binary_file_length + rd_len) > update_partition->size) {
-            if (debug_log >= 1)  ESP_LOGW(OTA_TAG, "Update file bigger than the partition size: %u > %u", binary_file_length+rd_len, update_partition->size);
-            goto exit;
+    }
+
+    // Wait for the reader to finish
+    while (!reader_done) {
+        if (ota_next_chunk(&chunk, &reader_done) > 0) {
+            if (debug_log >= 1)  ESP_LOGW(OTA_TAG, "More than expected bytes read");
+            xQueueSend(ota_free_queue, &chunk.idx, portMAX_DELAY);
         }
     }
+    ota_send_stats(binary_file_length, esp_timer_get_time() - tstart, reader.read_time, write_time);
 
     CHECK_ERROR_CODE(esp_task_wdt_reset(), ESP_OK);
     // Finished, set local md5
@@ -177,10 +300,18 @@ esp_err_t ota_fileupdate()
 
 exit:
     CHECK_ERROR_CODE(esp_task_wdt_reset(), ESP_OK);
-    if (fdd >= 0) {
-        k210_file_close(fdd);
+    // Stop the reader, the buffers can be freed after it has finished
+    ota_abort = true;
+    while (!reader_done) {
+        if (ota_next_chunk(&chunk, &reader_done) > 0) xQueueSend(ota_free_queue, &chunk.idx, portMAX_DELAY);
+    }
+    if (reader.fd >= 0) {
+        close(reader.fd);
+    }
+    for (int i=0; i<OTA_RING_BUFFERS; i++) {
+        if (ota_ring[i]) free(ota_ring[i]);
+        ota_ring[i] = NULL;
     }
-    if (ota_write_data) free(ota_write_data);
 
     return errexit;
 }
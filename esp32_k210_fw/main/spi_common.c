@@ -4,7 +4,6 @@
 #include <sys/stat.h>
 #include <sys/errno.h>
 
-#include "esp32/rom/crc.h"
 
 #include "tcpip_adapter.h"
 
@@ -25,32 +24,62 @@
 
 #include "global.h"
 
+#define SSL_SOCKET_FD_OFFSET    31000
+#define SSL_SESSION_CACHE_SIZE  4       // hosts with saved TLS session
+#define SSL_SESSION_HOST_MAX    64
+#define SSL_CONTEXT_POOL_SIZE   1       // SSL contexts kept for reuse after the socket is closed
+#define SSL_CONTEXT_POOL_IDLE   10000   // pooled SSL contexts are freed when not reused in this time (ms)
+#define SOCKET_CONNECT_TIMEOUT  3000
+#define SOCKET_MONITOR_TIMEOUT  1000
+#define SSL_HANDSHAKE_TIMEOUT   15000
+#define SSL_HANDSHAKE_POLL      100     // check for socket closed by K210 at this interval (ms)
+#define SOCKET_TASKS_STOP_WAIT  (SSL_HANDSHAKE_TIMEOUT + SOCKET_MONITOR_TIMEOUT)
+
+#define SSL_HS_NONE             0       // no handshake pending, socket can be used
+#define SSL_HS_CONNECT          1       // connect and client handshake executed by SSL_task
+#define SSL_HS_ACCEPT           2       // server handshake executed by SSL_task
+
 typedef struct _ssl_socket_t
 {
     int                      fd;
+    mbedtls_ssl_context      ssl;
+    mbedtls_net_context      client_fd;
+    mbedtls_net_context      remote_fd;
+    bool                     ssl_initialized;
+    volatile int             hs_state;          // SSL_HS_xxx
+    volatile bool            hs_abort;          // closed by K210 while the handshake was running
+    int                      hs_result;         // result of the last handshake, 0 or mbedtls error
+    char                     *host;             // connect parameters for SSL_task
+    int                      port;
+} ssl_socket_t;
+
+typedef struct _ssl_shared_t
+{
+    int                      refcount;
     void                     *cert_pem_data;
     int                      cert_pem_len;
     mbedtls_entropy_context  entropy;
     mbedtls_ctr_drbg_context ctr_drbg;
-    mbedtls_ssl_context      ssl;
     mbedtls_x509_crt         cacert;
     mbedtls_x509_crt         client_cert;
     mbedtls_pk_context       client_key;
     mbedtls_ssl_config       conf;
-    mbedtls_net_context      client_fd;
-    mbedtls_net_context      remote_fd;
     void                     *client_cert_pem_data;
     int                      client_cert_pem_len;
     void                     *client_key_pem_data;
     int                      client_key_pem_len;
     bool                     mutual_authentication;
-    bool                     ssl_initialized;
     bool                     verify_server;
-} ssl_socket_t;
+} ssl_shared_t;
 
-#define SSL_SOCKET_FD_OFFSET    31000
-#define SOCKET_CONNECT_TIMEOUT  3000
-#define SOCKET_CHECK_INTERVAL   20
+typedef struct _ssl_session_entry_t
+{
+    char                     host[SSL_SESSION_HOST_MAX];
+    int                      port;
+    uint32_t                 last_used;
+    bool                     valid;
+    mbedtls_ssl_session      session;
+} ssl_session_entry_t;
 
 
 size_t spi_transaction_length = 0;
@@ -64,14 +93,37 @@ static ssl_socket_t *ssl_sockets[CONFIG_LWIP_MAX_SOCKETS] = {NULL};
 static const char *SOCK_TAG = "[SPI_TASK_SOCK]";
 static const char *SOCK_TAG_SSL = "[SPI_TASK_SOCK_SSL]";
 
-//============================
-bool command_frame_check(void)
+// Decompress the payload of the compressed frame (see 'frame_compress()') in place
+//--------------------------------
+static bool frame_decompress(void)
+{
+    if (esp_len < 2) return false;
+    uint16_t size = SPI_RW_BUFFER[4] | (SPI_RW_BUFFER[5] << 8);
+    size_t clen = esp_len - 2;
+    if ((size > (spi_master_buffer_size-64)) || (clen > (size + LZ_INPLACE_MARGIN(size)))) return false;
+
+    // the compressed data is moved to the end of the buffer, the frame buffers
+    // are allocated with the margin needed for decompressing the largest payload
+    uint8_t *out = SPI_RW_BUFFER+4;
+    uint8_t *in = out + size + LZ_INPLACE_MARGIN(size) - clen;
+    memmove(in, SPI_RW_BUFFER+6, clen);
+    if (lz_decompress(in, clen, out, size) != size) return false;
+    esp_len = size;
+    link_stats_count(LINK_STAT_LZ_RECEIVED);
+    return true;
+}
+
+// The frames read with SLAVE_CMD_OPT_CRC also have the crc16 after the crc32 ('with_crc16'),
+// both are checked in a single pass over the frame
+//==========================================
+bool command_frame_check(bool with_crc16)
 {
     uint32_t crc, calc_crc;
     bool res = false;
 
     // Analyze received data (in 'SPI_RW_BUFFER')
-    esp_len = *((uint16_t *)(SPI_RW_BUFFER+2));
+    uint16_t frame_len = *((uint16_t *)(SPI_RW_BUFFER+2));
+    esp_len = frame_len & ~ESP_FRAME_LZ;
     spi_transaction_length = esp_len+8;
     if (spi_transaction_length >= 8) {
         // Transaction length OK
@@ -81,10 +133,25 @@ bool command_frame_check(void)
             if (esp_len <= (spi_master_buffer_size-64)) {
                 // Length ok
                 memcpy((void *)&crc, SPI_RW_BUFFER + esp_len + 4, 4);
-                calc_crc = crc32_le(0, SPI_RW_BUFFER, esp_len + 4);
-                if (crc == calc_crc) {
-                    // CRC32 check passed, command accepted
-                    res = true;
+                int crc_res = check_frame_crc(SPI_RW_BUFFER, esp_len + 4, with_crc16, &calc_crc);
+                if (crc_res == CRC_CHECK_OK) {
+                    // CRC check passed, command accepted
+                    if ((frame_len & ESP_FRAME_LZ) && (!frame_decompress())) {
+                        if (debug_log >= 1) ESP_LOGW(SPI_TAG, "Transaction: len=%u, bad compressed data", esp_len);
+                        esp_cmdstat |= ESP_ERROR_FRAME;
+                        esp_len = 0;
+                    }
+                    else {
+                        // the frame buffers are not cleared, the payload is terminated with zeros instead of the crc
+                        memset(SPI_RW_BUFFER + esp_len + 4, 0, SPI_FRAME_GUARD);
+                        res = true;
+                    }
+                }
+                else if (crc_res == CRC_CHECK_CRC16_ERROR) {
+                    link_stats_count(LINK_STAT_CRC16_ERRORS);
+                    if (debug_log >= 1) ESP_LOGW(SPI_TAG, "Transaction: len=%u, CRC16 Error", esp_len);
+                    esp_cmdstat |= ESP_ERROR_CRC;
+                    esp_len = 0;
                 }
                 else {
                     if (debug_log >= 1) {
@@ -110,103 +177,206 @@ bool command_frame_check(void)
     }
     else {
         // Valid transaction length must be at least 8 bytes
-        if (debug_log >= 1) ESP_LOGW(SPI_TAG, "Transaction: Frame length error (%d)", spi_transaction_length);
+        if (debug_log >= 1) ESP_LOGW(SPI_TAG, "Transaction: Frame length error (%u)", (unsigned)spi_transaction_length);
         esp_cmdstat = ESP_ERROR_FRAME;
         esp_len = 0;
     }
+    if (!res) link_stats_count(LINK_STAT_FRAME_ERRORS);
     return res;
 }
 
-//--------------------------------------------------
-static void close_mbedtls_socket(ssl_socket_t *sock)
+/*
+ * Shared TLS configuration, session cache and SSL context pool
+ * ---------------------------------------------------------------------------------------
+ * All SSL sockets use one reference counted TLS configuration ('ssl_shared'): one entropy
+ * source and DRBG, one 'mbedtls_ssl_config', the CA and client certificates parsed once.
+ * It is created when the first SSL socket is opened and freed when the last one is released.
+ * When a socket is closed, its SSL context (with the allocated record buffers) is reset and
+ * kept in a small pool, the next opened SSL socket reuses it instead of a new 'mbedtls_ssl_setup()'.
+ * A pooled context not reused within SSL_CONTEXT_POOL_IDLE ms is freed by SOCKET_task, with it
+ * the last reference to the shared configuration is dropped when no other SSL socket is open.
+ * After a successful handshake the TLS session is saved in the per-host (host:port) cache,
+ * the next connection to the same host offers it (session ID or session ticket); if the
+ * server accepts it, the abbreviated handshake is performed (no certificate exchange and
+ * no key agreement). A session rejected with a failed handshake is dropped from the cache.
+ * The pool and the session cache are flushed when WiFi is deinitialized.
+ * ---------------------------------------------------------------------------------------
+ */
+static ssl_shared_t *ssl_shared = NULL;
+static ssl_socket_t *ssl_context_pool[SSL_CONTEXT_POOL_SIZE] = {NULL};
+static uint64_t ssl_context_pool_time = 0;
+static ssl_session_entry_t ssl_session_cache[SSL_SESSION_CACHE_SIZE] = {0};
+static uint32_t ssl_session_seq = 0;
+static SemaphoreHandle_t ssl_rng_mutex = NULL;
+
+// The DRBG is shared by the SPI task and SSL_task, mbedtls is built without threading support
+//-----------------------------------------------------------------------
+static int ssl_rng(void *p_rng, unsigned char *output, size_t output_len)
 {
-    if (sock->ssl_initialized) {
-        if (debug_log >= 1) ESP_LOGI(SPI_TAG, "Cleanup mbedtls");
-        mbedtls_ssl_close_notify(&sock->ssl);
-        mbedtls_ssl_session_reset(&sock->ssl);
-        mbedtls_net_free(&sock->client_fd);
-        mbedtls_ssl_config_free(&sock->conf);
-        if (sock->verify_server) {
-            mbedtls_x509_crt_free(&sock->cacert);
-        }
-        if (sock->mutual_authentication) {
-            mbedtls_x509_crt_free(&sock->client_cert);
-            mbedtls_pk_free(&sock->client_key);
-        }
-        mbedtls_ctr_drbg_free(&sock->ctr_drbg);
-        mbedtls_entropy_free(&sock->entropy);
-        mbedtls_ssl_free(&sock->ssl);
-        sock->mutual_authentication = false;
-        sock->ssl_initialized = false;
-        sock->verify_server = false;
-    }
+    xSemaphoreTake(ssl_rng_mutex, portMAX_DELAY);
+    int ret = mbedtls_ctr_drbg_random(p_rng, output, output_len);
+    xSemaphoreGive(ssl_rng_mutex);
+    return ret;
 }
 
-//-----------------------------------------------------
-static int _mbed_socket_init_cacert(ssl_socket_t *sock)
+//---------------------------------------------------
+static int _mbed_socket_init_cacert(ssl_shared_t *sh)
 {
-    if (sock->verify_server) {
-        mbedtls_x509_crt_free(&sock->cacert);
+    if (sh->verify_server) {
+        mbedtls_x509_crt_free(&sh->cacert);
     }
-    mbedtls_x509_crt_init(&sock->cacert);
+    mbedtls_x509_crt_init(&sh->cacert);
 
-    if (sock->cert_pem_data) {
+    if (sh->cert_pem_data) {
         if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Loading the CA root certificate...");
-        int ret = mbedtls_x509_crt_parse(&sock->cacert, sock->cert_pem_data, sock->cert_pem_len + 1);
+        int ret = mbedtls_x509_crt_parse(&sh->cacert, sh->cert_pem_data, sh->cert_pem_len + 1);
 
         if (ret < 0) {
             if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_x509_crt_parse returned -0x%x", -ret);
             return -1;
         }
-        mbedtls_ssl_conf_ca_chain(&sock->conf, &sock->cacert, NULL);
-        mbedtls_ssl_conf_authmode(&sock->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+        mbedtls_ssl_conf_ca_chain(&sh->conf, &sh->cacert, NULL);
+        mbedtls_ssl_conf_authmode(&sh->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
 
-        sock->verify_server = true;
+        sh->verify_server = true;
     }
     else {
         if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "No CA root certificate used.");
-        mbedtls_ssl_conf_authmode(&sock->conf, MBEDTLS_SSL_VERIFY_NONE);
-        sock->verify_server = false;
+        mbedtls_ssl_conf_authmode(&sh->conf, MBEDTLS_SSL_VERIFY_NONE);
+        sh->verify_server = false;
     }
     return 0;
 }
 
-//----------------------------------------------------------
-static int _mbed_socket_init_client_cert(ssl_socket_t *sock)
+//--------------------------------------------------------
+static int _mbed_socket_init_client_cert(ssl_shared_t *sh)
 {
     int ret;
-    if (sock->mutual_authentication) {
-        mbedtls_x509_crt_free(&sock->client_cert);
-        mbedtls_pk_free(&sock->client_key);
+    if (sh->mutual_authentication) {
+        mbedtls_x509_crt_free(&sh->client_cert);
+        mbedtls_pk_free(&sh->client_key);
     }
 
-    sock->mutual_authentication = false;
-    mbedtls_x509_crt_init(&sock->client_cert);
-    mbedtls_pk_init(&sock->client_key);
+    sh->mutual_authentication = false;
+    mbedtls_x509_crt_init(&sh->client_cert);
+    mbedtls_pk_init(&sh->client_key);
 
-    if (sock->client_cert_pem_data && sock->client_key_pem_data) {
-        sock->mutual_authentication = true;
-        if ((ret = mbedtls_x509_crt_parse(&sock->client_cert, sock->client_cert_pem_data, sock->client_cert_pem_len + 1)) < 0) {
-            if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_x509_crt_parse returned -0x%x\nDATA=%s,len=%d", -ret, (char*)sock->client_cert_pem_data, sock->client_cert_pem_len);
+    if (sh->client_cert_pem_data && sh->client_key_pem_data) {
+        sh->mutual_authentication = true;
+        if ((ret = mbedtls_x509_crt_parse(&sh->client_cert, sh->client_cert_pem_data, sh->client_cert_pem_len + 1)) < 0) {
+            if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_x509_crt_parse returned -0x%x\nDATA=%s,len=%d", -ret, (char*)sh->client_cert_pem_data, sh->client_cert_pem_len);
             return -1;
         }
-        if ((ret = mbedtls_pk_parse_key(&sock->client_key, sock->client_key_pem_data, sock->client_key_pem_len + 1, NULL, 0)) < 0) {
-            if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_pk_parse_keyfile returned -0x%x\nDATA=%s,len=%d", -ret, (char*)sock->client_key_pem_data, sock->client_key_pem_len);
+        if ((ret = mbedtls_pk_parse_key(&sh->client_key, sh->client_key_pem_data, sh->client_key_pem_len + 1, NULL, 0)) < 0) {
+            if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_pk_parse_keyfile returned -0x%x\nDATA=%s,len=%d", -ret, (char*)sh->client_key_pem_data, sh->client_key_pem_len);
             return -1;
         }
 
-        if ((ret = mbedtls_ssl_conf_own_cert(&sock->conf, &sock->client_cert, &sock->client_key)) < 0) {
+        if ((ret = mbedtls_ssl_conf_own_cert(&sh->conf, &sh->client_cert, &sh->client_key)) < 0) {
             if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_ssl_conf_own_cert returned -0x%x", -ret);
             return -1;
         }
     }
-    else if (sock->client_cert_pem_data || sock->client_key_pem_data) {
+    else if (sh->client_cert_pem_data || sh->client_key_pem_data) {
         if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "You have to provide both client_cert_pem and client_key_pem for mutual authentication");
         return -1;
     }
     return 0;
 }
 
+//----------------------------
+static void ssl_shared_free()
+{
+    if (ssl_shared == NULL) return;
+
+    if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Free shared TLS configuration");
+    mbedtls_ssl_config_free(&ssl_shared->conf);
+    if (ssl_shared->verify_server) {
+        mbedtls_x509_crt_free(&ssl_shared->cacert);
+    }
+    if (ssl_shared->mutual_authentication) {
+        mbedtls_x509_crt_free(&ssl_shared->client_cert);
+        mbedtls_pk_free(&ssl_shared->client_key);
+    }
+    mbedtls_ctr_drbg_free(&ssl_shared->ctr_drbg);
+    mbedtls_entropy_free(&ssl_shared->entropy);
+    free(ssl_shared);
+    ssl_shared = NULL;
+}
+
+// Get the reference to the shared TLS configuration, create it on first use
+//--------------------------
+static int ssl_shared_get()
+{
+    int ret;
+
+    if (ssl_shared) {
+        ssl_shared->refcount++;
+        return 0;
+    }
+
+    if (ssl_rng_mutex == NULL) {
+        ssl_rng_mutex = xSemaphoreCreateMutex();
+        if (ssl_rng_mutex == NULL) return -1;
+    }
+    ssl_shared = calloc(1, sizeof(ssl_shared_t));
+    if (ssl_shared == NULL) return -1;
+
+    mbedtls_ctr_drbg_init(&ssl_shared->ctr_drbg);
+    mbedtls_ssl_config_init(&ssl_shared->conf);
+
+    mbedtls_entropy_init(&ssl_shared->entropy);
+    if ((ret = mbedtls_ctr_drbg_seed(&ssl_shared->ctr_drbg, mbedtls_entropy_func, &ssl_shared->entropy, NULL, 0)) != 0) {
+        if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_ctr_drbg_seed returned %d", ret);
+        goto error;
+    }
+
+    if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Setting up the shared SSL/TLS configuration...");
+    if ((ret = mbedtls_ssl_config_defaults(&ssl_shared->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
+        if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_ssl_config_defaults returned %d", ret);
+        goto error;
+    }
+
+    if (_mbed_socket_init_cacert(ssl_shared) < 0) goto error;
+    if (_mbed_socket_init_client_cert(ssl_shared) < 0) goto error;
+
+    mbedtls_ssl_conf_rng(&ssl_shared->conf, ssl_rng, &ssl_shared->ctr_drbg);
+    #if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&ssl_shared->conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+    #endif
+    #ifdef CONFIG_MBEDTLS_DEBUG
+    mbedtls_esp_enable_debug_log(&ssl_shared->conf, CONFIG_MBEDTLS_DEBUG_LEVEL);
+    #endif
+
+    ssl_shared->refcount = 1;
+    return 0;
+
+error:
+    ssl_shared_free();
+    return -1;
+}
+
+//---------------------------
+static void ssl_shared_put()
+{
+    if (ssl_shared == NULL) return;
+    ssl_shared->refcount--;
+    if (ssl_shared->refcount <= 0) ssl_shared_free();
+}
+
+//--------------------------------------------------
+static void close_mbedtls_socket(ssl_socket_t *sock)
+{
+    if (sock->ssl_initialized) {
+        if (debug_log >= 1) ESP_LOGI(SPI_TAG, "Cleanup mbedtls");
+        mbedtls_ssl_close_notify(&sock->ssl);
+        mbedtls_net_free(&sock->client_fd);
+        mbedtls_ssl_free(&sock->ssl);
+        sock->ssl_initialized = false;
+        ssl_shared_put();
+    }
+}
+
 //------------------------------------------------------------------------
 static int _mbed_socket_set_hostname(ssl_socket_t *sock, const char *host)
 {
@@ -225,77 +395,249 @@ static int init_mbedtls_socket(ssl_socket_t *sock)
 {
     int ret;
 
-    mbedtls_ssl_init(&sock->ssl);
-    mbedtls_ctr_drbg_init(&sock->ctr_drbg);
+    if (ssl_shared_get() != 0) return -1;
 
-    mbedtls_ssl_config_init(&sock->conf);
+    mbedtls_ssl_init(&sock->ssl);
+    mbedtls_net_init(&sock->client_fd);
 
-    mbedtls_entropy_init(&sock->entropy);
-    if ((ret = mbedtls_ctr_drbg_seed(&sock->ctr_drbg, mbedtls_entropy_func, &sock->entropy, NULL, 0)) != 0) {
-        if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_ctr_drbg_seed returned %d", ret);
+    if ((ret = mbedtls_ssl_setup(&sock->ssl, &ssl_shared->conf)) != 0) {
+        if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_ssl_setup returned -0x%x", -ret);
+        mbedtls_ssl_free(&sock->ssl);
+        ssl_shared_put();
         return -1;
     }
 
-    if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Setting up the SSL/TLS structure...");
-    if ((ret = mbedtls_ssl_config_defaults(&sock->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT)) != 0) {
-        if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_ssl_config_defaults returned %d", ret);
-        return -1;
+    sock->ssl_initialized = true;
+    return 0;
+}
+
+// Create the SSL socket, the pooled SSL context is used if available
+//-------------------------------------------
+static ssl_socket_t *ssl_socket_new(int fd)
+{
+    ssl_socket_t *sock = NULL;
+
+    for (int i=0; i<SSL_CONTEXT_POOL_SIZE; i++) {
+        if (ssl_context_pool[i]) {
+            sock = ssl_context_pool[i];
+            ssl_context_pool[i] = NULL;
+            if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Using pooled SSL context");
+            break;
+        }
+    }
+    if (sock == NULL) {
+        sock = pvPortMalloc(sizeof(ssl_socket_t));
+        if (sock == NULL) return NULL;
+        memset(sock, 0, sizeof(ssl_socket_t));
+        if (init_mbedtls_socket(sock) != 0) {
+            free(sock);
+            return NULL;
+        }
     }
+    sock->fd = fd;
+    sock->hs_state = SSL_HS_NONE;
+    sock->hs_abort = false;
+    sock->host = NULL;
+    sock->port = 0;
+    return sock;
+}
 
-    if (_mbed_socket_init_cacert(sock) < 0) return -1;
-    if (_mbed_socket_init_client_cert(sock) < 0) return -1;
-    if (_mbed_socket_set_hostname(sock, NULL) < 0) return -1;
+// Close the SSL socket 'n' and remove it from the SSL sockets list
+// The SSL context is reset and returned to the pool if there is room for it
+//-------------------------------------
+static void ssl_socket_release(int n)
+{
+    ssl_socket_t *sock = ssl_sockets[n];
+    ssl_sockets[n] = NULL;
+    if (sock == NULL) return;
+    if (sock->host) {
+        free(sock->host);
+        sock->host = NULL;
+    }
 
-    mbedtls_ssl_conf_rng(&sock->conf, mbedtls_ctr_drbg_random, &sock->ctr_drbg);
-    #ifdef CONFIG_MBEDTLS_DEBUG
-    mbedtls_esp_enable_debug_log(&sock->conf, CONFIG_MBEDTLS_DEBUG_LEVEL);
-    #endif
+    if (sock->ssl_initialized) {
+        for (int i=0; i<SSL_CONTEXT_POOL_SIZE; i++) {
+            if (ssl_context_pool[i] == NULL) {
+                mbedtls_ssl_close_notify(&sock->ssl);
+                mbedtls_net_free(&sock->client_fd);
+                if (mbedtls_ssl_session_reset(&sock->ssl) == 0) {
+                    sock->fd = -1;
+                    ssl_context_pool[i] = sock;
+                    ssl_context_pool_time = esp_timer_get_time();
+                    return;
+                }
+                break;
+            }
+        }
+    }
+    close_mbedtls_socket(sock);
+    free(sock);
+}
 
-    if ((ret = mbedtls_ssl_setup(&sock->ssl, &sock->conf)) != 0) {
-        if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_ssl_setup returned -0x%x", -ret);
-        return -1;
+//-----------------------------------------------------
+static void ssl_session_drop(ssl_session_entry_t *entry)
+{
+    if (entry->valid) mbedtls_ssl_session_free(&entry->session);
+    entry->valid = false;
+}
+
+//----------------------------------------------------------------------
+static ssl_session_entry_t *ssl_session_find(const char *host, int port)
+{
+    for (int i=0; i<SSL_SESSION_CACHE_SIZE; i++) {
+        if ((ssl_session_cache[i].valid) && (ssl_session_cache[i].port == port) && (strcmp(ssl_session_cache[i].host, host) == 0)) {
+            return &ssl_session_cache[i];
+        }
+    }
+    return NULL;
+}
+
+// Save the session of the connected socket, replaces the least recently used entry
+//-------------------------------------------------------------------------------
+static void ssl_session_save(const char *host, int port, mbedtls_ssl_context *ssl)
+{
+    if (strlen(host) >= SSL_SESSION_HOST_MAX) return;
+
+    ssl_session_entry_t *entry = ssl_session_find(host, port);
+    if (entry == NULL) {
+        entry = &ssl_session_cache[0];
+        for (int i=0; i<SSL_SESSION_CACHE_SIZE; i++) {
+            if (!ssl_session_cache[i].valid) {
+                entry = &ssl_session_cache[i];
+                break;
+            }
+            if (ssl_session_cache[i].last_used < entry->last_used) entry = &ssl_session_cache[i];
+        }
     }
+    ssl_session_drop(entry);
 
-    sock->ssl_initialized = true;
-    return 0;
+    mbedtls_ssl_session_init(&entry->session);
+    if (mbedtls_ssl_get_session(ssl, &entry->session) != 0) {
+        mbedtls_ssl_session_free(&entry->session);
+        return;
+    }
+    strcpy(entry->host, host);
+    entry->port = port;
+    entry->last_used = ++ssl_session_seq;
+    entry->valid = true;
+}
+
+// Free the pooled SSL contexts, 'sock_mutex' must be taken
+//-------------------------------------
+static void ssl_context_pool_free()
+{
+    for (int i=0; i<SSL_CONTEXT_POOL_SIZE; i++) {
+        if (ssl_context_pool[i]) {
+            if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Free pooled SSL context");
+            close_mbedtls_socket(ssl_context_pool[i]);
+            free(ssl_context_pool[i]);
+            ssl_context_pool[i] = NULL;
+        }
+    }
+}
+
+// Free the pooled SSL contexts if none was reused in SSL_CONTEXT_POOL_IDLE ms
+//---------------------------------------
+static void ssl_context_pool_expire()
+{
+    if ((esp_timer_get_time() - ssl_context_pool_time) < ((uint64_t)SSL_CONTEXT_POOL_IDLE * 1000)) return;
+    ssl_context_pool_free();
+}
+
+// Free the pooled SSL contexts and the saved sessions
+//-----------------------------
+static void ssl_sockets_flush()
+{
+    ssl_context_pool_free();
+    for (int i=0; i<SSL_SESSION_CACHE_SIZE; i++) {
+        ssl_session_drop(&ssl_session_cache[i]);
+    }
+}
+
+// Run the handshake on the non blocking socket, wait on the socket while the handshake needs more data
+// Fails if the socket is closed by K210 or the handshake does not complete in 'timeout_ms'
+//--------------------------------------------------------------------------
+static int handshake_mbedtls_socket(ssl_socket_t *sock, uint32_t timeout_ms)
+{
+    int ret;
+    uint64_t wait_end = esp_timer_get_time() + ((uint64_t)timeout_ms * 1000);
+
+    mbedtls_net_set_nonblock(&sock->client_fd);
+    while ((ret = mbedtls_ssl_handshake(&sock->ssl)) != 0) {
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ) mbedtls_net_poll(&sock->client_fd, MBEDTLS_NET_POLL_READ, SSL_HANDSHAKE_POLL);
+        else if (ret == MBEDTLS_ERR_SSL_WANT_WRITE) mbedtls_net_poll(&sock->client_fd, MBEDTLS_NET_POLL_WRITE, SSL_HANDSHAKE_POLL);
+        else break;
+        if (sock->hs_abort) {
+            ret = MBEDTLS_ERR_NET_CONN_RESET;
+            break;
+        }
+        if (esp_timer_get_time() > wait_end) {
+            ret = MBEDTLS_ERR_SSL_TIMEOUT;
+            break;
+        }
+    }
+    return ret;
 }
 
-//----------------------------------------------------------------------------------------------------
-static int connect_mbedtls_socket(const char *host, int port, ssl_socket_t *sock, uint32_t timeout_ms)
+// Connect to 'sock->host:sock->port' and perform the client handshake (executed by SSL_task)
+//------------------------------------------------------------------------
+static int connect_mbedtls_socket(ssl_socket_t *sock, uint32_t timeout_ms)
 {
     if (!sock->ssl_initialized) return -1;
-    if (_mbed_socket_set_hostname(sock, host) != 0) return -1;
 
+    const char *host = sock->host;
+    int port = sock->port;
     char buf[512];
     char port_str[16] = {'\0'};
+    char ip_str[16] = {'\0'};
+    ip4_addr_t ip4_addr;
     int ret, flags;
-    struct timeval tv;
+
+    if (_mbed_socket_set_hostname(sock, host) != 0) return -1;
 
     sprintf(port_str, "%d", port);
 
     mbedtls_net_init(&sock->client_fd);
 
-    tv.tv_sec = timeout_ms / 1000;
-    tv.tv_usec = (timeout_ms - (tv.tv_sec * 1000)) * 1000;
-    lwip_setsockopt(sock->client_fd.fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    // Resolve the host using the resolver cache, the host name is still used for SNI and certificate check
+    if (dns_cache_lookup(host, &ip4_addr.addr) != 0) {
+        if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "Cannot resolve '%s'", host);
+        return MBEDTLS_ERR_NET_UNKNOWN_HOST;
+    }
+    ip4addr_ntoa_r(&ip4_addr, ip_str, sizeof(ip_str));
 
-    if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Connecting to %s:%s...", host, port_str);
+    if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Connecting to %s:%s (%s)...", host, port_str, ip_str);
 
-    if ((ret = mbedtls_net_connect(&sock->client_fd, host, port_str, MBEDTLS_NET_PROTO_TCP)) != 0) {
+    if ((ret = mbedtls_net_connect(&sock->client_fd, ip_str, port_str, MBEDTLS_NET_PROTO_TCP)) != 0) {
         if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_net_connect returned -%x", -ret);
-        return -1;
+        return ret;
     }
     if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Connected.");
 
     mbedtls_ssl_set_bio(&sock->ssl, &sock->client_fd, mbedtls_net_send, mbedtls_net_recv, NULL);
 
+    // Offer the saved session, the full handshake is skipped if the server accepts it
+    xSemaphoreTake(sock_mutex, 100000);
+    ssl_session_entry_t *saved = ssl_session_find(host, port);
+    if ((saved) && (mbedtls_ssl_set_session(&sock->ssl, &saved->session) == 0)) {
+        saved->last_used = ++ssl_session_seq;
+        if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Resuming saved TLS session");
+    }
+    xSemaphoreGive(sock_mutex);
+
     if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Performing the SSL/TLS handshake...");
-    while ((ret = mbedtls_ssl_handshake(&sock->ssl)) != 0) {
-        if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
-            if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_ssl_handshake returned -0x%x", -ret);
-            return -1;
+    uint64_t tstart = esp_timer_get_time();
+    if ((ret = handshake_mbedtls_socket(sock, timeout_ms)) != 0) {
+        if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_ssl_handshake returned -0x%x", -ret);
+        if (saved) {
+            xSemaphoreTake(sock_mutex, 100000);
+            saved = ssl_session_find(host, port);
+            if (saved) ssl_session_drop(saved);
+            xSemaphoreGive(sock_mutex);
         }
+        return ret;
     }
+    if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Handshake done in %" PRIu64 " ms", (esp_timer_get_time() - tstart) / 1000);
 
     if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Verifying peer X.509 certificate...");
     if ((flags = mbedtls_ssl_get_verify_result(&sock->ssl)) != 0) {
@@ -310,9 +652,151 @@ static int connect_mbedtls_socket(const char *host, int port, ssl_socket_t *sock
     }
 
     if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Cipher suite is %s", mbedtls_ssl_get_ciphersuite(&sock->ssl));
+    xSemaphoreTake(sock_mutex, 100000);
+    ssl_session_save(host, port, &sock->ssl);
+    xSemaphoreGive(sock_mutex);
     return 0;
 }
 
+/*
+ * SSL handshake task
+ * ---------------------------------------------------------------------------------------
+ * The TLS handshake takes several round trips to the server and, without a saved session,
+ * the certificate verification and key agreement; it is not executed on the SPI task.
+ * If K210 has reported K210_INFO_ASYNCSSL, SCK_CONNECT and SCK_ACCEPT on SSL sockets only
+ * pass the socket to SSL_task and return immediately: SCK_CONNECT with result -1 and error
+ * EINPROGRESS, SCK_ACCEPT with the new socket and error EINPROGRESS. The other sockets and
+ * K210 commands are served meanwhile, commands on the socket itself (other than SCK_CLOSE)
+ * fail until the handshake is done.
+ * SSL_task executes the handshakes one at a time, on non blocking sockets, without holding
+ * 'sock_mutex' while waiting for the server. When done, the socket is marked as connected
+ * and the result is reported to K210 with ESP32_STATUS_CODE_SSL status message.
+ * If the handshake fails the socket stays opened (not connected) until closed by K210.
+ * Older K210 firmware expects the result of the handshake in the command response: the
+ * SPI task waits for SSL_task to finish the handshake ('ssl_handshake_wait()'), no status
+ * is sent, and the SSL socket is released if the handshake fails, as it was before.
+ * If K210 closes the socket while the handshake is running, SSL_task stops it at the
+ * next poll and releases the socket, no status is sent.
+ * ---------------------------------------------------------------------------------------
+ */
+
+// Pass the handshake of SSL socket 'n' to SSL_task, 'sock_mutex' must be taken
+//-----------------------------------------------------------------------
+static int ssl_handshake_start(int n, int op, const char *host, int port)
+{
+    ssl_socket_t *sock = ssl_sockets[n];
+    if ((sock == NULL) || (ssl_task_handle == NULL)) return -1;
+
+    if (host) {
+        sock->host = strdup(host);
+        if (sock->host == NULL) return -1;
+    }
+    sock->port = port;
+    sock->hs_abort = false;
+    sock->hs_state = op;
+    xTaskNotify(ssl_task_handle, 1 << n, eSetBits);
+    return 0;
+}
+
+//----------------------------------
+static void ssl_handshake_run(int n)
+{
+    xSemaphoreTake(sock_mutex, 100000);
+    ssl_socket_t *sock = ssl_sockets[n];
+    int op = (sock) ? sock->hs_state : SSL_HS_NONE;
+    bool abort_pending = (sock) ? sock->hs_abort : false;
+    xSemaphoreGive(sock_mutex);
+    if (op == SSL_HS_NONE) return;
+
+    int fd = n + SSL_SOCKET_FD_OFFSET;
+    int ret;
+    // closed by K210 or the task is stopping before the handshake was started
+    if (abort_pending) ret = MBEDTLS_ERR_NET_CONN_RESET;
+    else if (op == SSL_HS_CONNECT) ret = connect_mbedtls_socket(sock, SSL_HANDSHAKE_TIMEOUT);
+    else {
+        if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Performing client SSL/TLS handshake...");
+        ret = handshake_mbedtls_socket(sock, SSL_HANDSHAKE_TIMEOUT);
+        if ((ret != 0) && (debug_log >= 1)) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_ssl_handshake for client returned -0x%x", -ret);
+    }
+
+    xSemaphoreTake(sock_mutex, 100000);
+    bool aborted = sock->hs_abort;
+    sock->hs_result = ret;
+    sock->hs_state = SSL_HS_NONE;
+    if (sock->host) {
+        free(sock->host);
+        sock->host = NULL;
+    }
+    if (aborted) {
+        // closed by K210 while the handshake was running
+        ssl_socket_release(n);
+    }
+    else if (ret == 0) {
+        // Mark as connected in opened sockets list
+        for (int i=0; i<CONFIG_LWIP_MAX_SOCKETS; i++) {
+            if (opened_sockets[i].fd == fd) {
+                opened_sockets[i].connected = true;
+                break;
+            }
+        }
+    }
+    else {
+        // prepare the SSL context for the next connect
+        mbedtls_net_free(&sock->client_fd);
+        mbedtls_ssl_session_reset(&sock->ssl);
+    }
+    xSemaphoreGive(sock_mutex);
+
+    if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Handshake (fd=%d) %s, res=-0x%x", fd, (aborted) ? "aborted" : "finished", -ret);
+    if (aborted) return;
+    if (ret == 0) socket_monitor_wakeup();
+    // older K210 firmware gets the result in the response of the command waiting for it
+    if (k210_info.features & K210_INFO_ASYNCSSL) k210_status_send(ESP32_STATUS_CODE_SSL, (fd << 16) | ((-ret) & 0xFFFF));
+}
+
+// Wait until SSL_task has finished the handshake of SSL socket 'n' and return its result,
+// 'sock_mutex' must be taken, it is released while waiting
+//----------------------------------
+static int ssl_handshake_wait(int n)
+{
+    ssl_socket_t *sock = ssl_sockets[n];
+    int i = 0;
+    while (sock->hs_state != SSL_HS_NONE) {
+        xSemaphoreGive(sock_mutex);
+        vTaskDelay(pdMS_TO_TICKS(1));
+        i++;
+        if ((i % 1000) == 0) {
+            CHECK_ERROR_CODE(esp_task_wdt_reset(), ESP_OK);
+        }
+        xSemaphoreTake(sock_mutex, 100000);
+    }
+    return sock->hs_result;
+}
+
+//======================
+void SSL_task(void* arg)
+{
+    if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "SSL task started");
+
+    uint32_t notify_value;
+
+    while (1) {
+        // bits 0-15: SSL sockets with handshake pending
+        if (xTaskNotifyWait(0, UINT32_MAX, &notify_value, portMAX_DELAY) != pdPASS) continue;
+        if ((notify_value & 0xFFFF0000) == 0xA55A0000) {
+            // terminate task
+            break;
+        }
+        for (int n=0; n<CONFIG_LWIP_MAX_SOCKETS; n++) {
+            if (notify_value & (1 << n)) ssl_handshake_run(n);
+        }
+    }
+
+    if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "SSL task terminated");
+    ssl_task_handle = NULL;
+    vTaskDelete(NULL);
+}
+
 //----------------------------------------------------------------------------
 static int bind_mbedtls_socket(const char *host, int port, ssl_socket_t *sock)
 {
@@ -345,6 +829,7 @@ static int accept_mbedtls_socket(ssl_socket_t *sock, unsigned char *client_ip, s
 
     ret = mbedtls_net_accept(&sock->client_fd, &client_fd, client_ip, sizeip, cliip_len);
     if (ret != 0) {
+        if (ret == MBEDTLS_ERR_SSL_WANT_READ) return ret;
         if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_net_accept returned -%x", -ret);
         return -1;
     }
@@ -354,68 +839,140 @@ static int accept_mbedtls_socket(ssl_socket_t *sock, unsigned char *client_ip, s
     int fd = -1;
     for (int i=0; i<CONFIG_LWIP_MAX_SOCKETS; i++) {
         if (ssl_sockets[i] == NULL) {
-            ssl_socket_t *skt = pvPortMalloc(sizeof(ssl_socket_t));
-            if (skt) {
-                memcpy(skt, sock, sizeof(ssl_socket_t));
-                // Initialize mbedtls socket
-                mbedtls_net_free(&skt->client_fd);
-                mbedtls_ssl_session_reset(&skt->ssl);
+            ssl_sockets[i] = ssl_socket_new(i+SSL_SOCKET_FD_OFFSET);
+            if (ssl_sockets[i]) {
+                ssl_socket_t *skt = ssl_sockets[i];
                 memcpy(&skt->client_fd, &client_fd, sizeof(mbedtls_net_context));
+                mbedtls_net_init(&client_fd);
 
                 mbedtls_ssl_set_bio(&skt->ssl, &skt->client_fd, mbedtls_net_send, mbedtls_net_recv, NULL);
 
-                if (debug_log >= 1) ESP_LOGI(SOCK_TAG_SSL, "Performing client SSL/TLS handshake...");
-                while ((ret = mbedtls_ssl_handshake(&skt->ssl)) != 0) {
-                    if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
-                        if (debug_log >= 1) ESP_LOGE(SOCK_TAG_SSL, "mbedtls_ssl_handshake for client returned -0x%x", -ret);
-                    }
-                    else {
-                        ssl_sockets[i] = skt;
-                        ssl_sockets[i]->fd = i+SSL_SOCKET_FD_OFFSET;
-                        fd = i+SSL_SOCKET_FD_OFFSET;
-                    }
-                }
+                // the handshake is executed by SSL_task
+                if (ssl_handshake_start(i, SSL_HS_ACCEPT, NULL, 0) == 0) fd = i+SSL_SOCKET_FD_OFFSET;
+                else ssl_socket_release(i);
             }
             break;
         }
     }
+    // not used if no free SSL socket
+    mbedtls_net_free(&client_fd);
 
     return fd;
 }
 
+// Get the socket address of the host, the host name is resolved using the resolver cache
 //-------------------------------------------------------------------------------------------
 static int get_ipaddr(const char *host_str, int port, struct sockaddr_in *addr, int *errcode)
 {
-    const struct addrinfo hints = {
-        .ai_family = AF_INET,
-        .ai_socktype = SOCK_STREAM,
-    };
-    struct addrinfo *resp;
-    struct addrinfo *resi = NULL;
+    uint32_t ip = 0;
 
-    *errcode = 0;
-    int ret = -1;
-    char port_str[16] = {0};
-    sprintf(port_str, "%d", port);
     if (host_str[0] == '\0') {
         // a host of "" is equivalent to the default/all-local IP address
         host_str = "0.0.0.0";
     }
-    ret = lwip_getaddrinfo(host_str, port_str, &hints, &resp);
-    *errcode = errno;
-    if ((ret >= 0) && (resp)) {
-        for (resi = resp; resi; resi = resi->ai_next) {
-            if (resi->ai_family == AF_INET) break;
-        }
-        if ((resi) && (resi->ai_family == AF_INET)) {
-            memcpy(addr, (struct sockaddr_in *)resi->ai_addr, sizeof(struct sockaddr_in));
-            ret = 0;
+    *errcode = dns_cache_lookup(host_str, &ip);
+    if (*errcode != 0) return -1;
+
+    memset(addr, 0, sizeof(struct sockaddr_in));
+    addr->sin_family = AF_INET;
+    addr->sin_port = lwip_htons(port);
+    addr->sin_addr.s_addr = ip;
+    return 0;
+}
+
+/*
+ * Socket monitor
+ * ---------------------------------------------------------------------------------
+ * SOCKET_task waits in a single blocking 'lwip_select()' on all connected sockets
+ * which are not yet reported to K210 as having received data.
+ * A loopback UDP socket is included in the read set and used to wake up the task
+ * when the set of monitored sockets changes ('socket_monitor_wakeup()').
+ * For SSL sockets the underlying lwip socket is monitored, data already decrypted and
+ * buffered by mbedtls is checked with 'mbedtls_ssl_get_bytes_avail()'.
+ * If K210 has reported K210_INFO_SOCKRDMAP, all sockets found ready are reported with
+ * one status message (ESP32_STATUS_CODE_SOCKETRD, bitmap of ready sockets, see 'global.h'),
+ * older K210 firmware gets one status message with the socket fd for each ready socket.
+ * The wakeup socket is created when the task starts and takes one of the
+ * CONFIG_LWIP_MAX_SOCKETS lwip sockets, so at most CONFIG_LWIP_MAX_SOCKETS-1 sockets
+ * can be opened by K210 (less if other ESP32 services, e.g. the file server, use sockets).
+ * ---------------------------------------------------------------------------------
+ */
+static int sock_wakeup_fd = -1;
+static struct sockaddr_in sock_wakeup_addr;
+
+//------------------------------
+static int socket_monitor_init()
+{
+    socklen_t addr_len = sizeof(sock_wakeup_addr);
+
+    sock_wakeup_fd = lwip_socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock_wakeup_fd < 0) return -1;
+
+    memset(&sock_wakeup_addr, 0, sizeof(sock_wakeup_addr));
+    sock_wakeup_addr.sin_family = AF_INET;
+    sock_wakeup_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    sock_wakeup_addr.sin_port = 0;
+    if ((lwip_bind(sock_wakeup_fd, (struct sockaddr *)&sock_wakeup_addr, sizeof(sock_wakeup_addr)) < 0) ||
+        (lwip_getsockname(sock_wakeup_fd, (struct sockaddr *)&sock_wakeup_addr, &addr_len) < 0)) {
+        lwip_close(sock_wakeup_fd);
+        sock_wakeup_fd = -1;
+        return -1;
+    }
+    int flags = lwip_fcntl(sock_wakeup_fd, F_GETFL, 0);
+    lwip_fcntl(sock_wakeup_fd, F_SETFL, flags | O_NONBLOCK);
+    return 0;
+}
+
+//==========================
+void socket_monitor_wakeup()
+{
+    uint8_t wakeup = 1;
+    if (sock_wakeup_fd >= 0) {
+        lwip_sendto(sock_wakeup_fd, &wakeup, 1, 0, (struct sockaddr *)&sock_wakeup_addr, sizeof(sock_wakeup_addr));
+    }
+}
+
+// Get the lwip socket to monitor for the opened socket and check for buffered SSL data
+//------------------------------------------------------------
+static int socket_monitor_fd(socketcfg_t *skt, bool *buffered)
+{
+    int fd = skt->fd;
+    *buffered = false;
+    if (fd >= SSL_SOCKET_FD_OFFSET) {
+        int n = fd - SSL_SOCKET_FD_OFFSET;
+        fd = -1;
+        if ((n < CONFIG_LWIP_MAX_SOCKETS) && (ssl_sockets[n]) && (ssl_sockets[n]->fd == skt->fd)) {
+            fd = ssl_sockets[n]->client_fd.fd;
+            if ((ssl_sockets[n]->ssl_initialized) && (mbedtls_ssl_get_bytes_avail(&ssl_sockets[n]->ssl) > 0)) *buffered = true;
         }
-        else *errcode = ENETRESET;
     }
-    else ret = -1;
-    if (resp) lwip_freeaddrinfo(resp);
-    return ret;
+    return fd;
+}
+
+// Bit in the ready sockets bitmap for the socket
+//----------------------------------------
+static uint32_t socket_monitor_bit(int fd)
+{
+    if (fd >= SSL_SOCKET_FD_OFFSET) return 1u << (SOCKET_RDMAP_SSL_BIT + (fd - SSL_SOCKET_FD_OFFSET));
+    return 1u << (fd - LWIP_SOCKET_OFFSET);
+}
+
+// Report the ready sockets to K210, returns the bitmap of the reported sockets
+//-------------------------------------------------------------------------
+static uint32_t socket_monitor_report(uint32_t ready_map, const int *mon_skt)
+{
+    if (k210_info.features & K210_INFO_SOCKRDMAP) {
+        // all ready sockets with one status message
+        return (k210_status_send(ESP32_STATUS_CODE_SOCKETRD, ready_map) == ESP_OK) ? ready_map : 0;
+    }
+    // K210 expects one status message with the socket fd for each ready socket
+    uint32_t reported = 0;
+    for (int i=0; i<CONFIG_LWIP_MAX_SOCKETS; i++) {
+        if ((mon_skt[i] < 0) || ((ready_map & socket_monitor_bit(mon_skt[i])) == 0)) continue;
+        if (k210_status_send(ESP32_STATUS_CODE_SOCKETRD, mon_skt[i]) != ESP_OK) break;
+        reported |= socket_monitor_bit(mon_skt[i]);
+    }
+    return reported;
 }
 
 //=========================
@@ -424,58 +981,176 @@ void SOCKET_task(void* arg)
     if (debug_log >= 1) ESP_LOGI(SOCK_TAG, "Socket task started");
 
     uint32_t notify_value;
-    int i, ret;
-    int fd;
+    int i, ret, fd, maxfd;
+    int mon_fd[CONFIG_LWIP_MAX_SOCKETS];
+    int mon_skt[CONFIG_LWIP_MAX_SOCKETS];
+    uint16_t mon_seq[CONFIG_LWIP_MAX_SOCKETS];
+    bool buffered;
+    uint32_t ready_map;
     fd_set rfds;
     struct timeval tmout;
-    tmout.tv_sec = 0;
-    tmout.tv_usec = 0;
+    uint8_t wakeup_buf[8];
+
+    if (socket_monitor_init() != 0) {
+        if (debug_log >= 1) ESP_LOGW(SOCK_TAG, "Wakeup socket not created");
+    }
 
     while (1) {
-        BaseType_t res = xTaskNotifyWait(0, ULONG_MAX, &notify_value, pdMS_TO_TICKS(SOCKET_CHECK_INTERVAL));
-        xSemaphoreTake(sock_mutex, 100000);
-        if ((res == pdPASS) && (notify_value == 0xA55A0000)) {
+        if ((xTaskNotifyWait(0, UINT32_MAX, &notify_value, 0) == pdPASS) && (notify_value == 0xA55A0000)) {
             // terminate task
-            xSemaphoreGive(sock_mutex);
             break;
         }
 
+        // ---- Collect the sockets to monitor ----
+        FD_ZERO(&rfds);
+        maxfd = -1;
+        ready_map = 0;
+        xSemaphoreTake(sock_mutex, 100000);
+        ssl_context_pool_expire();
         for (i=0; i<CONFIG_LWIP_MAX_SOCKETS; i++) {
+            mon_fd[i] = -1;
+            mon_skt[i] = -1;
             if ((opened_sockets[i].fd >= 0) && (opened_sockets[i].connected) && (!opened_sockets[i].rdset)) {
-                fd = opened_sockets[i].fd;
-                // Check if this is SSL socket
-                if ((fd >= SSL_SOCKET_FD_OFFSET)) {
-                    int n = fd - SSL_SOCKET_FD_OFFSET;
-                    fd = -1;
-                    if ((n < CONFIG_LWIP_MAX_SOCKETS) && (ssl_sockets[n])) {
-                        if (ssl_sockets[n]->fd == fd) {
-                            fd = ssl_sockets[n]->client_fd.fd;
-                        }
-                    }
-                }
-                if (fd >= 0) {
-                    FD_ZERO(&rfds);
-                    FD_SET(fd, &rfds);
-
-                    ret = lwip_select(fd+1, &rfds, NULL, NULL, &tmout);
-                    if (ret >= 0) {
-                        if (FD_ISSET(fd, &rfds)) {
-                            // Socket has data received
-                            if (k210_status_send(ESP32_STATUS_CODE_SOCKETRD, fd) == ESP_OK) opened_sockets[i].rdset = true;
-                            vTaskDelay(pdMS_TO_TICKS(5));
-                        }
-                    }
-                }
+                fd = socket_monitor_fd(&opened_sockets[i], &buffered);
+                if (fd < 0) continue;
+                mon_fd[i] = fd;
+                mon_skt[i] = opened_sockets[i].fd;
+                mon_seq[i] = opened_sockets[i].open_seq;
+                if (buffered) ready_map |= socket_monitor_bit(mon_skt[i]);
+                FD_SET(fd, &rfds);
+                if (fd > maxfd) maxfd = fd;
             }
         }
         xSemaphoreGive(sock_mutex);
+
+        if (sock_wakeup_fd >= 0) {
+            FD_SET(sock_wakeup_fd, &rfds);
+            if (sock_wakeup_fd > maxfd) maxfd = sock_wakeup_fd;
+        }
+
+        // ---- Wait for data on any of the monitored sockets ----
+        if (ready_map) {
+            // buffered SSL data, only check the other sockets
+            tmout.tv_sec = 0;
+            tmout.tv_usec = 0;
+        }
+        else {
+            tmout.tv_sec = SOCKET_MONITOR_TIMEOUT / 1000;
+            tmout.tv_usec = (SOCKET_MONITOR_TIMEOUT % 1000) * 1000;
+        }
+        if (maxfd >= 0) ret = lwip_select(maxfd+1, &rfds, NULL, NULL, &tmout);
+        else {
+            vTaskDelay(pdMS_TO_TICKS(SOCKET_MONITOR_TIMEOUT));
+            ret = 0;
+        }
+        if (ret < 0) {
+            // a socket was probably closed while waiting
+            vTaskDelay(pdMS_TO_TICKS(10));
+            continue;
+        }
+        if ((sock_wakeup_fd >= 0) && (FD_ISSET(sock_wakeup_fd, &rfds))) {
+            while (lwip_recv(sock_wakeup_fd, wakeup_buf, sizeof(wakeup_buf), 0) > 0);
+        }
+        for (i=0; i<CONFIG_LWIP_MAX_SOCKETS; i++) {
+            if ((mon_fd[i] >= 0) && (FD_ISSET(mon_fd[i], &rfds))) ready_map |= socket_monitor_bit(mon_skt[i]);
+        }
+        if (ready_map == 0) continue;
+
+        // ---- Report the ready sockets to K210 ----
+        // The sockets are marked as reported before the status is sent, K210 can receive
+        // from the socket (which clears the mark) as soon as it gets the status.
+        // A socket closed while waiting is skipped, its slot (and fd) may already be reused.
+        xSemaphoreTake(sock_mutex, 100000);
+        for (i=0; i<CONFIG_LWIP_MAX_SOCKETS; i++) {
+            if ((mon_skt[i] < 0) || ((ready_map & socket_monitor_bit(mon_skt[i])) == 0)) continue;
+            if ((opened_sockets[i].fd == mon_skt[i]) && (opened_sockets[i].open_seq == mon_seq[i])) {
+                opened_sockets[i].rdset = true;
+            }
+            else {
+                ready_map &= ~socket_monitor_bit(mon_skt[i]);
+                mon_skt[i] = -1;
+            }
+        }
+        xSemaphoreGive(sock_mutex);
+        if (ready_map == 0) continue;
+
+        uint32_t reported = socket_monitor_report(ready_map, mon_skt);
+        if (reported != ready_map) {
+            // not reported, monitor the sockets again
+            xSemaphoreTake(sock_mutex, 100000);
+            for (i=0; i<CONFIG_LWIP_MAX_SOCKETS; i++) {
+                if ((mon_skt[i] >= 0) && (opened_sockets[i].fd == mon_skt[i]) && (opened_sockets[i].open_seq == mon_seq[i]) &&
+                    ((reported & socket_monitor_bit(mon_skt[i])) == 0)) {
+                    opened_sockets[i].rdset = false;
+                }
+            }
+            xSemaphoreGive(sock_mutex);
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
     }
 
+    if (sock_wakeup_fd >= 0) {
+        lwip_close(sock_wakeup_fd);
+        sock_wakeup_fd = -1;
+    }
     if (debug_log >= 1) ESP_LOGI(SOCK_TAG, "Socket task terminated");
     socket_task_handle = NULL;
     vTaskDelete(NULL);
 }
 
+/*
+ * Stop SOCKET_task and SSL_task, executed by the SPI task on exit
+ * Running handshakes are aborted, SSL_task stops them at the next poll, SOCKET_task is woken
+ * from 'lwip_select()'. Both tasks are waited for, only then the opened sockets are closed.
+ * Returns false if a task did not terminate in SOCKET_TASKS_STOP_WAIT ms, the sockets and
+ * 'sock_mutex' are still used by it and must not be freed.
+ */
+//-----------------------
+bool socket_tasks_stop()
+{
+    xSemaphoreTake(sock_mutex, 100000);
+    for (int n=0; n<CONFIG_LWIP_MAX_SOCKETS; n++) {
+        if ((ssl_sockets[n]) && (ssl_sockets[n]->hs_state != SSL_HS_NONE)) ssl_sockets[n]->hs_abort = true;
+    }
+    xSemaphoreGive(sock_mutex);
+
+    if (socket_task_handle) {
+        xTaskNotify(socket_task_handle, 0xA55A0000 , eSetBits);
+        socket_monitor_wakeup();
+    }
+    if (ssl_task_handle) xTaskNotify(ssl_task_handle, 0xA55A0000 , eSetBits);
+
+    int wait_time = 0;
+    while ((socket_task_handle) || (ssl_task_handle)) {
+        if (wait_time >= SOCKET_TASKS_STOP_WAIT) {
+            ESP_LOGE(SOCK_TAG, "Socket tasks not terminated (%s%s)", (socket_task_handle) ? "SOCK " : "", (ssl_task_handle) ? "SSL" : "");
+            return false;
+        }
+        // a status or file request queued by the stopping task is not executed anymore
+        file_request_abort();
+        vTaskDelay(pdMS_TO_TICKS(10));
+        wait_time += 10;
+    }
+
+    // No other task uses the sockets now
+    xSemaphoreTake(sock_mutex, 100000);
+    for (int i=0; i<CONFIG_LWIP_MAX_SOCKETS; i++) {
+        if ((opened_sockets[i].fd >= 0) && (!opened_sockets[i].ssl)) lwip_close(opened_sockets[i].fd);
+        opened_sockets[i].fd = -1;
+        opened_sockets[i].parrent = -1;
+        opened_sockets[i].connected = false;
+        opened_sockets[i].rdset = false;
+        opened_sockets[i].listening = false;
+        opened_sockets[i].ssl = false;
+    }
+    for (int n=0; n<CONFIG_LWIP_MAX_SOCKETS; n++) {
+        ssl_socket_release(n);
+    }
+    ssl_sockets_flush();
+    xSemaphoreGive(sock_mutex);
+    return true;
+}
+
 //--------------------------------------
 static int32_t process_socket_commands()
 {
@@ -485,6 +1160,7 @@ static int32_t process_socket_commands()
         esp_len = 0;
         return 0;
     }
+    uint16_t cmd = esp_cmdstat;
     xSemaphoreTake(sock_mutex, 100000);
     switch (esp_cmdstat) {
         case ESP_COMMAND_SCK_ADDRINFO: {
@@ -522,17 +1198,11 @@ static int32_t process_socket_commands()
 
             int fd = -1;
             if (ssl) {
-                // Find free SSL socket
+                // Find free SSL socket, the shared TLS configuration is used
                 for (int i=0; i<CONFIG_LWIP_MAX_SOCKETS; i++) {
                     if (ssl_sockets[i] == NULL) {
-                        ssl_socket_t *skt = pvPortMalloc(sizeof(ssl_socket_t));
-                        if (skt) {
-                            memset(skt, 0, sizeof(ssl_socket_t));
-                            ssl_sockets[i] = skt;
-                            ssl_sockets[i]->fd = i+SSL_SOCKET_FD_OFFSET;
-                            // Initialize mbedtls socket
-                            if (init_mbedtls_socket(ssl_sockets[i]) == 0) fd = i+SSL_SOCKET_FD_OFFSET;
-                        }
+                        ssl_sockets[i] = ssl_socket_new(i+SSL_SOCKET_FD_OFFSET);
+                        if (ssl_sockets[i]) fd = i+SSL_SOCKET_FD_OFFSET;
                         break;
                     }
                 }
@@ -552,6 +1222,7 @@ static int32_t process_socket_commands()
                     if (opened_sockets[i].fd < 0) {
                         opened_sockets[i].fd = fd;
                         opened_sockets[i].parrent = -1;
+                        opened_sockets[i].open_seq++;
                         opened_sockets[i].ssl = (fd >= SSL_SOCKET_FD_OFFSET);
                         opened_sockets[i].rdset = false;
                         opened_sockets[i].listening = false;
@@ -577,10 +1248,13 @@ static int32_t process_socket_commands()
                 int n = fd - SSL_SOCKET_FD_OFFSET;
                 if ((n < CONFIG_LWIP_MAX_SOCKETS) && (ssl_sockets[n])) {
                     if (ssl_sockets[n]->fd == fd) {
+                        if (ssl_sockets[n]->hs_state != SSL_HS_NONE) {
+                            // handshake running, the socket is released by SSL_task
+                            ssl_sockets[n]->fd = -1;
+                            ssl_sockets[n]->hs_abort = true;
+                        }
                         // close SSL socket
-                        close_mbedtls_socket(ssl_sockets[n]);
-                        free(ssl_sockets[n]);
-                        ssl_sockets[n] = NULL;
+                        else ssl_socket_release(n);
                         ret = 0;
                     }
                 }
@@ -615,7 +1289,7 @@ static int32_t process_socket_commands()
                 int n = fd - SSL_SOCKET_FD_OFFSET;
                 fd = -1;
                 if ((n < CONFIG_LWIP_MAX_SOCKETS) && (ssl_sockets[n])) {
-                    if (ssl_sockets[n]->fd == fd) {
+                    if ((ssl_sockets[n]->fd == fd) && (ssl_sockets[n]->hs_state == SSL_HS_NONE)) {
                         fd = ssl_sockets[n]->client_fd.fd;
                     }
                 }
@@ -657,20 +1331,19 @@ static int32_t process_socket_commands()
 
             int errcode = 0;
             int ret = -1;
+            bool in_progress = false;
             CHECK_ERROR_CODE(esp_task_wdt_reset(), ESP_OK);
 
             // Check if this is SSL socket
             if ((fd >= SSL_SOCKET_FD_OFFSET)) {
                 int n = fd - SSL_SOCKET_FD_OFFSET;
                 if ((n < CONFIG_LWIP_MAX_SOCKETS) && (ssl_sockets[n])) {
-                    if (ssl_sockets[n]->fd == fd) {
-                        // Connect SSL socket
-                        ret = connect_mbedtls_socket(host_str, port, ssl_sockets[n], SOCKET_CONNECT_TIMEOUT);
-                        if (ret != 0) {
-                            // close SSL socket
-                            close_mbedtls_socket(ssl_sockets[n]);
-                            free(ssl_sockets[n]);
-                            ssl_sockets[n] = NULL;
+                    if ((ssl_sockets[n]->fd == fd) && (ssl_sockets[n]->hs_state == SSL_HS_NONE)) {
+                        // Connect SSL socket, executed by SSL_task
+                        if (ssl_handshake_start(n, SSL_HS_CONNECT, host_str, port) == 0) {
+                            if (k210_info.features & K210_INFO_ASYNCSSL) in_progress = true;
+                            else if (ssl_handshake_wait(n) == 0) ret = 0;
+                            else ssl_socket_release(n);
                         }
                     }
                 }
@@ -706,7 +1379,7 @@ static int32_t process_socket_commands()
                 }
                 else ret = -1;
             }
-            errcode = errno;
+            errcode = (in_progress) ? EINPROGRESS : errno;
             if (ret >= 0) {
                 // Mark as connected in opened sockets list
                 for (int i=0; i<CONFIG_LWIP_MAX_SOCKETS; i++) {
@@ -737,14 +1410,12 @@ static int32_t process_socket_commands()
             if ((fd >= SSL_SOCKET_FD_OFFSET)) {
                 int n = fd - SSL_SOCKET_FD_OFFSET;
                 if ((n < CONFIG_LWIP_MAX_SOCKETS) && (ssl_sockets[n])) {
-                    if (ssl_sockets[n]->fd == fd) {
+                    if ((ssl_sockets[n]->fd == fd) && (ssl_sockets[n]->hs_state == SSL_HS_NONE)) {
                         // Bind SSL socket
                         ret = bind_mbedtls_socket(host_str, port, ssl_sockets[n]);
                         if (ret != 0) {
                             // close SSL socket
-                            close_mbedtls_socket(ssl_sockets[n]);
-                            free(ssl_sockets[n]);
-                            ssl_sockets[n] = NULL;
+                            ssl_socket_release(n);
                         }
                     }
                 }
@@ -824,7 +1495,7 @@ static int32_t process_socket_commands()
                 int n = fd - SSL_SOCKET_FD_OFFSET;
                 ret = -1;
                 if ((n < CONFIG_LWIP_MAX_SOCKETS) && (ssl_sockets[n])) {
-                    if (ssl_sockets[n]->fd == fd) {
+                    if ((ssl_sockets[n]->fd == fd) && (ssl_sockets[n]->hs_state == SSL_HS_NONE)) {
                         sock = ssl_sockets[n];
                         mbedtls_net_set_nonblock(&sock->client_fd);
                         ret = 0;
@@ -837,9 +1508,15 @@ static int32_t process_socket_commands()
                     // Check if this is SSL socket
                     if (sock) {
                         // Accept on SSL socket
-                        int ret = accept_mbedtls_socket(ssl_sockets[n], (unsigned char *)remote_ip, 16, &cliip_len);
+                        int ret = accept_mbedtls_socket(sock, (unsigned char *)remote_ip, 16, &cliip_len);
                         if (ret > 0) {
                             new_fd = ret;
+                            if (k210_info.features & K210_INFO_ASYNCSSL) errcode = EINPROGRESS;
+                            else if (ssl_handshake_wait(new_fd - SSL_SOCKET_FD_OFFSET) != 0) {
+                                ssl_socket_release(new_fd - SSL_SOCKET_FD_OFFSET);
+                                errcode = ECONNABORTED;
+                                new_fd = -1;
+                            }
                             break;
                         }
                         else if (ret != MBEDTLS_ERR_SSL_WANT_READ) {
@@ -881,10 +1558,12 @@ static int32_t process_socket_commands()
                     if (opened_sockets[i].fd < 0) {
                         opened_sockets[i].fd = new_fd;
                         opened_sockets[i].parrent = fd;
+                        opened_sockets[i].open_seq++;
                         opened_sockets[i].ssl = (new_fd >= SSL_SOCKET_FD_OFFSET);
                         opened_sockets[i].rdset = false;
                         opened_sockets[i].listening = false;
-                        opened_sockets[i].connected = true;
+                        // SSL socket is connected when the handshake is done
+                        opened_sockets[i].connected = ((new_fd < SSL_SOCKET_FD_OFFSET) || ((k210_info.features & K210_INFO_ASYNCSSL) == 0));
                         break;
                     }
                 }
@@ -924,7 +1603,7 @@ static int32_t process_socket_commands()
                 int n = fd - SSL_SOCKET_FD_OFFSET;
                 ret = -1;
                 if ((n < CONFIG_LWIP_MAX_SOCKETS) && (ssl_sockets[n])) {
-                    if (ssl_sockets[n]->fd == fd) {
+                    if ((ssl_sockets[n]->fd == fd) && (ssl_sockets[n]->hs_state == SSL_HS_NONE)) {
                         sock = ssl_sockets[n];
                         mbedtls_net_set_nonblock(&sock->client_fd);
                         ret = 0;
@@ -976,7 +1655,7 @@ static int32_t process_socket_commands()
                 if (sentlen == 0) errcode = ETIMEDOUT;
             }
 
-            if (debug_log >= 1) ESP_LOGI(SOCK_TAG, "Sent %d (err=%d, n=%d, time=%llu)", sentlen, errcode, n, esp_timer_get_time() - wait_start);
+            if (debug_log >= 1) ESP_LOGI(SOCK_TAG, "Sent %d (err=%d, n=%d, time=%" PRIu64 ")", sentlen, errcode, n, esp_timer_get_time() - wait_start);
             *((int32_t *)(SPI_RW_BUFFER+4)) = sentlen;
             *((int32_t *)(SPI_RW_BUFFER+8)) = errcode;
             esp_len = 8;
@@ -1005,7 +1684,7 @@ static int32_t process_socket_commands()
                 int n = fd - SSL_SOCKET_FD_OFFSET;
                 ret = -1;
                 if ((n < CONFIG_LWIP_MAX_SOCKETS) && (ssl_sockets[n])) {
-                    if (ssl_sockets[n]->fd == fd) {
+                    if ((ssl_sockets[n]->fd == fd) && (ssl_sockets[n]->hs_state == SSL_HS_NONE)) {
                         sock = ssl_sockets[n];
                         mbedtls_net_set_nonblock(&sock->client_fd);
                         ret = 0;
@@ -1077,7 +1756,7 @@ static int32_t process_socket_commands()
                 }
             }
 
-            if (debug_log >= 1) ESP_LOGI(SOCK_TAG, "RECEIVED %d [%d] (err=%d, closed=%d, n=%d, time=%llu)",
+            if (debug_log >= 1) ESP_LOGI(SOCK_TAG, "RECEIVED %d [%d] (err=%d, closed=%d, n=%d, time=%" PRIu64 ")",
                     ret, recv_len, errcode, peer_closed, n, esp_timer_get_time() - wait_start);
 
             *((int32_t *)(SPI_RW_BUFFER+4)) = ret; // received data length (> 0) or error (<= 0)
@@ -1114,7 +1793,7 @@ static int32_t process_socket_commands()
                 int n = fd - SSL_SOCKET_FD_OFFSET;
                 ret = -1;
                 if ((n < CONFIG_LWIP_MAX_SOCKETS) && (ssl_sockets[n])) {
-                    if (ssl_sockets[n]->fd == fd) {
+                    if ((ssl_sockets[n]->fd == fd) && (ssl_sockets[n]->hs_state == SSL_HS_NONE)) {
                         sock = ssl_sockets[n];
                         ret = 0;
                     }
@@ -1208,7 +1887,7 @@ static int32_t process_socket_commands()
                 }
             }
 
-            if (debug_log >= 1) ESP_LOGI(SOCK_TAG, "Received %d (err=%d, closed=%d, n=%d, time=%llu)",
+            if (debug_log >= 1) ESP_LOGI(SOCK_TAG, "Received %d (err=%d, closed=%d, n=%d, time=%" PRIu64 ")",
                     ret, errcode, peer_closed, n, esp_timer_get_time() - wait_start);
             *((int32_t *)(SPI_RW_BUFFER+4)) = ret; // received data length (>= 0) or error (< 0)
             *((int32_t *)(SPI_RW_BUFFER+8)) = errcode;
@@ -1235,7 +1914,7 @@ static int32_t process_socket_commands()
                 int n = fd - SSL_SOCKET_FD_OFFSET;
                 fd = -1;
                 if ((n < CONFIG_LWIP_MAX_SOCKETS) && (ssl_sockets[n])) {
-                    if (ssl_sockets[n]->fd == fd) {
+                    if ((ssl_sockets[n]->fd == fd) && (ssl_sockets[n]->hs_state == SSL_HS_NONE)) {
                         fd = ssl_sockets[n]->client_fd.fd;
                     }
                 }
@@ -1297,10 +1976,144 @@ static int32_t process_socket_commands()
         }
     }
     xSemaphoreGive(sock_mutex);
+    if ((cmd == ESP_COMMAND_SCK_CONNECT) || (cmd == ESP_COMMAND_SCK_ACCEPT) || (cmd == ESP_COMMAND_SCK_CLOSE) ||
+        (cmd == ESP_COMMAND_SCK_RECV) || (cmd == ESP_COMMAND_SCK_RDLINE)) {
+        // the set of monitored sockets may have changed
+        socket_monitor_wakeup();
+    }
     ets_delay_us(50);
     return 0;
 }
 
+/*
+ * Batch command (ESP_COMMAND_BATCH)
+ * ---------------------------------------------------------------
+ * Executes several commands received in one frame, in order.
+ * Request data:  sequence of sub-commands
+ *                [command (uint16)][length (uint16)][data (length bytes)]
+ * Response data: sequence of sub-command responses
+ *                [cmdstat (uint16)][length (uint16)][data (length bytes)]
+ * Commands which perform their own SPI transfers or don't return
+ * (RQGET, DEEPSLEEP, BATCH) are not allowed in a batch and return
+ * ESP_ERROR_COMMAND_UNKNOWN status with the sub-command id.
+ * The data received from a socket is lost if it doesn't fit in the
+ * response: SCK_RECV receives at most what fits in the remaining room,
+ * SCK_RDLINE, whose length can't be limited, is not allowed.
+ * The response is built in a spare frame buffer from the pool, which
+ * becomes the active frame buffer; the request is copied to its end and
+ * each sub-command is executed in the active frame buffer as if it was
+ * received alone. If no spare frame buffer can be allocated, the response
+ * is built in a heap buffer and copied to the active frame buffer at the
+ * end. The sub-command responses and the not yet executed sub-commands
+ * must fit in one frame together.
+ * ---------------------------------------------------------------
+ */
+//------------------------------------
+static int32_t process_batch_command()
+{
+    uint16_t batch_len = esp_len;
+    uint16_t resp_len = 0;
+    uint16_t max_len = spi_master_buffer_size - 64;
+    uint16_t idx = 0;
+    int n_cmds = 0;
+    int32_t res = 0;
+
+    uint8_t *resp_frame = spi_frame_get(0);
+    if (resp_frame == NULL) {
+        // the previous response may still be in flight
+        transferDataWait();
+        resp_frame = spi_frame_get(0);
+    }
+    uint8_t *heap_buf = NULL;
+    uint8_t *response;
+    if (resp_frame) response = resp_frame + DUMMY_BYTES + 4;
+    else {
+        // no spare frame buffer in low memory, the response needs no DMA capable memory until it is sent
+        heap_buf = malloc(max_len);
+        if (heap_buf == NULL) {
+            if (debug_log >= 1) ESP_LOGW(SPI_TAG, "Batch: no free buffer");
+            esp_cmdstat = ESP_COMMAND_BATCH | ESP_ERROR_PROCESS;
+            esp_len = 0;
+            return 0;
+        }
+        response = heap_buf;
+    }
+    uint8_t *request = response + max_len - batch_len;
+    memcpy(request, SPI_RW_BUFFER+4, batch_len);
+
+    while ((idx + 4) <= batch_len) {
+        uint16_t sub_cmd = *((uint16_t *)(request+idx)) & 0x00FF;
+        uint16_t sub_len = *((uint16_t *)(request+idx+2));
+        if ((idx + 4 + sub_len) > batch_len) break;
+
+        // Place the sub-command into the frame buffer as if it was received alone
+        esp_cmdstat = sub_cmd;
+        esp_len = sub_len;
+        *((uint16_t *)(SPI_RW_BUFFER)) = sub_cmd;
+        *((uint16_t *)(SPI_RW_BUFFER+2)) = sub_len;
+        memcpy(SPI_RW_BUFFER+4, request+idx+4, sub_len);
+        idx += 4 + sub_len;
+        n_cmds++;
+
+        // the responses must not overwrite the remaining sub-commands at the end of the frame
+        uint16_t room = max_len - (batch_len - idx);
+
+        if ((sub_cmd == ESP_COMMAND_RQGET) || (sub_cmd == ESP_COMMAND_DEEPSLEEP) || (sub_cmd == ESP_COMMAND_BATCH) ||
+            (sub_cmd == ESP_COMMAND_SCK_RDLINE)) {
+            if (debug_log >= 1) ESP_LOGW(SPI_TAG, "Batch: command not allowed (%d)", sub_cmd);
+            esp_cmdstat = sub_cmd | ESP_ERROR_COMMAND_UNKNOWN;
+            esp_len = 0;
+        }
+        else if (sub_cmd == ESP_COMMAND_SCK_RECV) {
+            // receive only as much as fits after the response header, the peer address and the previous responses
+            int fit = (int)room - (int)resp_len - (4 + 9);
+            if (SPI_RW_BUFFER[16]) fit -= sizeof(struct sockaddr);
+            if (fit <= 0) {
+                esp_cmdstat = sub_cmd | ESP_ERROR_LENGTH;
+                esp_len = 0;
+            }
+            else {
+                if (*((int32_t *)(SPI_RW_BUFFER+8)) > fit) *((int32_t *)(SPI_RW_BUFFER+8)) = fit;
+                res = processCommand();
+            }
+        }
+        else res = processCommand();
+
+        if ((resp_len + 4 + esp_len) > room) {
+            // no room for the sub-command response data
+            esp_cmdstat |= ESP_ERROR_LENGTH;
+            esp_len = 0;
+        }
+        if ((resp_len + 4) > room) break;
+        *((uint16_t *)(response+resp_len)) = esp_cmdstat;
+        *((uint16_t *)(response+resp_len+2)) = esp_len;
+        memcpy(response+resp_len+4, SPI_RW_BUFFER+4, esp_len);
+        resp_len += 4 + esp_len;
+        if (res != 0) {
+            // the command requested the SPI task exit, the rest of the batch is not executed
+            if (debug_log >= 1) ESP_LOGW(SPI_TAG, "Batch: command %d requested exit (%d)", sub_cmd, res);
+            break;
+        }
+    }
+
+    if (idx != batch_len) {
+        if (debug_log >= 1) ESP_LOGW(SPI_TAG, "Batch: processed %u of %u bytes", idx, batch_len);
+        esp_cmdstat = ESP_COMMAND_BATCH | ESP_ERROR_FRAME;
+    }
+    else esp_cmdstat = ESP_COMMAND_BATCH;
+    esp_len = resp_len;
+    if (resp_frame) {
+        // the response frame becomes the active frame buffer, the request frame returns to the pool
+        spi_buffer_set(resp_frame);
+    }
+    else {
+        memcpy(SPI_RW_BUFFER+4, response, resp_len);
+        free(heap_buf);
+    }
+    if (debug_log >= 2) ESP_LOGI(SPI_TAG, "Batch: %d commands, response length=%u", n_cmds, resp_len);
+    return res;
+}
+
 //======================
 int32_t processCommand()
 {
@@ -1324,6 +2137,10 @@ int32_t processCommand()
             esp_len = sizeof(time_t);
             break;
         }
+        case ESP_COMMAND_BATCH: {
+            if (debug_log >= 1) ESP_LOGI(SPI_TAG, "Command: BATCH, len=%u", esp_len);
+            return process_batch_command();
+        }
         case ESP_COMMAND_GETVER: {
             if (debug_log >= 1) ESP_LOGI(SPI_TAG, "Command: GET VERSION");
             uint32_t ver = VERSION_NUM;
@@ -1485,6 +2302,20 @@ int32_t processCommand()
             esp_len = strlen(pbuff);
             break;
         }
+        case ESP_COMMAND_GETSTATS: {
+            if (debug_log >= 1) ESP_LOGI(SPI_TAG, "Command: Get link statistics");
+            bool reset = ((esp_len > 0) && (SPI_RW_BUFFER[4] != 0));
+            int len = link_stats_get(SPI_RW_BUFFER+4, spi_master_buffer_size-64);
+            if (len < 0) {
+                esp_cmdstat |= ESP_ERROR_PROCESS;
+                esp_len = 0;
+            }
+            else {
+                esp_len = len;
+                if (reset) link_stats_reset();
+            }
+            break;
+        }
         case ESP_COMMAND_WIFIINIT: {
             if (debug_log >= 1) ESP_LOGI(SPI_TAG, "Command: WiFi init");
             if (!wifi_is_init) {
@@ -1523,6 +2354,11 @@ int32_t processCommand()
             if (wifi_is_init) {
                 wifi_deinit_sta_ap();
             }
+            // saved TLS sessions and resolved addresses are not valid on another network
+            xSemaphoreTake(sock_mutex, 100000);
+            ssl_sockets_flush();
+            xSemaphoreGive(sock_mutex);
+            dns_cache_flush();
             esp_len = 0;
             break;
         }
@@ -1596,7 +2432,46 @@ int32_t processCommand()
  * --------------------------------------------------------------
  */
 
-file_params_t file_func_params;
+file_params_t file_func_params;     // parameters of the request executed by the SPI task
+static bool listdir_legacy = false;    // K210 does not support ESP_COMMAND_FLISTDIRP
+
+/*
+ * File request queue
+ * --------------------------------------------------------------
+ * The K210 file requests are executed by the SPI task, other tasks queue them:
+ * - each request takes one of FILE_RQ_SLOTS request slots holding the request parameters,
+ *   the results and the completion semaphore, so several tasks (http server handlers, OTA,
+ *   file pipe) can have file requests pending at the same time
+ * - the caller waits for a free slot only if all slots are in use
+ * - the slot index is queued to the SPI task ('file_rq_queue') and the task is notified
+ *   with SPI_NOTIFY_FILE_RQ, the SPI task executes the queued requests in order and
+ *   gives the completion semaphore of each request
+ * - each request gets a tag (slot index + FILE_RQ_SLOTS * slot use count) shown in the log
+ * - when the SPI task exits the queue is closed ('file_rq_closed'), the queued requests
+ *   are completed with ESP_FILEERR_NOTCONNECTED and no new request is queued until the
+ *   SPI task is started again; 'file_rq_mutex' makes closing and queuing atomic
+ * The requests are executed one at a time, the K210 file protocol has no batch request,
+ * the file requests and the K210 requests are interleaved by the SPI task.
+ * --------------------------------------------------------------
+ */
+
+#define FILE_RQ_SLOTS   8
+
+typedef struct _file_request_t
+{
+    uint32_t          tag;
+    uint8_t           cmd;
+    file_params_t     params;
+    SemaphoreHandle_t done;
+} file_request_t;
+
+static file_request_t file_rq[FILE_RQ_SLOTS] = {0};
+static QueueHandle_t file_rq_free = NULL;      // indexes of the free slots
+static QueueHandle_t file_rq_queue = NULL;     // indexes of the slots waiting for execution
+static SemaphoreHandle_t file_rq_mutex = NULL; // protects 'file_rq_closed' and queuing
+static bool file_rq_closed = true;             // SPI task not running, requests are not queued
+
+static int file_request(uint8_t cmd, file_params_t *params);
 
 //----------------------------------------------
 static bool _filecmd_send_get(int size, bool eq)
@@ -1605,6 +2480,8 @@ static bool _filecmd_send_get(int size, bool eq)
     debug_log = 0; // disable logging during file requests
     uint8_t ntry = 3;
     int ret = ESP_FILEERR_RQSEND;
+    uint8_t cmd = esp_cmdstat & 0xff;
+    uint64_t tstart = esp_timer_get_time();
 
     // ===> Send file request to K210
 start:
@@ -1614,9 +2491,16 @@ start:
         ret = k210_wait_handshake();
         if (ret == ESP_OK) {
             // <=== Get file request response data
-            ret = transferData(SLAVE_CMD_READ, SLAVE_BUFFER_CMD_ADDRESS, size+8, NULL);
+            bool frame_ok;
+            uint32_t rdsize = size+8;
+            if ((k210_info.features & K210_INFO_LZ) && (size >= SPI_LZ_MIN_LENGTH) && (getCommand(0) == ESP_ERROR_OK)) {
+                // the response can be compressed, only the frame length is read
+                uint16_t flen = *((uint16_t *)(SPI_RW_BUFFER+2)) & ~ESP_FRAME_LZ;
+                if (flen <= size) rdsize = flen+8;
+            }
+            ret = readFrame(SLAVE_CMD_READ, rdsize, &frame_ok);
             if (ret == ESP_OK) {
-                if (command_frame_check()) {
+                if (frame_ok) {
                     // received frame (length & crc) ok
                     bool f = false;
                     if (eq) f = (esp_len == size);
@@ -1644,6 +2528,9 @@ start:
 
     file_func_params.result = ret;
     debug_log = dbglog;
+    link_stats_count(LINK_STAT_FILE_REQUESTS);
+    if (ret == 0) link_stats_command(cmd, (uint32_t)(esp_timer_get_time() - tstart));
+    else link_stats_count(LINK_STAT_FILE_ERRORS);
     return (ret == 0);
 }
 
@@ -1672,7 +2559,8 @@ static void _k210_file_read()
     size_t size = file_func_params.size;
     void *dst = file_func_params.spar;
 
-    if (size > spi_master_buffer_size) size = spi_master_buffer_size;
+    // the response frame must pass 'command_frame_check()'
+    if (size > K210_FILE_READ_MAX) size = K210_FILE_READ_MAX;
     // Send request to K210
     memcpy(SPI_RW_BUFFER+4, (uint8_t *)&fd, 4);
     memcpy(SPI_RW_BUFFER+8, (uint8_t *)&size, 4);
@@ -1694,8 +2582,12 @@ static void _k210_file_write()
 
     int wrlen = -1;
     // Send request to K210
+    if (file_func_params.dst) {
+        // the data is already in the frame buffer taken from the pool, the frame is sent as it is
+        spi_buffer_set((uint8_t *)file_func_params.dst);
+    }
+    else memcpy(SPI_RW_BUFFER+8, (uint8_t *)data, size);
     memcpy(SPI_RW_BUFFER+4, (uint8_t *)&fd, 4);
-    memcpy(SPI_RW_BUFFER+8, (uint8_t *)data, size);
     esp_len = size + 4;
     esp_cmdstat = ESP_COMMAND_FWRITE;
 
@@ -1721,6 +2613,26 @@ static void _k210_file_close()
     }
 }
 
+//----------------------------
+static void _k210_file_lseek()
+{
+    int fd = file_func_params.par1;
+    int whence = file_func_params.par2;
+    int32_t offset = (int32_t)file_func_params.size;
+    int32_t pos = -1;
+    // Send request to K210
+    memcpy(SPI_RW_BUFFER+4, (uint8_t *)&fd, 4);
+    memcpy(SPI_RW_BUFFER+8, (uint8_t *)&offset, 4);
+    memcpy(SPI_RW_BUFFER+12, (uint8_t *)&whence, 4);
+    esp_len = 12;
+    esp_cmdstat = ESP_COMMAND_FSEEK;
+
+    if (_filecmd_send_get(4, true)) {
+        memcpy(&pos, SPI_RW_BUFFER+4, 4);
+        file_func_params.result = pos;
+    }
+}
+
 //----------------------------
 static void _k210_file_fstat()
 {
@@ -1728,7 +2640,7 @@ static void _k210_file_fstat()
     k210_fstat_t *st = file_func_params.st;
 
     // Send request to K210
-    memcpy(SPI_RW_BUFFER+4, (uint8_t *)fd, 4);
+    memcpy(SPI_RW_BUFFER+4, (uint8_t *)&fd, 4);
     esp_len = 4;
     esp_cmdstat = ESP_COMMAND_FSTAT;
 
@@ -1784,6 +2696,7 @@ static void _k210_file_listdir()
 
     *listres = NULL;
     int ret, res = -1;
+    uint64_t tstart = esp_timer_get_time();
     // ===> Send dir list request to K210
     memcpy(SPI_RW_BUFFER+4, path, strlen(path));
     esp_len = strlen(path);
@@ -1795,13 +2708,14 @@ static void _k210_file_listdir()
         if (ret == ESP_OK) {
             // Get result size descriptor
             if (getCommand(0) == ESP_ERROR_OK) {
-                esp_len = *((uint16_t *)(SPI_RW_BUFFER+2));
+                esp_len = *((uint16_t *)(SPI_RW_BUFFER+2)) & ~ESP_FRAME_LZ;
                 if ((esp_len >= 2) && (esp_len <= (spi_master_buffer_size-32))) {
                     // <=== read dir list data from K210
                     ets_delay_us(250);
-                    ret = transferData(SLAVE_CMD_READ | SLAVE_CMD_OPT_CRC, SLAVE_BUFFER_CMD_ADDRESS, esp_len+8, NULL);
+                    bool frame_ok;
+                    ret = readFrame(SLAVE_CMD_READ | SLAVE_CMD_OPT_CRC, esp_len+8, &frame_ok);
                     if (ret == ESP_OK) {
-                        if (command_frame_check()) {
+                        if (frame_ok) {
                             if ((esp_cmdstat == ESP_COMMAND_FRESPONSE) && (esp_len >= 2)) {
                                 int16_t n_entries = *((int16_t *)(SPI_RW_BUFFER+4));
                                 if (n_entries > 0) {
@@ -1830,6 +2744,55 @@ static void _k210_file_listdir()
     else res = ESP_FILEERR_RQSEND;
 
     file_func_params.result = res;
+    link_stats_count(LINK_STAT_FILE_REQUESTS);
+    if (res >= 0) link_stats_command(ESP_COMMAND_FLISTDIR, (uint32_t)(esp_timer_get_time() - tstart));
+    else link_stats_count(LINK_STAT_FILE_ERRORS);
+}
+
+/*
+   Paged directory list request:
+   | uint32_t | uint32_t | path string |
+   | cursor   | max_len  |             |
+
+   response:
+   | int16_t | uint32_t    |           |     |
+   | result  | next_cursor | dir_entry | ... |
+
+   dir_entries are in the same format as in the full list, at most 'max_len' bytes of them.
+   The first request is sent with cursor 0, 'next_cursor' is opaque to ESP32 and is sent
+   back unchanged to get the next page, 0 means there are no more entries.
+   'result' is -1 if the directory does not exist or number of dir_entries in the page
+*/
+//-----------------------------------
+static void _k210_file_listdir_page()
+{
+    const char *path = (const char *)file_func_params.spar;
+    uint32_t cursor = file_func_params.cursor;
+    uint32_t size = file_func_params.size;
+    int16_t n_entries;
+
+    if (size > (K210_FILE_READ_MAX-6)) size = K210_FILE_READ_MAX-6;
+    // Send request to K210
+    memcpy(SPI_RW_BUFFER+4, &cursor, 4);
+    memcpy(SPI_RW_BUFFER+8, &size, 4);
+    memcpy(SPI_RW_BUFFER+12, path, strlen(path));
+    esp_len = strlen(path) + 8;
+    esp_cmdstat = ESP_COMMAND_FLISTDIRP;
+
+    if (_filecmd_send_get(size+6, false)) {
+        if (esp_len >= 6) {
+            memcpy(&n_entries, SPI_RW_BUFFER+4, 2);
+            memcpy(&cursor, SPI_RW_BUFFER+6, 4);
+            if (n_entries >= 0) {
+                memcpy(file_func_params.dst, SPI_RW_BUFFER+10, esp_len-6);
+                file_func_params.size = esp_len-6;
+                file_func_params.cursor = cursor;
+                file_func_params.result = n_entries;
+            }
+            else file_func_params.result = -1;
+        }
+        else file_func_params.result = ESP_FILEERR_SIZE1;
+    }
 }
 
 //-----------------------------
@@ -1874,16 +2837,11 @@ int k210_file_open(const char *path, int flags)
 {
     if ((spi_task_handle == NULL) || (!k210_slave_connected)) return ESP_FILEERR_NOTCONNECTED;
 
-    file_func_params.par1 = flags;
-    file_func_params.spar = (void *)path;
+    file_params_t params = {0};
+    params.par1 = flags;
+    params.spar = (void *)path;
 
-    if (xTaskGetCurrentTaskHandle() == spi_task_handle) _k210_file_open();
-    else {
-        xTaskNotify(spi_task_handle, ESP_COMMAND_FOPEN, eSetBits);
-        // Wait until the command is processed
-        xSemaphoreTake(func_semaphore, portMAX_DELAY);
-    }
-    return file_func_params.result;
+    return file_request(ESP_COMMAND_FOPEN, &params);
 }
 
 //------------------------------------------------
@@ -1891,17 +2849,12 @@ int k210_file_read(int fd, void *dst, size_t size)
 {
     if ((spi_task_handle == NULL) || (!k210_slave_connected)) return ESP_FILEERR_NOTCONNECTED;
 
-    file_func_params.par1 = fd;
-    file_func_params.size = size;
-    file_func_params.spar = dst;
+    file_params_t params = {0};
+    params.par1 = fd;
+    params.size = size;
+    params.spar = dst;
 
-    if (xTaskGetCurrentTaskHandle() == spi_task_handle) _k210_file_read();
-    else {
-        xTaskNotify(spi_task_handle, ESP_COMMAND_FREAD, eSetBits);
-        // Wait until the command is processed
-        xSemaphoreTake(func_semaphore, portMAX_DELAY);
-    }
-    return file_func_params.result;
+    return file_request(ESP_COMMAND_FREAD, &params);
 }
 
 //--------------------------------------------------------
@@ -1910,17 +2863,30 @@ int k210_file_write(int fd, const void *data, size_t size)
     if ((spi_task_handle == NULL) || (!k210_slave_connected)) return ESP_FILEERR_NOTCONNECTED;
     if (size > spi_master_buffer_size) return ESP_FILEERR_SIZE;
 
-    file_func_params.par1 = fd;
-    file_func_params.size = size;
-    file_func_params.spar = (void *)data;
+    file_params_t params = {0};
+    params.par1 = fd;
+    params.size = size;
+    params.spar = (void *)data;
 
-    if (xTaskGetCurrentTaskHandle() == spi_task_handle) _k210_file_write();
-    else {
-        xTaskNotify(spi_task_handle, ESP_COMMAND_FWRITE, eSetBits);
-        // Wait until the command is processed
-        xSemaphoreTake(func_semaphore, portMAX_DELAY);
+    return file_request(ESP_COMMAND_FWRITE, &params);
+}
+
+// Write the data placed at 'K210_FILE_WRITE_OFFSET' in the frame buffer taken from the pool
+// ('spi_frame_get()'), the frame is passed to the SPI task and must not be used after the call
+//------------------------------------------------------------
+int k210_file_write_frame(int fd, uint8_t *frame, size_t size)
+{
+    if ((spi_task_handle == NULL) || (!k210_slave_connected) || (size > K210_FILE_READ_MAX)) {
+        spi_frame_put(frame);
+        return (size > K210_FILE_READ_MAX) ? ESP_FILEERR_SIZE : ESP_FILEERR_NOTCONNECTED;
     }
-    return file_func_params.result;
+
+    file_params_t params = {0};
+    params.par1 = fd;
+    params.size = size;
+    params.dst = frame;
+
+    return file_request(ESP_COMMAND_FWRITE, &params);
 }
 
 //-------------------------
@@ -1928,15 +2894,23 @@ int k210_file_close(int fd)
 {
     if ((spi_task_handle == NULL) || (!k210_slave_connected)) return ESP_FILEERR_NOTCONNECTED;
 
-    file_func_params.par1 = fd;
+    file_params_t params = {0};
+    params.par1 = fd;
 
-    if (xTaskGetCurrentTaskHandle() == spi_task_handle) _k210_file_close();
-    else {
-        xTaskNotify(spi_task_handle, ESP_COMMAND_FCLOSE, eSetBits);
-        // Wait until the command is processed
-        xSemaphoreTake(func_semaphore, portMAX_DELAY);
-    }
-    return file_func_params.result;
+    return file_request(ESP_COMMAND_FCLOSE, &params);
+}
+
+//-------------------------------------------------
+int k210_file_lseek(int fd, int offset, int whence)
+{
+    if ((spi_task_handle == NULL) || (!k210_slave_connected)) return ESP_FILEERR_NOTCONNECTED;
+
+    file_params_t params = {0};
+    params.par1 = fd;
+    params.par2 = whence;
+    params.size = (size_t)offset;
+
+    return file_request(ESP_COMMAND_FSEEK, &params);
 }
 
 //----------------------
@@ -1950,16 +2924,11 @@ int k210_file_fstat(int fd, k210_fstat_t *st)
 {
     if ((spi_task_handle == NULL) || (!k210_slave_connected)) return ESP_FILEERR_NOTCONNECTED;
 
-    file_func_params.par1 = fd;
-    file_func_params.st = st;
+    file_params_t params = {0};
+    params.par1 = fd;
+    params.st = st;
 
-    if (xTaskGetCurrentTaskHandle() == spi_task_handle) _k210_file_fstat();
-    else {
-        xTaskNotify(spi_task_handle, ESP_COMMAND_FSTAT, eSetBits);
-        // Wait until the command is processed
-        xSemaphoreTake(func_semaphore, portMAX_DELAY);
-    }
-    return file_func_params.result;
+    return file_request(ESP_COMMAND_FSTAT, &params);
 }
 
 //----------------------------------------------------
@@ -1967,16 +2936,11 @@ int k210_file_stat(const char *path, k210_fstat_t *st)
 {
     if ((spi_task_handle == NULL) || (!k210_slave_connected)) return ESP_FILEERR_NOTCONNECTED;
 
-    file_func_params.spar = (void *)path;
-    file_func_params.st = st;
+    file_params_t params = {0};
+    params.spar = (void *)path;
+    params.st = st;
 
-    if (xTaskGetCurrentTaskHandle() == spi_task_handle) _k210_file_stat();
-    else {
-        xTaskNotify(spi_task_handle, ESP_COMMAND_FFSTAT, eSetBits);
-        // Wait until the command is processed
-        xSemaphoreTake(func_semaphore, portMAX_DELAY);
-    }
-    return file_func_params.result;
+    return file_request(ESP_COMMAND_FFSTAT, &params);
 }
 
 //------------------------------------
@@ -1984,15 +2948,10 @@ int k210_file_remove(const char *path)
 {
     if ((spi_task_handle == NULL) || (!k210_slave_connected)) return ESP_FILEERR_NOTCONNECTED;
 
-    file_func_params.spar = (void *)path;
+    file_params_t params = {0};
+    params.spar = (void *)path;
 
-    if (xTaskGetCurrentTaskHandle() == spi_task_handle) _k210_file_remove();
-    else {
-        xTaskNotify(spi_task_handle, ESP_COMMAND_FREMOVE, eSetBits);
-        // Wait until the command is processed
-        xSemaphoreTake(func_semaphore, portMAX_DELAY);
-    }
-    return file_func_params.result;
+    return file_request(ESP_COMMAND_FREMOVE, &params);
 }
 
 //-----------------------------------
@@ -2000,32 +2959,109 @@ int k210_file_rmdir(const char *path)
 {
     if ((spi_task_handle == NULL) || (!k210_slave_connected)) return ESP_FILEERR_NOTCONNECTED;
 
-    file_func_params.spar = (void *)path;
+    file_params_t params = {0};
+    params.spar = (void *)path;
 
-    if (xTaskGetCurrentTaskHandle() == spi_task_handle) _k210_file_rmdir();
-    else {
-        xTaskNotify(spi_task_handle, ESP_COMMAND_FRMDIR, eSetBits);
-        // Wait until the command is processed
-        xSemaphoreTake(func_semaphore, portMAX_DELAY);
+    return file_request(ESP_COMMAND_FRMDIR, &params);
+}
+
+// Full directory list in a single frame, used with K210 firmware without paged listing
+//-------------------------------------------------------------------
+static int k210_file_listdir_legacy(const char *path, void **listres)
+{
+    file_params_t params = {0};
+    params.spar = (void *)path;
+    params.listres = listres;
+
+    return file_request(ESP_COMMAND_FLISTDIR, &params);
+}
+
+// Get one page of the directory list into 'buf', the entries are in 'k210_file_listdir()' format
+// '*cursor' must be 0 for the first page, on return it is set to the cursor of the next page,
+//   0 if there are no more entries
+// '*size' is the size of 'buf' on input and the size of the returned entries on output
+// Returns the number of entries in the page, -1 if the directory does not exist or a file error code
+// If K210 does not support the paged listing, the full list is returned as the only page
+//-------------------------------------------------------------------------------------
+int k210_file_listdir_page(const char *path, uint32_t *cursor, void *buf, size_t *size)
+{
+    if ((spi_task_handle == NULL) || (!k210_slave_connected)) return ESP_FILEERR_NOTCONNECTED;
+
+    int res;
+    if (!listdir_legacy) {
+        file_params_t params = {0};
+        params.spar = (void *)path;
+        params.cursor = *cursor;
+        params.dst = buf;
+        params.size = *size;
+
+        res = file_request(ESP_COMMAND_FLISTDIRP, &params);
+        if (res >= 0) {
+            *cursor = params.cursor;
+            *size = params.size;
+            return res;
+        }
+        // K210 firmware without paged listing does not respond to the first page request
+        if ((*cursor != 0) || ((res != ESP_FILEERR_HANDSHAKE) && (res != ESP_FILEERR_HANDSHAKE1) && (res != ESP_FILEERR_CMDRESP))) return res;
+    }
+    else if (*cursor != 0) return ESP_FILEERR_UNKNOWNCMD;
+
+    void *list = NULL;
+    res = k210_file_listdir_legacy(path, &list);
+    if (res < 0) return res;
+    if (!listdir_legacy) {
+        if (debug_log >= 1) ESP_LOGW(SPI_TAG, "K210 has no paged directory listing, using full listing");
+        listdir_legacy = true;
+    }
+    // get the list length
+    size_t len = 0;
+    for (int i=0; i<res; i++) {
+        len += strlen((char *)list + len + 9) + 10;
     }
-    return file_func_params.result;
+    if (len <= *size) {
+        if (len) memcpy(buf, list, len);
+        *size = len;
+        *cursor = 0;
+    }
+    else res = ESP_FILEERR_SIZE;
+    if (list) free(list);
+    return res;
 }
 
+// Get the complete directory list, '*listres' is allocated and must be freed by the caller
+// Returns the number of entries, -1 if the directory does not exist or a file error code
 //-----------------------------------------------------
 int k210_file_listdir(const char *path, void **listres)
 {
-    if ((spi_task_handle == NULL) || (!k210_slave_connected)) return ESP_FILEERR_NOTCONNECTED;
+    size_t page_size = K210_FILE_READ_MAX;
+    uint8_t *list = NULL;
+    size_t len = 0;
+    uint32_t cursor = 0;
+    int res, n_entries = 0;
 
-    file_func_params.spar = (void *)path;
-    file_func_params.listres = listres;
+    *listres = NULL;
+    do {
+        uint8_t *new_list = realloc(list, len + page_size);
+        if (new_list == NULL) {
+            if (list) free(list);
+            return 0;
+        }
+        list = new_list;
+        size_t size = page_size;
+        res = k210_file_listdir_page(path, &cursor, list + len, &size);
+        // a page without entries must end the listing
+        if ((res == 0) && (cursor != 0)) res = ESP_FILEERR_CMDRESP1;
+        if (res < 0) {
+            free(list);
+            return res;
+        }
+        n_entries += res;
+        len += size;
+    } while (cursor != 0);
 
-    if (xTaskGetCurrentTaskHandle() == spi_task_handle) _k210_file_listdir();
-    else {
-        xTaskNotify(spi_task_handle, ESP_COMMAND_FLISTDIR, eSetBits);
-        // Wait until the command is processed
-        xSemaphoreTake(func_semaphore, portMAX_DELAY);
-    }
-    return file_func_params.result;
+    if (n_entries > 0) *listres = list;
+    else free(list);
+    return n_entries;
 }
 
 //-----------------------------
@@ -2079,21 +3115,16 @@ int k210_status_send(int type, int val)
 {
     if ((spi_task_handle == NULL) || (!k210_slave_connected)) return ESP_FILEERR_NOTCONNECTED;
 
-    file_func_params.par1 = type;
-    file_func_params.par2 = val;
+    file_params_t params = {0};
+    params.par1 = type;
+    params.par2 = val;
 
-    if (xTaskGetCurrentTaskHandle() == spi_task_handle) _k210_status_send();
-    else {
-        if (debug_log >= 2) ESP_LOGI(SPI_TAG, "Send status scheduled...");
-        xTaskNotify(spi_task_handle, ESP_COMMAND_STAT_SEND, eSetBits);
-        // Wait until the command is processed
-        xSemaphoreTake(func_semaphore, portMAX_DELAY);
-    }
-    return file_func_params.result;
+    if ((debug_log >= 2) && (xTaskGetCurrentTaskHandle() != spi_task_handle)) ESP_LOGI(SPI_TAG, "Send status scheduled...");
+    return file_request(ESP_COMMAND_STAT_SEND, &params);
 }
 
-//--------------------------------------------
-void process_internal_request(uint8_t command)
+//-----------------------------------------------
+static void file_request_execute(uint8_t command)
 {
     // Execute requested command
     switch (command) {
@@ -2109,6 +3140,9 @@ void process_internal_request(uint8_t command)
         case ESP_COMMAND_FCLOSE:
             _k210_file_close();
             break;
+        case ESP_COMMAND_FSEEK:
+            _k210_file_lseek();
+            break;
         case ESP_COMMAND_FSTAT:
             _k210_file_fstat();
             break;
@@ -2118,6 +3152,9 @@ void process_internal_request(uint8_t command)
         case ESP_COMMAND_FLISTDIR:
             _k210_file_listdir();
             break;
+        case ESP_COMMAND_FLISTDIRP:
+            _k210_file_listdir_page();
+            break;
         case ESP_COMMAND_FREMOVE:
             _k210_file_remove();
             break;
@@ -2130,7 +3167,124 @@ void process_internal_request(uint8_t command)
         default:
             file_func_params.result = ESP_FILEERR_UNKNOWNCMD;
     }
+}
+
+// Execute the file request, called by the 'k210_file_*()' functions
+// From other tasks the request is queued to the SPI task and the caller waits for its completion,
+// the SPI task executes the request directly
+//---------------------------------------------------------
+static int file_request(uint8_t cmd, file_params_t *params)
+{
+    if (xTaskGetCurrentTaskHandle() == spi_task_handle) {
+        // the request can be issued while a queued request is executed
+        file_params_t saved_params = file_func_params;
+        file_func_params = *params;
+        file_request_execute(cmd);
+        *params = file_func_params;
+        file_func_params = saved_params;
+        return params->result;
+    }
+    if (file_rq_queue == NULL) return ESP_FILEERR_NOTCONNECTED;
+
+    // Get a free request slot, wait if all slots are in use
+    uint8_t slot;
+    xQueueReceive(file_rq_free, &slot, portMAX_DELAY);
+    file_request_t *rq = &file_rq[slot];
+    rq->tag += FILE_RQ_SLOTS;
+    rq->cmd = cmd;
+    rq->params = *params;
+    rq->params.result = ESP_FILEERR_NOTCONNECTED;
+
+    // The SPI task could exit after the caller has checked it is running
+    xSemaphoreTake(file_rq_mutex, portMAX_DELAY);
+    if (file_rq_closed) {
+        xSemaphoreGive(file_rq_mutex);
+        // the frame buffer passed with the request is returned to the pool
+        if ((cmd == ESP_COMMAND_FWRITE) && (params->dst)) spi_frame_put(params->dst);
+        xQueueSend(file_rq_free, &slot, portMAX_DELAY);
+        params->result = ESP_FILEERR_NOTCONNECTED;
+        return params->result;
+    }
+    // there is room in the queue for all slots
+    xQueueSend(file_rq_queue, &slot, 0);
+    xTaskNotify(spi_task_handle, SPI_NOTIFY_FILE_RQ, eSetBits);
+    xSemaphoreGive(file_rq_mutex);
+    // Wait until the request is processed
+    xSemaphoreTake(rq->done, portMAX_DELAY);
+
+    *params = rq->params;
+    xQueueSend(file_rq_free, &slot, portMAX_DELAY);
+    return params->result;
+}
+
+// Create the request slots and queues, the slots are kept when the SPI task is restarted
+// Called by the SPI task, the queue is opened for new requests
+//======================
+bool file_request_init()
+{
+    if (file_rq_queue != NULL) {
+        xSemaphoreTake(file_rq_mutex, portMAX_DELAY);
+        file_rq_closed = false;
+        xSemaphoreGive(file_rq_mutex);
+        return true;
+    }
 
-    // inform the calling function execution finished
-    xSemaphoreGive(func_semaphore);
+    if (file_rq_mutex == NULL) file_rq_mutex = xSemaphoreCreateMutex();
+    if (file_rq_mutex == NULL) return false;
+    file_rq_free = xQueueCreate(FILE_RQ_SLOTS, sizeof(uint8_t));
+    if (file_rq_free == NULL) return false;
+    for (uint8_t i=0; i<FILE_RQ_SLOTS; i++) {
+        if (file_rq[i].done == NULL) file_rq[i].done = xSemaphoreCreateBinary();
+        if (file_rq[i].done == NULL) {
+            vQueueDelete(file_rq_free);
+            file_rq_free = NULL;
+            return false;
+        }
+        file_rq[i].tag = i;
+        xQueueSend(file_rq_free, &i, 0);
+    }
+    file_rq_queue = xQueueCreate(FILE_RQ_SLOTS, sizeof(uint8_t));
+    if (file_rq_queue == NULL) {
+        vQueueDelete(file_rq_free);
+        file_rq_free = NULL;
+        return false;
+    }
+    file_rq_closed = false;
+    return true;
+}
+
+// Execute the queued file requests in the order they were queued (SPI task)
+// At most FILE_RQ_SLOTS requests are executed, so that a K210 request is not delayed
+// by a continuous stream of file requests, the task is notified again if more are queued
+//==========================
+void process_file_requests()
+{
+    uint8_t slot;
+    for (int n=0; n<FILE_RQ_SLOTS; n++) {
+        if (xQueueReceive(file_rq_queue, &slot, 0) != pdTRUE) return;
+        file_request_t *rq = &file_rq[slot];
+        file_func_params = rq->params;
+        file_request_execute(rq->cmd);
+        rq->params = file_func_params;
+        if (debug_log >= 3) ESP_LOGI(SPI_TAG, "File request %u (cmd %u): %d", rq->tag, rq->cmd, rq->params.result);
+        xSemaphoreGive(rq->done);
+    }
+    if (uxQueueMessagesWaiting(file_rq_queue) > 0) xTaskNotify(spi_task_handle, SPI_NOTIFY_FILE_RQ, eSetBits);
+}
+
+// Close the queue and complete the queued requests with ESP_FILEERR_NOTCONNECTED,
+// the SPI task is exiting
+//=======================
+void file_request_abort()
+{
+    uint8_t slot;
+    if (file_rq_queue == NULL) return;
+    xSemaphoreTake(file_rq_mutex, portMAX_DELAY);
+    file_rq_closed = true;
+    while (xQueueReceive(file_rq_queue, &slot, 0) == pdTRUE) {
+        // the frame buffer passed with the request is returned to the pool
+        if ((file_rq[slot].cmd == ESP_COMMAND_FWRITE) && (file_rq[slot].params.dst)) spi_frame_put(file_rq[slot].params.dst);
+        xSemaphoreGive(file_rq[slot].done);
+    }
+    xSemaphoreGive(file_rq_mutex);
 }
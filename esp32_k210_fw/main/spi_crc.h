@@ -0,0 +1,60 @@
+/*
+ * CRC functions used on K210 <-> ESP32 SPI link
+ * ---------------------------------------------
+ * crc16: CCITT (0x1021), MSB first, initial value ~previousCrc16
+ * crc8:  Dallas/Maxim (0x31 reflected), initial value previousCrc8
+ * crc32: IEEE 802.3 (reflected), compatible with ROM 'crc32_le()'
+ *
+ * The lookup tables are constant (flash), no initialization is needed.
+ * Data is processed 4 bytes at a time (slice-by-4),
+ * the byte-at-a-time versions are kept for reference and benchmarking.
+ * The module does not depend on ESP-IDF and can be built on host.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CRC_CHECK_OK            0
+#define CRC_CHECK_CRC32_ERROR   1
+#define CRC_CHECK_CRC16_ERROR   2
+
+uint16_t calc_crc16_bytewise(const void* data, size_t length, uint16_t previousCrc16);
+uint16_t calc_crc16_slice4(const void* data, size_t length, uint16_t previousCrc16);
+
+uint8_t calc_crc8_bytewise(const void* data, size_t length, uint8_t previousCrc8);
+uint8_t calc_crc8_slice4(const void* data, size_t length, uint8_t previousCrc8);
+
+uint32_t calc_crc32(const void* data, size_t length, uint32_t previousCrc32);
+
+/*
+ * Calculate the crc32 of 'length' bytes of the frame and store it after the data,
+ * then calculate the crc16 of the frame including the crc32 and store it after the crc32.
+ * Both crc's are calculated in a single pass over the data.
+ * Result is identical to:
+ *   crc32 = crc32_le(0, buff, length);        memcpy(buff+length, &crc32, 4);
+ *   crc16 = calc_crc16(buff, length+4, 0);     memcpy(buff+length+4, &crc16, 2);
+ */
+void calc_frame_crc(uint8_t *buff, size_t length);
+
+/*
+ * Check the crc32 stored after 'length' bytes of the received frame and, if 'with_crc16'
+ * is set, the crc16 of the frame including the crc32 stored after the crc32,
+ * both in a single pass over the data.
+ * The calculated crc32 is returned in 'pcrc32' (if not NULL).
+ * Returns CRC_CHECK_OK, CRC_CHECK_CRC32_ERROR or CRC_CHECK_CRC16_ERROR
+ */
+int check_frame_crc(const uint8_t *buff, size_t length, bool with_crc16, uint32_t *pcrc32);
+
+#define calc_crc16(data, length, prev)  calc_crc16_slice4(data, length, prev)
+#define calc_crc8(data, length, prev)   calc_crc8_slice4(data, length, prev)
+
+#ifdef __cplusplus
+}
+#endif
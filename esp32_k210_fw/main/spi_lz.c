@@ -0,0 +1,178 @@
+/*
+ * LZ4 block format compressor and decompressor used on K210 <-> ESP32 SPI link
+ * (see 'spi_lz.h')
+ */
+
+#include <string.h>
+#include "spi_lz.h"
+
+#define LZ_MINMATCH         4
+#define LZ_LASTLITERALS     5       // the last 5 bytes are always literals
+#define LZ_MFLIMIT          12      // the last match must start at least 12 bytes before the end
+#define LZ_SKIP_TRIGGER     6       // the search step is increased after every 64 positions without a match
+#define LZ_RUN_MASK         15
+
+//------------------------------------------------
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+//----------------------------------------------
+static inline uint32_t lz_hash(const uint8_t *p)
+{
+    return (lz_read32(p) * 2654435761U) >> (32 - LZ_HASH_BITS);
+}
+
+//---------------------------------------------------------
+static inline uint8_t *lz_put_length(uint8_t *op, size_t n)
+{
+    // length above the 4-bit token field
+    while (n >= 255) {
+        *op++ = 255;
+        n -= 255;
+    }
+    *op++ = (uint8_t)n;
+    return op;
+}
+
+//===================================================================================================
+size_t lz_compress(const uint8_t *src, size_t length, uint8_t *dst, size_t dst_size, uint16_t *table)
+{
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *iend = src + length;
+    const uint8_t *mflimit = iend - LZ_MFLIMIT;
+    const uint8_t *matchlimit = iend - LZ_LASTLITERALS;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_size;
+
+    if (length > LZ_INPUT_MAX) return 0;
+    memset(table, 0, LZ_TABLE_SIZE * sizeof(uint16_t));
+
+    if (length > LZ_MFLIMIT) {
+        ip++;
+        while (1) {
+            // ---- find the next match ----
+            const uint8_t *match;
+            uint32_t search = 1 << LZ_SKIP_TRIGGER;
+            while (1) {
+                if (ip > mflimit) goto last_literals;
+                uint32_t h = lz_hash(ip);
+                match = src + table[h];
+                table[h] = (uint16_t)(ip - src);
+                if ((match < ip) && (lz_read32(match) == lz_read32(ip))) break;
+                ip += (search++ >> LZ_SKIP_TRIGGER);
+            }
+            // extend the match backwards
+            while ((ip > anchor) && (match > src) && (ip[-1] == match[-1])) {
+                ip--;
+                match--;
+            }
+            // and forwards
+            size_t mlen = LZ_MINMATCH;
+            while (((ip + mlen) < matchlimit) && (ip[mlen] == match[mlen])) mlen++;
+
+            // ---- sequence: token, literals, offset, match length ----
+            size_t lit = ip - anchor;
+            if ((op + 1 + lit + (lit / 255) + 1 + 2 + ((mlen - LZ_MINMATCH) / 255) + 1) > oend) return 0;
+            uint8_t *token = op++;
+            if (lit >= LZ_RUN_MASK) {
+                *token = LZ_RUN_MASK << 4;
+                op = lz_put_length(op, lit - LZ_RUN_MASK);
+            }
+            else *token = (uint8_t)(lit << 4);
+            memcpy(op, anchor, lit);
+            op += lit;
+            uint16_t offset = (uint16_t)(ip - match);
+            *op++ = offset & 0xFF;
+            *op++ = offset >> 8;
+            size_t ml = mlen - LZ_MINMATCH;
+            if (ml >= LZ_RUN_MASK) {
+                *token |= LZ_RUN_MASK;
+                op = lz_put_length(op, ml - LZ_RUN_MASK);
+            }
+            else *token |= (uint8_t)ml;
+
+            ip += mlen;
+            anchor = ip;
+            if (ip > mflimit) break;
+            // the position inside the match improves the next search
+            table[lz_hash(ip - 2)] = (uint16_t)(ip - 2 - src);
+        }
+    }
+
+last_literals:
+    {
+        size_t lit = iend - anchor;
+        if ((op + 1 + lit + ((lit + 255 - LZ_RUN_MASK) / 255)) > oend) return 0;
+        if (lit >= LZ_RUN_MASK) {
+            *op++ = LZ_RUN_MASK << 4;
+            op = lz_put_length(op, lit - LZ_RUN_MASK);
+        }
+        else *op++ = (uint8_t)(lit << 4);
+        memcpy(op, anchor, lit);
+        op += lit;
+    }
+    return op - dst;
+}
+
+//=================================================================================
+int lz_decompress(const uint8_t *src, size_t length, uint8_t *dst, size_t dst_size)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + length;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_size;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+
+        // ---- literals ----
+        size_t lit = token >> 4;
+        if (lit == LZ_RUN_MASK) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                lit += b;
+            } while (b == 255);
+        }
+        if ((lit > (size_t)(iend - ip)) || (lit > (size_t)(oend - op))) return -1;
+        // when decompressing in place the literals are moved towards the buffer start
+        memmove(op, ip, lit);
+        ip += lit;
+        op += lit;
+        // the last sequence has no match
+        if (ip == iend) break;
+
+        // ---- match ----
+        if ((iend - ip) < 2) return -1;
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if ((offset == 0) || (offset > (size_t)(op - dst))) return -1;
+        size_t mlen = token & LZ_RUN_MASK;
+        if (mlen == LZ_RUN_MASK) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                mlen += b;
+            } while (b == 255);
+        }
+        mlen += LZ_MINMATCH;
+        if (mlen > (size_t)(oend - op)) return -1;
+        const uint8_t *match = op - offset;
+        if (offset >= mlen) {
+            memcpy(op, match, mlen);
+            op += mlen;
+        }
+        else {
+            // overlapping match, repeats the last 'offset' bytes
+            while (mlen--) *op++ = *match++;
+        }
+    }
+    return op - dst;
+}
@@ -0,0 +1,47 @@
+/*
+ * Frame payload compression used on K210 <-> ESP32 SPI link
+ * ---------------------------------------------------------
+ * Fast LZ77 compressor and decompressor, the output is in LZ4 block format
+ * (the K210 side can use the reference LZ4 decoder).
+ * - the input is limited to 65535 bytes (one SPI frame), the whole input is the window
+ * - the compressor needs a hash table of LZ_TABLE_SIZE entries provided by the caller
+ *   (2 KB, no other memory is used), so that it can be used from several tasks
+ * - positions without a match are skipped faster and faster (as in LZ4), incompressible
+ *   data is rejected quickly
+ * - the decompressor checks all bounds and can decompress in place: if the compressed data
+ *   is placed at the end of the output buffer of at least 'size'+LZ_INPLACE_MARGIN(size)
+ *   bytes, the output never overwrites the compressed data not yet read
+ * The module does not depend on ESP-IDF and can be built on host.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LZ_HASH_BITS                10
+#define LZ_TABLE_SIZE               (1 << LZ_HASH_BITS)
+#define LZ_INPUT_MAX                65535
+#define LZ_INPLACE_MARGIN(size)     (((size) >> 8) + 32)
+
+/*
+ * Compress 'length' bytes from 'src' to 'dst'
+ * Returns the compressed length or 0 if the result would not fit into 'dst_size' bytes
+ * ('dst_size' smaller than 'length' rejects the data which does not compress enough)
+ */
+size_t lz_compress(const uint8_t *src, size_t length, uint8_t *dst, size_t dst_size, uint16_t *table);
+
+/*
+ * Decompress 'length' bytes from 'src' to 'dst'
+ * Returns the decompressed length or -1 if the data is malformed or larger than 'dst_size'
+ */
+int lz_decompress(const uint8_t *src, size_t length, uint8_t *dst, size_t dst_size);
+
+#ifdef __cplusplus
+}
+#endif
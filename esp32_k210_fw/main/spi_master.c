@@ -34,7 +34,6 @@
 #include "esp_system.h"
 #include "driver/gpio.h"
 #include "global.h"
-#include "esp32/rom/crc.h"
 #include "hal/spi_types.h"
 
 #define POOLING_INTERVAL            2000
@@ -45,11 +44,27 @@
 #define CMD_ERROR_BADCRC            -104
 #define CMD_ERROR_SPI_ERROR         -105
 
+#define HANDSHAKE_LOW               0
+#define HANDSHAKE_HIGH              1
+#define HANDSHAKE_PULSE             2
+#define HANDSHAKE_BLOCK_TIME_DEFAULT 50     // us
+#define HANDSHAKE_ISR_LATENCY       10      // us
+#define K210_BUSY_TIMEOUT           10000   // ms
+
 #define CMD_BUFFER_SIZE             16
 #define READ_BUFFER_SIZE            32
 #define COMMAND_STATUS_LENGTH       12
+#define SPI_FRAME_BUFFERS           3
+#define SPI_FRAME_HEAP_RESERVE      (48*1024)   // DMA capable memory left for WiFi and TLS
 
 uint8_t *spi_buffer = NULL;
+static int spi_frame_count = 0;
+static QueueHandle_t spi_frame_queue = NULL;    // free frame buffers
+static SemaphoreHandle_t spi_frame_mutex = NULL; // pool growth and close
+static uint8_t *spi_frame_retired = NULL;       // released frame, still in flight
+static bool spi_frame_closed = true;
+static uint8_t *spi_lz_frame = NULL;            // compressed copy of the sent frame
+static uint16_t lz_table[LZ_TABLE_SIZE];
 
 static DMA_ATTR uint8_t cmd_buf[CMD_BUFFER_SIZE] = {0};
 static DMA_ATTR uint8_t read_buf[READ_BUFFER_SIZE] = {0};
@@ -57,73 +72,15 @@ static spi_device_handle_t master_handle;
 
 TaskHandle_t spi_task_handle = NULL;
 TaskHandle_t socket_task_handle = NULL;
+TaskHandle_t ssl_task_handle = NULL;
 bool k210_slave_connected = false;
 k210_info_t k210_info = {0};
 uint32_t spi_master_buffer_size;
-SemaphoreHandle_t func_semaphore;
 QueueHandle_t sock_mutex = NULL;
 
 
 const char *SPI_TAG = "[SPI_TASK]";
 
-//-------------------------------------------
-static const uint16_t Crc16LookupTable[256] =
-{
-    0x0000,0x1021,0x2042,0x3063,0x4084,0x50a5,0x60c6,0x70e7,
-    0x8108,0x9129,0xa14a,0xb16b,0xc18c,0xd1ad,0xe1ce,0xf1ef,
-    0x1231,0x0210,0x3273,0x2252,0x52b5,0x4294,0x72f7,0x62d6,
-    0x9339,0x8318,0xb37b,0xa35a,0xd3bd,0xc39c,0xf3ff,0xe3de,
-    0x2462,0x3443,0x0420,0x1401,0x64e6,0x74c7,0x44a4,0x5485,
-    0xa56a,0xb54b,0x8528,0x9509,0xe5ee,0xf5cf,0xc5ac,0xd58d,
-    0x3653,0x2672,0x1611,0x0630,0x76d7,0x66f6,0x5695,0x46b4,
-    0xb75b,0xa77a,0x9719,0x8738,0xf7df,0xe7fe,0xd79d,0xc7bc,
-    0x48c4,0x58e5,0x6886,0x78a7,0x0840,0x1861,0x2802,0x3823,
-    0xc9cc,0xd9ed,0xe98e,0xf9af,0x8948,0x9969,0xa90a,0xb92b,
-    0x5af5,0x4ad4,0x7ab7,0x6a96,0x1a71,0x0a50,0x3a33,0x2a12,
-    0xdbfd,0xcbdc,0xfbbf,0xeb9e,0x9b79,0x8b58,0xbb3b,0xab1a,
-    0x6ca6,0x7c87,0x4ce4,0x5cc5,0x2c22,0x3c03,0x0c60,0x1c41,
-    0xedae,0xfd8f,0xcdec,0xddcd,0xad2a,0xbd0b,0x8d68,0x9d49,
-    0x7e97,0x6eb6,0x5ed5,0x4ef4,0x3e13,0x2e32,0x1e51,0x0e70,
-    0xff9f,0xefbe,0xdfdd,0xcffc,0xbf1b,0xaf3a,0x9f59,0x8f78,
-    0x9188,0x81a9,0xb1ca,0xa1eb,0xd10c,0xc12d,0xf14e,0xe16f,
-    0x1080,0x00a1,0x30c2,0x20e3,0x5004,0x4025,0x7046,0x6067,
-    0x83b9,0x9398,0xa3fb,0xb3da,0xc33d,0xd31c,0xe37f,0xf35e,
-    0x02b1,0x1290,0x22f3,0x32d2,0x4235,0x5214,0x6277,0x7256,
-    0xb5ea,0xa5cb,0x95a8,0x8589,0xf56e,0xe54f,0xd52c,0xc50d,
-    0x34e2,0x24c3,0x14a0,0x0481,0x7466,0x6447,0x5424,0x4405,
-    0xa7db,0xb7fa,0x8799,0x97b8,0xe75f,0xf77e,0xc71d,0xd73c,
-    0x26d3,0x36f2,0x0691,0x16b0,0x6657,0x7676,0x4615,0x5634,
-    0xd94c,0xc96d,0xf90e,0xe92f,0x99c8,0x89e9,0xb98a,0xa9ab,
-    0x5844,0x4865,0x7806,0x6827,0x18c0,0x08e1,0x3882,0x28a3,
-    0xcb7d,0xdb5c,0xeb3f,0xfb1e,0x8bf9,0x9bd8,0xabbb,0xbb9a,
-    0x4a75,0x5a54,0x6a37,0x7a16,0x0af1,0x1ad0,0x2ab3,0x3a92,
-    0xfd2e,0xed0f,0xdd6c,0xcd4d,0xbdaa,0xad8b,0x9de8,0x8dc9,
-    0x7c26,0x6c07,0x5c64,0x4c45,0x3ca2,0x2c83,0x1ce0,0x0cc1,
-    0xef1f,0xff3e,0xcf5d,0xdf7c,0xaf9b,0xbfba,0x8fd9,0x9ff8,
-    0x6e17,0x7e36,0x4e55,0x5e74,0x2e93,0x3eb2,0x0ed1,0x1ef0
-};
-
-//-----------------------------------------
-static const uint8_t Crc8LookupTable[256] =
-{
-    0, 94, 188, 226, 97, 63, 221, 131, 194, 156, 126, 32, 163, 253, 31, 65,
-    157, 195, 33, 127, 252, 162, 64, 30, 95, 1, 227, 189, 62, 96, 130, 220,
-    35, 125, 159, 193, 66, 28, 254, 160, 225, 191, 93, 3, 128, 222, 60, 98,
-    190, 224, 2, 92, 223, 129, 99, 61, 124, 34, 192, 158, 29, 67, 161, 255,
-    70, 24, 250, 164, 39, 121, 155, 197, 132, 218, 56, 102, 229, 187, 89, 7,
-    219, 133, 103, 57, 186, 228, 6, 88, 25, 71, 165, 251, 120, 38, 196, 154,
-    101, 59, 217, 135, 4, 90, 184, 230, 167, 249, 27, 69, 198, 152, 122, 36,
-    248, 166, 68, 26, 153, 199, 37, 123, 58, 100, 134, 216, 91, 5, 231, 185,
-    140, 210, 48, 110, 237, 179, 81, 15, 78, 16, 242, 172, 47, 113, 147, 205,
-    17, 79, 173, 243, 112, 46, 204, 146, 211, 141, 111, 49, 178, 236, 14, 80,
-    175, 241, 19, 77, 206, 144, 114, 44, 109, 51, 209, 143, 12, 82, 176, 238,
-    50, 108, 142, 208, 83, 13, 239, 177, 240, 174, 76, 18, 145, 207, 45, 115,
-    202, 148, 118, 40, 171, 245, 23, 73, 8, 86, 180, 234, 105, 55, 213, 139,
-    87, 9, 235, 181, 54, 104, 138, 212, 149, 203, 41, 119, 244, 170, 72, 22,
-    233, 183, 85, 11, 136, 214, 52, 106, 43, 117, 151, 201, 74, 20, 246, 168,
-    116, 42, 200, 150, 21, 75, 169, 247, 182, 232, 10, 84, 215, 137, 107, 53
-};
-
 //--------------------------------------------------------
 static void IRAM_ATTR spi_handshake_isr_handler(void* arg)
 {
@@ -136,35 +93,13 @@ static void IRAM_ATTR spi_handshake_isr_handler(void* arg)
     if (xHigherPriorityTaskWoken) portYIELD_FROM_ISR();
 }
 
-//---------------------------------------------------------------------------------
-static uint16_t calc_crc16(const void* data, size_t length, uint16_t previousCrc16)
-{
-    uint16_t crc = ~previousCrc16;
-    const uint8_t *pbuf = (const uint8_t *)data;
-
-    while (length--) {
-        crc = (crc<<8) ^ Crc16LookupTable[((crc>>8) ^ *pbuf++) & 0x00FF];
-    }
-    return crc;
-}
-
-//---------------------------------------------------------------------
-uint8_t calc_crc8(const void* data, size_t length, uint8_t previousCrc8)
-{
-    uint8_t crc = previousCrc8;
-    const uint8_t *pbuf = (const uint8_t *)data;
-    while (length--) {
-        crc = Crc8LookupTable[crc ^ *pbuf++];
-    }
-    return crc;
-}
-
 //-----------------------------------
 bool checkCRC(uint8_t *buff, int len)
 {
     uint16_t crc16 = calc_crc16((const void*)buff, len, 0);
     if (crc16 == *((uint16_t *)(buff+len))) return true;
     else {
+        link_stats_count(LINK_STAT_CRC16_ERRORS);
         if (debug_log >= 3) ESP_LOGI(SPI_TAG, "Crc16 error (%04X <> %04X)", crc16, *((uint16_t *)(buff+len)));
         return false;
     }
@@ -177,17 +112,106 @@ void setCRC(uint8_t *buff, int len)
     *((uint16_t *)(buff+len)) = crc16;
 }
 
+/*
+ * Handshake line waits
+ * ---------------------------------------------------------------------------------------
+ * 'k210_handshake_wait()' waits for the handshake line to reach the requested level
+ * (HANDSHAKE_LOW, HANDSHAKE_HIGH) or for the high->low transition (HANDSHAKE_PULSE).
+ * Level waits first spin for 'spin_us' (K210 usually responds in a few tens of us),
+ * then the handshake interrupt is enabled and the task blocks on the task notification
+ * until the level is reached or the timeout expires, leaving the CPU to other tasks.
+ * Spinning shorter than the overhead of the blocking wait does not pay off,
+ * the overhead is measured at initialization ('handshake_block_time').
+ * File requests (SPI_NOTIFY_FILE_RQ) received during the wait are not lost,
+ * they are re-posted to the task after the wait.
+ * ---------------------------------------------------------------------------------------
+ */
+static uint32_t handshake_block_time = HANDSHAKE_BLOCK_TIME_DEFAULT;
+
+//--------------------------------------------------------------------------------
+static bool k210_handshake_wait(uint8_t target, uint32_t spin_us, uint32_t tmo_us)
+{
+    uint64_t tstart = esp_timer_get_time();
+    uint64_t tend = tstart + tmo_us;
+    uint32_t notify_value, deferred = 0;
+    bool res = false;
+
+    if (target != HANDSHAKE_PULSE) {
+        // ---- Spin phase ----
+        if (spin_us < handshake_block_time) spin_us = handshake_block_time;
+        uint64_t tspin = tstart + ((spin_us < tmo_us) ? spin_us : tmo_us);
+        while (1) {
+            // the level is checked once more after the spin time has elapsed,
+            // the task could be preempted between the two checks
+            bool expired = (esp_timer_get_time() >= tspin);
+            if (gpio_get_level(GPIO_HANDSHAKE) == target) return true;
+            if (expired) break;
+        }
+        if (tspin >= tend) {
+            link_stats_count(LINK_STAT_HANDSHAKE_TIMEOUTS);
+            return false;
+        }
+    }
+
+    // ---- Blocking phase ----
+    gpio_set_intr_type(GPIO_HANDSHAKE, (target == HANDSHAKE_HIGH) ? GPIO_INTR_POSEDGE : GPIO_INTR_NEGEDGE);
+    gpio_intr_enable(GPIO_HANDSHAKE);
+    while (1) {
+        // the level could be reached before the interrupt was enabled
+        if ((target != HANDSHAKE_PULSE) && (gpio_get_level(GPIO_HANDSHAKE) == target)) {
+            res = true;
+            break;
+        }
+        uint64_t tnow = esp_timer_get_time();
+        if (tnow >= tend) break;
+
+        // block for at most 1 second, so that the watchdog can be reset during long waits
+        uint32_t twait = tend - tnow;
+        if (twait > 1000000) twait = 1000000;
+        notify_value = 0;
+        if (xTaskNotifyWait(0, UINT32_MAX, &notify_value, pdMS_TO_TICKS(twait / 1000) + 1) == pdPASS) {
+            deferred |= notify_value & ~SPI_NOTIFY_HANDSHAKE;
+            if ((target == HANDSHAKE_PULSE) && (notify_value & SPI_NOTIFY_HANDSHAKE)) {
+                res = true;
+                break;
+            }
+        }
+        CHECK_ERROR_CODE(esp_task_wdt_reset(), ESP_OK);
+    }
+    gpio_intr_disable(GPIO_HANDSHAKE);
+    gpio_set_intr_type(GPIO_HANDSHAKE, GPIO_INTR_NEGEDGE);
+
+    if (deferred) xTaskNotify(xTaskGetCurrentTaskHandle(), deferred, eSetBits);
+    if (!res) link_stats_count(LINK_STAT_HANDSHAKE_TIMEOUTS);
+    return res;
+}
+
+//------------------------------------
+static void k210_handshake_calibrate()
+{
+    // ==== Measure the overhead of the blocking handshake wait ===
+    // (interrupt setup and task notification round trip)
+    uint32_t notify_value;
+    uint64_t tstart = esp_timer_get_time();
+    for (int i=0; i<8; i++) {
+        gpio_set_intr_type(GPIO_HANDSHAKE, GPIO_INTR_POSEDGE);
+        gpio_intr_enable(GPIO_HANDSHAKE);
+        xTaskNotify(xTaskGetCurrentTaskHandle(), SPI_NOTIFY_HANDSHAKE, eSetBits);
+        xTaskNotifyWait(0, SPI_NOTIFY_HANDSHAKE, &notify_value, 0);
+        gpio_intr_disable(GPIO_HANDSHAKE);
+        gpio_set_intr_type(GPIO_HANDSHAKE, GPIO_INTR_NEGEDGE);
+    }
+    // add the interrupt latency and context switch time
+    handshake_block_time = ((esp_timer_get_time() - tstart) / 8) + HANDSHAKE_ISR_LATENCY;
+    if (debug_log >= 2) ESP_LOGI(SPI_TAG, "Handshake blocking wait overhead: %u us", handshake_block_time);
+}
+
 //-------------------------------------
 static bool k210WaitReady(int crc_time)
 {
     // ==== Wait for K210 SPI Slave to enter READY state (handshake Low) ===
-    int tmo = 100 + crc_time;
-    uint64_t tend = esp_timer_get_time() + tmo + 100;
-    while (tmo > 0) {
-        if (gpio_get_level(GPIO_HANDSHAKE) == 0) break;
-        if (esp_timer_get_time() > tend) return false;
-    }
-    return true;
+    int tmo = 200 + crc_time;
+    return k210_handshake_wait(HANDSHAKE_LOW, tmo, tmo);
 }
 
 //------------------------------------
@@ -195,47 +219,26 @@ static bool k210WaitIdle(int crc_time)
 {
     // ==== Wait for K210 SPI Slave to return to IDLE state ===
     int tmo = 300 + crc_time;
-    uint64_t tend = esp_timer_get_time() + tmo;
-    while (tmo > 0) {
-        if (gpio_get_level(GPIO_HANDSHAKE)) break;
-        if (esp_timer_get_time() > tend) return false;
-    }
-    return true;
+    return k210_handshake_wait(HANDSHAKE_HIGH, tmo, tmo);
 }
 
-//--------------------------------
-static uint32_t k210LongWaitIdle()
+//---------------------------
+static int k210LongWaitIdle()
 {
-    // ==== Wait for K210 SPI Slave to return to IDLE state (without timeout) ===
-    // Watchdog timeout will occur if running for very long time!
-    uint64_t tstart, tend;
-    tstart = esp_timer_get_time();
-    while (1) {
-        if (gpio_get_level(GPIO_HANDSHAKE)) {
-            tend = esp_timer_get_time();
-            break;
-        }
-        taskYIELD();
-    }
-    return (tend - tstart);
+    // ==== Wait for K210 SPI Slave to return to IDLE state (blocking, with long timeout) ===
+    uint64_t tstart = esp_timer_get_time();
+    if (!k210_handshake_wait(HANDSHAKE_HIGH, 0, K210_BUSY_TIMEOUT*1000)) return -1;
+    return (int)(esp_timer_get_time() - tstart);
 }
 
 //-----------------------
 int k210_wait_handshake()
 {
     CHECK_ERROR_CODE(esp_task_wdt_reset(), ESP_OK);
-    uint32_t notify_value = 0;
-    gpio_intr_enable(GPIO_HANDSHAKE);
-    BaseType_t res = xTaskNotifyWait(0, ULONG_MAX, &notify_value, pdMS_TO_TICKS(2000));
-    gpio_intr_disable(GPIO_HANDSHAKE);
-    if ((res == pdPASS) && (notify_value & SPI_NOTIFY_HANDSHAKE)) {
+    if (k210_handshake_wait(HANDSHAKE_PULSE, 0, 2000000)) {
         // handshake detected
         // wait for high handshake level
-        uint64_t tmo = esp_timer_get_time() + 300;
-        while (1) {
-            if (gpio_get_level(GPIO_HANDSHAKE) == 1) break;
-            if (esp_timer_get_time() > tmo) return 2;
-        }
+        if (!k210_handshake_wait(HANDSHAKE_HIGH, 300, 300)) return 2;
         return ESP_OK;
     }
     else return 1;
@@ -283,28 +286,65 @@ int IRAM_ATTR readTrans(uint8_t cmd_code)
     return ret;
 }
 
-//------------------------------------------------------------------------
-int transferData(uint8_t cmd, uint32_t addr, uint32_t dsize, uint8_t *data)
+/*
+ * Transfer engine
+ * ---------------------------------------------------------------------------------------
+ * Every transfer to/from K210 slave consists of three phases:
+ *   1. the command block is sent, K210 responds by pulling the handshake line low (READY)
+ *   2. the data block is written to or read from K210
+ *   3. K210 checks the data block (crc) and returns to IDLE state (handshake high)
+ * 'trans_start()' executes phase 1 and starts phase 2, 'trans_finish()' completes
+ * phase 2 and waits for phase 3.
+ * The time K210 spends in phase 3 is used on ESP32 side to check the received
+ * command frame ('readFrame()') or to prepare the next frame in another frame
+ * buffer while the previous one is still being processed ('transferDataAsync()').
+ * Only one transfer can be in flight, it is always completed before the next one is started.
+ * ---------------------------------------------------------------------------------------
+ */
+typedef struct _spi_trans_state_t
+{
+    spi_transaction_t t;
+    uint8_t  cmd;
+    uint32_t size;
+    uint8_t  ntry;
+    bool     pending;       // data phase started, transfer not yet completed
+    bool     queued;        // data phase queued to the SPI driver (DMA transaction)
+    bool     check_frame;   // check the received command frame while K210 returns to IDLE
+    bool     frame_ok;      // result of the command frame check
+    uint8_t  *frame;        // frame buffer of the data phase
+    uint64_t t1, t2, t3, t4, t5;
+} spi_trans_state_t;
+
+static spi_trans_state_t trans_state = {0};
+
+//-------------------------------------------------------------------------------------------------
+static int trans_start(uint8_t cmd, uint32_t addr, uint32_t dsize, uint8_t *data, bool check_frame)
 {
     /*
      * Small transactions ( <= 32 bytes ) are handled in polling mode for higher speed.
      * The overhead of interrupt transactions is more than just waiting for the transaction to complete.
      */
 
-    uint8_t ntry = MAX_TRANSFER_RETRIES;
+    esp_err_t ret;
     uint32_t size;
+    int crc_time;
+
+    trans_state.ntry = MAX_TRANSFER_RETRIES;
+    trans_state.pending = false;
+    trans_state.queued = false;
+    trans_state.check_frame = check_frame;
+    trans_state.frame_ok = false;
 
 start:
     size = dsize;
+    crc_time = 0;
     if (gpio_get_level(GPIO_HANDSHAKE) == 0) {
         if ((k210_slave_connected) && (debug_log >= 1)) ESP_LOGE(SPI_TAG, "transferData: K210 not Idle");
+        link_stats_count(LINK_STAT_NOT_IDLE);
         return CMD_ERROR_SLAVE_NOTREADY;
     }
 
-    esp_err_t ret;
-    uint64_t t1, t2, t3, t4, t5;
-    t1 = esp_timer_get_time();
-    int crc_time = 0;
+    trans_state.t1 = esp_timer_get_time();
 
     // Format the K210 SPI slave request
     /* Command structure:
@@ -358,9 +398,9 @@ start:
     #endif
     // ============================================================
 
-    t2 = esp_timer_get_time();
+    trans_state.t2 = esp_timer_get_time();
     if (ret != ESP_OK) {
-        if (debug_log >= 1) ESP_LOGE(SPI_TAG, "Trans #1 error (%d): %llu", ret, t2-t1);
+        if (debug_log >= 1) ESP_LOGE(SPI_TAG, "Trans #1 error (%d): %" PRIu64, ret, trans_state.t2-trans_state.t1);
         return ret;
     }
 
@@ -374,21 +414,23 @@ start:
     // --- After receiving the command K210 slave must respond by pulling the handshake line low
     // --- This should be less than 50 us
     if (!k210WaitReady(crc_time)) {
-        if ((k210_slave_connected) && (ntry > 0)) {
-            ntry--;
+        if ((k210_slave_connected) && (trans_state.ntry > 0)) {
+            trans_state.ntry--;
+            link_stats_count(LINK_STAT_RETRIES);
             vTaskDelay(pdMS_TO_TICKS(20));
             // slave nor ready, try again
             goto start;
         }
-        t3 = esp_timer_get_time();
-        if ((k210_slave_connected) && (debug_log >= 1)) ESP_LOGE(SPI_TAG, "K210 slave not ready: %llu, %llu (%u, %u) %u", t2-t1, t3-t2, cmd&0xFF, size, MAX_TRANSFER_RETRIES-ntry);
+        trans_state.t3 = esp_timer_get_time();
+        link_stats_count(LINK_STAT_READY_TIMEOUTS);
+        if ((k210_slave_connected) && (debug_log >= 1)) ESP_LOGE(SPI_TAG, "K210 slave not ready: %" PRIu64 ", %" PRIu64 " (%u, %u) %u",
+                trans_state.t2-trans_state.t1, trans_state.t3-trans_state.t2, cmd&0xFF, size, MAX_TRANSFER_RETRIES-trans_state.ntry);
         return CMD_ERROR_TIMEOUT;
     }
     // -----------------------------------------------------------------------------------------
 
-    t3 = esp_timer_get_time();
+    trans_state.t3 = esp_timer_get_time();
 
-    if ((cmd & 0x0f) != SLAVE_CMD_WRITE) crc_time = ((size * k210_info.crc_speed) / 1000000);
     if ((cmd & 0x0F) != SLAVE_CMD_WRSTAT_CONFIRM) {
         // add 2-byte crc16 to transfer size for commands with crc16
         if (cmd & SLAVE_CMD_OPT_CRC) size += 2;
@@ -403,37 +445,78 @@ start:
         trans_buff = SPI_RW_BUFFER;
     }
 
-    memset(&t, 0, sizeof(t)); //Zero out the transaction
-    t.length = size * 8;
+    trans_state.cmd = cmd;
+    trans_state.size = size;
+    trans_state.frame = spi_buffer;
+    memset(&trans_state.t, 0, sizeof(spi_transaction_t)); //Zero out the transaction
+    trans_state.t.length = size * 8;
     if ((cmd & 0x0f) == SLAVE_CMD_WRITE) {
-        t.tx_buffer = trans_buff;
+        trans_state.t.tx_buffer = trans_buff;
     }
     else {
-        t.rx_buffer = trans_buff;
-        t.rxlength = size * 8;
+        trans_state.t.rx_buffer = trans_buff;
+        trans_state.t.rxlength = size * 8;
     }
     // Send or receive data block to/from K210 slave
     #if SPI_MASTER_3WIRE
-    ret = spi_device_nodma_transmit(master_handle, &t, 0);
+    ret = spi_device_nodma_transmit(master_handle, &trans_state.t, 0);
     #else
-    if (size > 32) ret = spi_device_transmit(master_handle, &t);
+    if (size > 32) {
+        // DMA transaction, the result is collected in 'trans_finish()'
+        ret = spi_device_queue_trans(master_handle, &trans_state.t, portMAX_DELAY);
+        if (ret == ESP_OK) trans_state.queued = true;
+    }
     else {
         // if the data transaction is small, it is handled in polling mode for higher speed.
         // The overhead of interrupt transactions is more than just waiting for the transaction to complete.
-        ret = spi_device_polling_transmit(master_handle, &t);
+        ret = spi_device_polling_transmit(master_handle, &trans_state.t);
     }
     #endif
     // =============================================================================================================
 
-    t4 = esp_timer_get_time();
+    trans_state.t4 = esp_timer_get_time();
     if (ret != ESP_OK) {
-        if (debug_log >= 1) ESP_LOGE(SPI_TAG, "Trans #2 error (%d): %llu, %llu, %llu", ret, t2-t1, t3-t2, t4-t3);
+        if (debug_log >= 1) ESP_LOGE(SPI_TAG, "Trans #2 error (%d): %" PRIu64 ", %" PRIu64 ", %" PRIu64, ret,
+                trans_state.t2-trans_state.t1, trans_state.t3-trans_state.t2, trans_state.t4-trans_state.t3);
         return ret;
     }
 
+    trans_state.pending = true;
+    return ESP_OK;
+}
+
+//--------------------------------
+static int trans_finish_transfer()
+{
+    esp_err_t ret = ESP_OK;
+    int crc_time;
+    uint8_t cmd = trans_state.cmd;
+
+    if (!trans_state.pending) return ESP_OK;
+    trans_state.pending = false;
+
+    #if !SPI_MASTER_3WIRE
+    if (trans_state.queued) {
+        // Wait for the DMA data transaction to finish
+        spi_transaction_t *rtrans;
+        trans_state.queued = false;
+        ret = spi_device_get_trans_result(master_handle, &rtrans, portMAX_DELAY);
+        trans_state.t4 = esp_timer_get_time();
+        if (ret != ESP_OK) {
+            if (debug_log >= 1) ESP_LOGE(SPI_TAG, "Trans #2 error (%d): %" PRIu64 ", %" PRIu64 ", %" PRIu64, ret,
+                    trans_state.t2-trans_state.t1, trans_state.t3-trans_state.t2, trans_state.t4-trans_state.t3);
+            return ret;
+        }
+    }
+    #endif
+
+    // === The data block is transferred, K210 is now checking it and returning to IDLE state
+    // === Check the received command frame in the meantime
+    if (trans_state.check_frame) trans_state.frame_ok = command_frame_check((trans_state.cmd & SLAVE_CMD_OPT_CRC) != 0);
+
     // === Wait for the Write Command confirmation if requested ===============
     // === This should be less than 300 us + crc16 calculation time (if used)
-    if ((cmd & SLAVE_CMD_OPT_CRC)) crc_time = (size * k210_info.crc_speed) / 500000;
+    if ((cmd & SLAVE_CMD_OPT_CRC)) crc_time = (trans_state.size * k210_info.crc_speed) / 500000;
     else crc_time = 0;
 
     if ( ((cmd & 0x0f) == SLAVE_CMD_WRITE) && (cmd & SLAVE_CMD_OPT_CONFIRM) ) {
@@ -441,7 +524,7 @@ start:
         k210WaitIdle(crc_time);
 
         ret = readTrans(SLAVE_CMD_STATUS_TRANS);
-        t5 = esp_timer_get_time();
+        trans_state.t5 = esp_timer_get_time();
 
         if (ret != ESP_OK) return ret;
     }
@@ -455,24 +538,266 @@ start:
            (this should not take more than 100 ms)
         */
         if (!k210WaitIdle(700)) {
-            uint32_t twait = k210LongWaitIdle();
+            int twait = k210LongWaitIdle();
+            if (twait < 0) {
+                link_stats_count(LINK_STAT_BUSY_TIMEOUTS);
+                if (debug_log >= 1) ESP_LOGE(SPI_TAG, "transferData: K210 busy for more than %d ms", K210_BUSY_TIMEOUT);
+                return CMD_ERROR_SLAVE_NOTREADY;
+            }
+            link_stats_count(LINK_STAT_LONG_WAITS);
             if (debug_log >= 1) {
-                ESP_LOGW(SPI_TAG, "transferData done: K210 processing time %u us", twait+1000);
+                ESP_LOGW(SPI_TAG, "transferData done: K210 processing time %d us", twait+1000);
             }
-            //return CMD_ERROR_SLAVE_NOTREADY;
         }
-        t5 = esp_timer_get_time();
+        trans_state.t5 = esp_timer_get_time();
     }
 
-    if ((ntry < MAX_TRANSFER_RETRIES) && (debug_log >= 1)) {
-        ESP_LOGW(SPI_TAG, "OK; cmd=%u, retries=%u", cmd&0xFF, MAX_TRANSFER_RETRIES-ntry);
+    uint32_t phase_us[LINK_PHASE_MAX] = {
+        trans_state.t2-trans_state.t1, trans_state.t3-trans_state.t2, trans_state.t4-trans_state.t3, trans_state.t5-trans_state.t4
+    };
+    link_stats_transfer(((cmd & 0x0f) == SLAVE_CMD_WRITE), trans_state.size, phase_us);
+
+    if ((trans_state.ntry < MAX_TRANSFER_RETRIES) && (debug_log >= 1)) {
+        ESP_LOGW(SPI_TAG, "OK; cmd=%u, retries=%u", cmd&0xFF, MAX_TRANSFER_RETRIES-trans_state.ntry);
     }
     if (debug_log >= 2) {
-        ESP_LOGI(SPI_TAG, "OK; Times (us): command=%llu, ready=%llu, data=%llu, process=%llu", t2-t1, t3-t2, t4-t3, t5-t4);
+        ESP_LOGI(SPI_TAG, "OK; Times (us): command=%" PRIu64 ", ready=%" PRIu64 ", data=%" PRIu64 ", process=%" PRIu64,
+                trans_state.t2-trans_state.t1, trans_state.t3-trans_state.t2, trans_state.t4-trans_state.t3, trans_state.t5-trans_state.t4);
+    }
+    return ret;
+}
+
+//-----------------------
+static int trans_finish()
+{
+    int ret = trans_finish_transfer();
+    // the frame released while in flight can now be reused
+    if (spi_frame_retired) {
+        spi_frame_put(spi_frame_retired);
+        spi_frame_retired = NULL;
+    }
+    return ret;
+}
+
+//--------------------
+int transferDataWait()
+{
+    // Complete the transfer started by 'transferDataAsync()' (if any)
+    return trans_finish();
+}
+
+//------------------------------------------------------------------------
+int transferData(uint8_t cmd, uint32_t addr, uint32_t dsize, uint8_t *data)
+{
+    if (trans_state.pending) {
+        int ret = trans_finish();
+        if ((ret != ESP_OK) && (debug_log >= 1)) ESP_LOGW(SPI_TAG, "Previous transfer error (%d)", ret);
+    }
+
+    int ret = trans_start(cmd, addr, dsize, data, false);
+    if (ret != ESP_OK) return ret;
+    return trans_finish();
+}
+
+//---------------------------------------------------------------
+int transferDataAsync(uint8_t cmd, uint32_t addr, uint32_t dsize)
+{
+    // Only the write transfer can be left in flight
+    if ((cmd & 0x0F) != SLAVE_CMD_WRITE) return transferData(cmd, addr, dsize, NULL);
+
+    if (trans_state.pending) {
+        int ret = trans_finish();
+        if (ret != ESP_OK) return ret;
+    }
+    return trans_start(cmd, addr, dsize, NULL, false);
+}
+
+//--------------------------------------------------------
+int readFrame(uint8_t cmd, uint32_t dsize, bool *frame_ok)
+{
+    // Read the command frame and check it (length & crc32) while K210 returns to IDLE state
+    *frame_ok = false;
+    if (trans_state.pending) {
+        int ret = trans_finish();
+        if ((ret != ESP_OK) && (debug_log >= 1)) ESP_LOGW(SPI_TAG, "Previous transfer error (%d)", ret);
     }
+
+    int ret = trans_start(cmd, SLAVE_BUFFER_CMD_ADDRESS, dsize, NULL, true);
+    if (ret != ESP_OK) return ret;
+    ret = trans_finish();
+    *frame_ok = trans_state.frame_ok;
     return ret;
 }
 
+/*
+ * Frame buffer pool
+ * ---------------------------------------------------------------------------------------
+ * SPI frames are built and received in DMA capable frame buffers of SPI_FRAME_ALLOC_SIZE
+ * bytes, up to SPI_FRAME_BUFFERS are allocated. Only the active frame buffer is allocated
+ * when K210 is detected, before WiFi and TLS take their memory; the other ones are allocated
+ * when first needed and only while SPI_FRAME_HEAP_RESERVE bytes of DMA capable memory remain
+ * free after the allocation. Without them the transfers are not overlapped and the frames
+ * are not passed between the tasks.
+ * The frame buffers are passed between the SPI task and the other tasks by reference:
+ * - the SPI task always owns the active frame buffer ('spi_buffer')
+ * - the free frame buffers are kept in 'spi_frame_queue', any task can take one
+ *   ('spi_frame_get()'), fill it and hand it over to the SPI task, which makes it the
+ *   active buffer ('spi_buffer_set()', e.g. 'k210_file_write_frame()'), so the data
+ *   is sent without copying
+ * - the released active frame buffer returns to the pool, if it is still in flight
+ *   it is returned when the transfer is finished
+ * If the K210 accepts compressed frames, one more frame buffer is allocated outside the pool,
+ * on the same condition, for the compressed copy of the sent frames ('frame_compress()').
+ * The pool is closed when the SPI task exits, the frame buffers returned after that are freed.
+ * ---------------------------------------------------------------------------------------
+ */
+
+// Allocate a frame buffer if enough DMA capable memory remains free after it
+//----------------------------------
+static uint8_t *spi_frame_alloc()
+{
+    if (heap_caps_get_free_size(MALLOC_CAP_DMA) < (SPI_FRAME_ALLOC_SIZE + SPI_FRAME_HEAP_RESERVE)) return NULL;
+    return heap_caps_malloc(SPI_FRAME_ALLOC_SIZE, MALLOC_CAP_DMA);
+}
+
+// Add a new frame buffer to the pool if the pool is not full
+//--------------------------------
+static bool spi_frame_pool_grow()
+{
+    bool res = false;
+    xSemaphoreTake(spi_frame_mutex, portMAX_DELAY);
+    if ((!spi_frame_closed) && (spi_frame_count < SPI_FRAME_BUFFERS)) {
+        uint8_t *frame = spi_frame_alloc();
+        if (frame) {
+            spi_frame_count++;
+            xQueueSend(spi_frame_queue, &frame, 0);
+            res = true;
+        }
+        else if (debug_log >= 2) ESP_LOGW(SPI_TAG, "No memory for SPI frame buffer %d", spi_frame_count+1);
+    }
+    xSemaphoreGive(spi_frame_mutex);
+    return res;
+}
+
+// Get a free frame buffer from the pool, waits for 'wait' ticks if none is free
+// Returns NULL if no frame buffer is available
+//-------------------------------------
+uint8_t *spi_frame_get(TickType_t wait)
+{
+    uint8_t *frame = NULL;
+    if ((spi_frame_queue == NULL) || (spi_frame_closed)) return NULL;
+    if (xQueueReceive(spi_frame_queue, &frame, 0) == pdTRUE) return frame;
+    // none free, allocate the next one if the pool is not full
+    if ((spi_frame_pool_grow()) && (xQueueReceive(spi_frame_queue, &frame, 0) == pdTRUE)) return frame;
+    if (wait == 0) return NULL;
+
+    // a frame buffer released while in flight is returned when the SPI task finishes the transfer
+    if ((spi_task_handle) && (xTaskGetCurrentTaskHandle() != spi_task_handle)) xTaskNotify(spi_task_handle, SPI_NOTIFY_FRAME, eSetBits);
+    if (xQueueReceive(spi_frame_queue, &frame, wait) != pdTRUE) return NULL;
+    return frame;
+}
+
+// Return the frame buffer to the pool
+//--------------------------------
+void spi_frame_put(uint8_t *frame)
+{
+    if (frame == NULL) return;
+    if (spi_frame_closed) {
+        free(frame);
+        return;
+    }
+    xQueueSend(spi_frame_queue, &frame, portMAX_DELAY);
+}
+
+// Number of frame buffers which can be taken from the pool (not counting the active one)
+// The first spare frame buffer is allocated if it was not needed before
+//-------------------
+int spi_frame_spare()
+{
+    if (spi_frame_closed) return 0;
+    if (spi_frame_count < 2) spi_frame_pool_grow();
+    return spi_frame_count-1;
+}
+
+//-------------------------------------------
+static void spi_frame_release(uint8_t *frame)
+{
+    if ((trans_state.pending) && (frame == trans_state.frame)) spi_frame_retired = frame;
+    else spi_frame_put(frame);
+}
+
+// Make the frame buffer taken from the pool the active frame buffer (SPI task only),
+// the current active buffer is returned to the pool
+//---------------------------------
+void spi_buffer_set(uint8_t *frame)
+{
+    if ((frame == NULL) || (frame == spi_buffer)) return;
+    spi_frame_release(spi_buffer);
+    spi_buffer = frame;
+}
+
+//------------------------
+uint8_t *spi_buffer_swap()
+{
+    // Make another frame buffer active, the frame in the current one can still be in flight
+    uint8_t *frame = spi_frame_get(0);
+    if (frame == NULL) {
+        // No free frame buffer, the transfer must be finished before the buffer is reused
+        transferDataWait();
+        return spi_buffer;
+    }
+    spi_buffer_set(frame);
+    return spi_buffer;
+}
+
+//-------------------------------
+static bool spi_frame_pool_init()
+{
+    spi_frame_count = 0;
+    if (spi_frame_mutex == NULL) spi_frame_mutex = xSemaphoreCreateMutex();
+    if (spi_frame_mutex == NULL) return false;
+    if (spi_frame_queue == NULL) spi_frame_queue = xQueueCreate(SPI_FRAME_BUFFERS, sizeof(uint8_t *));
+    if (spi_frame_queue == NULL) return false;
+    xQueueReset(spi_frame_queue);
+
+    uint8_t *frame = (uint8_t *)heap_caps_malloc(SPI_FRAME_ALLOC_SIZE, MALLOC_CAP_DMA);
+    while (frame == NULL) {
+        if (spi_master_buffer_size < 1024) return false;
+        spi_master_buffer_size -= 1024;
+        frame = heap_caps_malloc(SPI_FRAME_ALLOC_SIZE, MALLOC_CAP_DMA);
+    }
+    spi_buffer = frame;
+    spi_frame_count = 1;
+    // the other frame buffers and the compressed frame buffer are allocated when needed
+    spi_frame_closed = false;
+    return true;
+}
+
+//--------------------------------
+static void spi_frame_pool_close()
+{
+    uint8_t *frame;
+    transferDataWait();
+    if (spi_frame_count == 0) {
+        // not allocated, the buffer used for K210 detection is static
+        spi_buffer = NULL;
+        return;
+    }
+    xSemaphoreTake(spi_frame_mutex, portMAX_DELAY);
+    spi_frame_closed = true;
+    xSemaphoreGive(spi_frame_mutex);
+    // free the frame buffers owned by the pool and the SPI task,
+    // the frame buffers still used by other tasks are freed when returned
+    while (xQueueReceive(spi_frame_queue, &frame, 0) == pdTRUE) {
+        free(frame);
+    }
+    free(spi_buffer);
+    spi_buffer = NULL;
+    if (spi_lz_frame) free(spi_lz_frame);
+    spi_lz_frame = NULL;
+    spi_frame_count = 0;
+}
+
 //-------------------------------------
 void getStatsInfo(bool stats, bool prn)
 {
@@ -547,19 +872,19 @@ void getStatsInfo(bool stats, bool prn)
     heap_caps_get_info(&info, MALLOC_CAP_INTERNAL | MALLOC_CAP_32BIT | MALLOC_CAP_8BIT | MALLOC_CAP_DMA);
     sprintf(pbuff+pbufidx, "Heap info:\n----------\n");
     pbufidx = strlen(pbuff);
-    sprintf(pbuff+pbufidx, "              Free: %u\n", info.total_free_bytes);
+    sprintf(pbuff+pbufidx, "              Free: %u\n", (unsigned)info.total_free_bytes);
     pbufidx = strlen(pbuff);
-    sprintf(pbuff+pbufidx, "         Allocated: %u\n", info.total_allocated_bytes);
+    sprintf(pbuff+pbufidx, "         Allocated: %u\n", (unsigned)info.total_allocated_bytes);
     pbufidx = strlen(pbuff);
-    sprintf(pbuff+pbufidx, "      Minimum free: %u\n", info.minimum_free_bytes);
+    sprintf(pbuff+pbufidx, "      Minimum free: %u\n", (unsigned)info.minimum_free_bytes);
     pbufidx = strlen(pbuff);
-    sprintf(pbuff+pbufidx, "      Total blocks: %u\n", info.total_blocks);
+    sprintf(pbuff+pbufidx, "      Total blocks: %u\n", (unsigned)info.total_blocks);
     pbufidx = strlen(pbuff);
-    sprintf(pbuff+pbufidx, "Largest free block: %u\n", info.largest_free_block);
+    sprintf(pbuff+pbufidx, "Largest free block: %u\n", (unsigned)info.largest_free_block);
     pbufidx = strlen(pbuff);
-    sprintf(pbuff+pbufidx, "  Allocated blocks: %u\n", info.allocated_blocks);
+    sprintf(pbuff+pbufidx, "  Allocated blocks: %u\n", (unsigned)info.allocated_blocks);
     pbufidx = strlen(pbuff);
-    sprintf(pbuff+pbufidx, "       Free blocks: %u\n\n", info.free_blocks);
+    sprintf(pbuff+pbufidx, "       Free blocks: %u\n\n", (unsigned)info.free_blocks);
     pbufidx = strlen(pbuff);
 
     if (prn) printf(pbuff);
@@ -601,7 +926,9 @@ static bool detectK210()
                 k210_info.databuff_ro_size = SPI_RW_BUFFER[15] | (SPI_RW_BUFFER[16] << 8) | (SPI_RW_BUFFER[17] << 16);
                 k210_info.crc_speed = SPI_RW_BUFFER[18] | (SPI_RW_BUFFER[19] << 8) | (SPI_RW_BUFFER[20] << 16);
                 k210_info.crc32_speed = SPI_RW_BUFFER[21] | (SPI_RW_BUFFER[22] << 8) | (SPI_RW_BUFFER[23] << 16);
-                bool handshake = (bool)SPI_RW_BUFFER[24];
+                k210_info.features = SPI_RW_BUFFER[24];
+                if (SPI_LZ_MIN_LENGTH == 0) k210_info.features &= ~K210_INFO_LZ;
+                bool handshake = (k210_info.features & K210_INFO_HANDSHAKE);
                 memcpy(k210_info.info, (char *)SPI_RW_BUFFER, 11);
                 k210_info.info[11] = '\0';
                 if (!handshake) {
@@ -609,17 +936,12 @@ static bool detectK210()
                     return false;
                 }
 
-                // Allocate spi buffer
+                // Allocate spi buffers
                 spi_buffer = NULL;
                 spi_master_buffer_size = k210_info.databuff_size - k210_info.databuff_ro_size;
-                spi_buffer = (uint8_t *)heap_caps_malloc(spi_master_buffer_size+64, MALLOC_CAP_DMA);
-                while (spi_buffer == NULL) {
-                    if (spi_master_buffer_size < 1024) {
-                        ESP_LOGE(SPI_TAG, "FATAL: cannot allocate SPI buffer");
-                        return false;
-                    }
-                    spi_master_buffer_size -= 1024;
-                    spi_buffer = heap_caps_malloc(spi_master_buffer_size+64, MALLOC_CAP_DMA);
+                if (!spi_frame_pool_init()) {
+                    ESP_LOGE(SPI_TAG, "FATAL: cannot allocate SPI buffer");
+                    return false;
                 }
 
                 // Test ESP32 crc calculation speeds
@@ -633,7 +955,7 @@ static bool detectK210()
                 uint16_t crc16 = calc_crc16(spi_buffer, 1000, 0);
                 crc16_speed = (uint32_t)(esp_timer_get_time() - tstart);
                 tstart = esp_timer_get_time();
-                uint32_t crc32 = crc32_le(0, spi_buffer, 1000);
+                uint32_t crc32 = calc_crc32(spi_buffer, 1000, 0);
                 crc32_speed = (uint32_t)(esp_timer_get_time() - tstart);
                 if (debug_log >= 3) ESP_LOGI(SPI_TAG, "CRC: %04X (%u), %08X (%u)", crc16, crc16_speed, crc32, crc32_speed);
 
@@ -644,11 +966,14 @@ static bool detectK210()
                 printf("    Version: %s\r\n", k210_info.info);
                 printf("Buffer size: %u bytes (Read Only: %u bytes) [ESP32: %u bytes]\r\n", k210_info.databuff_size, k210_info.databuff_ro_size, spi_master_buffer_size);
                 printf("CRC16 speed: %u ns [ESP32: %u us] per 1000 bytes\r\n", k210_info.crc_speed, crc16_speed);
-                printf("CRC32 speed: %u ns [ESP32: %u us] per 1000 bytes\r\n\r\n", k210_info.crc32_speed, crc32_speed);
+                printf("CRC32 speed: %u ns [ESP32: %u us] per 1000 bytes\r\n", k210_info.crc32_speed, crc32_speed);
+                printf("Compression: %s\r\n\r\n", (k210_info.features & K210_INFO_LZ) ? "yes" : "no");
 
                 if (debug_log >= 1) getStatsInfo(true, true);
 
                 k210_slave_connected = true;
+                // count only the transfers after the K210 is detected
+                link_stats_reset();
                 setStatus(ESP32_STATUS_K210_DETECTED, SET_STATUS_OP_OR);
                 vTaskDelay(pdMS_TO_TICKS(50));
                 k210_status_send(ESP32_STATUS_CODE_STATUS, getStatus());
@@ -658,6 +983,8 @@ static bool detectK210()
                 time(&seconds); // get the time from the RTC
                 k210_status_send(ESP32_STATUS_CODE_TIME, seconds);
                 vTaskDelay(pdMS_TO_TICKS(10));
+                // the K210 sends compressed frames only after it knows that ESP32 accepts them
+                if (k210_info.features & K210_INFO_LZ) k210_status_send(ESP32_STATUS_CODE_LZ, 1);
 
                 break;
             }
@@ -705,19 +1032,86 @@ uint16_t getCommand(uint16_t type)
     return res;
 }
 
-//----------------------------------
-esp_err_t send_response(uint8_t opt)
+//-------------------------------------------------------------
+static void format_frame(uint8_t *wrbuf, uint16_t len, bool lz)
 {
-    uint8_t *wrbuf = SPI_RW_BUFFER;
     wrbuf[0] = esp_cmdstat & 0xFF;
     wrbuf[1] = esp_cmdstat >> 8;
-    wrbuf[2] = esp_len & 0xFF;
-    wrbuf[3] = esp_len >> 8;
-    uint32_t crc = crc32_le(0, wrbuf, esp_len+4);
-    memcpy(wrbuf + esp_len + 4, (void *)&crc, 4);
-    setCRC(SPI_RW_BUFFER, esp_len+8);
+    wrbuf[2] = len & 0xFF;
+    wrbuf[3] = (len >> 8) | ((lz) ? (ESP_FRAME_LZ >> 8) : 0);
+    // crc32 and crc16 in a single pass
+    calc_frame_crc(wrbuf, len+4);
+}
 
-    return transferData(SLAVE_CMD_WRITE | opt, SLAVE_BUFFER_CMD_ADDRESS, esp_len+8, NULL);
+/*
+ * Compressed frames
+ * ---------------------------------------------------------------------------------------
+ * If the K210 accepts compressed frames (K210_INFO_LZ in the slave info), the payload
+ * of the frames sent to K210 is compressed into 'spi_lz_frame' and the compressed copy is sent:
+ *   |cmdstat (2)|length (2) | ESP_FRAME_LZ|payload length (2)|LZ4 block|crc32 (4)|
+ * - only the payloads of at least SPI_LZ_MIN_LENGTH bytes which get at least 1/16 smaller
+ *   are sent compressed, the incompressible data is rejected after a fast scan
+ * - the frame in the active frame buffer is not changed, so it can be sent again
+ * The compressed frames received from K210 (only sent after ESP32 has reported that it
+ * accepts them) are decompressed in place by 'command_frame_check()'.
+ * ---------------------------------------------------------------------------------------
+ */
+
+// Returns the length of the compressed payload or 0 if the frame is sent uncompressed
+//------------------------------
+static uint16_t frame_compress()
+{
+    if (((k210_info.features & K210_INFO_LZ) == 0) || (esp_len < SPI_LZ_MIN_LENGTH)) return 0;
+    if (spi_lz_frame == NULL) {
+        // without it the frames are sent uncompressed
+        spi_lz_frame = spi_frame_alloc();
+        if (spi_lz_frame == NULL) return 0;
+    }
+    // the previous compressed frame can still be in flight
+    if ((trans_state.pending) && (trans_state.frame == spi_lz_frame)) transferDataWait();
+
+    uint8_t *wrbuf = spi_lz_frame + DUMMY_BYTES;
+    size_t len = lz_compress(SPI_RW_BUFFER+4, esp_len, wrbuf+6, esp_len - (esp_len / 16) - 2, lz_table);
+    if (len == 0) return 0;
+    wrbuf[4] = esp_len & 0xFF;
+    wrbuf[5] = esp_len >> 8;
+    format_frame(wrbuf, len+2, true);
+    link_stats_count(LINK_STAT_LZ_SENT);
+    return len+2;
+}
+
+// Send the frame prepared in the active frame buffer, the frame is sent compressed if possible
+//--------------------------------------------------
+static esp_err_t send_frame(uint8_t opt, bool async)
+{
+    esp_err_t ret;
+    uint16_t len = frame_compress();
+    if (len == 0) {
+        format_frame(SPI_RW_BUFFER, esp_len, false);
+        if (async) return transferDataAsync(SLAVE_CMD_WRITE | opt, SLAVE_BUFFER_CMD_ADDRESS, esp_len+8);
+        return transferData(SLAVE_CMD_WRITE | opt, SLAVE_BUFFER_CMD_ADDRESS, esp_len+8, NULL);
+    }
+    // the compressed copy is sent, the active frame buffer is restored after the transfer is started
+    uint8_t *frame = spi_buffer;
+    spi_buffer = spi_lz_frame;
+    if (async) ret = transferDataAsync(SLAVE_CMD_WRITE | opt, SLAVE_BUFFER_CMD_ADDRESS, len+8);
+    else ret = transferData(SLAVE_CMD_WRITE | opt, SLAVE_BUFFER_CMD_ADDRESS, len+8, NULL);
+    spi_buffer = frame;
+    return ret;
+}
+
+//----------------------------------
+esp_err_t send_response(uint8_t opt)
+{
+    return send_frame(opt, false);
+}
+
+//----------------------------------------
+esp_err_t send_response_async(uint8_t opt)
+{
+    // The response frame is still in flight after return,
+    // use 'spi_buffer_swap()' before preparing the next frame
+    return send_frame(opt, true);
 }
 
 //------------------------------
@@ -727,9 +1121,8 @@ static bool spi_interface_init()
     // ==== Configure SPI interface ===========
     // ========================================
 
-    func_semaphore = xSemaphoreCreateBinary();
-    if (func_semaphore == NULL) {
-        ESP_LOGE(SPI_TAG, "Error creating function semaphore");
+    if (!file_request_init()) {
+        ESP_LOGE(SPI_TAG, "Error creating file request queue");
         return false;
     }
     sock_mutex = xSemaphoreCreateMutex();
@@ -806,6 +1199,7 @@ static bool spi_interface_init()
         ESP_LOGE(SPI_TAG, "Error initializing handshake pin interrupt");
         return false;
     }
+    k210_handshake_calibrate();
 
     #if !SPI_MASTER_3WIRE
     gpio_set_pull_mode(GPIO_MISO, GPIO_PULLUP_ONLY);
@@ -854,6 +1248,8 @@ static int process_K210_request()
     esp_err_t ret;
     uint16_t res;
     int32_t do_exit = 0;
+    int cmd = -1;
+    uint64_t tstart = esp_timer_get_time();
 
     // (1.) Check the command
     res = getCommand(ESP_STATUS_MREQUEST);
@@ -864,19 +1260,21 @@ static int process_K210_request()
         // ===============================================
 
         // Command execution requested, first 4 bytes of the command are in 'SPI_RW_BUFFER'
-        esp_len = *((uint16_t *)(SPI_RW_BUFFER+2));
+        esp_len = *((uint16_t *)(SPI_RW_BUFFER+2)) & ~ESP_FRAME_LZ;
         if (esp_len <= (spi_master_buffer_size-32)) {
             // Short delay between transactions
             ets_delay_us(10);
             // (2.) we have the command length, read the full command frame
             spi_transaction_length = esp_len+8;
-            ret = transferData(SLAVE_CMD_READ, SLAVE_BUFFER_CMD_ADDRESS, spi_transaction_length, NULL);
+            bool frame_ok;
+            ret = readFrame(SLAVE_CMD_READ, spi_transaction_length, &frame_ok);
             if (ret == ESP_OK) {
-                // Command frame read, check it
-                if (command_frame_check()) {
+                // Command frame read and checked
+                if (frame_ok) {
                     if (debug_log >= 2) ESP_LOGI(SPI_TAG, "Command: %d (0x%02X)", esp_cmdstat&0xff, esp_cmdstat&0xff);
 
                     // (3.) Process the command
+                    cmd = esp_cmdstat & 0xff;
                     do_exit = processCommand();
 
                     if ((esp_cmdstat == 0) && (debug_log >= 1)) ESP_LOGW(SPI_TAG, "Command (%04X) does not require response\r\n", *((uint16_t *)(SPI_RW_BUFFER)));
@@ -907,7 +1305,9 @@ static int process_K210_request()
     // ---------------------------------------------
     // (4.) Command was processed, send the response
     // ---------------------------------------------
-    ret = send_response(SLAVE_CMD_OPT_CRC);
+    // The response is completed before the next transfer, while K210 checks it
+    // the other frame buffer is cleaned and made ready for the next request
+    ret = send_response_async(SLAVE_CMD_OPT_CRC);
     if (ret == ESP_OK) {
         if (debug_log >= 2) {
             ESP_LOGI(SPI_TAG, "Command: Response sent (cmd=%04X, len=%u)\r\n", *((uint16_t *)(SPI_RW_BUFFER)), *((uint16_t *)(SPI_RW_BUFFER + 2)));
@@ -916,8 +1316,14 @@ static int process_K210_request()
     }
     else if (debug_log >= 1) ESP_LOGW(SPI_TAG, "Command: Error sending response\r\n");
 
-    // Clean the receive buffer
-    memset(spi_buffer, 0, spi_master_buffer_size);
+    if ((cmd >= 0) && (ret == ESP_OK)) {
+        link_stats_count(LINK_STAT_REQUESTS);
+        link_stats_command(cmd, (uint32_t)(esp_timer_get_time() - tstart));
+    }
+    else link_stats_count(LINK_STAT_REQUEST_ERRORS);
+
+    // The next request is received in another frame buffer while the response is in flight
+    spi_buffer_swap();
     return do_exit;
 }
 
@@ -948,13 +1354,21 @@ void IRAM_ATTR SPI_task(void* arg)
         opened_sockets[i].rdset = false;
         opened_sockets[i].listening = false;
         opened_sockets[i].ssl = false;
+        opened_sockets[i].open_seq = 0;
     }
 
+    dns_cache_init();
+
     // create the socket task
     if (xTaskCreatePinnedToCore(SOCKET_task, "SOCK task", 3072, NULL, 6, &socket_task_handle, 1) != pdPASS) {
         ESP_LOGE(SPI_TAG, "Error creating socket task");
         goto exit;
     }
+    // create the SSL handshake task
+    if (xTaskCreatePinnedToCore(SSL_task, "SSL task", 8192, NULL, 5, &ssl_task_handle, 0) != pdPASS) {
+        ESP_LOGE(SPI_TAG, "Error creating SSL task");
+        goto exit;
+    }
 
     // wait for power to K210 to be switched on
     while (!vdd_enabled) {
@@ -969,6 +1383,8 @@ void IRAM_ATTR SPI_task(void* arg)
     // request from K210 to close all open files
     k210_file_closeall();
     vTaskDelay(pdMS_TO_TICKS(20));
+    // K210 files are accessible through VFS
+    if ((esp_vfs_k210ffs_register() != ESP_OK) && (debug_log >= 1)) ESP_LOGW(SPI_TAG, "K210 VFS not registered");
 
     if (debug_log >= 1) printf("* Waiting command...\r\n\r\n");
 
@@ -983,7 +1399,7 @@ void IRAM_ATTR SPI_task(void* arg)
         // --- Wait for request (low pulse on handshake line) ---
         notify_value = 0;
         gpio_intr_enable(GPIO_HANDSHAKE);
-        BaseType_t res = xTaskNotifyWait(0, ULONG_MAX, &notify_value, pdMS_TO_TICKS(1000));
+        BaseType_t res = xTaskNotifyWait(0, UINT32_MAX, &notify_value, pdMS_TO_TICKS(1000));
         gpio_intr_disable(GPIO_HANDSHAKE);
         if (res == pdPASS) {
             // Watchdog reset
@@ -998,15 +1414,7 @@ void IRAM_ATTR SPI_task(void* arg)
             if (notify_value & SPI_NOTIFY_HANDSHAKE) {
                 // handshake detected, possible K210's request
                 // wait for high handshake level
-                uint64_t tmo = esp_timer_get_time() + 300;
-                bool f = false;
-                while (esp_timer_get_time() < tmo) {
-                    if (gpio_get_level(GPIO_HANDSHAKE) == 1) {
-                        f = true;
-                        break;
-                    }
-                }
-                if (!f) {
+                if (!k210_handshake_wait(HANDSHAKE_HIGH, 300, 300)) {
                     if (debug_log >= 2) ESP_LOGI(SPI_TAG, "Handshake, but no high edge");
                     continue;
                 }
@@ -1027,9 +1435,14 @@ void IRAM_ATTR SPI_task(void* arg)
                 }
             }
 
-            if (notify_value & SPI_NOTIFY_FUNC_MASK) {
-                // internal request
-                process_internal_request((uint8_t)(notify_value & SPI_NOTIFY_FUNC_MASK));
+            if (notify_value & SPI_NOTIFY_FRAME) {
+                // a task waits for a free frame buffer, finish the transfer of the released one
+                transferDataWait();
+            }
+
+            if (notify_value & SPI_NOTIFY_FILE_RQ) {
+                // file requests queued by other tasks
+                process_file_requests();
             }
         }
         #if K210_INACTIVITY_CHECK
@@ -1053,21 +1466,18 @@ void IRAM_ATTR SPI_task(void* arg)
     }
 
 exit:
-    spi_interface_deinit();
-
-    if (socket_task_handle) {
-        xTaskNotify(socket_task_handle, 0xA55A0000 , eSetBits);
-        vTaskDelay(2);
+    // the socket tasks use 'sock_mutex', the sockets and the SPI interface until terminated
+    if ((sock_mutex != NULL) && (socket_tasks_stop())) {
+        vSemaphoreDelete(sock_mutex);
+        sock_mutex = NULL;
     }
+    spi_interface_deinit();
+    // no request is queued to the task after this
+    file_request_abort();
     spi_task_handle = NULL;
 
-    if (sock_mutex != NULL) vSemaphoreDelete(sock_mutex);
-    if (func_semaphore != NULL) vSemaphoreDelete(func_semaphore);
-
-    if (spi_buffer) {
-        free(spi_buffer);
-        spi_buffer = NULL;
-    }
+    esp_vfs_k210ffs_unregister();
+    spi_frame_pool_close();
     if (debug_log >= 1) ESP_LOGW(SPI_TAG, "SPI Master task terminated");
 
     CHECK_ERROR_CODE(esp_task_wdt_delete(NULL), ESP_OK);             //Unsubscribe task from TWDT
@@ -6,10 +6,10 @@
 #include "freertos/event_groups.h"
 #include "lwip/err.h"
 #include "lwip/sys.h"
+#include "lwip/ip4.h"
 #include "tcpip_adapter.h"
 #include "esp_http_client.h"
 #include "esp_tls.h"
-#include "esp32/rom/crc.h"
 #include "esp_sntp.h"
 
 
@@ -296,42 +296,109 @@ esp_err_t start_web_server(const char *base_path)
 // Http client
 
 #define MAX_HTTP_RECV_BUFFER 512
+#define RQGET_TASK_STACK        8192
+#define RQGET_TASK_PRIORITY     5
+#define RQGET_BLOCK_WAIT        1000
+
+/*
+ * Streaming GET pipeline
+ *
+ * The HTTP client runs in its own task and copies the received data into the
+ * SPI frame buffers, the SPI task sends the filled blocks to K210.
+ * With two frame buffers one block is received while the other one is sent,
+ * the receiving side waits for a free buffer when K210 is slower (backpressure).
+ * If K210 has reported K210_INFO_RQHEADER, the response headers are collected in the
+ * first block, which is sent with ESP_STATUS_RQHEADER status before the data blocks,
+ * older K210 firmware only gets the data blocks and the final response (headers dropped).
+ */
+typedef struct {
+    uint8_t *buf;       // frame buffer, NULL marks the end of the request
+    uint32_t len;       // data length
+    uint16_t status;    // block status sent to K210
+} rq_block_t;
+
 static const char *TAG_HTTP = "[HTTPCLIENT]";
-static uint8_t *body_buff = NULL;
-static char *rqheader = NULL;
-static uint32_t body_length, body_ptr;
-static int rqheader_ptr = 0;
-static int rqheader_len = 0;
-static bool send_to_master = false;
-static uint32_t sent_bytes = 0;
-static uint32_t spi_time = 0;
-
-
-//------------------------------
-static void send_block_to_host()
+static QueueHandle_t rq_free_queue = NULL;
+static QueueHandle_t rq_full_queue = NULL;
+static uint8_t *rq_block = NULL;
+static uint32_t rq_block_ptr = 0;
+static uint16_t rq_block_status = 0;
+static uint32_t body_length = 0;
+static volatile bool send_to_master = false;
+static bool rq_send_headers = false;
+static esp_err_t rq_err = ESP_OK;
+static int rq_status_code = 0;
+static int rq_content_length = 0;
+
+
+//---------------------------------------
+static bool rq_block_get(uint16_t status)
+{
+    // Get the free block buffer, waits until the SPI task releases one
+    if (rq_block) return true;
+    if (xQueueReceive(rq_free_queue, &rq_block, portMAX_DELAY) != pdTRUE) return false;
+    rq_block_ptr = 0;
+    rq_block_status = status;
+    return true;
+}
+
+//-------------------------
+static void rq_block_post()
 {
-    // Command was received and requires response, prepare response
-    *((uint16_t *)(SPI_RW_BUFFER)) = esp_cmdstat;
-    *((uint16_t *)(SPI_RW_BUFFER + 2)) = esp_len;
-    uint32_t crc = crc32_le(0, SPI_RW_BUFFER, esp_len+4);
-    memcpy(SPI_RW_BUFFER + esp_len + 4, (void *)&crc, 4);
-    setCRC(SPI_RW_BUFFER, esp_len+8);
+    // Pass the current block to the SPI task
+    if (rq_block == NULL) return;
+    rq_block_t block = { .buf = rq_block, .len = rq_block_ptr, .status = rq_block_status };
+    rq_block = NULL;
+    rq_block_ptr = 0;
+    if ((block.len == 0) || (!send_to_master)) {
+        xQueueSend(rq_free_queue, &block.buf, portMAX_DELAY);
+        return;
+    }
+    xQueueSend(rq_full_queue, &block, portMAX_DELAY);
+}
 
+// Restore the active frame buffer, return the block buffers to the frame pool
+//-----------------------------------------------------------------------
+static void rq_frames_release(uint8_t *active, uint8_t **bufs, int nbufs)
+{
+    spi_buffer = active;
+    for (int i=0; i<nbufs; i++) {
+        if (bufs[i] != active) spi_frame_put(bufs[i]);
+    }
+}
+
+//-----------------------------------------------------------
+static void rq_block_write(const uint8_t *data, uint32_t len)
+{
+    while ((len > 0) && (send_to_master)) {
+        if (!rq_block_get(ESP_STATUS_MULTIBLOCK)) return;
+        uint32_t n = body_length - rq_block_ptr;
+        if (n > len) n = len;
+        memcpy(rq_block + DUMMY_BYTES + 4 + rq_block_ptr, data, n);
+        rq_block_ptr += n;
+        data += n;
+        len -= n;
+        // Buffer full, send it to K210
+        if (rq_block_ptr >= body_length) rq_block_post();
+    }
+}
+
+//-----------------------------------------------
+static int send_block_to_host(uint32_t *spi_time)
+{
+    // Command was received and requires response, the block is sent as the response frame
     uint64_t tstart = esp_timer_get_time();
-    int ret = transferData(SLAVE_CMD_WRITE | SLAVE_CMD_OPT_CRC, SLAVE_BUFFER_CMD_ADDRESS, esp_len+8, NULL);
-    spi_time += (esp_timer_get_time() - tstart);
+    int ret = send_response(SLAVE_CMD_OPT_CRC);
+    *spi_time += (esp_timer_get_time() - tstart);
 
     if (ret == ESP_OK) {
-        sent_bytes += esp_len;
         // wait for confirmation handshake pulse
         ret = k210_wait_handshake();
         if (ret != ESP_OK) {
-            send_to_master = false;
             if (debug_log >= 1) ESP_LOGW(TAG_HTTP, "Send to K210: no handshake (%d)", ret);
-            return;
         }
     }
-    else send_to_master = false;
+    return ret;
 }
 
 //=========================================================
@@ -349,45 +416,25 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
             break;
         case HTTP_EVENT_ON_HEADER:
             if (debug_log >= 3) ESP_LOGI(TAG_HTTP, "HTTP_EVENT_ON_HEADER, key=%s, value=%s", evt->header_key, evt->header_value);
-            if (rqheader) {
-                int len = strlen(evt->header_key) + strlen(evt->header_value) + rqheader_ptr + 5;
-                if (len < rqheader_len) {
-                    strcat(rqheader, evt->header_key);
-                    strcat(rqheader, ": ");
-                    strcat(rqheader, evt->header_value);
-                    strcat(rqheader, "\r\n");
-                    rqheader_ptr = strlen(rqheader);
+            if ((send_to_master) && (rq_send_headers) && (rq_block_get(ESP_STATUS_RQHEADER)) && (rq_block_status == ESP_STATUS_RQHEADER)) {
+                int len = strlen(evt->header_key) + strlen(evt->header_value) + 4;
+                if ((rq_block_ptr + len) <= body_length) {
+                    char *rqheader = (char *)(rq_block + DUMMY_BYTES + 4 + rq_block_ptr);
+                    sprintf(rqheader, "%s: %s\r\n", evt->header_key, evt->header_value);
+                    rq_block_ptr += len;
                 }
             }
             break;
         case HTTP_EVENT_ON_DATA:
             if (debug_log >= 3) ESP_LOGI(TAG_HTTP, "HTTP_EVENT_ON_DATA, len=%d%s (%d)", evt->data_len, (esp_http_client_is_chunked_response(evt->client)) ? " chunked" : "", send_to_master);
-            if ((body_buff) && (send_to_master)) {
-                for (int i=0; i<evt->data_len; i++) {
-                    body_buff[body_ptr++] = ((uint8_t *)evt->data)[i];
-                    if (body_ptr >= body_length) {
-                        // Buffer full, send it to K210
-                        esp_len = body_ptr;
-                        esp_cmdstat &= 0x00FF;
-                        esp_cmdstat |= ESP_STATUS_MULTIBLOCK;
-                        send_block_to_host();
-                        body_ptr = 0;
-                        if (!send_to_master) break;
-                    }
-                }
-            }
-            CHECK_ERROR_CODE(esp_task_wdt_reset(), ESP_OK);
-
+            // Headers block is completed on first data
+            if ((rq_block) && (rq_block_status == ESP_STATUS_RQHEADER)) rq_block_post();
+            rq_block_write((uint8_t *)evt->data, evt->data_len);
             break;
         case HTTP_EVENT_ON_FINISH:
             if (debug_log >= 3) ESP_LOGI(TAG_HTTP, "HTTP_EVENT_ON_FINISH");
-            if ((body_ptr > 0) && (send_to_master)) {
-                // Buffer not empty, send it to K210
-                esp_len = body_ptr;
-                esp_cmdstat &= 0x00FF;
-                esp_cmdstat |= ESP_STATUS_MULTIBLOCK;
-                send_block_to_host();
-            }
+            // Buffer not empty, send it to K210
+            rq_block_post();
             break;
         case HTTP_EVENT_DISCONNECTED:
             if (debug_log >= 2) ESP_LOGI(TAG_HTTP, "HTTP_EVENT_DISCONNECTED");
@@ -402,6 +449,57 @@ esp_err_t _http_event_handler(esp_http_client_event_t *evt)
     return ESP_OK;
 }
 
+//===============================
+static void RQGET_task(void *arg)
+{
+    esp_http_client_handle_t client = (esp_http_client_handle_t)arg;
+
+    rq_err = esp_http_client_perform(client);
+    if (rq_err == ESP_OK) {
+        // Headers only response, or the last block was not posted on finish
+        rq_block_post();
+        rq_status_code = esp_http_client_get_status_code(client);
+        rq_content_length = esp_http_client_get_content_length(client);
+    }
+    else if (rq_block) {
+        xQueueSend(rq_free_queue, &rq_block, portMAX_DELAY);
+        rq_block = NULL;
+    }
+    esp_http_client_cleanup(client);
+
+    // Signal the end of request to the SPI task
+    rq_block_t block = { .buf = NULL, .len = 0, .status = 0 };
+    xQueueSend(rq_full_queue, &block, portMAX_DELAY);
+    vTaskDelete(NULL);
+}
+
+// Replace the host name in 'http://' url with the address from the resolver cache
+// 'host' gets the original 'host[:port]' for the Host header
+// Not used for 'https://', the host name is needed for SNI and the certificate check
+//-------------------------------------------------------------------------------------------------
+static bool rq_resolve_url(const char *url, char *ip_url, int url_size, char *host, int host_size)
+{
+    ip4_addr_t ip4_addr;
+    char name[64];
+    char ip_str[16];
+
+    if (strncasecmp(url, "http://", 7) != 0) return false;
+    const char *hstart = url + 7;
+    int hlen = strcspn(hstart, ":/?#");
+    int alen = strcspn(hstart, "/?#");
+    if ((hlen == 0) || (hlen >= sizeof(name)) || (alen >= host_size) || (memchr(hstart, '@', alen))) return false;
+    memcpy(name, hstart, hlen);
+    name[hlen] = '\0';
+    if (ip4addr_aton(name, &ip4_addr)) return false;
+
+    if (dns_cache_lookup(name, &ip4_addr.addr) != 0) return false;
+    ip4addr_ntoa_r(&ip4_addr, ip_str, sizeof(ip_str));
+    if (snprintf(ip_url, url_size, "http://%s%s", ip_str, hstart + hlen) >= url_size) return false;
+    memcpy(host, hstart, alen);
+    host[alen] = '\0';
+    return true;
+}
+
 //==========================
 void requests_GET(char *url)
 {
@@ -411,56 +509,109 @@ void requests_GET(char *url)
         esp_len = 0;
         return;
     }
-    body_buff = SPI_RW_BUFFER+4;
+
+    // The free frame buffers from the SPI frame pool are used as block buffers,
+    // the active frame buffer is used too if there are less than two
+    uint8_t *active = spi_buffer;
+    uint8_t *bufs[2];
+    int nbufs = 0;
+    while ((nbufs < 2) && ((bufs[nbufs] = spi_frame_get(0)) != NULL)) nbufs++;
+    if (nbufs < 2) bufs[nbufs++] = active;
     body_length = spi_master_buffer_size - 64;
-    body_ptr = 0;
-    rqheader = NULL;
-    rqheader_len = 0;
-    rqheader_ptr = 0;
-    sent_bytes = 0;
-    spi_time = 0;
-    if (rqheader) memset(rqheader, 0, rqheader_len);
+    rq_block = NULL;
+    rq_block_ptr = 0;
+    rq_err = ESP_FAIL;
+    rq_status_code = 0;
+    rq_content_length = 0;
+    uint32_t sent_bytes = 0;
+    uint32_t spi_time = 0;
+
+    // The queues are created on first request and kept,
+    // the request task can still be inside 'xQueueSend' when the end block is received
+    if (rq_free_queue == NULL) rq_free_queue = xQueueCreate(2, sizeof(uint8_t *));
+    if (rq_full_queue == NULL) rq_full_queue = xQueueCreate(3, sizeof(rq_block_t));
+    if ((rq_free_queue == NULL) || (rq_full_queue == NULL)) {
+        if (debug_log >= 1) ESP_LOGE(TAG_HTTP, "GET: error creating queues");
+        goto error;
+    }
+    xQueueReset(rq_free_queue);
+    xQueueReset(rq_full_queue);
+    for (int i=0; i<nbufs; i++) {
+        xQueueSend(rq_free_queue, &bufs[i], 0);
+    }
+
+    char ip_url[REQUESTS_URL_MAX_SIZE+16];
+    char host[REQUESTS_URL_MAX_SIZE];
+    bool resolved = rq_resolve_url(url, ip_url, sizeof(ip_url), host, sizeof(host));
 
     esp_http_client_config_t config = {
-        .url = url,
+        .url = (resolved) ? ip_url : url,
         .event_handler = _http_event_handler,
         .buffer_size = 2048,
     };
     esp_http_client_handle_t client = esp_http_client_init(&config);
     if (client == NULL) {
         if (debug_log >= 1) ESP_LOGE(TAG_HTTP, "GET: HttpClient init failed");
-        esp_cmdstat &= 0x00FF;
-        esp_cmdstat |= ESP_ERROR_PROCESS;
-        esp_len = 0;
-        return;
+        goto error;
     }
+    if (resolved) esp_http_client_set_header(client, "Host", host);
 
     // GET
     send_to_master = true;
+    rq_send_headers = ((k210_info.features & K210_INFO_RQHEADER) != 0);
     uint64_t tstart = esp_timer_get_time();
 
-    esp_err_t err = esp_http_client_perform(client);
+    if (xTaskCreatePinnedToCore(RQGET_task, "RQGET task", RQGET_TASK_STACK, (void *)client, RQGET_TASK_PRIORITY, NULL, 0) != pdPASS) {
+        if (debug_log >= 1) ESP_LOGE(TAG_HTTP, "GET: error creating request task");
+        esp_http_client_cleanup(client);
+        goto error;
+    }
+
+    // Send the received blocks to K210 until the request task finishes
+    rq_block_t block;
+    while (1) {
+        CHECK_ERROR_CODE(esp_task_wdt_reset(), ESP_OK);
+        if (xQueueReceive(rq_full_queue, &block, RQGET_BLOCK_WAIT / portTICK_PERIOD_MS) != pdTRUE) continue;
+        if (block.buf == NULL) break;
+
+        if (send_to_master) {
+            spi_buffer = block.buf;
+            esp_len = block.len;
+            esp_cmdstat &= 0x00FF;
+            esp_cmdstat |= block.status;
+            if (send_block_to_host(&spi_time) == ESP_OK) {
+                if (block.status == ESP_STATUS_MULTIBLOCK) sent_bytes += block.len;
+            }
+            // stop sending, the rest of the response is received and dropped
+            else send_to_master = false;
+        }
+        xQueueSend(rq_free_queue, &block.buf, portMAX_DELAY);
+    }
 
     uint64_t tend = esp_timer_get_time();
-    body_buff = NULL;
-    rqheader = NULL;
-    if (err == ESP_OK) {
-        if (debug_log >= 1) ESP_LOGI(TAG_HTTP, "GET: Status = %d, content_length = %d, sent=%u, time=%llu us (spi: %u)",
-                esp_http_client_get_status_code(client), esp_http_client_get_content_length(client),
-                sent_bytes, tend - tstart, spi_time);
-        int cont_len = esp_http_client_get_content_length(client);
+    send_to_master = false;
+    rq_frames_release(active, bufs, nbufs);
+
+    if (rq_err == ESP_OK) {
+        if (debug_log >= 1) ESP_LOGI(TAG_HTTP, "GET: Status = %d, content_length = %d, sent=%u, time=%" PRIu64 " us (spi: %u)",
+                rq_status_code, rq_content_length, sent_bytes, tend - tstart, spi_time);
         esp_cmdstat &= 0x00FF;
         esp_cmdstat |= ESP_STATUS_RQFINISH;
-        memcpy(SPI_RW_BUFFER+4, (void *)&cont_len, sizeof(int));
+        memcpy(SPI_RW_BUFFER+4, (void *)&rq_content_length, sizeof(int));
         esp_len = sizeof(int);
     }
     else {
-        if (debug_log >= 1) ESP_LOGE(TAG_HTTP, "GET: request failed: %s", esp_err_to_name(err));
+        if (debug_log >= 1) ESP_LOGE(TAG_HTTP, "GET: request failed: %s", esp_err_to_name(rq_err));
         esp_cmdstat &= 0x00FF;
         esp_cmdstat |= ESP_ERROR_PROCESS;
         esp_len = 0;
     }
+    return;
 
-    esp_http_client_cleanup(client);
+error:
+    rq_frames_release(active, bufs, nbufs);
+    esp_cmdstat &= 0x00FF;
+    esp_cmdstat |= ESP_ERROR_PROCESS;
+    esp_len = 0;
 }
 